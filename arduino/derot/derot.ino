@@ -32,7 +32,6 @@
 #include "ccspi.h"
 #include "SPI.h"
 #include "Arduino.h"
-#include "AccelStepper.h"
 
 #include "Wire.h"
 #include "Adafruit_MCP23017.h"
@@ -50,53 +49,13 @@
 #include "UserIO.h"
 
 
-/**********************************************************************
-  Define the number of teeth on each gear in the de-rotator mechanism
- **********************************************************************/  
-
-#define Td 		17.0   // number of teeth of gear on the stepper
-#define T1C		41.0   // number of teeth connected to Td
-#define T2C		16.0   // number of teeth on top T1C
-#define Tf		200.0  // number of teeth connected to T1C
-
-
-#define GEAR_RATIO	T1C/Td*Tf/T2C
-
-/*
-   number of stepper motor steps to turn 360 deg
-*/
-#define STEPPER_360	200.0
-
-/*
-   the mechanical step size in deg/step
-
-	The default mechanical step size is calculated as follows:
-		# of teeth on stepper motor = 17 = Td
-		# of teeth on gear that connects to Td, T1C  = 41 
-		# of teeth on gear that sits on top of T1C, T2C = 16 
-		# of teeth on gear that connects to T2C, Tf  = 200
-
-	The final gear ratio is:
-		T1C/Td * Tf/T2C = (41/17)*(200/16) = 30.14705882
-
-	i.e. 1 360 degree turn of the final gear (Tf) requires
-	30.14705882 turns of the drive gear (Td).
-	=> 1 turn of Td gives 360.0/30.1405882 = 11.94146341 degrees
-	of Tf
-
-	The stepper motor takes 200 steps to make 1 turn (because it
-	is 1.8 deg/step and thus 360/1.8 = 200), this means 1 step of
-	the stepper motor gives: 11.94146341/200.0 = 0.0597 deg/step
-
-	For accuracy: the default mechanical stepsize is
-		mechanical_stepsize = 360.0/(T1C/Td*Tf/T2C)/(200.0) =
-		0.05970731707 deg/step
-*/
-#define MECHANICAL_STEPSIZE	360.0/(GEAR_RATIO*STEPPER_360)
-
 UserIO userio;
 Telescope telescope;
-DeRotator derotator(&telescope, MECHANICAL_STEPSIZE);
+/*
+   the mechanical step size comes from the gear train, see GearTrain.h.
+   A saved gear train replaces it when the settings are loaded.
+*/
+DeRotator derotator(&telescope, GearTrain());
 TCPServer tcpServer(&userio, &derotator);
 SerialServer serialServer(&userio, &derotator);
 
@@ -150,6 +109,9 @@ void loop()
   userio.ServiceDeRotator();
   userio.ServiceSetup();
   userio.ServiceOtherCommands();
+
+  // keep the stepper position for the next power up
+  derotator.ServicePosition();
   
   serialServer.ServiceLoop();
 }
@@ -26,6 +26,8 @@
 #include <SPI.h>
 #include <Arduino.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
 #include "utility/debug.h"
 
@@ -35,8 +37,41 @@
 #include "BaseServer.h"
 #include "UserIO.h"
 
-#define MECHANICAL_STEPSIZE	0.05970731707 // deg/step
+/*
+   Telemetry is never pushed faster than this, so that every-step
+   telemetry of a slew cannot swamp the link.
+*/
+#define TELEMETRY_MIN_PERIOD_MS		50
 
+/*
+   Every-step telemetry is still pushed this often when the stepper
+   is not moving, so that the client can tell the link is alive.
+*/
+#define TELEMETRY_HEARTBEAT_MS		1000
+
+/*
+   The menu that a command belongs to, so that the LCD shows it
+*/
+#define NO_MENU		0
+#define CONTROL_MENU	1
+#define SETUP_MENU	2
+
+/*
+   The size in bytes of the reply that a command sends back, i.e.
+   _reply, _reply and _ivalue, or those and n of the _fvalue's
+*/
+#define SIZE_REPLY	2
+#define SIZE_INT16	4
+#define SIZE_FLOAT(n)	(4 + 4*(n))
+
+/*
+   How a field of the compact status is written (see StatusPacket.hpp)
+*/
+#define STATUS_INT16	0	// zigzag varint
+#define STATUS_FLOAT	1	// its 4 bytes
+#define STATUS_STRING	2	// its length and its chars
+
+#define STATUS_SSID_SIZE	32	// StatusPacket::_WLAN_ssid
 
 /**********************************************************************
 NAME
@@ -50,9 +85,51 @@ SYNOPSIS
 
                                                 
 PROTECTED FUNCTIONS
+	reply_size(		- returns the size in bytes of the
+	  command		- reply to this command. The whole
+	)			  ReplyPacket if it is not a command
+
+	frame_packet(		- put
+	  frame			- into this buffer of FRAME_SIZE(sz)
+	  packet		- this packet
+	  sz			- of this many bytes
+	  seq			- with this seq
+	)			- returns the size of the frame
+
+	unframe_request(	- take the request out of
+	  frame			- this frame, which has all of its
+				  FRAME_SIZE(length) bytes
+	  rq			- and put it here, the bytes that were
+	)			  not sent being zero. Returns 0 on
+				  success. -1 if the length or the CRC
+				  is bad
+
+	compact_status(		- write
+	  sp			- this status
+	  format		- as STATUS_COMPACT or STATUS_CHANGED
+	  status		- into this buffer of STATUS_COMPACT_MAX
+	)			- returns its size. 0 if format is
+				  neither, when the StatusPacket itself
+				  is sent back
+
+	reset_connection()	- forget what the last client asked
+				  for: PROTOCOL_RAW, no compact status
+				  and no telemetry
 
 PRIVATE FUNCTIONS
 
+	command_index(		- find
+	  command		- this command in _commands[]
+	)			- returns its index, or -1 if it is not
+				  a command
+
+	There is one handler for every command in _commands[], e.g.
+	start_derotator() for DEROTATOR_START, which all take
+	(rq, rp, sp) like ServiceRequests(). rp->_reply has already
+	been set to the usual reply of the command, and the handler
+	only changes it if something else happened, e.g. to
+	REPLY_BAD_ARGUMENT or REPLY_BUSY. They all return 0.
+
 LOCAL TYPES AND CLASSES
 
 AUTHOR
@@ -67,10 +144,99 @@ REVISION
 **********************************************************************/
 
 
+/*
+   The commands in the order of command_index(): the menu that is
+   shown, the reply that is normally sent back and its size
+*/
+const BaseServer::Command BaseServer::_commands[N_COMMANDS] PROGMEM = {
+  {DEROTATOR_START, CONTROL_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::start_derotator},
+  {DEROTATOR_STOP, CONTROL_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::stop_derotator},
+  {DEROTATOR_GOTO_HALL_HOME, CONTROL_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::goto_hall_home},
+  {DEROTATOR_GOTO_USER_HOME, CONTROL_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::goto_user_home},
+  {SETUP_SET_USER_HOME, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_user_home},
+  {SETUP_MAX_CW, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_max_cw},
+  {SETUP_MAX_CCW, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_max_ccw},
+  {SETUP_ENABLE_LIMITS, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::enable_limits},
+  {SETUP_IS_CLOCKWISE, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_clockwise},
+  {SETUP_SAVE_SETTINGS, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::save_settings},
+  {SETUP_LOAD_SETTINGS, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::load_settings},
+  {SETUP_DEF_SETTINGS, SETUP_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::load_default_settings},
+  {CMD_GET_ALTAZ_ZETA, NO_MENU, REPLY_OK, SIZE_FLOAT(4), &BaseServer::get_altaz_zeta},
+  {CMD_GET_THETA, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::get_theta},
+  {CMD_GOTO_THETA, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::goto_theta},
+  {CMD_QUERY_STATE, NO_MENU, REPLY_OK, sizeof(StatusPacket), &BaseServer::query_state},
+  {CMD_GET_USER_HOME_POS, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::get_user_home_pos},
+  {CMD_GET_MAX_CW_POS, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::get_max_cw_pos},
+  {CMD_GET_MAX_CCW_POS, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::get_max_ccw_pos},
+  {CMD_SET_WLAN_SSID, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_wlan_ssid},
+  {CMD_SET_WLAN_PASS, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_wlan_pass},
+  {CMD_SET_WLAN_SECURITY, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_wlan_security},
+  {CMD_SET_OMEGA_VALUE, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_omega},
+  {CMD_GET_OMEGA_VALUE, NO_MENU, REPLY_OK, SIZE_FLOAT(1), &BaseServer::get_omega},
+  {CMD_SET_TRACKING_MODE, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_tracking_mode},
+  {CMD_GET_TRACKING_MODE, NO_MENU, REPLY_INT16, SIZE_INT16, &BaseServer::get_tracking_mode},
+  {CMD_SET_MICROSTEP, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_microstep},
+  {CMD_GET_MICROSTEP, NO_MENU, REPLY_INT16, SIZE_INT16, &BaseServer::get_microstep},
+  {CMD_SET_STEPPER_SPEED, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_stepper_speed},
+  {CMD_GET_STEPPER_SPEED, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(1), &BaseServer::get_stepper_speed},
+  {CMD_SET_HIGH_RATE, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_high_rate},
+  {CMD_GET_HIGH_RATE, NO_MENU, REPLY_INT16, SIZE_INT16, &BaseServer::get_high_rate},
+  {CMD_SET_TELESCOPE_MODE, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_telescope_mode},
+  {CMD_GET_TELESCOPE_MODE, NO_MENU, REPLY_INT16, SIZE_INT16, &BaseServer::get_telescope_mode},
+  {CMD_SET_FIX_INTERVAL, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_fix_interval},
+  {CMD_GET_FIX_INTERVAL, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(1), &BaseServer::get_fix_interval},
+  {CMD_GET_FUSION_STATS, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(4), &BaseServer::get_fusion_stats},
+  {CMD_SET_SLEW, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_slew},
+  {CMD_GET_SLEW, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(2), &BaseServer::get_slew},
+  {CMD_GET_HOMING_STATS, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(4), &BaseServer::get_homing_stats},
+  {CMD_SET_ERROR_BUDGET, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_error_budget},
+  {CMD_GET_ERROR_BUDGET, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(3), &BaseServer::get_error_budget},
+  {CMD_GET_RATE_FORECAST, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(3), &BaseServer::get_rate_forecast},
+  {CMD_GET_LIMIT_FORECAST, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(3), &BaseServer::get_limit_forecast},
+  {CMD_SET_GEAR_TRAIN, NO_MENU, REPLY_OK, SIZE_REPLY, &BaseServer::set_gear_train},
+  {CMD_GET_GEAR_TRAIN, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(4), &BaseServer::get_gear_train},
+  {CMD_SUBSCRIBE_TELEMETRY, NO_MENU, REPLY_OK, SIZE_INT16, &BaseServer::subscribe_telemetry},
+  {CMD_BATCH, NO_MENU, REPLY_BATCH_ERR, SIZE_INT16, &BaseServer::refuse_batch},
+  {CMD_GET_COMMAND_STATS, NO_MENU, REPLY_FLOAT, SIZE_FLOAT(4), &BaseServer::get_command_stats},
+  {CMD_SET_PROTOCOL, NO_MENU, REPLY_OK, SIZE_FLOAT(2), &BaseServer::set_protocol}
+};
+
+/*
+   The fields of the compact status, in the order that they are sent
+*/
+const BaseServer::StatusField BaseServer::_status_fields[N_STATUS_FIELDS] PROGMEM = {
+  {STATUS_TAG_REPLY, STATUS_INT16, offsetof(StatusPacket, _reply), sizeof(int16_t)},
+  {STATUS_TAG_IS_CLOCKWISE, STATUS_INT16, offsetof(StatusPacket, _is_clockwise_correction), sizeof(int16_t)},
+  {STATUS_TAG_HOME_POS, STATUS_INT16, offsetof(StatusPacket, _home_pos), sizeof(int16_t)},
+  {STATUS_TAG_MAX_CW, STATUS_INT16, offsetof(StatusPacket, _max_cw), sizeof(int16_t)},
+  {STATUS_TAG_MAX_CCW, STATUS_INT16, offsetof(StatusPacket, _max_ccw), sizeof(int16_t)},
+  {STATUS_TAG_IS_ENABLE_LIMITS, STATUS_INT16, offsetof(StatusPacket, _is_enable_limits), sizeof(int16_t)},
+  {STATUS_TAG_ANGLE, STATUS_FLOAT, offsetof(StatusPacket, _angle), sizeof(float)},
+  {STATUS_TAG_ACCUMULATED_ANGLE, STATUS_FLOAT, offsetof(StatusPacket, _accumulated_angle), sizeof(float)},
+  {STATUS_TAG_WLAN_SSID, STATUS_STRING, offsetof(StatusPacket, _WLAN_ssid), STATUS_SSID_SIZE},
+  {STATUS_TAG_WLAN_SECURITY, STATUS_INT16, offsetof(StatusPacket, _WLAN_security), sizeof(int16_t)},
+  {STATUS_TAG_OMEGA, STATUS_FLOAT, offsetof(StatusPacket, _omega), sizeof(float)}
+};
+
+#if COMMAND_STATS
+uint16_t BaseServer::_calls[N_COMMANDS];
+uint16_t BaseServer::_max_us[N_COMMANDS];
+uint16_t BaseServer::_mean_us[N_COMMANDS];
+#endif
+
 BaseServer::BaseServer(UserIO* userio, DeRotator* derotator)
 {
   _userio = userio;
   _derotator = derotator;
+
+  _telemetry_period_ms = TELEMETRY_OFF;
+  _is_telemetry_pending = false;
+  _telemetry_ms = 0;
+  _telemetry_pos = 0;
+  _telemetry_status = REPLY_OK;
+
+  _pipeline_max = 1;
+  reset_connection();
 }
 
 BaseServer::~BaseServer()
@@ -92,192 +258,956 @@ int BaseServer::ServiceRequests(RequestPacket* const rq,
 				ReplyPacket* const rp,
 				StatusPacket* const sp)
 {
-  extern menu main_menu;
-  extern menu control_menu;
-  extern menu setup_menu;
-  
+  const int i = command_index(rq->_command);
 
-  // do derotator control commands
-  if((rq->_command >= 10) && (rq->_command <20)){ 
-    main_menu.activeNode=&control_menu;
-    // always return OK for these commands
-    rp->_reply = REPLY_OK;
-    
-    switch(rq->_command){
-      case DEROTATOR_START:
-	_userio->SetInitDeRotatorFlag();
-      break;
-      case DEROTATOR_STOP:
-	_userio->SetStopDeRotatorFlag();
-	_derotator->Stop();
-      break;
-      case DEROTATOR_GOTO_HALL_HOME:
-	_userio->SetGotoHallHomeFlag();
-      break;
-      case DEROTATOR_GOTO_USER_HOME:
-	_userio->SetGotoUserHomeFlag();
-      break;	    
+  // unknown commands are ignored
+  if(i < 0){
+    return 0;
+  }
+
+  Command command;
+  memcpy_P(&command, &_commands[i], sizeof(Command));
+
+  switch(command._menu){
+    case CONTROL_MENU:
+      _userio->ShowControlMenu();
+    break;
+    case SETUP_MENU:
+      _userio->ShowSetupMenu();
+    break;
+  }
+
+  // the handler changes this if it is not the usual reply
+  rp->_reply = command._reply;
+
+#if COMMAND_STATS
+  const unsigned long start_us = micros();
+#endif
+  const int status = (this->*command._handler)(rq, rp, sp);
+#if COMMAND_STATS
+  const unsigned long elapsed_us = micros() - start_us;
+  const uint16_t dt_us = elapsed_us > 0xffff? 0xffff:elapsed_us;
+
+  // a running mean, so that no total can overflow. Once the count
+  // stops at 0xffff the last calls still move it a little
+  if(_calls[i] < 0xffff){
+    _calls[i]++;
+  }
+  _mean_us[i] += (static_cast<long>(dt_us) - _mean_us[i])/_calls[i];
+  if(dt_us > _max_us[i]){
+    _max_us[i] = dt_us;
+  }
+#endif
+
+  return status;
+}
+
+int BaseServer::ServiceBatch(const int n,
+			     RequestPacket* const rq,
+			     ReplyPacket* const rp)
+{
+  // refuse the whole batch rather than run part of it
+  rp[0]._reply = REPLY_BATCH_ERR;
+  rp[0]._ivalue = 0;
+
+  if((n < 1) || (n > BATCH_MAX)){
+    return 0;
+  }
+
+  for(int i=0; i<n; i++){
+    if((rq[i]._command == CMD_QUERY_STATE) ||
+       (rq[i]._command == CMD_BATCH)){
+      return 0;
     }
   }
 
-  char buf[64];  
-  // do setup  commands
-  if((rq->_command >= 20) && (rq->_command <30)){ 
-    main_menu.activeNode=&setup_menu;
+  StatusPacket sp;	// not used by the commands of a batch
+  
+  for(int i=0; i<n; i++){
+    ReplyPacket* const reply = &rp[i+1];
+    memset(reply, 0, sizeof(ReplyPacket));
     
-    // always return OK for these commands
-    rp->_reply = REPLY_OK;
+    if(ServiceRequests(&rq[i], reply, &sp) != 0){
+      return -1;
+    }
+  }
+
+  rp[0]._reply = REPLY_OK;
+  rp[0]._ivalue = n;
+
+  return 0;
+}
+
+int BaseServer::reply_size(const int command)
+{
+  const int i = command_index(command);
+
+  if(i < 0){
+    return sizeof(ReplyPacket);
+  }
+
+  return pgm_read_byte(&_commands[i]._size);
+}
+
+int BaseServer::frame_packet(char* const frame,
+			     const void* const packet,
+			     const int sz,
+			     const uint8_t seq)
+{
+  frame[0] = FRAME_SYNC0;
+  frame[1] = FRAME_SYNC1;
+  frame[2] = sz;
+  frame[3] = seq;
+  memcpy(frame + FRAME_HEADER_SIZE, packet, sz);
+
+  const uint16_t crc =
+    PositionStore::CRC16(reinterpret_cast<const uint8_t*>(frame + 2), sz + 2);
+  frame[FRAME_HEADER_SIZE + sz] = crc & 0xff;
+  frame[FRAME_HEADER_SIZE + sz + 1] = crc >> 8;
+
+  return FRAME_SIZE(sz);
+}
+
+int BaseServer::unframe_request(const char* const frame,
+				RequestPacket* const rq)
+{
+  const int sz = static_cast<uint8_t>(frame[2]);
+
+  // at least the command
+  if((sz < static_cast<int>(sizeof(int16_t))) ||
+     (sz > static_cast<int>(sizeof(RequestPacket)))){
+    return -1;
+  }
+
+  const uint16_t crc =
+    PositionStore::CRC16(reinterpret_cast<const uint8_t*>(frame + 2), sz + 2);
+  if((static_cast<uint8_t>(frame[FRAME_HEADER_SIZE + sz]) != (crc & 0xff)) ||
+     (static_cast<uint8_t>(frame[FRAME_HEADER_SIZE + sz + 1]) != (crc >> 8))){
+    return -1;
+  }
+
+  memset(rq, 0, sizeof(RequestPacket));
+  memcpy(rq, frame + FRAME_HEADER_SIZE, sz);
+
+  return 0;
+}
+
+int BaseServer::compact_status(const StatusPacket* const sp,
+			       const int format,
+			       char* const status)
+{
+  if((format != STATUS_COMPACT) && (format != STATUS_CHANGED)){
+    return 0;
+  }
+
+  // STATUS_CHANGED needs the fields of the last compact status
+  const bool is_changed = (format == STATUS_CHANGED) && _is_status_sent;
+  const char* const packet = reinterpret_cast<const char*>(sp);
+  char* sent = _status_sent;
+  int sz = 0;
+
+  status[sz++] = is_changed? STATUS_CHANGED:STATUS_COMPACT;
+
+  for(int i=0; i<N_STATUS_FIELDS; i++){
+    StatusField field;
+    memcpy_P(&field, &_status_fields[i], sizeof(StatusField));
+
+    // whatever is after the end of the SSID is not compared
+    int length = field._size;
+    if(field._type == STATUS_STRING){
+      length = 0;
+      while((length < field._size) && (packet[field._offset + length] != '\0')){
+	length++;
+      }
+    }
     
-    switch(rq->_command){
-      case SETUP_SET_USER_HOME:
-	_derotator->SetUserHome(static_cast<long>(rq->_fvalue[0]/MECHANICAL_STEPSIZE)); // steps
-	sprintf(buf, ": %d", _derotator->GetUserHome()); // already in steps	
-        _userio->Print("Setting Home to",
-		       buf,
-		       1000);
-	_userio->ForceLCDPrintMenu(setup_menu, true);	    
-      break;
-      
-      case SETUP_MAX_CW:
-	_derotator->SetMaxCW(static_cast<long>(rq->_fvalue[0]/MECHANICAL_STEPSIZE)); // steps
-	sprintf(buf, ": %d", _derotator->GetMaxCW()); // already in steps	
-        _userio->Print("Setting CW to",
-		       buf,
-		       1000);	
-
-	_userio->ForceLCDPrintMenu(setup_menu, true);	    
-      break;
-      case SETUP_MAX_CCW:
-	_derotator->SetMaxCCW(static_cast<long>(rq->_fvalue[0]/MECHANICAL_STEPSIZE)); // steps
-	sprintf(buf, ": %d", _derotator->GetMaxCCW()); // already in steps	
-        _userio->Print("Setting CCW to",
-		       buf,
-		       1000);	
-
-	_userio->ForceLCDPrintMenu(setup_menu, true);	    
-      break;
-      
-      case SETUP_ENABLE_LIMITS:
-	_userio->_is_enable_limits = rq->_ivalue != 0; // is enable limits if nonzero value is found
-      break;
-      
-      case SETUP_IS_CLOCKWISE:
-	_userio->_is_clockwise = rq->_ivalue != 0; // is clockwise if a nonzero value is found
-	_userio->ForceLCDPrintMenu(setup_menu, true);
-      break;
-      
-      case SETUP_SAVE_SETTINGS:
-	_userio->SaveSettings();	    
-      break;
-      
-      case SETUP_LOAD_SETTINGS:;
-	_userio->LoadSavedSettings();
+    char value[STATUS_SSID_SIZE];
+    memset(value, 0, field._size);
+    memcpy(value, packet + field._offset, length);
+
+    bool is_sent = false;
+    if(is_changed){
+      is_sent = memcmp(value, sent, field._size) != 0;
+    }
+    else {
+      for(int j=0; j<field._size; j++){
+	if(value[j] != 0){
+	  is_sent = true;
+	  break;
+	}
+      }
+    }
+
+    memcpy(sent, value, field._size);
+    sent += field._size;
+
+    if(!is_sent){
+      continue;
+    }
+
+    status[sz++] = field._tag;
+    switch(field._type){
+      case STATUS_INT16: {
+	int16_t v;
+	memcpy(&v, value, sizeof(int16_t));
+	uint16_t zigzag =
+	  static_cast<uint16_t>(static_cast<uint16_t>(v) << 1) ^ (v < 0? 0xffff:0);
+	while(zigzag >= 0x80){
+	  status[sz++] = (zigzag & 0x7f) | 0x80;
+	  zigzag >>= 7;
+	}
+	status[sz++] = zigzag;
+      }
       break;
-      
-      case SETUP_DEF_SETTINGS:
-	_userio->LoadDefaultSettings();
+      case STATUS_STRING:
+	status[sz++] = length;
+	memcpy(status + sz, value, length);
+	sz += length;
       break;
+      default:
+	memcpy(status + sz, value, field._size);
+	sz += field._size;
     }
   }
 
-  // do other commands
-  if(rq->_command >= 100){
+  _is_status_sent = true;
+  return sz;
+}
 
-    // rp->_reply not necessarily ok with these commands
-    switch(rq->_command){
-      case CMD_GET_ALTAZ_ZETA:
-	double alt, az;
-	_derotator->GetAltAz(&alt, &az);
-	rp->_reply = _userio->_derotator_continue_status;
-	rp->_fvalue[0] = alt;
-	rp->_fvalue[1] = az;
-	rp->_fvalue[2] = _derotator->GetAccumulatedAngle();
-	rp->_fvalue[3] = _derotator->GetAngle();
-      break;
-      case CMD_GET_THETA:
-	rp->_reply = REPLY_OK;	
-	double theta;
-	theta = _derotator->GetAngle();
-	rp->_fvalue[0] = theta;
+void BaseServer::reset_connection()
+{
+  _is_framed = false;
+  _is_status_sent = false;
+
+  _telemetry_period_ms = TELEMETRY_OFF;
+  _is_telemetry_pending = false;
+}
+
+int BaseServer::IsTelemetryDue()
+{
+  if(_telemetry_period_ms < 0){
+    return 0;
+  }
+
+  if(_is_telemetry_pending){
+    return 1;
+  }
+
+  const unsigned long dt = millis() - _telemetry_ms;
+
+  if(_telemetry_period_ms > TELEMETRY_EVERY_STEP){
+    return dt >= static_cast<unsigned long>(_telemetry_period_ms);
+  }
+
+  // every step, but coalesce the steps of a fast move
+  if(dt < TELEMETRY_MIN_PERIOD_MS){
+    return 0;
+  }
+
+  return (StepEngine::GetPosition() != _telemetry_pos) ||
+    (_userio->_derotator_continue_status != _telemetry_status) ||
+    (dt >= TELEMETRY_HEARTBEAT_MS);
+}
+
+int BaseServer::GetTelemetry(TelemetryPacket* const tp)
+{
+  double alt, az;
+  _derotator->GetAltAz(&alt, &az);
+
+  _telemetry_ms = millis();
+  _telemetry_pos = StepEngine::GetPosition();
+  _telemetry_status = _userio->_derotator_continue_status;
+  _is_telemetry_pending = false;
+
+  tp->_reply = REPLY_TELEMETRY;
+  tp->_status = _telemetry_status;
+  tp->_time_ms = _telemetry_ms;
+  tp->_alt = alt;
+  tp->_az = az;
+  tp->_accumulated_angle = _derotator->GetAccumulatedAngle();
+  tp->_angle = _derotator->GetAngle();
+
+  return 0;
+}
+
+int BaseServer::command_index(const int command)
+{
+  int i;
+
+  if((command >= DEROTATOR_START) && (command <= DEROTATOR_GOTO_USER_HOME)){
+    i = command - DEROTATOR_START;
+  }
+  else if((command >= SETUP_SET_USER_HOME) && (command <= SETUP_DEF_SETTINGS)){
+    i = 4 + command - SETUP_SET_USER_HOME;
+  }
+  else if((command >= CMD_GET_ALTAZ_ZETA) && (command <= CMD_SET_PROTOCOL)){
+    i = 12 + command - CMD_GET_ALTAZ_ZETA;
+  }
+  else {
+    return -1;
+  }
+
+  // catches a command that is missing from the table
+  if(static_cast<int16_t>(pgm_read_word(&_commands[i]._command)) != command){
+    return -1;
+  }
+
+  return i;
+}
+
+/*
+  derotator control commands
+*/
+
+int BaseServer::start_derotator(RequestPacket* const rq,
+				ReplyPacket* const rp,
+				StatusPacket* const sp)
+{
+  _userio->SetInitDeRotatorFlag();
+  return 0;
+}
+
+int BaseServer::stop_derotator(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  _userio->SetStopDeRotatorFlag();
+  _derotator->Stop();
+  return 0;
+}
+
+int BaseServer::goto_hall_home(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  _userio->SetGotoHallHomeFlag();
+  rp->_fvalue[0] = _derotator->GetMoveTime(); // longest search in s
+  return 0;
+}
+
+int BaseServer::goto_user_home(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  _userio->SetGotoUserHomeFlag();
+  rp->_fvalue[0] = _derotator->GetMoveTime(); // s
+  return 0;
+}
+
+/*
+  setup commands
+*/
+
+int BaseServer::set_user_home(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  char buf[64];
+
+  _derotator->SetUserHome(_derotator->GetGearTrain().ToSteps(rq->_fvalue[0])); // steps
+  sprintf(buf, ": %d", _derotator->GetUserHome()); // already in steps
+  _userio->Print("Setting Home to",
+		 buf,
+		 1000);
+  _userio->ShowSetupMenu(true);
+  return 0;
+}
+
+int BaseServer::set_max_cw(RequestPacket* const rq,
+			   ReplyPacket* const rp,
+			   StatusPacket* const sp)
+{
+  char buf[64];
+
+  _derotator->SetMaxCW(_derotator->GetGearTrain().ToSteps(rq->_fvalue[0])); // steps
+  sprintf(buf, ": %d", _derotator->GetMaxCW()); // already in steps
+  _userio->Print("Setting CW to",
+		 buf,
+		 1000);
+  _userio->ShowSetupMenu(true);
+  return 0;
+}
+
+int BaseServer::set_max_ccw(RequestPacket* const rq,
+			    ReplyPacket* const rp,
+			    StatusPacket* const sp)
+{
+  char buf[64];
+
+  _derotator->SetMaxCCW(_derotator->GetGearTrain().ToSteps(rq->_fvalue[0])); // steps
+  sprintf(buf, ": %d", _derotator->GetMaxCCW()); // already in steps
+  _userio->Print("Setting CCW to",
+		 buf,
+		 1000);
+  _userio->ShowSetupMenu(true);
+  return 0;
+}
+
+int BaseServer::enable_limits(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->_is_enable_limits = rq->_ivalue != 0; // is enable limits if nonzero value is found
+  return 0;
+}
+
+int BaseServer::set_clockwise(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->_is_clockwise = rq->_ivalue != 0; // is clockwise if a nonzero value is found
+  _userio->ShowSetupMenu(true);
+  return 0;
+}
+
+int BaseServer::save_settings(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->SaveSettings();
+  return 0;
+}
+
+int BaseServer::load_settings(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->LoadSavedSettings();
+  return 0;
+}
+
+int BaseServer::load_default_settings(RequestPacket* const rq,
+				      ReplyPacket* const rp,
+				      StatusPacket* const sp)
+{
+  _userio->LoadDefaultSettings();
+  return 0;
+}
+
+/*
+  other commands. rp->_reply is not necessarily ok with these
+*/
+
+int BaseServer::get_altaz_zeta(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  double alt, az;
+  _derotator->GetAltAz(&alt, &az);
+
+  rp->_reply = _userio->_derotator_continue_status;
+  rp->_fvalue[0] = alt;
+  rp->_fvalue[1] = az;
+  rp->_fvalue[2] = _derotator->GetAccumulatedAngle();
+  rp->_fvalue[3] = _derotator->GetAngle();
+  return 0;
+}
+
+int BaseServer::get_theta(RequestPacket* const rq,
+			  ReplyPacket* const rp,
+			  StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetAngle();
+  return 0;
+}
+
+int BaseServer::goto_theta(RequestPacket* const rq,
+			   ReplyPacket* const rp,
+			   StatusPacket* const sp)
+{
+  _derotator->StartGoingToUserAngle(rq->_fvalue[0]);
+  _userio->_is_goto_user_angle = true;
+  rp->_fvalue[0] = _derotator->GetMoveTime(); // s
+  return 0;
+}
+
+int BaseServer::query_state(RequestPacket* const rq,
+			    ReplyPacket* const rp,
+			    StatusPacket* const sp)
+{
+  // send back the state of the derotator
+  // whether it is rotating already
+  if ((_userio->_is_start_derotator == false) &&
+      (_userio->_is_stop_derotator == false)){
+    sp->_reply = REPLY_IS_DEROTATING;
+  }
+  else {
+    sp->_reply = REPLY_OK;
+  }
+  sp->_is_clockwise_correction = _derotator->GetCorrectionDirection()? 1:0;
+  sp->_is_enable_limits = _derotator->IsEnableLimits()? 1:0;
+
+  sp->_home_pos = _derotator->GetUserHome();
+  sp->_max_cw = _derotator->GetMaxCW();
+  sp->_max_ccw = _derotator->GetMaxCCW();
+  sp->_angle = _derotator->GetAngle();
+  sp->_accumulated_angle = _derotator->GetAccumulatedAngle();
+
+  // The filling in of WLAN_security and WLAN_security is
+  // done in TCPServer.cpp
+  uint8_t security;
+  _userio->GetSSID(static_cast<char*>(sp->_WLAN_ssid), &security);
+  sp->_WLAN_security = security;
+  sp->_WLAN_password[0] = '\0'; // never send back the password
+
+  sp->_omega = _derotator->GetOmega();
+  return 0;
+}
+
+int BaseServer::get_user_home_pos(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetUserHome();
+  return 0;
+}
+
+int BaseServer::get_max_cw_pos(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetMaxCW();
+  return 0;
+}
+
+int BaseServer::get_max_ccw_pos(RequestPacket* const rq,
+				ReplyPacket* const rp,
+				StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetMaxCCW();
+  return 0;
+}
+
+int BaseServer::set_wlan_ssid(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->SetSSID(rq->_buf);
+  return 0;
+}
+
+int BaseServer::set_wlan_pass(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  _userio->SetPass(rq->_buf);
+  return 0;
+}
+
+int BaseServer::set_wlan_security(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  _userio->SetSecurity(rq->_ivalue);
+  return 0;
+}
+
+int BaseServer::set_omega(RequestPacket* const rq,
+			  ReplyPacket* const rp,
+			  StatusPacket* const sp)
+{
+  _derotator->SetOmega(rq->_fvalue[0]);
+  return 0;
+}
+
+int BaseServer::get_omega(RequestPacket* const rq,
+			  ReplyPacket* const rp,
+			  StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetOmega();
+  return 0;
+}
+
+int BaseServer::set_tracking_mode(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  // the new mode only takes effect from Start()
+  if ((_userio->_is_start_derotator == false) &&
+      (_userio->_is_stop_derotator == false)){
+    rp->_reply = REPLY_BUSY;
+    return 0;
+  }
+
+  switch(rq->_ivalue){
+    case DeRotator::SCHEDULED:
+      _derotator->SetTrackingMode(DeRotator::SCHEDULED);
       break;
-      case CMD_GOTO_THETA:
-	rp->_reply = REPLY_OK;		
-	theta = rq->_fvalue[0];
-	_derotator->StartGoingToUserAngle(theta);
-	_userio->_is_goto_user_angle = true;
+    case DeRotator::ABSOLUTE:
+      _derotator->SetTrackingMode(DeRotator::ABSOLUTE);
       break;
-      case CMD_QUERY_STATE:
-	// send back the state of the derotator
-	// whether it is rotating already
-	if ((_userio->_is_start_derotator == false) &&
-	    (_userio->_is_stop_derotator == false)){
-	  sp->_reply = REPLY_IS_DEROTATING;
-	}
-	else {
-	  sp->_reply = REPLY_OK;
-	}
-	sp->_is_clockwise_correction = _derotator->GetCorrectionDirection()? 1:0;
-	sp->_is_enable_limits = _derotator->IsEnableLimits()? 1:0;
+    default:
+      _derotator->SetTrackingMode(DeRotator::POLLED);
+  }
+  return 0;
+}
+
+int BaseServer::get_tracking_mode(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  rp->_ivalue = _derotator->GetTrackingMode();
+  return 0;
+}
 
-	sp->_home_pos = _derotator->GetUserHome();
-	sp->_max_cw = _derotator->GetMaxCW();
-	sp->_max_ccw = _derotator->GetMaxCCW();
-	sp->_angle = _derotator->GetAngle();
-	sp->_accumulated_angle = _derotator->GetAccumulatedAngle();
+int BaseServer::set_microstep(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  // the positions are rescaled, so the motor must not be turning
+  int status;
+  if ((_userio->_is_start_derotator == false) &&
+      (_userio->_is_stop_derotator == false)){
+    rp->_reply = REPLY_BUSY;
+  }
+  else if((status = _derotator->SetMicrostep(rq->_ivalue)) != 0){
+    rp->_reply = status == -3? REPLY_BUSY:REPLY_BAD_ARGUMENT;
+  }
+  return 0;
+}
 
-	// The filling in of WLAN_security and WLAN_security is
-	// done in TCPServer.cpp
-	uint8_t security;
-	_userio->GetSSID(static_cast<char*>(sp->_WLAN_ssid), &security);
-	sp->_WLAN_security = security;
-	sp->_WLAN_password[0] = '\0'; // never send back the password
+int BaseServer::get_microstep(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  rp->_ivalue = _derotator->GetMicrostep();
+  return 0;
+}
 
-	sp->_omega = _derotator->GetOmega();
+int BaseServer::set_stepper_speed(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  if(_derotator->SetStepperSpeed(rq->_fvalue[0]) != 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+  }
+  return 0;
+}
 
-      break;
+int BaseServer::get_stepper_speed(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetStepperSpeed();
+  return 0;
+}
 
-      case CMD_GET_USER_HOME_POS:
-	rp->_reply = REPLY_OK;		
-	rp->_fvalue[0] = _derotator->GetUserHome();
-      break;
+int BaseServer::set_high_rate(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  // not while the POLLED mode may have handed over
+  if ((_userio->_is_start_derotator == false) &&
+      (_userio->_is_stop_derotator == false)){
+    rp->_reply = REPLY_BUSY;
+    return 0;
+  }
 
-      case CMD_GET_MAX_CW_POS:
-	rp->_reply = REPLY_OK;		
-        rp->_fvalue[0] = _derotator->GetMaxCW();
-      break;
+  if(rq->_ivalue){
+    _derotator->EnableHighRate();
+  }
+  else {
+    _derotator->DisableHighRate();
+  }
+  return 0;
+}
 
-      case CMD_GET_MAX_CCW_POS:
-	rp->_reply = REPLY_OK;		
-        rp->_fvalue[0] = _derotator->GetMaxCCW();
-      break;
+int BaseServer::get_high_rate(RequestPacket* const rq,
+			      ReplyPacket* const rp,
+			      StatusPacket* const sp)
+{
+  rp->_ivalue = _derotator->IsEnableHighRate()? 1:0;
+  return 0;
+}
 
-      case CMD_SET_WLAN_SSID:
-	rp->_reply = REPLY_OK;
-	_userio->SetSSID(rq->_buf);
-      break;
-	
-      case CMD_SET_WLAN_PASS:
-	rp->_reply = REPLY_OK;
-	_userio->SetPass(rq->_buf);
+int BaseServer::set_telescope_mode(RequestPacket* const rq,
+				   ReplyPacket* const rp,
+				   StatusPacket* const sp)
+{
+  // the new mode only takes effect from Start()
+  if ((_userio->_is_start_derotator == false) &&
+      (_userio->_is_stop_derotator == false)){
+    rp->_reply = REPLY_BUSY;
+    return 0;
+  }
+
+  switch(rq->_ivalue){
+    case Telescope::FUSED:
+      _derotator->GetTelescope()->SetMode(Telescope::FUSED);
       break;
-	
-      case CMD_SET_WLAN_SECURITY:
-	rp->_reply = REPLY_OK;
-	_userio->SetSecurity(rq->_ivalue);	
+    case Telescope::EPHEMERIS:
+      _derotator->GetTelescope()->SetMode(Telescope::EPHEMERIS);
       break;
+    default:
+      _derotator->GetTelescope()->SetMode(Telescope::DIRECT);
+  }
+  return 0;
+}
 
-    case CMD_SET_OMEGA_VALUE:
-      rp->_reply = REPLY_OK;
-      double omega;
-      omega = rq->_fvalue[0];
-      _derotator->SetOmega(omega);
-      break;
+int BaseServer::get_telescope_mode(RequestPacket* const rq,
+				   ReplyPacket* const rp,
+				   StatusPacket* const sp)
+{
+  rp->_ivalue = _derotator->GetTelescope()->GetMode();
+  return 0;
+}
+
+int BaseServer::set_fix_interval(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  if(_derotator->GetTelescope()->SetFixInterval(rq->_fvalue[0]) != 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+  }
+  return 0;
+}
+
+int BaseServer::get_fix_interval(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetTelescope()->GetFixInterval();
+  return 0;
+}
+
+int BaseServer::get_fusion_stats(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  // all in arcsec
+  Telescope* const telescope = _derotator->GetTelescope();
+  double dalt, daz;
+  telescope->GetInnovation(&dalt, &daz);
+  const long count = telescope->GetFixCount();
+
+  rp->_ivalue = count > 32767? 32767:static_cast<int16_t>(count);
+  rp->_fvalue[0] = dalt*3600.0;
+  rp->_fvalue[1] = daz*3600.0;
+  rp->_fvalue[2] = telescope->GetInnovationRMS()*3600.0;
+  rp->_fvalue[3] = telescope->GetResidualRMS()*3600.0;
+  return 0;
+}
+
+int BaseServer::set_slew(RequestPacket* const rq,
+			 ReplyPacket* const rp,
+			 StatusPacket* const sp)
+{
+  // speed in full steps/s and acceleration in full steps/s^2
+  if(_derotator->SetSlew(rq->_fvalue[0], rq->_fvalue[1]) != 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+  }
+  return 0;
+}
+
+int BaseServer::get_slew(RequestPacket* const rq,
+			 ReplyPacket* const rp,
+			 StatusPacket* const sp)
+{
+  rp->_fvalue[0] = _derotator->GetSlewSpeed();
+  rp->_fvalue[1] = _derotator->GetSlewAcceleration();
+  return 0;
+}
 
-    case CMD_GET_OMEGA_VALUE:
-	rp->_reply = REPLY_OK;		
-        rp->_fvalue[0] = _derotator->GetOmega();      
-      break;      
+int BaseServer::get_homing_stats(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  // all in full steps
+  double shift, mean, sigma;
+  const int count = _derotator->GetHomingStats(&shift, &mean, &sigma);
+
+  rp->_ivalue = count;
+  rp->_fvalue[0] = shift;
+  rp->_fvalue[1] = mean;
+  rp->_fvalue[2] = sigma;
+  rp->_fvalue[3] = _derotator->GetHomingOffset();
+  return 0;
+}
+
+int BaseServer::set_error_budget(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  // in arcmin
+  if(_derotator->SetErrorBudget(rq->_fvalue[0]) != 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+  }
+  return 0;
+}
+
+int BaseServer::get_error_budget(RequestPacket* const rq,
+				 ReplyPacket* const rp,
+				 StatusPacket* const sp)
+{
+  // and the telescope queries that it has led to
+  const long count = _derotator->GetQueryCount();
+
+  rp->_ivalue = count > 32767? 32767:static_cast<int16_t>(count);
+  rp->_fvalue[0] = _derotator->GetErrorBudget();
+  rp->_fvalue[1] = _derotator->GetQueryRate();
+  rp->_fvalue[2] = _derotator->GetFixInterval();
+  return 0;
+}
+
+int BaseServer::get_rate_forecast(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  // s until the field turns too fast to step, -1 if not
+  // within the forecast. REPLY_OK if not derotating
+  double time_s, peak_rate;
+
+  if(_derotator->GetRateForecast(&time_s, &peak_rate) != 0){
+    rp->_reply = REPLY_OK;
+    return 0;
+  }
+
+  rp->_ivalue = time_s >= 0? 1:0;
+  rp->_fvalue[0] = time_s;
+  rp->_fvalue[1] = peak_rate;
+  rp->_fvalue[2] = _derotator->GetMaxRate();
+  return 0;
+}
+
+int BaseServer::get_limit_forecast(RequestPacket* const rq,
+				   ReplyPacket* const rp,
+				   StatusPacket* const sp)
+{
+  // s until max cw (ivalue = +1) or max ccw (-1) is reached
+  double time_s, trackable_s;
+  int dir;
+
+  if(_derotator->GetLimitForecast(&time_s, &dir) != 0){
+    rp->_reply = REPLY_OK;
+    return 0;
+  }
+
+  rp->_ivalue = dir;
+  rp->_fvalue[0] = time_s;
+  // and what Continue() will return first
+  rp->_fvalue[1] = _derotator->GetTrackability(&trackable_s);
+  rp->_fvalue[2] = trackable_s;
+  return 0;
+}
+
+int BaseServer::set_gear_train(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  // stepper motor turns per turn of the final gear and full
+  // steps per turn of the stepper motor
+  GearTrain gear_train;
+
+  if(gear_train.Set(rq->_fvalue[0], rq->_fvalue[1]) != 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+  }
+  else if(_derotator->SetGearTrain(gear_train) != 0){
+    // not while the motor is turning
+    rp->_reply = REPLY_BUSY;
+  }
+  return 0;
+}
+
+int BaseServer::get_gear_train(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       StatusPacket* const sp)
+{
+  const GearTrain& gear_train = _derotator->GetGearTrain();
+
+  rp->_ivalue = _derotator->GetMicrostep();
+  rp->_fvalue[0] = gear_train.GetRatio();
+  rp->_fvalue[1] = gear_train.GetStepsPerTurn();
+  rp->_fvalue[2] = gear_train.GetStepsize(); // deg/full step
+  rp->_fvalue[3] = gear_train.GetStepsPerDegree();
+  return 0;
+}
+
+int BaseServer::subscribe_telemetry(RequestPacket* const rq,
+				    ReplyPacket* const rp,
+				    StatusPacket* const sp)
+{
+  // the packets are pushed by the ServiceLoop() of the server
+  // that received this request
+  if(rq->_ivalue < 0){
+    _telemetry_period_ms = TELEMETRY_OFF;
+    _is_telemetry_pending = false;
+  }
+  else {
+    _telemetry_period_ms = rq->_ivalue;
+    if((_telemetry_period_ms > TELEMETRY_EVERY_STEP) &&
+       (_telemetry_period_ms < TELEMETRY_MIN_PERIOD_MS)){
+      _telemetry_period_ms = TELEMETRY_MIN_PERIOD_MS;
+    }
+    _is_telemetry_pending = true;
+  }
+  rp->_ivalue = _telemetry_period_ms;
+  return 0;
+}
+
+int BaseServer::refuse_batch(RequestPacket* const rq,
+			     ReplyPacket* const rp,
+			     StatusPacket* const sp)
+{
+  // a batch is read by the server and run by ServiceBatch(), so
+  // it only gets here from inside a batch
+  rp->_ivalue = 0;
+  return 0;
+}
+
+int BaseServer::get_command_stats(RequestPacket* const rq,
+				  ReplyPacket* const rp,
+				  StatusPacket* const sp)
+{
+  int i = 0;
+
+  if(rq->_ivalue == STATS_RESET){
+#if COMMAND_STATS
+    memset(_calls, 0, sizeof(_calls));
+    memset(_max_us, 0, sizeof(_max_us));
+    memset(_mean_us, 0, sizeof(_mean_us));
+#endif
+    rp->_reply = REPLY_OK;
+    return 0;
+  }
+
+  if(rq->_ivalue == STATS_SLOWEST){
+#if COMMAND_STATS
+    for(int j=1; j<N_COMMANDS; j++){
+      if(_max_us[j] > _max_us[i]){
+	i = j;
+      }
     }
+#endif
+  }
+  else if((i = command_index(rq->_ivalue)) < 0){
+    rp->_reply = REPLY_BAD_ARGUMENT;
+    return 0;
   }
-  return 0;  
+
+#if COMMAND_STATS
+  rp->_ivalue = _calls[i] > 32767? 32767:static_cast<int16_t>(_calls[i]);
+  rp->_fvalue[0] = _max_us[i];
+  rp->_fvalue[1] = _mean_us[i];
+#else
+  rp->_ivalue = 0;
+  rp->_fvalue[0] = 0;
+  rp->_fvalue[1] = 0;
+#endif
+  rp->_fvalue[2] = static_cast<int16_t>(pgm_read_word(&_commands[i]._command));
+  rp->_fvalue[3] = pgm_read_byte(&_commands[i]._size);
+  return 0;
+}
+
+int BaseServer::set_protocol(RequestPacket* const rq,
+			     ReplyPacket* const rp,
+			     StatusPacket* const sp)
+{
+  // the server sends this reply in the protocol of the request
+  _is_framed = rq->_ivalue == PROTOCOL_FRAMED;
+  _is_status_sent = false;
+
+  rp->_ivalue = _is_framed? PROTOCOL_FRAMED:PROTOCOL_RAW;
+  rp->_fvalue[0] = _is_framed? _pipeline_max:1;
+  rp->_fvalue[1] = CMD_SET_PROTOCOL;
+  return 0;
 }
@@ -43,6 +43,27 @@ SYNOPSIS
 	SerialServer so that common functions can be consolidated
 	here. The most important common function is ServiceRequests()
 	which both derived classes have to execute identically.
+
+	ServiceRequests() looks the command up in a table in PROGMEM
+	that gives, for every command, the menu that it belongs to,
+	the reply that it normally sends back, the size in bytes of
+	that reply and the private function that handles it. Every
+	call is timed in us, so that CMD_GET_COMMAND_STATS can tell
+	which requests hold up the control loop. The counts are
+	shared by the TCPServer and the SerialServer, and are left
+	out when COMMAND_STATS is 0.
+
+	Each server starts in PROTOCOL_RAW, so that older clients
+	keep working, until a client asks for PROTOCOL_FRAMED with
+	CMD_SET_PROTOCOL (see RequestPacket.hpp). The framing
+	itself is done here, and the reading and writing of the
+	frames by the derived classes, which also put the server back
+	into PROTOCOL_RAW when the client goes away.
+
+	In PROTOCOL_FRAMED, CMD_QUERY_STATE can also be answered with
+	the compact status of StatusPacket.hpp. The fields of the last
+	compact status are kept, so that STATUS_CHANGED only sends
+	the ones that have changed since.
 	
 
 CONSTRUCTOR
@@ -66,6 +87,24 @@ INTERFACE
 	  sp			  ReplyPacket rp or StatusPacket sp
 	)			- returns 0 on success	
 
+	ServiceBatch(		- service a CMD_BATCH of
+	  n			- this many requests that are in
+	  rq			- this array, and put the reply of the
+	  rp			  batch in rp[0] and the replies of the
+	)			  requests in rp[1..n]. All the requests
+				  are checked before any is run. Returns
+				  0 on success. The number of ReplyPacket's
+				  to send back is 1 + rp[0]._ivalue
+
+	IsTelemetryDue()	- returns 1 if a TelemetryPacket
+				  should be pushed to the client that
+				  subscribed with CMD_SUBSCRIBE_TELEMETRY.
+				  0 otherwise
+
+	GetTelemetry(		- fill in
+	  tp			- this TelemetryPacket and restart the
+	)			  push period. Returns 0 on success
+
 
 AUTHOR                                          
 
@@ -78,6 +117,36 @@ REVISION
 
 **********************************************************************/
 
+/*
+   The number of commands in the table of ServiceRequests(), i.e.
+   DEROTATOR_START..DEROTATOR_GOTO_USER_HOME,
+   SETUP_SET_USER_HOME..SETUP_DEF_SETTINGS and
+   CMD_GET_ALTAZ_ZETA..CMD_SET_PROTOCOL
+*/
+#define N_COMMANDS	(4 + 8 + (CMD_SET_PROTOCOL - CMD_GET_ALTAZ_ZETA + 1))
+
+/*
+   The service times of the commands take 6 bytes of SRAM for every
+   one of them. Define COMMAND_STATS as 0 to leave them out, when
+   CMD_GET_COMMAND_STATS returns no calls
+*/
+#ifndef COMMAND_STATS
+	#define COMMAND_STATS	1
+#endif
+
+/*
+   The seq of a request that did not come in a frame. Its reply is
+   not sent in a frame either
+*/
+#define FRAME_NONE	-1
+
+/*
+   The fields of the compact status and the bytes that are kept of
+   them: 7 int16_t's, 3 floats and the SSID
+*/
+#define N_STATUS_FIELDS		11
+#define STATUS_SENT_SIZE	(7*2 + 3*4 + 32)
+
 using namespace std;
 
 class UserIO;
@@ -95,8 +164,181 @@ public:
   int ServiceRequests(RequestPacket* const rq,
 		      ReplyPacket* const rp,
 		      StatusPacket* const sp);
+
+  int ServiceBatch(const int n,
+		   RequestPacket* const rq,
+		   ReplyPacket* const rp);
+
+  int IsTelemetryDue();
+  int GetTelemetry(TelemetryPacket* const tp);
+
+protected:
+  int reply_size(const int command);
+  int frame_packet(char* const frame,
+		   const void* const packet,
+		   const int sz,
+		   const uint8_t seq);
+  int unframe_request(const char* const frame,
+		      RequestPacket* const rq);
+  int compact_status(const StatusPacket* const sp,
+		     const int format,
+		     char* const status);
+  void reset_connection();
+
 protected:
   UserIO* _userio;
   DeRotator* _derotator;
+
+  bool _is_framed;		// PROTOCOL_FRAMED has been asked for
+  uint8_t _pipeline_max;	// requests that can be outstanding
+
+private:
+  typedef int (BaseServer::*Handler)(RequestPacket* const rq,
+				     ReplyPacket* const rp,
+				     StatusPacket* const sp);
+
+  struct Command {
+    int16_t _command;		// checked against the command looked up
+    uint8_t _menu;		// menu to show on the LCD
+    int16_t _reply;		// the reply that is normally sent back
+    uint8_t _size;		// the size of that reply in bytes
+    Handler _handler;
+  };
+
+  struct StatusField {
+    uint8_t _tag;		// STATUS_TAG_*
+    uint8_t _type;		// how the value is written
+    uint8_t _offset;		// in the StatusPacket
+    uint8_t _size;		// in the StatusPacket
+  };
+
+  int command_index(const int command);
+
+  int start_derotator(RequestPacket* const rq, ReplyPacket* const rp,
+		      StatusPacket* const sp);
+  int stop_derotator(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int goto_hall_home(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int goto_user_home(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int set_user_home(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_max_cw(RequestPacket* const rq, ReplyPacket* const rp,
+		 StatusPacket* const sp);
+  int set_max_ccw(RequestPacket* const rq, ReplyPacket* const rp,
+		  StatusPacket* const sp);
+  int enable_limits(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_clockwise(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int save_settings(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int load_settings(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int load_default_settings(RequestPacket* const rq, ReplyPacket* const rp,
+			    StatusPacket* const sp);
+  int get_altaz_zeta(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int get_theta(RequestPacket* const rq, ReplyPacket* const rp,
+		StatusPacket* const sp);
+  int goto_theta(RequestPacket* const rq, ReplyPacket* const rp,
+		 StatusPacket* const sp);
+  int query_state(RequestPacket* const rq, ReplyPacket* const rp,
+		  StatusPacket* const sp);
+  int get_user_home_pos(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int get_max_cw_pos(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int get_max_ccw_pos(RequestPacket* const rq, ReplyPacket* const rp,
+		      StatusPacket* const sp);
+  int set_wlan_ssid(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_wlan_pass(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_wlan_security(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int set_omega(RequestPacket* const rq, ReplyPacket* const rp,
+		StatusPacket* const sp);
+  int get_omega(RequestPacket* const rq, ReplyPacket* const rp,
+		StatusPacket* const sp);
+  int set_tracking_mode(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int get_tracking_mode(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int set_microstep(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int get_microstep(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_stepper_speed(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int get_stepper_speed(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int set_high_rate(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int get_high_rate(RequestPacket* const rq, ReplyPacket* const rp,
+		    StatusPacket* const sp);
+  int set_telescope_mode(RequestPacket* const rq, ReplyPacket* const rp,
+			 StatusPacket* const sp);
+  int get_telescope_mode(RequestPacket* const rq, ReplyPacket* const rp,
+			 StatusPacket* const sp);
+  int set_fix_interval(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int get_fix_interval(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int get_fusion_stats(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int set_slew(RequestPacket* const rq, ReplyPacket* const rp,
+	       StatusPacket* const sp);
+  int get_slew(RequestPacket* const rq, ReplyPacket* const rp,
+	       StatusPacket* const sp);
+  int get_homing_stats(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int set_error_budget(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int get_error_budget(RequestPacket* const rq, ReplyPacket* const rp,
+		       StatusPacket* const sp);
+  int get_rate_forecast(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int get_limit_forecast(RequestPacket* const rq, ReplyPacket* const rp,
+			 StatusPacket* const sp);
+  int set_gear_train(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int get_gear_train(RequestPacket* const rq, ReplyPacket* const rp,
+		     StatusPacket* const sp);
+  int subscribe_telemetry(RequestPacket* const rq, ReplyPacket* const rp,
+			  StatusPacket* const sp);
+  int refuse_batch(RequestPacket* const rq, ReplyPacket* const rp,
+		   StatusPacket* const sp);
+  int get_command_stats(RequestPacket* const rq, ReplyPacket* const rp,
+			StatusPacket* const sp);
+  int set_protocol(RequestPacket* const rq, ReplyPacket* const rp,
+		   StatusPacket* const sp);
+
+private:
+  static const Command _commands[N_COMMANDS];	// in PROGMEM
+
+#if COMMAND_STATS
+  // per-command service time, shared by both servers. The times
+  // stop at 0xffff us
+  static uint16_t _calls[N_COMMANDS];
+  static uint16_t _max_us[N_COMMANDS];
+  static uint16_t _mean_us[N_COMMANDS];
+#endif
+
+  static const StatusField _status_fields[N_STATUS_FIELDS];	// in PROGMEM
+
+private:
+  // telemetry subscription
+  int16_t _telemetry_period_ms;	// TELEMETRY_OFF when not subscribed
+  bool _is_telemetry_pending;	// push the first packet at once
+  unsigned long _telemetry_ms;	// millis() of the last push
+  long _telemetry_pos;		// stepper position of the last push
+  int _telemetry_status;	// continue status of the last push
+
+private:
+  // the fields of the last compact status, for STATUS_CHANGED
+  bool _is_status_sent;
+  char _status_sent[STATUS_SENT_SIZE];
 };
 #endif
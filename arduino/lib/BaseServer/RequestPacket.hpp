@@ -83,6 +83,104 @@ SEE ALSO
 #define CMD_SET_WLAN_SECURITY	109
 #define CMD_SET_OMEGA_VALUE	110
 #define CMD_GET_OMEGA_VALUE	111
+#define CMD_SET_TRACKING_MODE	112
+#define CMD_GET_TRACKING_MODE	113
+#define CMD_SET_MICROSTEP	114
+#define CMD_GET_MICROSTEP	115
+#define CMD_SET_STEPPER_SPEED	116
+#define CMD_GET_STEPPER_SPEED	117
+#define CMD_SET_HIGH_RATE	118
+#define CMD_GET_HIGH_RATE	119
+#define CMD_SET_TELESCOPE_MODE	120
+#define CMD_GET_TELESCOPE_MODE	121
+#define CMD_SET_FIX_INTERVAL	122
+#define CMD_GET_FIX_INTERVAL	123
+#define CMD_GET_FUSION_STATS	124
+#define CMD_SET_SLEW		125
+#define CMD_GET_SLEW		126
+#define CMD_GET_HOMING_STATS	127
+#define CMD_SET_ERROR_BUDGET	128
+#define CMD_GET_ERROR_BUDGET	129
+#define CMD_GET_RATE_FORECAST	130
+#define CMD_GET_LIMIT_FORECAST	131
+#define CMD_SET_GEAR_TRAIN	132
+#define CMD_GET_GEAR_TRAIN	133
+#define CMD_SUBSCRIBE_TELEMETRY	134
+
+/*
+	CMD_SUBSCRIBE_TELEMETRY takes the period in ms in _ivalue.
+	The server then pushes a TelemetryPacket (see
+	ReplyPacket.hpp) at that period, or whenever the stepper
+	moves for TELEMETRY_EVERY_STEP, until TELEMETRY_OFF.
+*/
+#define TELEMETRY_EVERY_STEP	0
+#define TELEMETRY_OFF		-1
+
+#define CMD_BATCH		135
+
+/*
+	CMD_BATCH takes the number of requests in _ivalue. That many
+	RequestPacket's follow it and are run one after the other
+	before anything else is done. The reply is a ReplyPacket
+	with _ivalue = the number of requests, followed by their
+	ReplyPacket's in the same order. CMD_QUERY_STATE and
+	CMD_BATCH cannot be in a batch. Over serial the whole batch
+	arrives while loop() may be busy, so it is only sent with
+	PROTOCOL_FRAMED and when its frames all fit into the
+	SERIAL_RX_SIZE bytes of the RX buffer. The requests are
+	then read one frame at a time. Otherwise send them one at
+	a time.
+*/
+#define BATCH_MAX		6
+#define SERIAL_RX_SIZE		64
+
+#define CMD_GET_COMMAND_STATS	136
+
+/*
+	CMD_GET_COMMAND_STATS takes a command in _ivalue and returns
+	how often it has been called and its max and mean service
+	time in us, up to 65535 us. STATS_SLOWEST asks for the
+	command with the longest service time and STATS_RESET
+	clears all of them.
+*/
+#define STATS_SLOWEST		-1
+#define STATS_RESET		-2
+
+#define CMD_SET_PROTOCOL	137
+
+/*
+	CMD_SET_PROTOCOL takes PROTOCOL_RAW or PROTOCOL_FRAMED in
+	_ivalue. The reply is in the protocol of the request. It
+	returns the protocol now in use in _ivalue, how many
+	requests can be outstanding in _fvalue[0] and
+	CMD_SET_PROTOCOL in _fvalue[1], so that the reply of an
+	older derotator that does not know the command is not
+	taken for a yes.
+
+	With PROTOCOL_RAW a request is a whole RequestPacket and
+	the reply a whole ReplyPacket or StatusPacket. With
+	PROTOCOL_FRAMED every packet is sent as the frame
+
+	  FRAME_SYNC0 FRAME_SYNC1 length seq packet crc
+
+	where packet is the first length bytes of the packet, the
+	rest of it being zero, and crc is the CRC-16/CCITT of
+	length, seq and packet, LSB first. Anything that is not a
+	good frame is dropped. Every request frame gets one reply
+	frame with the same seq, in the order of the requests, so
+	that several can be outstanding. The requests of a CMD_BATCH
+	that is refused get no reply. Telemetry is sent with
+	FRAME_TELEMETRY_SEQ, so requests are numbered from 1.
+*/
+#define PROTOCOL_RAW		0
+#define PROTOCOL_FRAMED		1
+
+#define FRAME_SYNC0		0xA5
+#define FRAME_SYNC1		0x5A
+#define FRAME_HEADER_SIZE	4	// sync, length and seq
+#define FRAME_CRC_SIZE		2
+#define FRAME_SIZE(n)		(FRAME_HEADER_SIZE + (n) + FRAME_CRC_SIZE)
+#define FRAME_TELEMETRY_SEQ	0
 
 
 struct RequestPacket
@@ -23,12 +23,15 @@
 /* operating system header files (use <> for make depend) */
 #include <Arduino.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
 
 /* general system header files (use "" for make depend) */
 
 /* local include files (use "") */
 #include "DeRotator.h"
+#include "TrigTable.h"
 
 /**********************************************************************
 	Defines for the mechanical de-rotator
@@ -45,14 +48,43 @@
 #define RAD2DEG 180.0/M_PI
 
 #define OMEGA	7.2921150e-5 // rotation frequency of the Earth in rad/s. Number is from wikipedia
-#define DT_FRACTION	0.25	  // Given the predicted time to get to 1 motor step,
-				  // reduce it by this amount to check telescope position
+#define ERROR_BUDGET		0.5	// arcmin that the field angle may be
+					// off between telescope fixes. In
+					// between, alt, az are propagated
+					// by propagate()
+#define MAX_FIX_INTERVAL_US	60000000 // but at least once a minute
+
+#define FORECAST_STEP_S		30	// s between the samples of the forecast
+#define FORECAST_HORIZON_S	10800	// s = 3 hours that it looks ahead
+#define FORECAST_INTERVAL_US	60000000 // us between the forecasts of a session
+#define FORECAST_SAMPLES	4	// samples made per Continue() call so
+					// that the loop is not held up
+
+#define SUBSTEP_SHIFT		32	// the remainder is kept in 2^-32 steps
+#define SUBSTEPS_PER_STEP	(static_cast<int64_t>(1) << SUBSTEP_SHIFT)
+#define DT_SUBSTEPS		(SUBSTEPS_PER_STEP >> 2) // Given the predicted time
+					// to get to 1 motor step, reduce
+					// it to 1/4 to update the angle
 
 /**********************************************************************
 	Hall switch interrupt pin
  **********************************************************************/
 #define INTERRUPT_SIGNAL_PIN 18  
 
+/**********************************************************************
+	Stepper motor driver pins
+ **********************************************************************/
+#define STEPPER_STEP_PIN	6
+#define STEPPER_DIR_PIN		7
+
+// DRV8825 microstep select. The DRV8825 pulls MS0-MS2 low, so
+// with these pins unconnected it is always at full step.
+#define STEPPER_MS0_PIN		22
+#define STEPPER_MS1_PIN		23
+#define STEPPER_MS2_PIN		24
+
+#define MAX_MICROSTEP		32
+
 
 /**********************************************************************
 NAME
@@ -67,17 +99,110 @@ PROTECTED FUNCTIONS
 
 PRIVATE FUNCTIONS
 
-	dzeta_dt(	- calculate the derotator angular velocity in rad/s.
-	  latitude_rad	- at this latitude in radians
+	set_latitude(	- cache the latitude terms of the session
+	  latitude_rad	- for this latitude in radians
+	)
+
+	dzeta_dt(	- calculate the derotator angular velocity in rad/s
+			  at the latitude of the session with TrigTable.
 	  alt, az	- when the telescope is pointed to star at alt,az in degrees
 	)		- returns the derotator angular velocity. Value can be NEGATIVE!
 
 	predictor(	- predicts the time needed to achieve one motor step
-	  latitude_rad	- at this latitude in radians
 	  alt, az	- when the telescope is pointed to star at alt,az in degrees
 	  angle_rad	- this is the angle of interest in radians
 	)		- returns the time needed to get to the above angle
 
+	to_substeps(	- convert to the fixed point remainder
+	  angle_rad	- this angle in rad
+	)		- returns it in sub-steps, 2^SUBSTEP_SHIFT a step
+
+	to_rad(		- convert back
+	  substeps	- this many sub-steps
+	)		- returns it in rad
+
+	to_rate(	- convert the derotator angular velocity
+	  zeta_dot	- in rad/s
+	)		- returns it in sub-steps/us, clipped to a long
+
+	time_to(	- the time for the remainder to move by
+	  substeps	- this many sub-steps at _rate_sub_us
+	)		- returns it in us, but at most
+			  MAX_FIX_INTERVAL_US
+
+	rates(		- calculate the rates of change
+	  alt_rad, az_rad - of the star at alt, az in radians
+	  dalt, daz	- returns the alt and az rates in rad/s
+	)		- returns the derotator angular velocity in rad/s
+
+	propagate(	- integrate the derotator angle with the midpoint
+			  rule, i.e. with the rate at alt, az half
+			  way through the interval, which is found from
+			  the analytic alt, az rates.
+	  dt_s		- over this time in s
+	  alt, az	- starting from this alt, az in degrees. Returns
+			  the alt, az at the end of the interval.
+	)		- returns the derotator angle in rad
+
+	field_angle(	- the parallactic angle in rad. Its rate is
+			  dzeta_dt().
+	  alt, az	- of the star at alt, az in degrees
+	)
+
+	refresh_altaz(	- start a telescope query if the last fix is
+	  time_us	- older than the fix interval at this time.
+	)		  Otherwise _alt0, _az0 are left as propagated.
+
+	poll_fix()	- read the reply of the telescope query in
+			  flight, without waiting. Returns 0 and
+			  updates _alt0, _az0 propagated to _time_us
+			  when the reply is complete. Returns 1 if
+			  the query is in flight. Returns -1 if there is
+			  no query or it has failed, in which case the
+			  next query is after another fix interval.
+
+	begin_fix(	- start a telescope query
+	  time_us	- at this time
+	)
+
+	fix_interval()	- returns the time in us between telescope
+			  fixes: the time for the field angle to be
+			  off by the error budget from a straight
+			  line, i.e. sqrt(2 budget/|d2zeta/dt2|), but
+			  not less than TIME_STEP_US or more than
+			  MAX_FIX_INTERVAL_US
+
+	dzeta_dt2(	- calculate the derotator angular acceleration
+	  alt, az	- when the telescope is pointed to star at alt,az in degrees
+	)		- returns it in rad/s^2
+
+	max_rate()	- returns the fastest |dzeta/dt| in rad/s that
+			  the tracking mode can step. The POLLED mode
+			  without the high rate returns -1 when a
+			  quarter step takes less than TIME_STEP_US,
+			  the others when a step takes less than
+			  MIN_STEPPER_TIME_US.
+
+	service_forecast() - make FORECAST_SAMPLES more samples of the
+			  forecast in progress, or start a new one
+			  FORECAST_INTERVAL_US after the last one.
+
+	begin_forecast() - start a forecast from _alt0, _az0 at
+			  _time_us. The hour angle and declination
+			  are found from them, so that the star can be
+			  put at any later time exactly.
+
+	continue_forecast( - sample the field angle and its rate
+	  nsamples	- at this many more FORECAST_STEP_S. The
+			  rate is too fast if it is at a sample or
+			  on average between samples, which catches
+			  a zenith pass in between. The steps from
+			  home follow the unwrapped field angle. The
+			  crossings are interpolated. When the
+			  forecast reaches FORECAST_HORIZON_S or the
+			  star sets it is made the current one.
+	)
+
 	step_motor(	- tells the stepper motor to increment by one step.
 	  is_clockwise	- in the clockwise direction if true.
 			  Otherwise anti-clockwise. Default: true.
@@ -85,6 +210,75 @@ PRIVATE FUNCTIONS
 			  Returns -1 if max_cw and mac_ccw limits are
 			  reached.
 
+	continue_scheduled()	- Continue() in the SCHEDULED tracking mode.
+
+	update_schedule(	- take a new telescope fix and replan
+	  time_us		- that was started at this time
+	  alt, az		- the reply of the telescope
+	)			- returns 0 on success.
+				  returns -1 if the steps will be closer
+				  than MIN_STEPPER_TIME_US.
+
+	plan_next_step()	- append the time of the step after the
+				  last planned one to the StepEngine.
+				  Returns 0 on success.
+				  Returns -1 if nothing was planned.
+
+	begin_schedule()	- start planning steps from the current
+				  remainder and telescope fix.
+
+	step_rate_status()	- returns 0 if the motor can step as fast
+				  as the derotation needs, else -1.
+
+	continue_absolute()	- Continue() in the ABSOLUTE tracking mode.
+
+	update_target(		- propagate alt, az and calculate the
+				  StepEngine position of the field angle
+	  time_us		- at this time
+	)
+
+	write_microstep_pins()	- set the DRV8825 MS0-MS2 pins for
+				  the microstep factor.
+
+	motor_direction(	- returns the StepEngine direction +1/-1
+	  is_clockwise		- for this correction direction
+	)
+
+	begin_slew(		- start a move with the slew profile
+	  nsteps		- of this many steps
+	  dir			- in this StepEngine direction
+	  max_speed		- at most this many full steps/s
+	)
+
+	continue_slew()		- queue the next steps of the move
+
+	make_position_record(	- fill in the position and the session
+	  r			- state of this record
+	)
+
+	checkpoint_rotation()	- bring the unwrapped field angle up to
+				  the last update of alt, az
+
+	finish_resume(		- Start() and carry on with the session
+				  of the checkpoint
+	  alt			- at the current alt
+	  az			- and az in degrees
+	)			- returns what Start() returns
+
+	finish_homing()		- make the Hall edge found by the slow
+				  approach position 0 and update the
+				  repeatability statistics
+
+	rescale(		- scale
+	  steps			- this position in steps
+	  ratio			- by this
+	)			- returns it rounded to a step
+
+	sync_engine()		- account for the steps made by the
+				  StepEngine since the last call in
+				  the angles. Returns the number of
+				  correction steps.
+
 	hall_interrupt_handler() - handle the interrupt from the Hall magnet	
 
 				  
@@ -105,30 +299,151 @@ REVISION
 
 volatile bool DeRotator::_is_stop_rotating = false;
 volatile bool DeRotator::_is_searching_for_hall_home = false;
+volatile bool DeRotator::_is_hall_found = false;
+volatile long DeRotator::_hall_pos = 0;
+volatile unsigned long DeRotator::_hall_time_us = 0;
 
-#define STEPPER_SPEED  100	// 100 steps/second
+#define STEPPER_SPEED  100	// 100 full steps/second
 				// 200 steps required for 1 turn
 				// therefore 0.5 Hz
-
-#define MIN_STEPPER_TIME_US  static_cast<unsigned long>(1e6/STEPPER_SPEED) 			
+				// This is the default. See SetStepperSpeed()
+
+#define MIN_STEPPER_TIME_US  _min_step_time_us
+
+#define SLEW_SPEED		400	// full steps/s
+#define SLEW_ACCELERATION	800	// full steps/s^2. A 90 deg move of
+					// 1500 steps then takes 4.3 s
+
+#define HALL_SEARCH_DEG		10.0	// the furthest the search turns
+#define HALL_BACKOFF_STEPS	10	// full steps to back off before the
+					// slow approach. More than the
+					// hysteresis of the Hall switch
+#define HALL_APPROACH_SPEED	200	// full steps/s at most of the fast
+					// approach so that it does not
+					// overshoot the edge by much
+#define HALL_CREEP_SPEED	40	// full steps/s of the slow approach
+#define HALL_VALIDATE_STEPS	5	// full steps past the Hall home where
+					// the switch must still be on
+
+#define POSITION_STORE_ADDRESS	1024	// after the UserIO settings
+#define POSITION_STORE_SLOTS	32	// 32 x 50 bytes
+#define POSITION_IDLE_US	2000000	// us = 2 s before the position is saved
+#define CHECKPOINT_US		10000000 // us = 10 s between checkpoints
+					// of a session. At most 2880 in an
+					// 8 h night spread over the slots is
+					// 90 writes of each
+#define SIDEREAL_RATE		1.00273790935 // sidereal s per s
+#define RESUME_GAP_SLACK_S	2.0	// s. The LX200 gives the sidereal time
+					// to 1 s, so a gap can be a little < 0
+#define RESUME_MAX_GAP_S	3600.0	// s. A longer gap is a bad sidereal
+					// time or a session of another night
 
 DeRotator::DeRotator(Telescope* const telescope,
-		     const double mechanical_stepsize,
+		     const GearTrain& gear_train,
 		     const bool is_debug)
 :
-  _stepper(AccelStepper(AccelStepper::DRIVER, 6,7)),
   _telescope(telescope),
   _latitude_rad(0.0), // this will be initialized in Start() by querying Telescope
   _omega(OMEGA),
-  _MECHANICAL_STEPSIZE_RAD(mechanical_stepsize*DEG2RAD),
-  _is_debug(is_debug)
+  _gear_train(gear_train),
+  _FULL_STEPSIZE_RAD(gear_train.GetStepsize()*DEG2RAD),
+  _FULL_STEPS_PER_RAD(gear_train.GetStepsPerDegree()*RAD2DEG),
+  _MECHANICAL_STEPSIZE_RAD(gear_train.GetStepsize()*DEG2RAD),
+  _STEPS_PER_RAD(gear_train.GetStepsPerDegree()*RAD2DEG),
+  _is_debug(is_debug),
+  _position_store(POSITION_STORE_ADDRESS, POSITION_STORE_SLOTS)
 {
   _time_us = 0;
-  _angle_rad = 0;
-  _accumulated_angle_rad = 0;
-
-  _stepper.setSpeed(STEPPER_SPEED);  
-  _stepper.setMaxSpeed(STEPPER_SPEED);
+  _dt_us = 0;
+  _angle_sub = 0;
+  _accumulated_steps = 0;
+  _rate_sub_us = 0;
+
+  _tracking_mode = POLLED;
+  _zeta_dot = 0;
+  _fix_time_us = 0;
+  _fix_interval_us = TIME_STEP_US;
+  _error_budget_rad = ERROR_BUDGET/60.0*DEG2RAD;
+  _query_count = 0;
+  _query_start_us = 0;
+  _query_time_us = 0;
+  _sin_lat = 0;
+  _cos_lat = 1;
+  _omega_sin_lat = 0;
+  _omega_cos_lat = OMEGA;
+  _plan_alt = 0;
+  _plan_az = 0;
+  _plan_time_us = 0;
+  _plan_angle_rad = 0;
+  _zeta_rad = 0;
+  _zeta0_rad = 0;
+  _start_pos = 0;
+  _target_pos = 0;
+  _engine_pos = 0;
+  _fc_k = -1;
+  _fc_time_us = 0;
+  _fc_ha = 0;
+  _fc_sin_dec = 0;
+  _fc_cos_dec = 1;
+  _fc_zeta = 0;
+  _fc_zeta0 = 0;
+  _fc_rate = 0;
+  _fc_pos = 0;
+  _fc_pos0 = 0;
+  _fc_rate_s = -1;
+  _fc_peak_rate = 0;
+  _fc_limit_s = -1;
+  _fc_span_s = 0;
+  _fc_limit_dir = 0;
+  _is_forecast = false;
+  _forecast_time_us = 0;
+  _forecast_rate_s = -1;
+  _forecast_peak_rate = 0;
+  _forecast_limit_s = -1;
+  _forecast_span_s = 0;
+  _forecast_limit_dir = 0;
+  _goto_dir = 1;
+  _homing_state = HOMING_APPROACH;
+  _hall_fast_pos = 0;
+  _creep_end_pos = 0;
+  _hall_start_time_us = 0;
+  _is_homed = false;
+  _homing_count = 0;
+  _homing_sum = 0;
+  _homing_sum2 = 0;
+  _homing_shift = 0;
+  _homing_offset = 0;
+  _homing_time_s = 0;
+  _is_derotating = false;
+  _idle_pos = 0;
+  _idle_time_us = 0;
+  memset(&_saved_record, 0, sizeof(_saved_record));
+  _start_time_us = 0;
+  _lst0 = -1;
+  _checkpoint_time_us = 0;
+  _is_resume_pending = false;
+  _is_catching_up = false;
+  memset(&_resume_record, 0, sizeof(_resume_record));
+  _resume_alt = 0;
+  _resume_az = 0;
+  _resume_time_us = 0;
+  _resume_gap_s = -1;
+  _resume_rotation_rad = 0;
+  _is_high_rate = true;
+  _is_high_rate_active = false;
+
+  _microstep = 1;
+  _stepper_speed = STEPPER_SPEED;
+  _min_step_time_us = static_cast<unsigned long>(1e6/STEPPER_SPEED);
+  _slew_speed = SLEW_SPEED;
+  _slew_acceleration = SLEW_ACCELERATION;
+
+  StepEngine::Begin(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+
+  pinMode(STEPPER_MS0_PIN, OUTPUT);
+  pinMode(STEPPER_MS1_PIN, OUTPUT);
+  pinMode(STEPPER_MS2_PIN, OUTPUT);
+  write_microstep_pins();
 
   LoadLimits();
 
@@ -145,23 +460,71 @@ DeRotator::~DeRotator()
 
 int DeRotator::Start(const double alt, const double az)
 {
-  // reset the last step time here and in AccelStepper()
+  // reset the last step time
   _last_step_time_us = micros();
-  _stepper.resetTime();
-  _latitude_rad = _telescope->GetLatitude()*DEG2RAD;  
+  set_latitude(_telescope->GetLatitude()*DEG2RAD);
   
   _time_us = _last_step_time_us; 
-  _dt_us = predictor(_latitude_rad, alt, az, _MECHANICAL_STEPSIZE_RAD*DT_FRACTION)*1e6;
+  _rate_sub_us = to_rate(dzeta_dt(alt, az));
+  _dt_us = time_to(DT_SUBSTEPS);
 
-  _accumulated_angle_rad = 0.0;  
-  _angle_rad = 0.0;
+  _accumulated_steps = 0;
+  _angle_sub = 0;
   _alt0 = alt;
   _az0 = az;
+  _fix_time_us = _time_us;
+  _fix_interval_us = fix_interval();
+  _telescope->CancelQuery();
+  _query_count = 0;
+  _query_start_us = _time_us;
 #ifdef AAAAAA
   Serial.print("last time step us= "); Serial.println(_last_step_time_us, DEC);
   Serial.print("time us = "); Serial.println(_time_us, DEC);
   Serial.print("dt us = "); Serial.println(_dt_us, 16);
 #endif
+  _is_high_rate_active = false;
+  _is_derotating = true;
+  _is_resume_pending = false;
+
+  // for the checkpoints of the session
+  _start_time_us = _time_us;
+  _start_pos = StepEngine::GetPosition();
+  _zeta0_rad = field_angle(alt, az);
+  _zeta_rad = _zeta0_rad;
+  _checkpoint_time_us = micros();
+
+  // look ahead for where the session will fail. Continue() makes the
+  // forecast FORECAST_SAMPLES at a time so that Start() does not block
+  begin_forecast();
+
+  // carried on from Init(), so that the loop does not wait for the LX200
+  if(_telescope->GetSiderealTime(&_lst0) != 0){
+    _lst0 = -1;
+  }
+
+  if(_tracking_mode == ABSOLUTE){
+    StepEngine::Clear();
+    _engine_pos = StepEngine::GetPosition();
+    _start_pos = _engine_pos;
+    _target_pos = _engine_pos;
+    _zeta0_rad = field_angle(_alt0, _az0);
+    _zeta_rad = _zeta0_rad;
+    _zeta_dot = dzeta_dt(_alt0, _az0);
+    if(_dt_us < MIN_STEPPER_TIME_US){
+      _dt_us = MIN_STEPPER_TIME_US;
+    }
+
+    return step_rate_status();
+  }
+
+  if((_tracking_mode == SCHEDULED) ||
+     (_is_high_rate && (_dt_us <= TIME_STEP_US))){
+    StepEngine::Clear();
+    begin_schedule();
+
+    return step_rate_status();
+  }
+
   if(_dt_us > TIME_STEP_US){
     return 0;
   }
@@ -172,69 +535,87 @@ int DeRotator::Start(const double alt, const double az)
 
 int DeRotator::Continue()
 {
+  if(_is_catching_up){
+    continue_slew();
+    if(!_slew.IsDone() || !StepEngine::IsEmpty()){
+      return 1;
+    }
+
+    // the field has kept rotating during the slew
+    _is_catching_up = false;
+    double alt = _resume_alt, az = _resume_az;
+    propagate(static_cast<long>(micros() - _resume_time_us)*1e-6, &alt, &az);
+    return finish_resume(alt, az);
+  }
+
+  service_forecast();
+
+  if(_tracking_mode == ABSOLUTE){
+    return continue_absolute();
+  }
+
+  if((_tracking_mode == SCHEDULED) || _is_high_rate_active){
+    return continue_scheduled();
+  }
+
   int status = 0;
   unsigned long time_us = micros(); // time since micro woke up in us. Note wraps in 1hr15 minutes!
-  unsigned long time_ms = millis(); // time since micro woke up in ms. Note wraps in 50 days!
   unsigned long dtime_us = time_us - _time_us; // us
 
+  // pick up the telescope fix if it has arrived
+  poll_fix();
+
   /*
     check that both dtime and that the stepper will cause a step to
     take place. The reason is that a while() loop check in
     step_motor() screws up the correction timing.
    */
   if((dtime_us >= _dt_us) && ((time_us - _last_step_time_us) >= MIN_STEPPER_TIME_US)){
-    // calculate the incremental angular change	
-    double dangle_rad = dzeta_dt(_latitude_rad, _alt0, _az0)*dtime_us*1e-6; // rad
+    // calculate the incremental angular change and where the star
+    // has moved to
+    const int64_t dangle_sub = to_substeps(propagate(dtime_us*1e-6, &_alt0, &_az0));
 
     // check whether we need to actually turn the de-rotator motor
     // Note since dzeta_dt can be NEGATIVE, the angle can be negative.
-    // So must compare positive numbers
+    // So must compare positive numbers. The remainder is in integer
+    // sub-steps, so that it does not drift however long the session
 
-    double angle_rad = _angle_rad + dangle_rad;
-    if(fabs(angle_rad) >= _MECHANICAL_STEPSIZE_RAD){
-      if(step_motor(angle_rad > 0) == 0){
+    const int64_t angle_sub = _angle_sub + dangle_sub;
+    if((angle_sub >= SUBSTEPS_PER_STEP) || (angle_sub <= -SUBSTEPS_PER_STEP)){
+      if(step_motor(angle_sub > 0) == 0){
 
         // update the angles, and if there's some remainder that we
-        // still need to correct, I'll leave in _angle_rad.
-
-	// Depending on whether dangle_rad is positive or negative, I
-        // either add or remove MECHANICAL_STEPSIZE_RAD from
-        // _angle_rad and _accumulated_angle_rad
-	
-	if(dangle_rad > 0){
-#ifdef AAAAA	  
-	  Serial.print("angle_rad (>0) = "); Serial.println(angle_rad, DEC);
-	  Serial.print("_angle_rad (>0) = "); Serial.println(_angle_rad, DEC);	  
-#endif	  
-	  _angle_rad = angle_rad - _MECHANICAL_STEPSIZE_RAD;
-	  _accumulated_angle_rad += _MECHANICAL_STEPSIZE_RAD;	  
-#ifdef AAAAAAA
-	  Serial.print("dtime = "); Serial.println(dtime, DEC);
-	  Serial.print("dangle = "); Serial.println(dangle_rad, DEC);
-#endif	  
+        // still need to correct, I'll leave in _angle_sub. It is the
+        // direction of the step that is taken off, which is the
+        // direction of the remainder.
+	if(angle_sub > 0){
+	  _angle_sub = angle_sub - SUBSTEPS_PER_STEP;
+	  _accumulated_steps++;
 	}
 	else {
-	  _angle_rad = angle_rad + _MECHANICAL_STEPSIZE_RAD;
-	  _accumulated_angle_rad -= _MECHANICAL_STEPSIZE_RAD;
-#ifdef AAAAAA	  
-	  Serial.print("_angle_rad (<0) = "); Serial.println(_angle_rad, DEC);
-	  Serial.print("dtime = "); Serial.println(dtime,DEC);
-#endif	  
+	  _angle_sub = angle_sub + SUBSTEPS_PER_STEP;
+	  _accumulated_steps--;
 	}
 
         // Now remember the current time and calculate the time increment of the next step
 	_time_us = time_us;
-	_telescope->GetAltAz(time_ms*1e-3, &_alt0, &_az0);
-	_dt_us = predictor(_latitude_rad, _alt0, _az0, _MECHANICAL_STEPSIZE_RAD*DT_FRACTION)*1e6;
+	refresh_altaz(time_us);
+	_rate_sub_us = to_rate(dzeta_dt(_alt0, _az0));
+	_dt_us = time_to(DT_SUBSTEPS);
 
         // check that the next time step is not smaller than our sampling time
 	if(_dt_us > TIME_STEP_US){
 	  status = 1; // tell user that we have made stepper motor take one step and next
 		      // predicted time step is ok.
 #ifdef AAAAAA
-	  Serial.print(_time_us, DEC); Serial.print(" "); Serial.println(_accumulated_angle_rad, 12);
+	  Serial.print(_time_us, DEC); Serial.print(" "); Serial.println(_accumulated_steps, DEC);
 #endif	  
         }
+	else if(_is_high_rate){
+	  // too fast for polling: hand over to the schedule
+	  begin_schedule();
+	  status = step_rate_status() == 0? 1:-1;
+	}
 	else {
 	  status = -1;      // else tell user the predicted time step is too small
 	}
@@ -244,16 +625,22 @@ int DeRotator::Continue()
 	return -2;
       }
     } // angle_rad >= mechanical stepsize
-    else { // I am not turning the motor, but I still need to update the _angle_rad
-      _angle_rad += dangle_rad;
+    else { // I am not turning the motor, but I still need to update the _angle_sub
+      _angle_sub = angle_sub;
       // Now remember the current time and calculate the time increment of the next step
       _time_us = time_us; //us
-      _telescope->GetAltAz(time_ms*1e-3, &_alt0, &_az0);
-      _dt_us = predictor(_latitude_rad, _alt0, _az0, _MECHANICAL_STEPSIZE_RAD*DT_FRACTION)*1e6;
+      refresh_altaz(time_us);
+      _rate_sub_us = to_rate(dzeta_dt(_alt0, _az0));
+      _dt_us = time_to(DT_SUBSTEPS);
       // check that the next time step is not smaller than our sampling time
       if(_dt_us > TIME_STEP_US){
 	status = 0; // tell user not to do anything yet, but everything is still ok
       }
+      else if(_is_high_rate){
+	// too fast for polling: hand over to the schedule
+	begin_schedule();
+	status = step_rate_status();
+      }
       else {
 	status = -1; // tell user that the predicted time step is too small     
       }
@@ -266,6 +653,13 @@ int DeRotator::Continue()
 int DeRotator::Stop()
 {
   _is_stop_rotating = true;
+  _is_derotating = false;
+  _is_resume_pending = false;
+  _is_catching_up = false;
+  _is_forecast = false;
+  _fc_k = -1;
+  // throw away any steps that have been scheduled but not made
+  StepEngine::Clear();
   return 0;
 }
 
@@ -274,6 +668,121 @@ int DeRotator::IsStop() const
   return _is_stop_rotating? 1:0;
 }
 
+void DeRotator::SetTrackingMode(const TRACKING_MODE mode)
+{
+  _tracking_mode = mode;
+}
+
+DeRotator::TRACKING_MODE DeRotator::GetTrackingMode() const
+{
+  return _tracking_mode;
+}
+
+void DeRotator::EnableHighRate()
+{
+  _is_high_rate = true;
+}
+
+void DeRotator::DisableHighRate()
+{
+  _is_high_rate = false;
+}
+
+bool DeRotator::IsEnableHighRate() const
+{
+  return _is_high_rate;
+}
+
+int DeRotator::SetMicrostep(const int microstep)
+{
+  // must be a power of 2 up to MAX_MICROSTEP
+  if((microstep < 1) || (microstep > MAX_MICROSTEP) ||
+     ((microstep & (microstep - 1)) != 0)){
+    return -1;
+  }
+
+  if((_stepper_speed*microstep)*StepEngine::GetTickTime() > 1e6){
+    return -2;
+  }
+
+  if(microstep == _microstep){
+    return 0;
+  }
+
+  // the queued steps and the slew are in the old microsteps
+  if(_is_derotating || !StepEngine::IsEmpty()){
+    return -3;
+  }
+
+  // all positions are kept in microsteps, so rescale them
+  const long pos = StepEngine::GetPosition();
+  StepEngine::SetPosition(pos*microstep/_microstep);
+  _home_pos = _home_pos*microstep/_microstep;
+  _max_cw = _max_cw*microstep/_microstep;
+  _max_ccw = _max_ccw*microstep/_microstep;
+  _engine_pos = StepEngine::GetPosition();
+  _accumulated_steps = _accumulated_steps*microstep/_microstep;
+  _angle_sub = _angle_sub*microstep/_microstep;
+
+  _microstep = microstep;
+  _MECHANICAL_STEPSIZE_RAD = _FULL_STEPSIZE_RAD/_microstep;
+  _STEPS_PER_RAD = _FULL_STEPS_PER_RAD*_microstep;
+  _min_step_time_us = static_cast<unsigned long>(1e6/(_stepper_speed*_microstep));
+
+  write_microstep_pins();
+
+  return 0;
+}
+
+int DeRotator::GetMicrostep() const
+{
+  return _microstep;
+}
+
+int DeRotator::SetStepperSpeed(const double speed)
+{
+  if((speed <= 0) || ((speed*_microstep)*StepEngine::GetTickTime() > 1e6)){
+    return -1;
+  }
+
+  _stepper_speed = speed;
+  _min_step_time_us = static_cast<unsigned long>(1e6/(_stepper_speed*_microstep));
+
+  return 0;
+}
+
+double DeRotator::GetStepperSpeed() const
+{
+  return _stepper_speed;
+}
+
+int DeRotator::SetSlew(const double speed, const double acceleration)
+{
+  if((speed <= 0) || (acceleration <= 0)){
+    return -1;
+  }
+
+  _slew_speed = speed;
+  _slew_acceleration = acceleration;
+
+  return 0;
+}
+
+double DeRotator::GetSlewSpeed() const
+{
+  return _slew_speed;
+}
+
+double DeRotator::GetSlewAcceleration() const
+{
+  return _slew_acceleration;
+}
+
+double DeRotator::GetMoveTime() const
+{
+  return _slew.GetTime();
+}
+
 int DeRotator::Turn(const DIRECTION dir)
 {
 
@@ -281,11 +790,12 @@ int DeRotator::Turn(const DIRECTION dir)
     IMPORTANT!!!!! Clockwise and anti-clockwise is defined w.r.t. the
     stepper motor and NOT to the camera rotation
     direction.
-    +STEPPER_SPEED is always defined to be clockwise and
-    -STEPPER_SPEED is always defined to be anti-clockwise.
+    A +1 step of the StepEngine is always defined to be clockwise and
+    a -1 step is always defined to be anti-clockwise.
    */
   int err = 0;
-  long dpos = _stepper.currentPosition() - _home_pos;
+  int8_t step = 1;
+  long dpos = StepEngine::GetQueuedPosition() - _home_pos;
   switch(dir){
     case CW:
       if(_is_enable_limits){
@@ -294,7 +804,7 @@ int DeRotator::Turn(const DIRECTION dir)
 	}
       }
 
-      _stepper.setSpeed(STEPPER_SPEED);
+      step = 1;
       break;
       
     case CCW:
@@ -304,11 +814,15 @@ int DeRotator::Turn(const DIRECTION dir)
 	}
       }
 
-      _stepper.setSpeed(-STEPPER_SPEED);
+      step = -1;
       break;
   }
-  
-  _stepper.runSpeed();
+
+  // only keep one step in the engine so that the motor stops as
+  // soon as the button is released
+  if((err == 0) && StepEngine::IsEmpty()){
+    StepEngine::PushAfter(step, MIN_STEPPER_TIME_US);
+  }
 
   return err;
 }
@@ -317,41 +831,90 @@ int DeRotator::Turn(const DIRECTION dir)
 int DeRotator::StartGoingToHallHome()
 {
   _is_stop_rotating = false;
+  _is_hall_found = false;
   _is_searching_for_hall_home = true;
   
-  _stepper.resetTime();
-  _stepper.setSpeed(STEPPER_SPEED);
+  StepEngine::Clear();
+  _start_hall_search_pos = StepEngine::GetPosition();
+  _hall_start_time_us = micros();
 
-  _start_hall_search_pos = _stepper.currentPosition();
+  // safety. Only rotate by + 10 deg. The fast approach never goes further
+  _homing_state = HOMING_APPROACH;
+  begin_slew(_gear_train.ToSteps(HALL_SEARCH_DEG)*_microstep, 1,
+	     _slew_speed < HALL_APPROACH_SPEED? _slew_speed:HALL_APPROACH_SPEED);
 
   return 0;
 }
 
 int DeRotator::ContinueFindingHallHome()
 {
-  if(!_is_stop_rotating){
-    // safety. Check that we only rotated by +/- 10 deg
-    // number of steps = (10 deg)/(0.0597 deg/step) = 167
-    long dpos = _stepper.currentPosition() - _start_hall_search_pos;
-    if((dpos < -167) || (dpos > 167)){
-      return -1;
-    }
-    _stepper.runSpeed();
+  if(_is_stop_rotating){
+    // Set the current position to zero. This also throws away the
+    // steps that may still be queued
+    StepEngine::SetPosition(0);
+    _is_searching_for_hall_home = false;  
+
+    return 0;
   }
-  else {
-    // Set the current position to zero.
-    _stepper.setCurrentPosition(0);
-    // there is a bug in setCurrentPosition,
-    // I have to set speed to the reverse and forward
-    // so that the rotation in the CW direction can work
-    // immediately after HALL Home is found
-    _stepper.setSpeed(-STEPPER_SPEED);    
-    _stepper.setSpeed(STEPPER_SPEED);
 
-    _is_searching_for_hall_home = false;  
+  switch(_homing_state){
+    case HOMING_APPROACH:
+      if(_is_hall_found){
+	// come to rest without losing steps
+	_hall_fast_pos = _hall_pos;
+	_slew.Decelerate();
+	_homing_state = HOMING_STOP;
+      }
+      continue_slew();
+      if((_homing_state == HOMING_APPROACH) &&
+	 _slew.IsDone() && StepEngine::IsEmpty()){
+	// not found within +10 deg
+	_is_searching_for_hall_home = false;  
+	return -1;
+      }
+      break;
+
+    case HOMING_STOP:
+      continue_slew();
+      if(_slew.IsDone() && StepEngine::IsEmpty()){
+	// back off to just before the edge found by the fast approach
+	const long backoff_pos = _hall_fast_pos - HALL_BACKOFF_STEPS*_microstep;
+	begin_slew(StepEngine::GetPosition() - backoff_pos, -1, _slew_speed);
+	_homing_state = HOMING_BACKOFF;
+      }
+      break;
+
+    case HOMING_BACKOFF:
+      continue_slew();
+      if(_slew.IsDone() && StepEngine::IsEmpty()){
+	// re-arm the interrupt and creep back onto the edge
+	_is_hall_found = false;
+	_creep_end_pos = StepEngine::GetPosition() + 2*HALL_BACKOFF_STEPS*_microstep;
+	_homing_state = HOMING_CREEP;
+      }
+      break;
+
+    case HOMING_CREEP:
+      if(_is_hall_found){
+	// only the step that fired the switch can be in the engine.
+	// The edge is position 0
+	StepEngine::Clear();
+	finish_homing();
+	return 0;
+      }
+
+      if(StepEngine::IsEmpty()){
+	if(StepEngine::GetPosition() >= _creep_end_pos){
+	  // the edge found by the fast approach has gone away
+	  _is_searching_for_hall_home = false;  
+	  return -1;
+	}
+	StepEngine::PushAfter(1, static_cast<unsigned long>(1e6/(HALL_CREEP_SPEED*_microstep)));
+      }
+      break;
   }
 
-  return !_is_stop_rotating? 1:0;
+  return 1;
 }
 
 void DeRotator::StopFindingHallHome()
@@ -360,21 +923,41 @@ void DeRotator::StopFindingHallHome()
   _is_searching_for_hall_home = false;  
 }
 
+int DeRotator::GetHomingStats(double* shift, double* mean, double* sigma) const
+{
+  *shift = _homing_shift;
+  *mean = 0;
+  *sigma = 0;
+
+  if(_homing_count > 0){
+    *mean = _homing_sum/_homing_count;
+    const double var = _homing_sum2/_homing_count - (*mean)*(*mean);
+    *sigma = var > 0? sqrt(var):0;
+  }
+
+  return _homing_count;
+}
+
+double DeRotator::GetHomingOffset() const
+{
+  return _homing_offset;
+}
+
+double DeRotator::GetHomingTime() const
+{
+  return _homing_time_s;
+}
+
 int DeRotator::StartGoingToUserHome()
 {
   _is_stop_rotating = false;
-  _stepper.resetTime();  
-  _stepper.moveTo(_home_pos);
+  StepEngine::Clear();
 
-  long current_pos = _stepper.currentPosition();
+  long current_pos = StepEngine::GetPosition();
   long dpos = current_pos - _home_pos;
 
-  if(dpos > 0){
-    _stepper.setSpeed(-STEPPER_SPEED);
-  }
-  else {
-    _stepper.setSpeed(STEPPER_SPEED); 
-  }
+  _goto_dir = dpos > 0? -1:1;
+  begin_slew(labs(dpos), _goto_dir, _slew_speed);
 
   return 0;
 }
@@ -383,9 +966,9 @@ int DeRotator::ContinueFindingUserHome()
 {
 
   if(!_is_stop_rotating){  
-    _stepper.runSpeed();
+    continue_slew();
 
-    long current_pos = _stepper.currentPosition();
+    long current_pos = StepEngine::GetPosition();
   
     if(current_pos != _home_pos){
       return 1;
@@ -396,53 +979,54 @@ int DeRotator::ContinueFindingUserHome()
   }
   else {
     // STOP because user has emergency stopped the rotation
+    StepEngine::Clear();
     return 0;
   }
 }
 
 void DeRotator::SetUserHome()
 {
-  _home_pos = _stepper.currentPosition();
+  _home_pos = StepEngine::GetPosition();
 }
 
 void DeRotator::SetUserHome(const long home_pos)
 {
-  _home_pos = home_pos;
+  _home_pos = home_pos*_microstep;
 }
 
 long DeRotator::GetUserHome() const
 {
-  return _home_pos;
+  return _home_pos/_microstep;
 }
 
 void DeRotator::SetMaxCW()
 {
-  _max_cw = _stepper.currentPosition() - _home_pos;
+  _max_cw = StepEngine::GetPosition() - _home_pos;
 }
 
 void DeRotator::SetMaxCW(const long max_cw)
 {
-  _max_cw = max_cw;
+  _max_cw = max_cw*_microstep;
 }
 
 long DeRotator::GetMaxCW() const
 {
-  return _max_cw;
+  return _max_cw/_microstep;
 }
 
 void DeRotator::SetMaxCCW()
 {
-  _max_ccw = _stepper.currentPosition() - _home_pos;
+  _max_ccw = StepEngine::GetPosition() - _home_pos;
 }
 
 void DeRotator::SetMaxCCW(const long max_ccw)
 {
-  _max_ccw = max_ccw;
+  _max_ccw = max_ccw*_microstep;
 }
 
 long DeRotator::GetMaxCCW() const
 {
-  return _max_ccw;
+  return _max_ccw/_microstep;
 }
 
 void DeRotator::EnableLimits()
@@ -472,7 +1056,7 @@ bool DeRotator::GetCorrectionDirection() const
 
 double DeRotator::GetAccumulatedAngle() const
 {
-  return _accumulated_angle_rad*RAD2DEG;
+  return _accumulated_steps*_MECHANICAL_STEPSIZE_RAD*RAD2DEG;
 }
 
 void DeRotator::GetAltAz(double* alt, double* az) const
@@ -486,20 +1070,20 @@ void DeRotator::LoadLimits(const long home_pos,
 			   const float max_ccw,
 			   const bool is_enable_limits)
 {
-  _home_pos = home_pos;
+  _home_pos = home_pos*_microstep;
 
   float max_cw_rad = max_cw*DEG2RAD;
   float max_ccw_rad = max_ccw*DEG2RAD;
   
-  _max_cw = static_cast<long>(max_cw_rad/_MECHANICAL_STEPSIZE_RAD);
-  _max_ccw = static_cast<long>(max_ccw_rad/_MECHANICAL_STEPSIZE_RAD);
+  _max_cw = static_cast<long>(max_cw_rad*_STEPS_PER_RAD);
+  _max_ccw = static_cast<long>(max_ccw_rad*_STEPS_PER_RAD);
 
   _is_enable_limits = is_enable_limits;
 }
 
 double DeRotator::GetAngle() 
 {
-  long dpos = _stepper.currentPosition() - _home_pos;
+  long dpos = StepEngine::GetPosition() - _home_pos;
 
   return dpos*_MECHANICAL_STEPSIZE_RAD*RAD2DEG;
 }
@@ -507,39 +1091,37 @@ double DeRotator::GetAngle()
 int DeRotator::StartGoingToUserAngle(const double angle)
 {
   _is_stop_rotating = false;
-  _stepper.resetTime();  
+  StepEngine::Clear();
 
-  long current_pos = _stepper.currentPosition();
+  long current_pos = StepEngine::GetPosition();
   long dpos0 = current_pos - _home_pos;
 
   // the user given angle is already w.r.t. User HOME position
-  long new_pos = static_cast<long>(angle*DEG2RAD/_MECHANICAL_STEPSIZE_RAD);
+  long new_pos = static_cast<long>(angle*DEG2RAD*_STEPS_PER_RAD);
 
   // calculate which way to rotate
   long dpos = new_pos - dpos0;
-  if(dpos > 0){
-    _stepper.setSpeed(STEPPER_SPEED);
-  }
-  else {
-    _stepper.setSpeed(-STEPPER_SPEED); 
-  }
+  _goto_dir = dpos > 0? 1:-1;
 
   // and the absolute position is
   _user_abs_angle_pos = new_pos + _home_pos;
+  begin_slew(labs(dpos), _goto_dir, _slew_speed);
+
   return 0;  
 }
 
 int DeRotator::ContinueFindingUserAngle()
 {
   if(!_is_stop_rotating){
-    _stepper.runSpeed();
+    continue_slew();
 
-    long current_pos = _stepper.currentPosition();
+    long current_pos = StepEngine::GetPosition();
 
     if(_is_enable_limits){
       long dpos = current_pos - _home_pos;    
       if((dpos >= _max_cw) || (dpos <= _max_ccw)){
         Serial.println("step_motor: max reached");    
+        StepEngine::Clear();
         return -2;
       }
     }
@@ -553,6 +1135,7 @@ int DeRotator::ContinueFindingUserAngle()
   }
   else {
     // STOP because user has emergency stopped the rotation
+    StepEngine::Clear();
     return 0;
   }
 }
@@ -560,93 +1143,1070 @@ int DeRotator::ContinueFindingUserAngle()
 void DeRotator::SetOmega(const double omega)
 {
   _omega = omega;
+  set_latitude(_latitude_rad);
 }
 
 double DeRotator::GetOmega() const
 {
   return _omega;
 }
-   
 
-double DeRotator::dzeta_dt(const double latitude_rad,
-			   const double alt,
-			   const double az)
+int DeRotator::SetErrorBudget(const double budget)
 {
-  double alt_rad = alt*DEG2RAD;
-  double az_rad = az*DEG2RAD;
+  if(budget <= 0){
+    return -1;
+  }
 
-  return _omega*cos(az_rad)*cos(latitude_rad)/cos(alt_rad);
+  _error_budget_rad = budget/60.0*DEG2RAD;
+  return 0;
 }
-  
 
-double DeRotator::predictor(const double latitude_rad,
-			    const double alt,
-			    const double az,
-			    const double angle_rad)
+double DeRotator::GetErrorBudget() const
 {
-  double zeta_dot = dzeta_dt(latitude_rad, alt, az);
+  return _error_budget_rad*RAD2DEG*60.0;
+}
 
-  // zeta_dot can be NEGATIVE! But predicted time must be positive
-  return fabs(angle_rad/zeta_dot);
+long DeRotator::GetQueryCount() const
+{
+  return _query_count;
 }
 
+double DeRotator::GetQueryRate() const
+{
+  const double elapsed_s = (micros() - _query_start_us)*1e-6;
+  if(!_is_derotating || (elapsed_s <= 0)){
+    return 0;
+  }
 
+  return _query_count*60.0/elapsed_s;
+}
 
-int DeRotator::step_motor(const bool is_clockwise) 
+double DeRotator::GetFixInterval() const
 {
-  if(is_clockwise){
-    if(_is_clockwise_correction){
-      _stepper.move(1);
-      // I have to setspeed() again because move() screws up AccelStepper::_stepInterval value!
-      _stepper.setSpeed(STEPPER_SPEED);      
-    }
-    else {
-      _stepper.move(-1);
-      _stepper.setSpeed(-STEPPER_SPEED);            
-    }
+  return _fix_interval_us*1e-6;
+}
+
+int DeRotator::GetRateForecast(double* time_s, double* peak_rate) const
+{
+  *time_s = -1;
+  *peak_rate = 0;
+  if(!_is_derotating || !_is_forecast){
+    return -1;
   }
-  else {
-    if(_is_clockwise_correction){
-      _stepper.move(-1);
-      // I have to setspeed() again because move() screws up AccelStepper::_stepInterval value!
-      _stepper.setSpeed(-STEPPER_SPEED);            
-    }
-    else {
-      _stepper.move(1);
-      _stepper.setSpeed(STEPPER_SPEED);            
+
+  if(_forecast_rate_s >= 0){
+    *time_s = _forecast_rate_s - (micros() - _forecast_time_us)*1e-6;
+    if(*time_s < 0){
+      *time_s = 0;
     }
   }
-  
-  long dpos = _stepper.currentPosition() - _home_pos;
-  if(_is_enable_limits){
-    if((dpos >= _max_cw) || (dpos <= _max_ccw)){
-      Serial.println("step_motor: max reached");    
-      return -2;
+  *peak_rate = _forecast_peak_rate*RAD2DEG;
+
+  return 0;
+}
+
+int DeRotator::GetLimitForecast(double* time_s, int* dir) const
+{
+  *time_s = -1;
+  *dir = 0;
+  if(!_is_derotating || !_is_forecast){
+    return -1;
+  }
+
+  if(_forecast_limit_s >= 0){
+    *time_s = _forecast_limit_s - (micros() - _forecast_time_us)*1e-6;
+    if(*time_s < 0){
+      *time_s = 0;
     }
+    *dir = _forecast_limit_dir;
   }
-  
-  int i=0;
-  while(_stepper.runSpeed() == false){
-    /*
-	This loop should NEVER be entered!  Empiricially, this would
-	screw up the correction timing if stepper does not step when
-	required. The Continue() function checks that the stepper is
-	ready to step before calling this function.
-     */
-    _stepper.setSpeed(STEPPER_SPEED);    
-    Serial.print("i = ");
-    Serial.println(i++, DEC);
+
+  return 0;
+}
+
+int DeRotator::GetTrackability(double* time_s) const
+{
+  double rate_s, limit_s, peak_rate;
+  int dir;
+
+  if(GetRateForecast(&rate_s, &peak_rate) != 0){
+    *time_s = -1;
+    return -3;
   }
+  GetLimitForecast(&limit_s, &dir);
 
-  _last_step_time_us = micros(); // us
+  if((rate_s >= 0) && ((limit_s < 0) || (rate_s <= limit_s))){
+    *time_s = rate_s;
+    return -1;
+  }
+
+  if(limit_s >= 0){
+    *time_s = limit_s;
+    return -2;
+  }
 
+  *time_s = _forecast_span_s - (micros() - _forecast_time_us)*1e-6;
+  if(*time_s < 0){
+    *time_s = 0;
+  }
   return 0;
 }
-    
-void DeRotator::hall_interrupt_handler()
+
+double DeRotator::GetMaxRate() const
+{
+  return max_rate()*RAD2DEG;
+}
+
+Telescope* DeRotator::GetTelescope() const
+{
+  return _telescope;
+}
+
+int DeRotator::SetGearTrain(const GearTrain& gear_train)
+{
+  if(_is_derotating || !StepEngine::IsEmpty()){
+    return -1;
+  }
+
+  // the positions are in steps, so rescale them to stay at the same
+  // angles of the camera
+  const double ratio = gear_train.GetStepsPerDegree()/_gear_train.GetStepsPerDegree();
+  StepEngine::SetPosition(rescale(StepEngine::GetPosition(), ratio));
+  _home_pos = rescale(_home_pos, ratio);
+  _max_cw = rescale(_max_cw, ratio);
+  _max_ccw = rescale(_max_ccw, ratio);
+  _engine_pos = StepEngine::GetPosition();
+  _accumulated_steps = rescale(_accumulated_steps, ratio);
+  _angle_sub = static_cast<int64_t>(_angle_sub*ratio);
+  _homing_shift *= ratio;
+  _homing_sum *= ratio;
+  _homing_sum2 *= ratio*ratio;
+  _homing_offset *= ratio;
+
+  _gear_train = gear_train;
+  _FULL_STEPSIZE_RAD = gear_train.GetStepsize()*DEG2RAD;
+  _FULL_STEPS_PER_RAD = gear_train.GetStepsPerDegree()*RAD2DEG;
+  _MECHANICAL_STEPSIZE_RAD = _FULL_STEPSIZE_RAD/_microstep;
+  _STEPS_PER_RAD = _FULL_STEPS_PER_RAD*_microstep;
+
+  return 0;
+}
+
+const GearTrain& DeRotator::GetGearTrain() const
+{
+  return _gear_train;
+}
+
+int DeRotator::RestorePosition()
+{
+  PositionRecord r;
+  if(_position_store.Load(&r) != 0){
+    return -1;
+  }
+
+  // the record may have been saved at another microstep
+  const long pos = r._position*_microstep/r._microstep;
+
+  // quick check that the motor has not been turned while the power
+  // was off: just past the Hall home the switch is on
+  if((r._flags & POSITION_IS_HOMED) &&
+     (pos >= 0) && (pos <= HALL_VALIDATE_STEPS*_microstep) &&
+     (digitalRead(INTERRUPT_SIGNAL_PIN) != LOW)){
+    return -2;
+  }
+
+  StepEngine::SetPosition(pos);
+  _engine_pos = pos;
+  _home_pos = r._home_pos*_microstep/r._microstep;
+  _max_cw = r._max_cw*_microstep/r._microstep;
+  _max_ccw = r._max_ccw*_microstep/r._microstep;
+  _is_enable_limits = (r._flags & POSITION_IS_LIMITS_ENABLED) != 0;
+  _is_homed = (r._flags & POSITION_IS_HOMED) != 0;
+  _accumulated_steps = static_cast<long>(floor(r._accumulated_angle*DEG2RAD*_STEPS_PER_RAD + 0.5));
+
+  _saved_record = r;
+  _idle_pos = pos;
+  _idle_time_us = micros();
+
+  if(r._flags & POSITION_IS_DEROTATING){
+    _resume_record = r;
+    _resume_record._start_pos = r._start_pos*_microstep/r._microstep;
+    _tracking_mode = static_cast<TRACKING_MODE>(r._tracking_mode);
+    _is_resume_pending = true;
+  }
+
+  return 0;
+}
+
+int DeRotator::ServicePosition()
 {
-  noInterrupts();
-  if(_is_searching_for_hall_home)
-    _is_stop_rotating = true;
-  interrupts();
+  const unsigned long now_us = micros();
+  const long pos = StepEngine::GetPosition();
+
+  // write out the last record a byte at a time
+  if(_position_store.Service() != 0){
+    return 0;
+  }
+
+  PositionRecord r;
+  if(_is_derotating){
+    // checkpoint the session on a fixed cadence, so that the gap
+    // found by Resume() is never more than CHECKPOINT_US out and the
+    // EEPROM wear does not depend on how fast the field turns
+    if(_is_catching_up || (now_us - _checkpoint_time_us < CHECKPOINT_US)){
+      return 0;
+    }
+    _checkpoint_time_us = now_us;
+
+    checkpoint_rotation();
+    make_position_record(&r);
+
+    // nothing to save if neither the motor nor the field has turned
+    if((r._position == _saved_record._position) &&
+       (r._rotation == _saved_record._rotation)){
+      return 0;
+    }
+
+    _position_store.Save(&r);
+    _saved_record = r;
+
+    return 1;
+  }
+
+  // a session that has been stopped must not be resumed, so save
+  // that straight away
+  const bool is_stopped = (_saved_record._flags & POSITION_IS_DEROTATING) != 0;
+
+  if(_is_searching_for_hall_home ||
+     !StepEngine::IsEmpty() || (pos != _idle_pos)){
+    _idle_pos = pos;
+    _idle_time_us = now_us;
+    if(!is_stopped){
+      return 0;
+    }
+  }
+
+  if(!is_stopped && (now_us - _idle_time_us < POSITION_IDLE_US)){
+    return 0;
+  }
+
+  make_position_record(&r);
+  if((r._position == _saved_record._position) &&
+     (r._home_pos == _saved_record._home_pos) &&
+     (r._max_cw == _saved_record._max_cw) &&
+     (r._max_ccw == _saved_record._max_ccw) &&
+     (r._accumulated_angle == _saved_record._accumulated_angle) &&
+     (r._microstep == _saved_record._microstep) &&
+     (r._flags == _saved_record._flags)){
+    // nothing has changed. Spare the EEPROM
+    return 0;
+  }
+
+  _position_store.Save(&r);
+  _saved_record = r;
+
+  return 1;
+}
+
+bool DeRotator::IsHomed() const
+{
+  return _is_homed;
+}
+
+bool DeRotator::IsResumePending() const
+{
+  return _is_resume_pending;
+}
+
+int DeRotator::Resume(const double alt, const double az)
+{
+  if(!_is_resume_pending){
+    return Start(alt, az);
+  }
+
+  const PositionRecord& r = _resume_record;
+  set_latitude(_telescope->GetLatitude()*DEG2RAD);
+
+  // how long the power was off, from the clock of the LX200
+  double lst;
+  _resume_gap_s = -1;
+  if((r._lst >= 0) && (_telescope->GetSiderealTime(&lst) == 0)){
+    double dlst = lst - r._lst;
+    dlst -= 24.0*floor(dlst/24.0 + 0.5);
+    const double gap_s = dlst*3600.0/SIDEREAL_RATE;
+    if((gap_s < -RESUME_GAP_SLACK_S) || (gap_s > RESUME_MAX_GAP_S)){
+      // do not carry on a session from a gap that cannot be right
+      _is_resume_pending = false;
+      return -3;
+    }
+    _resume_gap_s = gap_s > 0? gap_s:0;
+  }
+
+  // the field rotation since Start() that the motor should have
+  // made by now against what it has made
+  double dzeta = field_angle(alt, az) - r._zeta;
+  dzeta -= 2*M_PI*floor(dzeta/(2*M_PI) + 0.5);
+  const double made_rad = (StepEngine::GetPosition() - r._start_pos)*
+    motor_direction(true)*_MECHANICAL_STEPSIZE_RAD;
+  _resume_rotation_rad = r._rotation + dzeta - made_rad;
+
+  _resume_alt = alt;
+  _resume_az = az;
+  _resume_time_us = micros();
+  _is_derotating = true;
+  _is_stop_rotating = false;
+
+  // ABSOLUTE servos to the field angle by itself
+  const long nsteps = static_cast<long>(floor(_resume_rotation_rad*_STEPS_PER_RAD + 0.5));
+  if((_tracking_mode != ABSOLUTE) && (nsteps != 0)){
+    StepEngine::Clear();
+    begin_slew(labs(nsteps), motor_direction(nsteps > 0), _slew_speed);
+    _is_catching_up = true;
+    return 1;
+  }
+
+  return finish_resume(alt, az);
+}
+
+void DeRotator::GetResumeGap(double* gap_s, double* rotation) const
+{
+  *gap_s = _resume_gap_s;
+  *rotation = _resume_rotation_rad*RAD2DEG;
+}
+   
+
+void DeRotator::set_latitude(const double latitude_rad)
+{
+  // the latitude terms are constant for the session
+  _latitude_rad = latitude_rad;
+  _sin_lat = sin(_latitude_rad);
+  _cos_lat = cos(_latitude_rad);
+  _omega_sin_lat = _omega*_sin_lat;
+  _omega_cos_lat = _omega*_cos_lat;
+}
+
+double DeRotator::dzeta_dt(const double alt,
+			   const double az) const
+{
+  double alt_rad = alt*DEG2RAD;
+  double az_rad = az*DEG2RAD;
+
+  return _omega_cos_lat*TrigTable::Cos(az_rad)*TrigTable::Sec(alt_rad);
+}
+  
+
+double DeRotator::dzeta_dt2(const double alt,
+			    const double az) const
+{
+  const double alt_rad = alt*DEG2RAD;
+  const double az_rad = az*DEG2RAD;
+  double dalt, daz;
+  rates(alt_rad, az_rad, &dalt, &daz);
+
+  // d/dt of _omega cos(lat) cos(az)/cos(alt)
+  const double sec_alt = TrigTable::Sec(alt_rad);
+  const double tan_alt = TrigTable::Sin(alt_rad)*sec_alt;
+
+  return _omega_cos_lat*sec_alt*(TrigTable::Cos(az_rad)*tan_alt*dalt -
+				 TrigTable::Sin(az_rad)*daz);
+}
+
+double DeRotator::rates(const double alt_rad,
+			const double az_rad,
+			double* dalt,
+			double* daz) const
+{
+  const double sin_az = TrigTable::Sin(az_rad);
+  const double cos_az = TrigTable::Cos(az_rad);
+  const double sec_alt = TrigTable::Sec(alt_rad);
+
+  *dalt = _omega_cos_lat*sin_az;
+  *daz = _omega_sin_lat - _omega_cos_lat*cos_az*TrigTable::Sin(alt_rad)*sec_alt;
+
+  return _omega_cos_lat*cos_az*sec_alt;
+}
+
+double DeRotator::propagate(const double dt_s, double* alt, double* az) const
+{
+  double dalt, daz;
+  const double alt_rad = *alt*DEG2RAD;
+  const double az_rad = *az*DEG2RAD;
+
+  // rates at the start and at the midpoint of the interval
+  rates(alt_rad, az_rad, &dalt, &daz);
+
+  const double alt_mid = alt_rad + 0.5*dt_s*dalt;
+  const double az_mid = az_rad + 0.5*dt_s*daz;
+  const double zeta_dot = rates(alt_mid, az_mid, &dalt, &daz);
+
+  *alt = (alt_rad + dt_s*dalt)*RAD2DEG;
+  *az = (az_rad + dt_s*daz)*RAD2DEG;
+  if(*az >= 360.0){
+    *az -= 360.0;
+  }
+  else if(*az < 0.0){
+    *az += 360.0;
+  }
+
+  return zeta_dot*dt_s;
+}
+
+double DeRotator::field_angle(const double alt, const double az) const
+{
+  const double alt_rad = alt*DEG2RAD;
+  const double az_rad = az*DEG2RAD;
+
+  return atan2(sin(az_rad)*_cos_lat,
+	       cos(alt_rad)*_sin_lat - sin(alt_rad)*_cos_lat*cos(az_rad));
+}
+
+void DeRotator::refresh_altaz(const unsigned long time_us)
+{
+  if(_telescope->IsQuerying() || ((time_us - _fix_time_us) < _fix_interval_us)){
+    return;
+  }
+
+  begin_fix(time_us);
+  poll_fix();
+}
+
+void DeRotator::begin_fix(const unsigned long time_us)
+{
+  _query_time_us = time_us;
+  // only the queries that the LX200 has to answer
+  if(_telescope->BeginQuery(millis()*1e-3) > 0){
+    _query_count++;
+  }
+}
+
+int DeRotator::poll_fix()
+{
+  if(!_telescope->IsQuerying()){
+    return -1;
+  }
+
+  const int status = _telescope->Poll();
+  if(status > 0){
+    return 1;
+  }
+
+  // Result() also ends a query that got no reply
+  double alt, az;
+  const int result = _telescope->Result(&alt, &az);
+  if((status < 0) || (result != 0)){
+    // no reply: keep propagating and try again later
+    _fix_time_us = micros();
+    return -1;
+  }
+
+  // the reply is for when the query started
+  propagate(static_cast<long>(_time_us - _query_time_us)*1e-6, &alt, &az);
+  _alt0 = alt;
+  _az0 = az;
+  _fix_time_us = _query_time_us;
+  _fix_interval_us = fix_interval();
+
+  return 0;
+}
+
+unsigned long DeRotator::fix_interval()
+{
+  // the propagation between fixes is at least as good as a straight
+  // line, which is off by zeta''*dt^2/2 after dt
+  const double zeta_ddot = fabs(dzeta_dt2(_alt0, _az0));
+  if(zeta_ddot*MAX_FIX_INTERVAL_US*1e-6*MAX_FIX_INTERVAL_US*1e-6 <= 2*_error_budget_rad){
+    return MAX_FIX_INTERVAL_US;
+  }
+
+  double dt_us = sqrt(2*_error_budget_rad/zeta_ddot)*1e6;
+  if(dt_us < TIME_STEP_US){
+    dt_us = TIME_STEP_US;
+  }
+
+  return static_cast<unsigned long>(dt_us);
+}
+
+double DeRotator::predictor(const double alt,
+			    const double az,
+			    const double angle_rad) const
+{
+  double zeta_dot = dzeta_dt(alt, az);
+
+  // zeta_dot can be NEGATIVE! But predicted time must be positive
+  return fabs(angle_rad/zeta_dot);
+}
+
+int64_t DeRotator::to_substeps(const double angle_rad) const
+{
+  const double substeps = angle_rad*_STEPS_PER_RAD*SUBSTEPS_PER_STEP;
+  return static_cast<int64_t>(substeps >= 0? substeps + 0.5:substeps - 0.5);
+}
+
+double DeRotator::to_rad(const int64_t substeps) const
+{
+  return static_cast<double>(substeps)/SUBSTEPS_PER_STEP*_MECHANICAL_STEPSIZE_RAD;
+}
+
+long DeRotator::to_rate(const double zeta_dot) const
+{
+  const double rate = zeta_dot*_STEPS_PER_RAD*SUBSTEPS_PER_STEP*1e-6;
+
+  // near the zenith the rate blows up, but then the motor cannot
+  // keep up anyway
+  if(rate >= LONG_MAX){
+    return LONG_MAX;
+  }
+  else if(rate <= -LONG_MAX){
+    return -LONG_MAX;
+  }
+
+  return static_cast<long>(rate >= 0? rate + 0.5:rate - 0.5);
+}
+
+unsigned long DeRotator::time_to(const int64_t substeps) const
+{
+  // _rate_sub_us can be NEGATIVE! But the time must be positive.
+  // When the rate goes through 0 there is a new look at least every
+  // MAX_FIX_INTERVAL_US
+  const int64_t rate = _rate_sub_us >= 0? _rate_sub_us:-static_cast<int64_t>(_rate_sub_us);
+  const int64_t n = substeps >= 0? substeps:-substeps;
+  if(n >= rate*static_cast<int64_t>(MAX_FIX_INTERVAL_US)){
+    return MAX_FIX_INTERVAL_US;
+  }
+
+  return static_cast<unsigned long>(n/rate);
+}
+
+
+
+double DeRotator::max_rate() const
+{
+  if((_tracking_mode == POLLED) && !_is_high_rate){
+    return _MECHANICAL_STEPSIZE_RAD*
+      (static_cast<double>(DT_SUBSTEPS)/SUBSTEPS_PER_STEP)*1e6/TIME_STEP_US;
+  }
+
+  return _MECHANICAL_STEPSIZE_RAD*1e6/MIN_STEPPER_TIME_US;
+}
+
+void DeRotator::service_forecast()
+{
+  if(_fc_k >= 0){
+    continue_forecast(FORECAST_SAMPLES);
+  }
+  else if(_is_derotating &&
+	  ((micros() - _forecast_time_us) >= FORECAST_INTERVAL_US)){
+    begin_forecast();
+  }
+}
+
+void DeRotator::begin_forecast()
+{
+  const double alt_rad = _alt0*DEG2RAD;
+  const double az_rad = _az0*DEG2RAD;
+  const double sin_alt = sin(alt_rad), cos_alt = cos(alt_rad);
+  const double cos_az = cos(az_rad);
+
+  _fc_sin_dec = sin_alt*_sin_lat + cos_alt*_cos_lat*cos_az;
+  _fc_cos_dec = sqrt(1 - _fc_sin_dec*_fc_sin_dec);
+  _fc_ha = atan2(-sin(az_rad)*cos_alt, sin_alt*_cos_lat - cos_alt*_sin_lat*cos_az);
+  _fc_time_us = _time_us;
+
+  _fc_zeta0 = field_angle(_alt0, _az0);
+  _fc_zeta = _fc_zeta0;
+  _fc_rate = fabs(dzeta_dt(_alt0, _az0));
+  _fc_pos0 = StepEngine::GetQueuedPosition() - _home_pos;
+  _fc_pos = _fc_pos0;
+  _fc_peak_rate = _fc_rate;
+  _fc_rate_s = _fc_rate > max_rate()? 0:-1;
+  _fc_limit_s = -1;
+  _fc_limit_dir = 0;
+  if(_is_enable_limits && ((_fc_pos >= _max_cw) || (_fc_pos <= _max_ccw))){
+    _fc_limit_s = 0;
+    _fc_limit_dir = _fc_pos >= _max_cw? 1:-1;
+  }
+  _fc_span_s = 0;
+  _fc_k = 0;
+}
+
+void DeRotator::continue_forecast(int nsamples)
+{
+  const int horizon = FORECAST_HORIZON_S/FORECAST_STEP_S;
+  const double limit_rate = max_rate();
+  bool is_done = false;
+
+  while((nsamples-- > 0) && !is_done){
+    const double t_s = static_cast<double>(_fc_k + 1)*FORECAST_STEP_S;
+    const double ha = _fc_ha + _omega*t_s;
+    const double cos_ha = cos(ha);
+    const double sin_alt = _fc_sin_dec*_sin_lat + _fc_cos_dec*_cos_lat*cos_ha;
+
+    if(sin_alt < 0){
+      // the star has set
+      is_done = true;
+      break;
+    }
+
+    const double alt = asin(sin_alt)*RAD2DEG;
+    double az = atan2(-_fc_cos_dec*sin(ha),
+		      _fc_sin_dec*_cos_lat - _fc_cos_dec*cos_ha*_sin_lat)*RAD2DEG;
+    if(az < 0.0){
+      az += 360.0;
+    }
+
+    // unwrap the field angle, which jumps by 2 pi
+    double dzeta = field_angle(alt, az) - _fc_zeta;
+    dzeta -= 2*M_PI*floor(dzeta/(2*M_PI) + 0.5);
+    _fc_zeta += dzeta;
+
+    const double rate = fabs(dzeta_dt(alt, az));
+    const double mean_rate = fabs(dzeta)/FORECAST_STEP_S;
+    if(rate > _fc_peak_rate){
+      _fc_peak_rate = rate;
+    }
+    if(mean_rate > _fc_peak_rate){
+      _fc_peak_rate = mean_rate;
+    }
+
+    if(_fc_rate_s < 0){
+      if(rate > limit_rate){
+	_fc_rate_s = t_s - FORECAST_STEP_S*(rate - limit_rate)/(rate - _fc_rate);
+      }
+      else if(mean_rate > limit_rate){
+	// a peak in between the samples
+	_fc_rate_s = t_s - FORECAST_STEP_S;
+      }
+    }
+    _fc_rate = rate;
+
+    const double pos = _fc_pos0 +
+      motor_direction(true)*(_fc_zeta - _fc_zeta0)*_STEPS_PER_RAD;
+    if(_is_enable_limits && (_fc_limit_s < 0) &&
+       ((pos >= _max_cw) || (pos <= _max_ccw))){
+      const double limit = pos >= _max_cw? _max_cw:_max_ccw;
+      _fc_limit_s = t_s - FORECAST_STEP_S*(pos - limit)/(pos - _fc_pos);
+      _fc_limit_dir = pos >= _max_cw? 1:-1;
+    }
+    _fc_pos = pos;
+
+    _fc_k++;
+    _fc_span_s = t_s;
+    is_done = _fc_k >= horizon;
+  }
+
+  if(is_done){
+    _is_forecast = true;
+    _forecast_time_us = _fc_time_us;
+    _forecast_rate_s = _fc_rate_s;
+    _forecast_peak_rate = _fc_peak_rate;
+    _forecast_limit_s = _fc_limit_s;
+    _forecast_span_s = _fc_span_s;
+    _forecast_limit_dir = _fc_limit_dir;
+    _fc_k = -1;
+  }
+}
+
+int DeRotator::step_motor(const bool is_clockwise) 
+{
+  long dpos = StepEngine::GetQueuedPosition() - _home_pos;
+  if(_is_enable_limits){
+    if((dpos >= _max_cw) || (dpos <= _max_ccw)){
+      Serial.println("step_motor: max reached");    
+      return -2;
+    }
+  }
+
+  /*
+    The engine makes the step at its next tick. Continue() never
+    steps closer than MIN_STEPPER_TIME_US, so the queue cannot be
+    full.
+  */
+  _last_step_time_us = micros(); // us
+  StepEngine::Push(_last_step_time_us, motor_direction(is_clockwise));
+
+  return 0;
+}
+
+int8_t DeRotator::motor_direction(const bool is_clockwise) const
+{
+  return (is_clockwise == _is_clockwise_correction)? 1:-1;
+}
+
+long DeRotator::sync_engine()
+{
+  // the correction steps that the engine has made since the last call
+  const long pos = StepEngine::GetPosition();
+  const long nsteps = (pos - _engine_pos)*motor_direction(true);
+  _engine_pos = pos;
+
+  _angle_sub -= nsteps*SUBSTEPS_PER_STEP;
+  _accumulated_steps += nsteps;
+
+  return nsteps;
+}
+
+void DeRotator::begin_schedule()
+{
+  // the polled path has already accounted for the steps that it
+  // has queued in the engine
+  _engine_pos = StepEngine::GetQueuedPosition();
+  _zeta_dot = dzeta_dt(_alt0, _az0);
+  _fix_time_us = _time_us;
+  _fix_interval_us = fix_interval();
+  _plan_time_us = _time_us;
+  _plan_angle_rad = to_rad(_angle_sub);
+  _plan_alt = _alt0;
+  _plan_az = _az0;
+
+  _is_high_rate_active = _tracking_mode != SCHEDULED;
+}
+
+int DeRotator::step_rate_status() const
+{
+  // can the motor make the steps as fast as the derotation needs?
+  return fabs(_MECHANICAL_STEPSIZE_RAD/_zeta_dot)*1e6 >= MIN_STEPPER_TIME_US? 0:-1;
+}
+
+int DeRotator::continue_absolute()
+{
+  unsigned long time_us = micros();
+  int status = 0;
+
+  // pick up the telescope fix if it has arrived
+  poll_fix();
+
+  // has the engine made a step?
+  const long pos = StepEngine::GetPosition();
+  if(pos != _engine_pos){
+    _engine_pos = pos;
+    _accumulated_steps = (pos - _start_pos)*motor_direction(true);
+    status = 1;
+
+    if(_is_enable_limits){
+      long dpos = pos - _home_pos;
+      if((dpos >= _max_cw) || (dpos <= _max_ccw)){
+	// user limits reached!
+	StepEngine::Clear();
+	return -2;
+      }
+    }
+  }
+
+  // only the latest target matters, so if the loop is late the
+  // updates in between are simply not made
+  if((time_us - _time_us) >= _dt_us){
+    update_target(time_us);
+  }
+
+  // servo to the target one step at a time at the stepper speed
+  const long dpos = _target_pos - StepEngine::GetQueuedPosition();
+  if((dpos != 0) && StepEngine::IsEmpty()){
+    StepEngine::PushAfter(dpos > 0? 1:-1, MIN_STEPPER_TIME_US);
+  }
+
+  return step_rate_status() == 0? status:-1;
+}
+
+void DeRotator::update_target(const unsigned long time_us)
+{
+  propagate(static_cast<long>(time_us - _time_us)*1e-6, &_alt0, &_az0);
+  _time_us = time_us;
+  refresh_altaz(time_us);
+
+  // unwrap the field angle, which jumps by 2 pi
+  double dzeta = field_angle(_alt0, _az0) - _zeta_rad;
+  dzeta -= 2*M_PI*floor(dzeta/(2*M_PI) + 0.5);
+  _zeta_rad += dzeta;
+
+  const double angle_rad = _zeta_rad - _zeta0_rad;
+  const long nsteps = static_cast<long>(floor(angle_rad*_STEPS_PER_RAD + 0.5));
+  _target_pos = _start_pos + nsteps*motor_direction(true);
+  _angle_sub = to_substeps(angle_rad - _accumulated_steps*_MECHANICAL_STEPSIZE_RAD);
+
+  _zeta_dot = dzeta_dt(_alt0, _az0);
+  _rate_sub_us = to_rate(_zeta_dot);
+  _dt_us = time_to(DT_SUBSTEPS);
+  if(_dt_us < MIN_STEPPER_TIME_US){
+    _dt_us = MIN_STEPPER_TIME_US;
+  }
+  else if(_dt_us > _fix_interval_us){
+    // the rate can go through zero and change sign
+    _dt_us = _fix_interval_us;
+  }
+}
+
+void DeRotator::write_microstep_pins()
+{
+  // DRV8825 table: 1 = 000, 2 = 100, 4 = 010, 8 = 110, 16 = 001, 32 = 101
+  uint8_t mode = 0;
+  for(int m = _microstep; m > 1; m >>= 1){
+    mode++;
+  }
+  
+  digitalWrite(STEPPER_MS0_PIN, (mode & 1)? HIGH:LOW);
+  digitalWrite(STEPPER_MS1_PIN, (mode & 2)? HIGH:LOW);
+  digitalWrite(STEPPER_MS2_PIN, (mode & 4)? HIGH:LOW);
+}
+
+int DeRotator::continue_scheduled()
+{
+  unsigned long time_us = micros();
+
+  // the hot path: has the engine made any of the planned steps?
+  if(sync_engine() != 0){
+    if(_is_enable_limits){
+      long dpos = _engine_pos - _home_pos;
+      if((dpos >= _max_cw) || (dpos <= _max_ccw)){
+	// user limits reached!
+	StepEngine::Clear();
+	return -2;
+      }
+    }
+
+    return 1;
+  }
+
+  // nothing has happened, so do the background work: pick up the
+  // telescope fix, start a new one or plan one more step
+  if(_telescope->IsQuerying()){
+    double alt, az;
+    const int status = _telescope->Poll();
+
+    if((status == 0) && (_telescope->Result(&alt, &az) == 0)){
+      return update_schedule(_query_time_us, alt, az);
+    }
+
+    if(status < 0){
+      // no reply: replan from the last fix propagated up to now and
+      // try again later
+      _telescope->Result(&alt, &az);
+      alt = _alt0;
+      az = _az0;
+      propagate(static_cast<long>(time_us - _time_us)*1e-6, &alt, &az);
+      return update_schedule(time_us, alt, az);
+    }
+  }
+  else if((time_us - _fix_time_us) >= _fix_interval_us){
+    begin_fix(time_us);
+    return 0;
+  }
+
+  if(!StepEngine::IsFull()){
+    plan_next_step();
+  }
+
+  return 0;
+}
+
+int DeRotator::update_schedule(const unsigned long time_us,
+				const double alt,
+				const double az)
+{
+  // the engine has kept making the planned steps while the telescope
+  // was being queried. Now throw away the rest of the plan and
+  // account for the steps that were made in the meantime
+  StepEngine::Clear();
+  sync_engine();
+
+  // bring the remainder up to the time of the fix by propagating
+  // from the last fix
+  double alt1 = _alt0, az1 = _az0;
+  _angle_sub += to_substeps(propagate(static_cast<long>(time_us - _time_us)*1e-6, &alt1, &az1));
+  _time_us = time_us;
+
+  _alt0 = alt;
+  _az0 = az;
+  _zeta_dot = dzeta_dt(_alt0, _az0);
+  _fix_time_us = time_us;
+
+  // the fixes do not have to be as often as the steps because alt,
+  // az are propagated in between, but they cannot be faster than the
+  // loop can query the telescope
+  _fix_interval_us = fix_interval();
+
+  // and replan from the fix. Fill up the engine so that it has
+  // steps to make during the next query
+  _plan_time_us = _time_us;
+  _plan_angle_rad = to_rad(_angle_sub);
+  _plan_alt = _alt0;
+  _plan_az = _az0;
+  while(!StepEngine::IsFull() && (plan_next_step() == 0)){
+  }
+
+  return step_rate_status();
+}
+
+int DeRotator::plan_next_step()
+{
+  // do not plan past the user limits. Once the motor gets there,
+  // continue_scheduled() returns -2
+  if(_is_enable_limits){
+    long dpos = StepEngine::GetQueuedPosition() - _home_pos;
+    if((dpos >= _max_cw) || (dpos <= _max_ccw)){
+      return -1;
+    }
+  }
+
+  // only plan as far ahead as the next fix and its reply
+  if(static_cast<long>(_plan_time_us - (_fix_time_us + 2*_fix_interval_us)) > 0){
+    return -1;
+  }
+
+  // time for the remainder to reach one mechanical step with the
+  // rate at the last planned step ...
+  double alt = _plan_alt, az = _plan_az;
+  const double zeta_dot = dzeta_dt(alt, az);
+  if(zeta_dot == 0.0){
+    return -1;
+  }
+  
+  const double target_rad = zeta_dot > 0? _MECHANICAL_STEPSIZE_RAD:-_MECHANICAL_STEPSIZE_RAD;
+  double dt_s = (target_rad - _plan_angle_rad)/zeta_dot;
+  if(dt_s < 0){
+    dt_s = 0; // already overdue
+  }
+  double dangle_rad = propagate(dt_s, &alt, &az);
+
+  // ... and corrected once with the rate at the end of the step
+  const double zeta_dot1 = dzeta_dt(alt, az);
+  if(zeta_dot1*zeta_dot > 0){
+    dt_s += (target_rad - _plan_angle_rad - dangle_rad)/zeta_dot1;
+    if(dt_s < 0){
+      dt_s = 0;
+    }
+    alt = _plan_alt;
+    az = _plan_az;
+    dangle_rad = propagate(dt_s, &alt, &az);
+  }
+
+  const unsigned long dt = static_cast<unsigned long>(dt_s*1e6);
+  _plan_time_us += dt;
+  _plan_angle_rad += dangle_rad - target_rad;
+  _plan_alt = alt;
+  _plan_az = az;
+
+  return StepEngine::Push(_plan_time_us, motor_direction(zeta_dot > 0));
+}
+
+int DeRotator::finish_resume(const double alt, const double az)
+{
+  const PositionRecord r = _resume_record;
+  const int status = Start(alt, az);
+
+  // carry on the session of the checkpoint: its start position, the
+  // rotation since then and what is left of it to correct
+  double dzeta = _zeta_rad - r._zeta;
+  dzeta -= 2*M_PI*floor(dzeta/(2*M_PI) + 0.5);
+  const double rotation_rad = r._rotation + dzeta;
+
+  _start_pos = r._start_pos;
+  _zeta0_rad = _zeta_rad - rotation_rad;
+  _accumulated_steps = (StepEngine::GetPosition() - _start_pos)*motor_direction(true);
+  _angle_sub = to_substeps(rotation_rad - _accumulated_steps*_MECHANICAL_STEPSIZE_RAD);
+  _plan_angle_rad = to_rad(_angle_sub);
+
+  if(_resume_gap_s >= 0){
+    _start_time_us -= static_cast<unsigned long>((r._elapsed + _resume_gap_s)*1e6);
+  }
+
+  return status;
+}
+
+void DeRotator::checkpoint_rotation()
+{
+  if(_tracking_mode == ABSOLUTE){
+    // already kept up to date by update_target()
+    return;
+  }
+
+  // unwrap the field angle at the last update of alt, az
+  double dzeta = field_angle(_alt0, _az0) - _zeta_rad;
+  dzeta -= 2*M_PI*floor(dzeta/(2*M_PI) + 0.5);
+  _zeta_rad += dzeta;
+}
+
+void DeRotator::make_position_record(PositionRecord* r) const
+{
+  memset(r, 0, sizeof(*r));
+  r->_position = StepEngine::GetPosition();
+  r->_home_pos = _home_pos;
+  r->_max_cw = _max_cw;
+  r->_max_ccw = _max_ccw;
+  r->_accumulated_angle = _accumulated_steps*_MECHANICAL_STEPSIZE_RAD*RAD2DEG;
+  r->_microstep = _microstep;
+  r->_flags = (_is_homed? POSITION_IS_HOMED:0) |
+    (_is_enable_limits? POSITION_IS_LIMITS_ENABLED:0);
+
+  if(_is_derotating){
+    // the rotation is that at the last update of alt, az
+    const double elapsed_s = (_time_us - _start_time_us)*1e-6;
+    r->_flags |= POSITION_IS_DEROTATING;
+    r->_tracking_mode = _tracking_mode;
+    r->_start_pos = _start_pos;
+    r->_rotation = _zeta_rad - _zeta0_rad;
+    r->_zeta = _zeta_rad - 2*M_PI*floor(_zeta_rad/(2*M_PI) + 0.5);
+    r->_lst = _lst0 >= 0? _lst0 + elapsed_s*SIDEREAL_RATE/3600.0:-1;
+    r->_elapsed = elapsed_s;
+  }
+}
+
+long DeRotator::rescale(const long steps, const double ratio)
+{
+  const double x = steps*ratio;
+  return static_cast<long>(x >= 0? x + 0.5:x - 0.5);
+}
+
+void DeRotator::finish_homing()
+{
+  // positions in full steps so that they survive SetMicrostep()
+  const double edge = static_cast<double>(_hall_pos)/_microstep;
+
+  _homing_offset = static_cast<double>(_hall_fast_pos - _hall_pos)/_microstep;
+  _homing_time_s = (_hall_time_us - _hall_start_time_us)*1e-6;
+
+  // where the edge is in the frame of the last homing. It is 0 if
+  // homing is repeatable and no steps have been lost since
+  if(_is_homed){
+    _homing_shift = edge;
+    _homing_count++;
+    _homing_sum += edge;
+    _homing_sum2 += edge*edge;
+  }
+  _is_homed = true;
+
+  StepEngine::SetPosition(StepEngine::GetPosition() - _hall_pos);
+  _is_searching_for_hall_home = false;  
+}
+
+void DeRotator::begin_slew(const long nsteps,
+			   const int8_t dir,
+			   const double max_speed)
+{
+  // at most one step per tick of the StepEngine
+  double speed = max_speed*_microstep;
+  if(speed*StepEngine::GetTickTime() > 1e6){
+    speed = 1e6/StepEngine::GetTickTime();
+  }
+
+  _goto_dir = dir;
+  _slew.Begin(nsteps, speed, _slew_acceleration*_microstep);
+}
+
+void DeRotator::continue_slew()
+{
+  // keep the engine full so that a slow loop() does not slow the
+  // motor down
+  while(!_slew.IsDone() && !StepEngine::IsFull()){
+    StepEngine::PushAfter(_goto_dir, _slew.NextInterval());
+  }
+}
+
+void DeRotator::hall_interrupt_handler()
+{
+  // interrupts are off in here and must stay off
+  if(_is_searching_for_hall_home && !_is_hall_found){
+    _hall_pos = StepEngine::GetPositionFromISR();
+    _hall_time_us = micros();
+    _is_hall_found = true;
+  }
 }
@@ -24,8 +24,13 @@
 #ifndef DEROTATOR_HPP
 #define DEROTATOR_HPP
 
-#include "AccelStepper.h"
+#include <stdint.h>
+
 #include "Telescope.h"
+#include "StepEngine.h"
+#include "SlewProfile.h"
+#include "PositionStore.h"
+#include "GearTrain.h"
 
 /**********************************************************************
 NAME
@@ -48,8 +53,8 @@ CONSTRUCTOR
 
         DeRotator(		- constructor
 	  telescope		- pointer to the user constructed Telescope object
-	  mechanical_stepsize	- the mechanical step size of the
-				  system in degrees/step
+	  gear_train		- the gears that give the mechanical
+				  step size of the system
 	  is_debug		- enable debugging if true. Default: true
 	)	
 
@@ -80,6 +85,93 @@ INTERFACE
 				  returns -2 if the user set max ccw
 				  or cw have been reached
 
+	SetTrackingMode(	- choose how Continue() applies the derotation
+	  mode			- POLLED: the default. Each call of
+				  Continue() after the predicted time
+				  integrates the angle, queries the
+				  telescope and steps at most once.
+				  SCHEDULED: the times of the next
+				  steps are planned into the StepEngine
+				  from the rate at the last telescope
+				  fix. Continue() only compares
+				  micros() with the head of the queue
+				  and plans one more step or queries
+				  the telescope when there is nothing
+				  to do. Continue() returns -1 only
+				  when the steps are closer than the
+				  stepper motor can turn.
+				  ABSOLUTE: the field angle is
+				  calculated from the parallactic
+				  angle at alt, az minus its value at
+				  Start() and the stepper motor is
+				  servoed to the nearest step. The
+				  error does not build up over the
+				  session and updates that the loop
+				  is too late for are skipped.
+				  Continue() returns -1 only when the
+				  steps are closer than the stepper
+				  motor can turn.
+	)			  Must be called before Start().
+
+	GetTrackingMode()	- returns the tracking mode
+
+	EnableHighRate()	- the default. When the POLLED mode
+				  cannot keep up, e.g. near the zenith
+				  where the rate goes as 1/cos(alt),
+				  hand over to the SCHEDULED mode
+				  instead of returning -1. -1 is then
+				  only returned when the steps are
+				  closer than the stepper speed allows.
+
+	DisableHighRate()	- Continue() returns -1 when the POLLED
+				  mode cannot keep up.
+
+	IsEnableHighRate()	- returns whether the high rate
+				  tracking is enabled.
+
+	SetMicrostep(		- set the microstep factor of the driver
+	  microstep		- 1, 2, 4, 8, 16 or 32
+	)			- returns 0 on success.
+				  returns -1 if microstep is not valid.
+				  returns -2 if the stepper speed is too
+				  fast for this microstep.
+				  returns -3 if it is derotating or the
+				  motor is turning.
+				  The user positions and limits are
+				  always in full steps.
+
+	GetMicrostep()		- returns the microstep factor
+
+	SetStepperSpeed(	- set the fastest stepper speed
+	  speed			- in full steps/s. Default: 100
+	)			- returns 0 on success.
+				  returns -1 if the StepEngine cannot
+				  step this fast.
+
+	GetStepperSpeed()	- returns the stepper speed in full
+				  steps/s
+
+	SetSlew(		- set the trapezoidal profile of the
+				  moves to the Hall home, the user home
+				  and the user angle
+	  speed			- max speed in full steps/s. Default: 400
+	  acceleration		- in full steps/s^2. Default: 800
+	)			- returns 0 on success.
+				  returns -1 if either is <= 0.
+				  The speed is capped at what the
+				  StepEngine can step.
+
+	GetSlewSpeed()		- returns the max slew speed in full
+				  steps/s
+
+	GetSlewAcceleration()	- returns the slew acceleration in
+				  full steps/s^2
+
+	GetMoveTime()		- returns the time in s until the
+				  move to the Hall home, the user home
+				  or the user angle ends. For the Hall
+				  home this is the longest fast approach.
+
 	Stop()			- stop de-rotation. Also resets the
 				  accumulated angle. Returns 0 on
 				  success.
@@ -87,12 +179,23 @@ INTERFACE
 	IsStop()		- returns whether the derotator
 				  has stopped rotating
 
-	Turn(			- turn the stepper motor
+	Turn(			- turn the stepper motor by one step at
+				  STEPPER_SPEED. Call it for as long as
+				  the motor has to turn.
 	  dir			- in the given direction: CW or CCW.
-	)			- returns
+	)			- returns 0 on success.
+				  returns -1 if max cw has been reached
+				  returns -2 if max ccw has been reached
 
 	StartGoingToHallHome()	- start going to the home position defined
-				  by the Hall switch
+				  by the Hall switch. The switch is
+				  first found with a fast approach
+				  at the slew profile. The motor then
+				  stops, backs off and finds the edge
+				  again at HALL_CREEP_SPEED. The position
+				  and time where the switch fires are
+				  recorded by hall_interrupt_handler()
+				  and the slow edge becomes 0.
 
 	ContinueFindingHallHome() - continue looking for the Hall home
 				    position, i.e. Hall interrupt is asserted.
@@ -101,6 +204,25 @@ INTERFACE
 				    obstacle.
 				    Returns 0 if rotation is stopped
 					    1 if rotation is continuing
+					   -1 if the switch is not found
+
+	GetHomingStats(		- the repeatability of the Hall home
+	  shift			- where the last edge was in full steps
+				  in the frame of the homing before it.
+				  It is 0 if no steps have been lost
+	  mean			- mean of the shifts
+	  sigma			- and their standard deviation
+	)			- returns the number of shifts. The
+				  first homing after power up has none.
+
+	GetHomingOffset()	- returns how many full steps later the
+				  fast approach found the edge than the
+				  slow one, i.e. the error of a single
+				  fast approach
+
+	GetHomingTime()		- returns the time in s from
+				  StartGoingToHallHome() to the slow
+				  edge from the interrupt timestamps
 
 	StopFindingHallHome()	- found the Hall home position and stop the
 				  rotation.
@@ -186,6 +308,141 @@ INTERFACE
 				  rad/s. This value contains the
 				  user's tweak.
 
+	SetErrorBudget(		- how far the field angle may be off
+				  before the telescope is queried
+				  again. The time between queries is
+				  found from the angular acceleration
+				  of the field, so they are far apart
+				  away from the meridian and close
+				  together near the zenith.
+	  budget		- in arcmin. Default: ERROR_BUDGET
+	)			- returns 0 on success.
+				  returns -1 if budget is <= 0
+
+	GetErrorBudget()	- returns the error budget in arcmin
+
+	GetQueryCount()		- returns the telescope queries since
+				  Start() that were sent to the LX200,
+				  i.e. not those that the FUSED or
+				  EPHEMERIS model answered
+
+	GetQueryRate()		- returns those telescope queries per
+				  minute since Start(). 0 if not
+				  derotating.
+
+	GetFixInterval()	- returns the current time between
+				  telescope queries in s
+
+	GetRateForecast(	- when the field will turn faster than
+				  the tracking mode can step, forecast
+				  from the star's hour angle over the
+				  next FORECAST_HORIZON_S or until it
+				  sets. It is begun at Start() and again
+				  every FORECAST_INTERVAL_US, and made
+				  by Continue() a few samples at a time.
+	  time_s		- s from now. -1 if it will not
+	  peak_rate		- the fastest |rate| in deg/s over the
+				  forecast
+	)			- returns 0 on success.
+				  returns -1 if not derotating, or the
+				  first forecast is not done yet.
+
+	GetLimitForecast(	- when the derotator will reach the
+				  max cw or max ccw limit
+	  time_s		- s from now. -1 if it will not, or the
+				  limits are disabled
+	  dir			- +1 for max cw, -1 for max ccw, else 0
+	)			- returns 0 on success.
+				  returns -1 if not derotating, or the
+				  first forecast is not done yet.
+
+	GetTrackability(	- which of the above comes first
+	  time_s		- s from now when Continue() will fail,
+				  else how far the forecast goes
+	)			- returns 0 if the target can be
+				  tracked to the end of the forecast.
+				  returns -1 if the rate comes first,
+				  -2 if a limit comes first, i.e. what
+				  Continue() will return.
+				  returns -3 if not derotating, or the
+				  first forecast is not done yet.
+
+	GetMaxRate()		- returns the fastest field rotation in
+				  deg/s that the tracking mode can
+				  step
+
+	GetTelescope()		- returns the telescope that the
+				  derotator queries
+
+	SetGearTrain(		- change the mechanism to
+	  gear_train		- these gears
+	)			- returns 0 on success.
+				  returns -1 while derotating or
+				  while the motor is turning.
+				  The position, the user home and the
+				  limits are rescaled to the new steps,
+				  so that they stay at the same angles.
+
+	GetGearTrain()		- returns the gear train, which converts
+				  between degrees and full steps
+
+	RestorePosition()	- restore the stepper position, the user
+				  home, the limits and the accumulated
+				  angle saved by ServicePosition(). Call
+				  it in setup() after the settings have
+				  been loaded. If the position is within
+				  HALL_VALIDATE_STEPS of the Hall home,
+				  the Hall switch must be on.
+				  Returns 0 on success.
+				  Returns -1 if nothing has been saved.
+				  Returns -2 if the Hall switch does not
+				  agree. Nothing is restored.
+
+	ServicePosition()	- save the position and the session
+				  state when the motor has been idle for
+				  POSITION_IDLE_US and it has changed
+				  since the last save. While derotating
+				  the session is checkpointed every
+				  CHECKPOINT_US if the motor or the
+				  field has turned. Nothing is saved while
+				  homing. Call it from loop(). Returns 1
+				  if a save has been started, otherwise 0.
+
+	IsResumePending()	- returns true if RestorePosition()
+				  found a session that was derotating
+				  when the power went away
+
+	Resume(			- resume that session instead of
+				  Start(). The field rotation that was
+				  missed since the checkpoint is made
+				  up with the slew profile, then
+				  derotation carries on as if the
+				  session had never stopped. The steps
+				  that the motor took after the
+				  checkpoint are not known, so it is
+				  out by what it moved in the last
+				  CHECKPOINT_US before the power went.
+	  alt			- the current alt
+	  az			- and az of the telescope in degrees
+	)			- returns what Start() returns.
+				  returns -3 if the sidereal time
+				  gives a gap since the checkpoint
+				  that is < 0 or > RESUME_MAX_GAP_S.
+				  The session is then dropped and
+				  the caller has to Start() afresh.
+
+	GetResumeGap(		- how long the session was lost for
+	  gap_s			- s from the checkpoint to Resume().
+				  -1 if the LX200 does not give the
+				  sidereal time.
+	  rotation		- deg of field rotation that had to be
+				  made up at Resume()
+	)
+
+	IsHomed()		- returns true if position 0 is the
+				  Hall home, i.e. it has been found
+				  since the EEPROM was last cleared
+
 	LoadLimits(		- load the limits of
 	  home_pos			- home. Default = 0 
 	  max_cw		- max_cw. Default = +90 deg
@@ -210,7 +467,7 @@ class DeRotator
 {
 public:
   DeRotator(Telescope* const telescope,
-	    const double mechanical_stepsize,
+	    const GearTrain& gear_train,
 	    const bool is_debug = true);
   
   ~DeRotator();
@@ -223,6 +480,8 @@ public:
     -stepper motor speed is anti-clockwise.
    */
   enum DIRECTION {CW, CCW};
+
+  enum TRACKING_MODE {POLLED, SCHEDULED, ABSOLUTE};
   
 public:
   int Start(const double alt, const double az);
@@ -230,11 +489,31 @@ public:
   int Stop();
   int IsStop() const;
 
+  void SetTrackingMode(const TRACKING_MODE mode);
+  TRACKING_MODE GetTrackingMode() const;
+
+  void EnableHighRate();
+  void DisableHighRate();
+  bool IsEnableHighRate() const;
+
+  int SetMicrostep(const int microstep);
+  int GetMicrostep() const;
+  int SetStepperSpeed(const double speed);
+  double GetStepperSpeed() const;
+
+  int SetSlew(const double speed, const double acceleration);
+  double GetSlewSpeed() const;
+  double GetSlewAcceleration() const;
+  double GetMoveTime() const;
+
   int Turn(const DIRECTION dir);
 
   int StartGoingToHallHome();
   int ContinueFindingHallHome();
   void StopFindingHallHome();
+  int GetHomingStats(double* shift, double* mean, double* sigma) const;
+  double GetHomingOffset() const;
+  double GetHomingTime() const;
   
   int StartGoingToUserHome();  
   int ContinueFindingUserHome();
@@ -268,6 +547,30 @@ public:
 
   void SetOmega(const double f);
   double GetOmega() const;
+
+  int SetErrorBudget(const double budget);
+  double GetErrorBudget() const;
+  long GetQueryCount() const;
+  double GetQueryRate() const;
+  double GetFixInterval() const;
+
+  int GetRateForecast(double* time_s, double* peak_rate) const;
+  int GetLimitForecast(double* time_s, int* dir) const;
+  int GetTrackability(double* time_s) const;
+  double GetMaxRate() const;
+
+  Telescope* GetTelescope() const;
+
+  int SetGearTrain(const GearTrain& gear_train);
+  const GearTrain& GetGearTrain() const;
+
+  int RestorePosition();
+  int ServicePosition();
+  bool IsHomed() const;
+
+  bool IsResumePending() const;
+  int Resume(const double alt, const double az);
+  void GetResumeGap(double* gap_s, double* rotation) const;
   
 public:
   void LoadLimits(const long home_pos = 0,
@@ -276,49 +579,190 @@ public:
 		  const bool is_enable_limits = false);
 
 private:
-  double dzeta_dt(const double latitude,
-		  const double alt,
-		  const double az);
+  void set_latitude(const double latitude_rad);
+
+  double dzeta_dt(const double alt,
+		  const double az) const;
+  double dzeta_dt2(const double alt,
+		   const double az) const;
 
-  double predictor(const double latitude,
-		   const double alt,
+  double predictor(const double alt,
 		   const double az,
-		   const double angle_rad);
+		   const double angle_rad) const;
+
+  int64_t to_substeps(const double angle_rad) const;
+  double to_rad(const int64_t substeps) const;
+  long to_rate(const double zeta_dot) const;
+  unsigned long time_to(const int64_t substeps) const;
+
+  double rates(const double alt_rad,
+	       const double az_rad,
+	       double* dalt,
+	       double* daz) const;
+
+  double propagate(const double dt_s, double* alt, double* az) const;
+
+  double field_angle(const double alt, const double az) const;
+
+  void refresh_altaz(const unsigned long time_us);
+  int poll_fix();
+  void begin_fix(const unsigned long time_us);
+  unsigned long fix_interval();
+
+  double max_rate() const;
+  void service_forecast();
+  void begin_forecast();
+  void continue_forecast(int nsamples);
 
   int step_motor(const bool is_clockwise = true);
 
+  int8_t motor_direction(const bool is_clockwise) const;
+  long sync_engine();
+
+  int continue_scheduled();
+  int update_schedule(const unsigned long time_us,
+		      const double alt,
+		      const double az);
+  int plan_next_step();
+  void begin_schedule();
+  int step_rate_status() const;
+
+  int continue_absolute();
+  void update_target(const unsigned long time_us);
+
+  void write_microstep_pins();
+
+  void finish_homing();
+  static long rescale(const long steps, const double ratio);
+
+  void make_position_record(PositionRecord* r) const;
+  void checkpoint_rotation();
+  int finish_resume(const double alt, const double az);
+
+  void begin_slew(const long nsteps, const int8_t dir, const double max_speed);
+  void continue_slew();
+
 private:
-  AccelStepper _stepper;  
   Telescope* _telescope;
 
 private:
   double _alt0, _az0;  
-  double _angle_rad;
-  double _accumulated_angle_rad;
+  int64_t _angle_sub;		  // remainder to correct in sub-steps
+  long _accumulated_steps;	  // correction steps since Start()
+  long _rate_sub_us;		  // sub-steps/us at the last update
   unsigned long _time_us;
-  double _dt_us;
+  unsigned long _dt_us;
 
   unsigned long _last_step_time_us;
 
   bool _is_clockwise_correction;
 
+private:
+  TRACKING_MODE _tracking_mode;
+  long _engine_pos;		  // StepEngine position at the last sync_engine()
+  bool _is_high_rate;
+  bool _is_high_rate_active;	  // POLLED has handed over to the schedule
+  double _zeta_dot;		  // rad/s at the last telescope fix
+  unsigned long _fix_time_us;	  // time of the last telescope fix
+  unsigned long _fix_interval_us; // time to the next telescope fix
+  unsigned long _query_time_us;	  // time the telescope query was started
+  double _error_budget_rad;	  // of the field angle between fixes
+  long _query_count;		  // telescope queries since Start()
+  unsigned long _query_start_us;  // time of Start()
+  unsigned long _plan_time_us;	  // time of the last planned step
+  double _plan_angle_rad;	  // remainder at _plan_time_us
+  double _plan_alt, _plan_az;	  // propagated alt, az at _plan_time_us
+
+  double _zeta_rad;		  // unwrapped field angle at _time_us
+  double _zeta0_rad;		  // and at Start()
+  long _start_pos;		  // StepEngine position at Start()
+  long _target_pos;		  // StepEngine position of the field angle
+
+  int _fc_k;			  // samples of the forecast made. < 0 if none
+  unsigned long _fc_time_us;	  // forecast from _alt0, _az0 at this time
+  double _fc_ha;		  // rad. Hour angle of the star then
+  double _fc_sin_dec, _fc_cos_dec;
+  double _fc_zeta, _fc_zeta0;	  // unwrapped field angle, now and then
+  double _fc_rate, _fc_pos;	  // rad/s and steps from home at the last sample
+  double _fc_pos0;		  // steps from home at _fc_time_us
+  double _fc_rate_s, _fc_peak_rate, _fc_limit_s, _fc_span_s;
+  int8_t _fc_limit_dir;
+
+  bool _is_forecast;		  // the last complete forecast:
+  unsigned long _forecast_time_us;
+  double _forecast_rate_s;	  // s after _forecast_time_us. < 0 if never
+  double _forecast_peak_rate;	  // rad/s
+  double _forecast_limit_s;	  // s after _forecast_time_us. < 0 if never
+  double _forecast_span_s;	  // how far it looked ahead
+  int8_t _forecast_limit_dir;
+
 private:
   double _latitude_rad;
+  double _sin_lat, _cos_lat;
   double _omega;
-  const double _MECHANICAL_STEPSIZE_RAD; // in rad/step
+  double _omega_sin_lat, _omega_cos_lat; // _omega times the above
+  GearTrain _gear_train;
+  double _FULL_STEPSIZE_RAD;	   // in rad/full step
+  double _FULL_STEPS_PER_RAD;	   // and its reciprocal
+  double _MECHANICAL_STEPSIZE_RAD; // in rad/step at the microstep factor
+  double _STEPS_PER_RAD;	   // and its reciprocal
+
+  int _microstep;
+  double _stepper_speed;	   // full steps/s
+  unsigned long _min_step_time_us;
   const bool _is_debug;
 
 private:
   long _home_pos;
   long _max_cw, _max_ccw;
   bool _is_enable_limits;
+  int8_t _goto_dir;		  // StepEngine direction to the user home or angle
+
+  PositionStore _position_store;
+  PositionRecord _saved_record;	  // the last one saved or restored
+  bool _is_derotating;		  // between Start() and Stop()
+  long _idle_pos;		  // StepEngine position since
+  unsigned long _idle_time_us;	  // this time
+
+  unsigned long _start_time_us;	  // of the session
+  double _lst0;			  // hours at _start_time_us. < 0 if unknown
+  unsigned long _checkpoint_time_us;
+
+  bool _is_resume_pending;
+  bool _is_catching_up;		  // slewing to make up the lost rotation
+  PositionRecord _resume_record;
+  double _resume_alt, _resume_az; // at Resume()
+  unsigned long _resume_time_us;
+  double _resume_gap_s;
+  double _resume_rotation_rad;
+
+  SlewProfile _slew;
+  double _slew_speed;		  // full steps/s
+  double _slew_acceleration;	  // full steps/s^2
 
 public:
   static void hall_interrupt_handler();
   static volatile bool _is_stop_rotating;
   static volatile bool _is_searching_for_hall_home;  
+  static volatile bool _is_hall_found;
+  static volatile long _hall_pos;  // StepEngine position at the Hall edge
+  static volatile unsigned long _hall_time_us; // and when it fired
   long _start_hall_search_pos;
 
+private:
+  enum HOMING_STATE {HOMING_APPROACH, HOMING_STOP, HOMING_BACKOFF, HOMING_CREEP};
+
+  HOMING_STATE _homing_state;
+  long _hall_fast_pos;		  // edge found by the fast approach
+  long _creep_end_pos;		  // give up the slow approach here
+  unsigned long _hall_start_time_us;
+  bool _is_homed;		  // the position is that of a Hall home
+  int _homing_count;		  // homings since the first one
+  double _homing_sum, _homing_sum2; // of the shifts in full steps
+  double _homing_shift;		  // full steps. The last one
+  double _homing_offset;	  // full steps. Fast minus slow edge
+  double _homing_time_s;	  // start to the slow edge
+
   
 };
 #endif
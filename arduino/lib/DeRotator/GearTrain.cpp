@@ -0,0 +1,128 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <math.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "GearTrain.h"
+
+/**********************************************************************
+  Define the number of teeth on each gear in the de-rotator mechanism
+ **********************************************************************/
+
+#define Td 		17.0   // number of teeth of gear on the stepper
+#define T1C		41.0   // number of teeth connected to Td
+#define T2C		16.0   // number of teeth on top T1C
+#define Tf		200.0  // number of teeth connected to T1C
+
+/*
+   number of stepper motor steps to turn 360 deg
+*/
+#define STEPPER_360	200.0
+
+/**********************************************************************
+NAME
+        GearTrain - the gears between the stepper motor and the
+		    camera, and the mechanical step size that they give.
+
+SYNOPSIS
+	See GearTrain.h
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+GearTrain::GearTrain()
+{
+  _ratio = 0;
+  _steps_per_turn = 0;
+  Set(T1C/Td*Tf/T2C, STEPPER_360);
+}
+
+GearTrain::GearTrain(const double td,
+		     const double t1c,
+		     const double t2c,
+		     const double tf,
+		     const double steps_per_turn)
+{
+  _ratio = 0;
+  _steps_per_turn = 0;
+  if((td <= 0) || (t2c <= 0) || (Set(t1c/td*tf/t2c, steps_per_turn) != 0)){
+    Set(T1C/Td*Tf/T2C, STEPPER_360);
+  }
+}
+
+int GearTrain::Set(const double ratio, const double steps_per_turn)
+{
+  // written so that NaN, e.g. from erased EEPROM, is not > 0 either
+  if(!(ratio > 0) || !(steps_per_turn > 0) ||
+     isinf(ratio) || isinf(steps_per_turn)){
+    return -1;
+  }
+
+  _ratio = ratio;
+  _steps_per_turn = steps_per_turn;
+  _steps_per_degree = ratio*steps_per_turn/360.0;
+  _stepsize = 1.0/_steps_per_degree;
+
+  return 0;
+}
+
+double GearTrain::GetRatio() const
+{
+  return _ratio;
+}
+
+double GearTrain::GetStepsPerTurn() const
+{
+  return _steps_per_turn;
+}
+
+double GearTrain::GetStepsize() const
+{
+  return _stepsize;
+}
+
+double GearTrain::GetStepsPerDegree() const
+{
+  return _steps_per_degree;
+}
+
+long GearTrain::ToSteps(const double degrees) const
+{
+  return static_cast<long>(degrees*_steps_per_degree);
+}
+
+double GearTrain::ToDegrees(const long steps) const
+{
+  return steps*_stepsize;
+}
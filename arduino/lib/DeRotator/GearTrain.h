@@ -0,0 +1,149 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef GEARTRAIN_HPP
+#define GEARTRAIN_HPP
+
+/**********************************************************************
+NAME
+
+        GearTrain - the gears between the stepper motor and the
+		    camera, and the mechanical step size that they give.
+
+SYNOPSIS
+	GearTrain is the one place where the mechanical step size is
+	kept. It is found from the gear ratio and the number of full
+	steps that the stepper motor takes to make one turn, and its
+	reciprocal is kept too, so that converting between degrees and
+	steps is always a multiplication.
+
+	The default is the gears of the derotator:
+		# of teeth on stepper motor = 17 = Td
+		# of teeth on gear that connects to Td, T1C  = 41
+		# of teeth on gear that sits on top of T1C, T2C = 16
+		# of teeth on gear that connects to T2C, Tf  = 200
+
+	The final gear ratio is:
+		T1C/Td * Tf/T2C = (41/17)*(200/16) = 30.14705882
+
+	i.e. 1 360 degree turn of the final gear (Tf) requires
+	30.14705882 turns of the drive gear (Td).
+	=> 1 turn of Td gives 360.0/30.1405882 = 11.94146341 degrees
+	of Tf
+
+	The stepper motor takes 200 steps to make 1 turn (because it
+	is 1.8 deg/step and thus 360/1.8 = 200), this means 1 step of
+	the stepper motor gives: 11.94146341/200.0 = 0.0597 deg/step
+
+	For accuracy: the default mechanical stepsize is
+		mechanical_stepsize = 360.0/(T1C/Td*Tf/T2C)/(200.0) =
+		0.05970731707 deg/step
+
+	Another mechanism is set with Set() and saved with the UserIO
+	settings, so the sketch does not have to be built again.
+
+CONSTRUCTOR
+
+        GearTrain()		- the gears of the derotator above
+
+        GearTrain(		- a train of two pairs of gears
+	  td			- teeth on the stepper motor gear
+	  t1c			- teeth on the gear that Td turns
+	  t2c			- teeth on the gear on top of T1C
+	  tf			- teeth on the final gear that T2C turns
+	  steps_per_turn	- full steps of the stepper motor in
+				  one turn
+	)
+
+INTERFACE
+	Set(			- set the gear train from
+	  ratio			- the turns of the stepper motor in one
+				  turn of the final gear
+	  steps_per_turn	- full steps of the stepper motor in
+				  one turn
+	)			- returns 0 on success.
+				  returns -1 if either is not > 0 or is
+				  not finite. The gear train is not
+				  changed.
+
+	GetRatio()		- returns the gear ratio
+
+	GetStepsPerTurn()	- returns the full steps in one turn of
+				  the stepper motor
+
+	GetStepsize()		- returns the mechanical step size in
+				  deg/full step
+
+	GetStepsPerDegree()	- returns its reciprocal in full
+				  steps/deg
+
+	ToSteps(		- convert
+	  degrees		- this angle
+	)			- returns it in full steps, truncated
+				  towards 0
+
+	ToDegrees(		- convert
+	  steps			- this many full steps
+	)			- returns it in degrees
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	DeRotator.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+class GearTrain
+{
+public:
+  GearTrain();
+  GearTrain(const double td,
+	    const double t1c,
+	    const double t2c,
+	    const double tf,
+	    const double steps_per_turn);
+
+public:
+  int Set(const double ratio, const double steps_per_turn);
+
+  double GetRatio() const;
+  double GetStepsPerTurn() const;
+  double GetStepsize() const;
+  double GetStepsPerDegree() const;
+
+  long ToSteps(const double degrees) const;
+  double ToDegrees(const long steps) const;
+
+private:
+  double _ratio;		// stepper motor turns per final gear turn
+  double _steps_per_turn;	// full steps per stepper motor turn
+  double _stepsize;		// deg/full step
+  double _steps_per_degree;	// full steps/deg
+};
+#endif
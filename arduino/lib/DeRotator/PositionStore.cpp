@@ -0,0 +1,175 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "PositionStore.h"
+
+/**********************************************************************
+NAME
+        PositionStore - keeps the stepper position and the session
+			state in EEPROM across a power cycle.
+
+SYNOPSIS
+	See PositionStore.h
+
+PRIVATE FUNCTIONS
+
+	crc(			- returns the CRC
+	  r			- of this record without its _crc
+	)
+
+	slot_address(		- returns the EEPROM address
+	  slot			- of this slot
+	)
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+PositionStore::PositionStore(const int address, const uint8_t num_slots)
+  : _address(address),
+    _num_slots(num_slots)
+{
+  _next_slot = 0;
+  _sequence = 0;
+  _is_loaded = false;
+  _write_slot = 0;
+  _write_index = sizeof(PositionRecord);
+}
+
+int PositionStore::Load(PositionRecord* r)
+{
+  bool is_found = false;
+  PositionRecord slot;
+
+  for(uint8_t i=0; i<_num_slots; i++){
+    EEPROM.get(slot_address(i), slot);
+    if(slot._crc != crc(slot)){
+      // never written or only partly written
+      continue;
+    }
+
+    // the newest record has the largest sequence number, even after
+    // it wraps around
+    if(!is_found || (static_cast<int32_t>(slot._sequence - _sequence) > 0)){
+      *r = slot;
+      _sequence = slot._sequence;
+      _next_slot = (i + 1) % _num_slots;
+      is_found = true;
+    }
+  }
+
+  _is_loaded = true;
+
+  return is_found? 0:-1;
+}
+
+int PositionStore::Save(PositionRecord* r)
+{
+  if(!_is_loaded){
+    // carry on from the newest slot and sequence number
+    PositionRecord newest;
+    Load(&newest);
+  }
+
+  if(!IsBusy()){
+    _write_slot = _next_slot;
+    _next_slot = (_next_slot + 1) % _num_slots;
+  }
+
+  // a record that is replaced half way is just written again into
+  // the same slot. Its old contents are already invalid
+  r->_sequence = ++_sequence;
+  r->_crc = crc(*r);
+  _record = *r;
+  _write_index = 0;
+
+  return 0;
+}
+
+int PositionStore::Service()
+{
+  const uint8_t* const p = reinterpret_cast<const uint8_t*>(&_record);
+  const int address = slot_address(_write_slot);
+
+  // skip over the bytes that are already right without waiting
+  while(_write_index < sizeof(PositionRecord)){
+    if(EEPROM.read(address + _write_index) != p[_write_index]){
+      if(!eeprom_is_ready()){
+	return 1;
+      }
+      EEPROM.write(address + _write_index, p[_write_index]);
+      _write_index++;
+      break;
+    }
+    _write_index++;
+  }
+
+  return IsBusy()? 1:0;
+}
+
+bool PositionStore::IsBusy() const
+{
+  return _write_index < sizeof(PositionRecord);
+}
+
+uint32_t PositionStore::GetSequence() const
+{
+  return _sequence;
+}
+
+uint16_t PositionStore::CRC16(const uint8_t* data,
+			      const size_t length,
+			      uint16_t crc)
+{
+  for(size_t i=0; i<length; i++){
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for(uint8_t bit=0; bit<8; bit++){
+      crc = (crc & 0x8000)? (crc << 1) ^ 0x1021:(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+uint16_t PositionStore::crc(const PositionRecord& r)
+{
+  return CRC16(reinterpret_cast<const uint8_t*>(&r), offsetof(PositionRecord, _crc));
+}
+
+int PositionStore::slot_address(const uint8_t slot) const
+{
+  return _address + slot*sizeof(PositionRecord);
+}
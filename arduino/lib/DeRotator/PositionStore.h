@@ -0,0 +1,154 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef POSITIONSTORE_HPP
+#define POSITIONSTORE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************************************************
+NAME
+
+        PositionStore - keeps the stepper position and the session
+			state in EEPROM across a power cycle.
+
+SYNOPSIS
+	The record is written to a ring of slots so that each slot is
+	only written once every num_slots saves. This spreads the
+	100,000 write cycles of the EEPROM over all the slots. Each
+	record has a sequence number and a CRC-16, so that a record
+	that was only partly written when the power went away is
+	ignored and the one before it is used.
+
+	Each byte that is written to the EEPROM takes 3.3 ms. So that
+	loop() is not held up, Save() only copies the record and
+	Service() writes it one byte at a time when the EEPROM is
+	ready. Bytes that have not changed are not written.
+
+CONSTRUCTOR
+
+        PositionStore(		- constructor
+	  address		- EEPROM address of the first slot
+	  num_slots		- the number of slots
+	)
+
+INTERFACE
+	Load(			- find the newest valid record
+	  r			- and copy it here
+	)			- returns 0 on success.
+				  returns -1 if there is none
+
+	Save(			- start writing the record to the next
+				  slot. A record that is still being
+				  written is replaced.
+	  r			- this record. Its sequence number and
+				  CRC are filled in.
+	)			- returns 0 on success.
+
+	Service()		- write the next byte of the record if
+				  the EEPROM is ready. Call it from
+				  loop(). Returns 1 if there are bytes
+				  left to write, otherwise 0.
+
+	IsBusy()		- returns true if the record has not
+				  been written out yet
+
+	GetSequence()		- returns the sequence number of the
+				  last record that was loaded or saved
+
+	CRC16(			- CRC-16/CCITT
+	  data			- of these bytes
+	  length		- and this many of them
+	  crc			- starting with this CRC. Default: 0xFFFF
+	)			- returns the CRC
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	DeRotator.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define POSITION_IS_HOMED		0x01 // position 0 is the Hall home
+#define POSITION_IS_LIMITS_ENABLED	0x02
+#define POSITION_IS_DEROTATING		0x04 // the session below is active
+
+struct PositionRecord {
+  uint32_t _sequence;
+  long _position;		// StepEngine position
+  long _home_pos;		// the user home
+  long _max_cw, _max_ccw;	// limits from the user home
+  float _accumulated_angle;	// deg
+  uint8_t _microstep;		// of all the positions
+  uint8_t _flags;
+
+  // the derotation session at the checkpoint
+  uint8_t _tracking_mode;
+  long _start_pos;		// StepEngine position at Start()
+  float _rotation;		// rad of field rotation since Start()
+  float _zeta;			// rad. The field angle
+  float _lst;			// hours. Local sidereal time, < 0 if unknown
+  float _elapsed;		// s since Start()
+
+  uint16_t _crc;		// of all of the above
+};
+
+class PositionStore
+{
+public:
+  PositionStore(const int address, const uint8_t num_slots);
+
+public:
+  int Load(PositionRecord* r);
+  int Save(PositionRecord* r);
+  int Service();
+  bool IsBusy() const;
+  uint32_t GetSequence() const;
+
+  static uint16_t CRC16(const uint8_t* data,
+			const size_t length,
+			uint16_t crc = 0xFFFF);
+
+private:
+  static uint16_t crc(const PositionRecord& r);
+  int slot_address(const uint8_t slot) const;
+
+private:
+  const int _address;
+  const uint8_t _num_slots;
+  uint8_t _next_slot;
+  uint32_t _sequence;
+  bool _is_loaded;
+
+  PositionRecord _record;	// being written
+  uint8_t _write_slot;
+  uint8_t _write_index;		// next byte of _record to write
+};
+#endif
@@ -0,0 +1,142 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <math.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "SlewProfile.h"
+
+/**********************************************************************
+NAME
+        SlewProfile - trapezoidal speed profile of a fast move of
+		      the stepper motor.
+
+SYNOPSIS
+	See SlewProfile.h
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+SlewProfile::SlewProfile()
+{
+  _steps_left = 0;
+  _speed = 0;
+  _max_speed = 1;
+  _acceleration = 1;
+}
+
+void SlewProfile::Begin(const long nsteps,
+			const double max_speed,
+			const double acceleration)
+{
+  _steps_left = nsteps > 0? nsteps:0;
+  _speed = 0;
+  _max_speed = max_speed;
+  _acceleration = acceleration;
+}
+
+unsigned long SlewProfile::NextInterval()
+{
+  const double v2 = _speed*_speed;
+  const double two_a = 2*_acceleration;
+  double v2_next;
+
+  if(v2 >= two_a*_steps_left){
+    // decelerate so that the speed is 0 after the last step
+    v2_next = v2*(_steps_left - 1)/_steps_left;
+  }
+  else if((_speed < _max_speed) &&
+	  ((_speed == 0) || (v2 + two_a <= two_a*(_steps_left - 1)))){
+    // accelerate, as long as there are still steps to stop in
+    v2_next = v2 + two_a;
+    if(v2_next > _max_speed*_max_speed){
+      v2_next = _max_speed*_max_speed;
+    }
+  }
+  else {
+    v2_next = v2;
+  }
+
+  const double v_next = sqrt(v2_next);
+  const double dt_s = 2.0/(_speed + v_next);
+
+  _speed = v_next;
+  _steps_left--;
+
+  return static_cast<unsigned long>(dt_s*1e6);
+}
+
+void SlewProfile::Decelerate()
+{
+  const long nstop = static_cast<long>(ceil(_speed*_speed/(2*_acceleration)));
+
+  if(nstop < _steps_left){
+    _steps_left = nstop;
+  }
+}
+
+bool SlewProfile::IsDone() const
+{
+  return _steps_left <= 0;
+}
+
+long SlewProfile::GetStepsLeft() const
+{
+  return _steps_left;
+}
+
+double SlewProfile::GetTime() const
+{
+  if(_steps_left <= 0){
+    return 0;
+  }
+
+  const double v = _speed;
+  const double a = _acceleration;
+  const double n = _steps_left;
+
+  if(n*2*a <= v*v){
+    // only decelerating from here
+    return v > 0? 2*n/v:0;
+  }
+
+  // the highest speed that can be reached before decelerating
+  double v_peak = sqrt(a*n + 0.5*v*v);
+  double cruise_s = 0;
+  if(v_peak > _max_speed){
+    v_peak = _max_speed;
+    cruise_s = (n - (2*v_peak*v_peak - v*v)/(2*a))/v_peak;
+  }
+
+  return (v_peak - v)/a + cruise_s + v_peak/a;
+}
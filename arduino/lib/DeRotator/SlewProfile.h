@@ -0,0 +1,110 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SLEWPROFILE_HPP
+#define SLEWPROFILE_HPP
+
+/**********************************************************************
+NAME
+
+        SlewProfile - trapezoidal speed profile of a fast move of
+		      the stepper motor.
+
+SYNOPSIS
+	SlewProfile accelerates from rest at a constant acceleration
+	up to the maximum speed, cruises and then decelerates to rest
+	so that the move of a given number of steps takes the least
+	time. If the move is too short to reach the maximum speed, the
+	profile is a triangle.
+
+	The time of each step is found from the speed before and after
+	it: a step made at a constant acceleration from speed v0 to v1
+	takes 2/(v0 + v1). The speed is updated as v1^2 = v0^2 + 2a
+	when accelerating. When decelerating it falls in proportion to
+	the steps left, so the motor comes to rest on the last step.
+
+CONSTRUCTOR
+
+        SlewProfile()		- constructor
+
+INTERFACE
+	Begin(			- start a move from rest
+	  nsteps		- of this many steps
+	  max_speed		- in steps/s
+	  acceleration		- in steps/s^2
+	)
+
+	NextInterval()		- returns the time in us from the last
+				  step to the next step. Must not be
+				  called when IsDone().
+
+	Decelerate()		- stop as soon as the acceleration
+				  allows, i.e. shorten the move to the
+				  steps that are needed to come to
+				  rest.
+
+	IsDone()		- returns true if all the steps have
+				  been given out
+
+	GetStepsLeft()		- returns the number of steps that have
+				  not been given out
+
+	GetTime()		- returns the time in s that the rest of
+				  the move takes
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	StepEngine.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+class SlewProfile
+{
+public:
+  SlewProfile();
+
+public:
+  void Begin(const long nsteps,
+	     const double max_speed,
+	     const double acceleration);
+  unsigned long NextInterval();
+  void Decelerate();
+
+  bool IsDone() const;
+  long GetStepsLeft() const;
+  double GetTime() const;
+
+private:
+  long _steps_left;
+  double _speed;		// steps/s after the last step
+  double _max_speed;		// steps/s
+  double _acceleration;		// steps/s^2
+};
+#endif
@@ -0,0 +1,205 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <Arduino.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "StepEngine.h"
+
+/**********************************************************************
+NAME
+        StepEngine - steps the stepper motor from a timer interrupt
+
+SYNOPSIS
+	See StepEngine.h
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define TICK_US		250	// the timer interrupt period, i.e. at
+				// most 4000 steps/s
+#define STEP_PULSE_US	2	// DRV8825 needs >= 1.9 us high
+
+StepQueue StepEngine::_queue;
+uint8_t StepEngine::_step_pin = 0;
+uint8_t StepEngine::_dir_pin = 0;
+volatile long StepEngine::_position = 0;
+volatile unsigned long StepEngine::_last_step_time_us = 0;
+long StepEngine::_queued_position = 0;
+unsigned long StepEngine::_last_queued_time_us = 0;
+
+#ifdef __AVR__
+ISR(TIMER5_COMPA_vect)
+{
+  StepEngine::Tick();
+}
+#endif
+
+void StepEngine::Begin(const uint8_t step_pin, const uint8_t dir_pin)
+{
+  _step_pin = step_pin;
+  _dir_pin = dir_pin;
+
+  pinMode(_step_pin, OUTPUT);
+  pinMode(_dir_pin, OUTPUT);
+  digitalWrite(_step_pin, LOW);
+
+  noInterrupts();
+  _queue.Clear();
+  _position = 0;
+  _queued_position = 0;
+  _last_step_time_us = micros();
+  _last_queued_time_us = _last_step_time_us;
+
+#ifdef __AVR__
+  // Timer5, CTC mode, prescaler 8 => 0.5 us per count at 16 MHz
+  TCCR5A = 0;
+  TCCR5B = _BV(WGM52) | _BV(CS51);
+  TCNT5 = 0;
+  OCR5A = TICK_US*(F_CPU/8000000UL) - 1;
+  TIMSK5 |= _BV(OCIE5A);
+#else
+  SimBoard::AttachTimer(TICK_US, Tick);
+#endif
+  interrupts();
+}
+
+int StepEngine::Push(const unsigned long time_us, const int8_t dir)
+{
+  if(_queue.Push(time_us, dir) != 0){
+    return -1;
+  }
+
+  _queued_position += dir;
+  _last_queued_time_us = time_us;
+
+  return 0;
+}
+
+int StepEngine::PushAfter(const int8_t dir, const unsigned long interval_us)
+{
+  unsigned long time_us = _last_queued_time_us + interval_us;
+  const unsigned long now_us = micros();
+
+  if(static_cast<long>(time_us - now_us) < 0){
+    time_us = now_us;
+  }
+
+  return Push(time_us, dir);
+}
+
+void StepEngine::Clear()
+{
+  noInterrupts();
+  _queue.Clear();
+  _queued_position = _position;
+  _last_queued_time_us = _last_step_time_us;
+  interrupts();
+}
+
+bool StepEngine::IsEmpty()
+{
+  return _queue.IsEmpty();
+}
+
+bool StepEngine::IsFull()
+{
+  return _queue.IsFull();
+}
+
+long StepEngine::GetPosition()
+{
+  // a long is not written atomically by the MEGA2560
+  noInterrupts();
+  const long pos = _position;
+  interrupts();
+
+  return pos;
+}
+
+long StepEngine::GetPositionFromISR()
+{
+  // GetPosition() would turn the interrupts back on
+  return _position;
+}
+
+long StepEngine::GetQueuedPosition()
+{
+  return _queued_position;
+}
+
+void StepEngine::SetPosition(const long pos)
+{
+  noInterrupts();
+  _queue.Clear();
+  _position = pos;
+  _queued_position = pos;
+  _last_queued_time_us = _last_step_time_us;
+  interrupts();
+}
+
+unsigned long StepEngine::GetLastStepTime()
+{
+  noInterrupts();
+  const unsigned long time_us = _last_step_time_us;
+  interrupts();
+
+  return time_us;
+}
+
+unsigned long StepEngine::GetTickTime()
+{
+  return TICK_US;
+}
+
+void StepEngine::Tick()
+{
+  const StepQueue::Step* step = _queue.Head();
+
+  if(!step || (static_cast<long>(micros() - step->_time_us) < 0)){
+    return;
+  }
+
+  digitalWrite(_dir_pin, step->_dir > 0? HIGH:LOW);
+  digitalWrite(_step_pin, HIGH);
+  delayMicroseconds(STEP_PULSE_US);
+  digitalWrite(_step_pin, LOW);
+
+  _position += step->_dir;
+  _last_step_time_us = step->_time_us;
+  _queue.Pop();
+}
@@ -0,0 +1,150 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STEPENGINE_HPP
+#define STEPENGINE_HPP
+
+#include <stdint.h>
+#include "StepQueue.h"
+
+/**********************************************************************
+NAME
+
+        StepEngine - steps the stepper motor from a timer interrupt
+
+SYNOPSIS
+	The steps are queued with their micros() due time by
+	loop(). A timer interrupt that ticks every TICK_US emits the
+	step at the head of the queue as soon as it is due, so that the
+	step timing does not depend on how long the rest of loop()
+	takes, e.g. writing to the LCD or the CC3000.
+
+	On the MEGA2560 the tick is Timer5 in CTC mode. On a host
+	computer the tick is SimBoard::AttachTimer(), see
+	../../sim/shim/Arduino.h
+
+	The engine owns the stepper motor position. +1 steps set the
+	direction pin HIGH and increment the position, just like
+	AccelStepper in DRIVER mode.
+
+	All the functions are static because there is only one
+	timer interrupt.
+
+INTERFACE
+	Begin(			- set up the pins and start the tick
+	  step_pin		- step pin of the driver
+	  dir_pin		- direction pin of the driver
+	)			  The queue is emptied and the
+				  position is set to 0.
+
+	Push(			- queue a step
+	  time_us		- due at this micros() time
+	  dir			- in this direction: +1 or -1
+	)			- returns 0 on success.
+				  returns -1 if the queue is full.
+
+	PushAfter(		- queue a step 
+	  dir			- in this direction: +1 or -1
+	  interval_us		- this many us after the last queued
+				  or emitted step, but not before now.
+	)			- returns 0 on success.
+				  returns -1 if the queue is full.
+
+	Clear()			- throw away the steps that have not been
+				  emitted yet.
+
+	IsEmpty()		- returns true if there are no queued steps.
+
+	IsFull()		- returns true if Push() will fail.
+
+	GetPosition()		- returns the position of the motor in
+				  steps, i.e. the steps emitted so far.
+
+	GetPositionFromISR()	- GetPosition() for an interrupt
+				  routine, where interrupts are
+				  already off.
+
+	GetQueuedPosition()	- returns the position of the motor
+				  after all the queued steps have
+				  been emitted.
+
+	SetPosition(		- Clear() and then set the position
+	  pos			- to this
+	)
+
+	GetLastStepTime()	- returns the micros() due time of the
+				  last emitted step
+
+	GetTickTime()		- returns the timer interrupt period in
+				  us. At most one step is made per tick.
+
+	Tick()			- the interrupt routine. Only to be
+				  called by the timer.
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	StepQueue.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+class StepEngine
+{
+public:
+  static void Begin(const uint8_t step_pin, const uint8_t dir_pin);
+
+  static int Push(const unsigned long time_us, const int8_t dir);
+  static int PushAfter(const int8_t dir, const unsigned long interval_us);
+  static void Clear();
+
+  static bool IsEmpty();
+  static bool IsFull();
+
+  static long GetPosition();
+  static long GetPositionFromISR();
+  static long GetQueuedPosition();
+  static void SetPosition(const long pos);
+
+  static unsigned long GetLastStepTime();
+  static unsigned long GetTickTime();
+
+  static void Tick();
+
+private:
+  static StepQueue _queue;
+  static uint8_t _step_pin, _dir_pin;
+
+  // written by Tick()
+  static volatile long _position;
+  static volatile unsigned long _last_step_time_us;
+
+  // written by loop()
+  static long _queued_position;
+  static unsigned long _last_queued_time_us;
+};
+#endif
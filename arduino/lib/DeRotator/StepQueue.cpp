@@ -0,0 +1,112 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <stdlib.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "StepQueue.h"
+
+// stop the compiler from moving memory accesses across it, so that
+// _steps is written before _tail and read before _head moves on
+#define COMPILER_BARRIER()	asm volatile("" ::: "memory")
+
+/**********************************************************************
+NAME
+        StepQueue - ring buffer of future stepper motor steps.
+
+SYNOPSIS
+	See StepQueue.h
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+StepQueue::StepQueue()
+  : _head(0),
+    _tail(0)
+{
+}
+
+void StepQueue::Clear()
+{
+  _head = _tail;
+}
+
+bool StepQueue::IsEmpty() const
+{
+  return _head == _tail;
+}
+
+bool StepQueue::IsFull() const
+{
+  return static_cast<uint8_t>((_tail + 1) & (QUEUE_SIZE - 1)) == _head;
+}
+
+uint8_t StepQueue::Size() const
+{
+  return (_tail - _head) & (QUEUE_SIZE - 1);
+}
+
+int StepQueue::Push(const unsigned long time_us, const int8_t dir)
+{
+  const uint8_t tail = _tail;
+  const uint8_t next = (tail + 1) & (QUEUE_SIZE - 1);
+
+  if(next == _head){
+    return -1;
+  }
+
+  // fill in the step before the consumer can see it
+  _steps[tail]._time_us = time_us;
+  _steps[tail]._dir = dir;
+  COMPILER_BARRIER();
+  _tail = next;
+
+  return 0;
+}
+
+const StepQueue::Step* StepQueue::Head() const
+{
+  const bool is_empty = _head == _tail;
+  // the step is only read after _tail says that it is there
+  COMPILER_BARRIER();
+  return is_empty? NULL:&_steps[_head];
+}
+
+void StepQueue::Pop()
+{
+  if(_head != _tail){
+    // done with the step before the producer may reuse it
+    COMPILER_BARRIER();
+    _head = (_head + 1) & (QUEUE_SIZE - 1);
+  }
+}
@@ -0,0 +1,112 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STEPQUEUE_HPP
+#define STEPQUEUE_HPP
+
+#include <stdint.h>
+
+/**********************************************************************
+NAME
+
+        StepQueue - ring buffer of future stepper motor steps.
+
+SYNOPSIS
+	StepQueue holds the time and direction of the next few
+	stepper motor steps so that the caller only has to compare
+	micros() against the head of the queue to know whether a step
+	is due.
+
+	There is no locking. The queue is safe with exactly one
+	producer that calls Push() and exactly one consumer that calls
+	Head() and Pop(), e.g. loop() and an interrupt routine, because
+	only the producer writes _tail and only the consumer writes
+	_head, and both are single bytes. A compiler barrier keeps the
+	step itself on the right side of each index update.
+
+	Clear() must only be called when the consumer cannot run.
+
+CONSTRUCTOR
+
+        StepQueue()		- constructor
+
+INTERFACE
+	Clear()			- empty the queue
+
+	IsEmpty()		- returns true if there are no steps
+
+	IsFull()		- returns true if Push() will fail
+
+	Size()			- returns the number of queued steps
+
+	Push(			- add a step at the end of the queue
+	  time_us		- that is due at this micros() time
+	  dir			- in this direction: +1 or -1
+	)			- returns 0 on success.
+				  returns -1 if the queue is full.
+
+	Head()			- returns the next step or NULL if the
+				  queue is empty
+
+	Pop()			- remove the step returned by Head()
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+class StepQueue
+{
+public:
+  StepQueue();
+
+public:
+  struct Step {
+    unsigned long _time_us;
+    int8_t _dir;
+  };
+
+public:
+  void Clear();
+  bool IsEmpty() const;
+  bool IsFull() const;
+  uint8_t Size() const;
+
+  int Push(const unsigned long time_us, const int8_t dir);
+  const Step* Head() const;
+  void Pop();
+
+private:
+  enum {QUEUE_SIZE = 32}; // must be a power of 2
+
+  Step _steps[QUEUE_SIZE];
+  volatile uint8_t _head;  // written only by the consumer
+  volatile uint8_t _tail;  // written only by the producer
+};
+#endif
@@ -0,0 +1,128 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <Arduino.h>
+#include <math.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "TrigTable.h"
+
+/**********************************************************************
+NAME
+        TrigTable - cosine, sine and secant by linear interpolation
+		    of a table in flash
+
+SYNOPSIS
+	See TrigTable.h
+
+PRIVATE FUNCTIONS
+
+	lookup(		- interpolate the table
+	  u		- at this angle in segments, >= 0
+	)		- returns the cosine
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define TRIG_HALF_PI	1.57079632679489661923
+#define TRIG_STEP_RAD	(TRIG_HALF_PI/TRIG_SEGMENTS)
+#define TRIG_SCALE	(TRIG_SEGMENTS/TRIG_HALF_PI) // segments/rad
+#define TRIG_TURN	(4*TRIG_SEGMENTS)	     // segments/turn
+
+// cos(x) for 0 <= x <= pi/2 to better than 1e-19, in Horner form so
+// that it is a constant expression that the compiler evaluates
+#define TRIG_X2(x)	((x)*(x))
+#define TRIG_COS(x)	(1 - TRIG_X2(x)/2*(1 - TRIG_X2(x)/12*(1 - TRIG_X2(x)/30* \
+			(1 - TRIG_X2(x)/56*(1 - TRIG_X2(x)/90*(1 - TRIG_X2(x)/132* \
+			(1 - TRIG_X2(x)/182*(1 - TRIG_X2(x)/240*(1 - TRIG_X2(x)/306* \
+			(1 - TRIG_X2(x)/380*(1 - TRIG_X2(x)/462)))))))))))
+
+#define TRIG_C(i)	static_cast<float>(TRIG_COS((i)*TRIG_STEP_RAD))
+#define TRIG_C4(i)	TRIG_C(i), TRIG_C(i + 1), TRIG_C(i + 2), TRIG_C(i + 3)
+#define TRIG_C16(i)	TRIG_C4(i), TRIG_C4(i + 4), TRIG_C4(i + 8), TRIG_C4(i + 12)
+#define TRIG_C64(i)	TRIG_C16(i), TRIG_C16(i + 16), TRIG_C16(i + 32), TRIG_C16(i + 48)
+#define TRIG_C256(i)	TRIG_C64(i), TRIG_C64(i + 64), TRIG_C64(i + 128), TRIG_C64(i + 192)
+
+const float TrigTable::_cos_table[TRIG_SEGMENTS + 1] PROGMEM = {
+  TRIG_C256(0), TRIG_C(256)
+};
+
+float TrigTable::Cos(const float x_rad)
+{
+  // cos is even
+  return lookup(fabs(x_rad)*static_cast<float>(TRIG_SCALE));
+}
+
+float TrigTable::Sin(const float x_rad)
+{
+  // sin(x) = cos(pi/2 - x)
+  return lookup(fabs(static_cast<float>(TRIG_HALF_PI) - x_rad)*static_cast<float>(TRIG_SCALE));
+}
+
+float TrigTable::Sec(const float x_rad)
+{
+  return 1.0f/Cos(x_rad);
+}
+
+float TrigTable::MaxError(const float x_rad)
+{
+  // the interpolation, the float table and the float argument
+  const float h = static_cast<float>(TRIG_STEP_RAD);
+  return h*h/8*(fabs(cos(x_rad)) + h) + 1.2e-7f*(1 + fabs(x_rad));
+}
+
+float TrigTable::lookup(float u)
+{
+  // a whole number of turns away does not matter
+  if(u >= TRIG_TURN){
+    u -= TRIG_TURN*floor(u/TRIG_TURN);
+  }
+
+  unsigned int i = static_cast<unsigned int>(u);
+  float f = u - i;
+  const unsigned char quadrant = (i/TRIG_SEGMENTS) & 3;
+  i &= TRIG_SEGMENTS - 1;
+
+  // the 2nd and 4th quadrants go through the table backwards ...
+  if(quadrant & 1){
+    i = TRIG_SEGMENTS - 1 - i;
+    f = 1 - f;
+  }
+
+  const float c0 = pgm_read_float(&_cos_table[i]);
+  const float c1 = pgm_read_float(&_cos_table[i + 1]);
+  const float c = c0 + (c1 - c0)*f;
+
+  // ... and the 2nd and 3rd are negative
+  return ((quadrant == 1) || (quadrant == 2))? -c:c;
+}
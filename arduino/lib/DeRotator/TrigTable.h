@@ -0,0 +1,100 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef TRIGTABLE_HPP
+#define TRIGTABLE_HPP
+
+/**********************************************************************
+NAME
+
+        TrigTable - cosine, sine and secant by linear interpolation
+		    of a table in flash
+
+SYNOPSIS
+	The table holds cos() of TRIG_SEGMENTS + 1 angles evenly spaced
+	over the first quadrant, and the other quadrants are its
+	mirror images. It is filled by the compiler from a Taylor
+	series, because Arduino 1.6.4 compiles C++98 and so it cannot be
+	constexpr, and it is kept in PROGMEM so that it does not take
+	any RAM.
+
+	The error of the linear interpolation is at most h^2/8 of
+	|cos()| over the segment of width h = (pi/2)/TRIG_SEGMENTS. For
+	256 segments that is 4.7e-6 relative, plus 1.2e-7 absolute
+	from rounding the table to float and 1.2e-7*|x| from rounding
+	the angle to float. Sec() is 1/Cos() and so has
+	the same relative error until the float rounding of cos()
+	dominates within ~1e-4 rad of +-pi/2.
+
+	A lookup is a multiply, two reads from flash and a linear
+	interpolation, against the polynomial of the soft float cos()
+	of avr-libc. trig_bench/trig_bench.ino times both on the
+	MEGA2560 and sim/trig_bench.cpp on the host.
+
+INTERFACE
+	Cos(			- returns the cosine
+	  x_rad			- of this angle in rad
+	)
+
+	Sin(			- returns the sine
+	  x_rad			- of this angle in rad
+	)
+
+	Sec(			- returns 1/cos
+	  x_rad			- of this angle in rad
+	)
+
+	MaxError(		- returns the bound on |Cos(x) - cos(x)|
+	  x_rad			- at this angle in rad
+	)
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	DeRotator.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define TRIG_SEGMENTS	256	// per quadrant. Must be a power of 2
+
+class TrigTable
+{
+public:
+  static float Cos(const float x_rad);
+  static float Sin(const float x_rad);
+  static float Sec(const float x_rad);
+  static float MaxError(const float x_rad);
+
+private:
+  static float lookup(float u);
+
+private:
+  static const float _cos_table[TRIG_SEGMENTS + 1];
+};
+#endif
@@ -33,6 +33,13 @@
 #include "ReplyPacket.hpp"
 #include "StatusPacket.hpp"
 
+/*
+   Requests that can be outstanding. Two short request frames fit in
+   the SERIAL_RX_SIZE bytes of the receive buffer of Serial while
+   the server is busy
+*/
+#define SERIAL_PIPELINE_MAX	2
+
 /**********************************************************************
 NAME
         SerialServer - This class sets up serial port 0 to listen to
@@ -45,7 +52,26 @@ SYNOPSIS
 PROTECTED FUNCTIONS
 
 PRIVATE FUNCTIONS
-
+	service_batch(		- read, service and reply to a CMD_BATCH
+	  n			- of this many requests
+	  seq			- that came with this seq, or
+	)			  FRAME_NONE. Returns 0 on success
+
+	read_request(		- read the next
+	  rq			- request into here, and
+	  seq			- its seq, or FRAME_NONE if it did not
+				  come in a frame
+	  is_wait		- wait for it to arrive if true.
+				  Otherwise stop looking for a frame
+				  when there is nothing more to read
+	)			- returns 0 on success. -1 if nothing
+				  good was read
+
+	write_packet(		- write
+	  packet		- this packet
+	  sz			- of this many bytes
+	  seq			- in a frame with this seq, or as it is
+	)			  for FRAME_NONE. Returns 0 on success
 
 LOCAL TYPES AND CLASSES
 
@@ -65,6 +91,8 @@ SerialServer::SerialServer(UserIO* userio, DeRotator* derotator)
   : BaseServer(userio, derotator)
 {
   Serial.begin(115200);
+
+  _pipeline_max = SERIAL_PIPELINE_MAX;
 }
 
 SerialServer::~SerialServer()
@@ -78,50 +106,33 @@ int SerialServer::ServiceLoop()
   ReplyPacket rp;
   StatusPacket sp;
   
-  int sz;
+  int seq;
 
   // Check if there is data available to read.
   if (Serial.available() > 0) {
-    if(sz = Serial.readBytes((char*)(&rq), sizeof(RequestPacket))){
-      // for debugging
+    if(read_request(&rq, &seq, false) != 0){
+      // dropped. A frame is looked for again the next time
     }
-
-    if(ServiceRequests(&rq, &rp, &sp) == 0){
+    else if(rq._command == CMD_BATCH){
+      if(service_batch(rq._ivalue, seq) != 0){
+	return -1;
+      }
+    }
+    else if(ServiceRequests(&rq, &rp, &sp) == 0){
       if(rq._command != CMD_QUERY_STATE){
-
-	if(Serial.write((char*)(&rp),
-			sizeof(ReplyPacket)) != sizeof(ReplyPacket)){
-	  Serial.println(F("SerialServer::ServiceLoop: did not write the entire reply packet"));
+	if(write_packet(&rp, seq == FRAME_NONE? sizeof(ReplyPacket):
+			reply_size(rq._command), seq) != 0){
 	  return -1;
-	}	  
+	}
       }
       else {
-	// Serial only supports sending packets in 64 byte chunks
-	// without editing the default
-	// hardware/arduino/cores/arduino/HardwareSerial.cpp file.	
-	// #define SERIAL_BUFFER_SIZE	64
-	// Thus I'm going to send the StatusPacket back in chunks.
-	#define SERIAL_BUFFER_SIZE	64
-	
-	char* packet_ptr = (char*)&sp;
-	char* packet_end = packet_ptr + sizeof(StatusPacket);
-	while((packet_ptr + SERIAL_BUFFER_SIZE) < packet_end){
-	  if(Serial.write(packet_ptr,
-			  SERIAL_BUFFER_SIZE) != SERIAL_BUFFER_SIZE){
-	    Serial.println(F("SerialServer::ServiceLoop: did not write the entire reply packet"));
-	    return -1;
-	  }
-	  packet_ptr += SERIAL_BUFFER_SIZE;
-	}
-        // now send off the remainder
-	if(packet_ptr < packet_end){
-	  int sz = packet_end - packet_ptr;
-	  int sz1;
-
-	  if(Serial.write(packet_ptr, sz) != sz){
-	    Serial.println(F("SerialServer::ServiceLoop: did not write the entire reply packet"));
-	    return -1;
-	  }
+	// the compact status needs the length of a frame
+	char status[STATUS_COMPACT_MAX];
+	const int sz =
+	  seq == FRAME_NONE? 0:compact_status(&sp, rq._ivalue, status);
+	if(((sz > 0)? write_packet(status, sz, seq):
+	    write_packet(&sp, sizeof(StatusPacket), seq)) != 0){
+	  return -1;
 	}
       }
     } // ServiceRequests
@@ -130,13 +141,145 @@ int SerialServer::ServiceLoop()
       return -1;
     }
   }  // Serial.available()
+
+  // push telemetry after any reply so that the reply is not delayed
+  if(IsTelemetryDue()){
+    TelemetryPacket tp;
+    GetTelemetry(&tp);
+
+    if(write_packet(&tp, sizeof(TelemetryPacket),
+		    _is_framed? FRAME_TELEMETRY_SEQ:FRAME_NONE) != 0){
+      return -1;
+    }
+  }
    
   Serial.flush();
 
   return 0;
 }
 
+int SerialServer::service_batch(const int n, const int seq)
+{
+  RequestPacket rq[BATCH_MAX];
+  ReplyPacket rp[BATCH_MAX+1];
+  int rq_seq[BATCH_MAX];
+
+  // read every request of the batch, even of one that is refused,
+  // so that the next request starts at a packet boundary
+  for(int i=0; i<n; i++){
+    const int j = (i < BATCH_MAX)? i:0;
+    
+    if(read_request(&rq[j], &rq_seq[j], true) != 0){
+      Serial.println(F("SerialServer::service_batch: did not read the entire batch"));
+      return -1;
+    }
+  }
 
+  if(ServiceBatch(n, rq, rp) != 0){
+    Serial.println(F("SerialServer::service_batch: ServiceBatch() failed"));
+    return -1;
+  }
 
+  const bool is_framed = seq != FRAME_NONE;
+  
+  if(write_packet(&rp[0], is_framed? reply_size(CMD_BATCH):sizeof(ReplyPacket),
+		  seq) != 0){
+    return -1;
+  }
+  
+  for(int i=0; i<rp[0]._ivalue; i++){
+    if(write_packet(&rp[i+1],
+		    is_framed? reply_size(rq[i]._command):sizeof(ReplyPacket),
+		    rq_seq[i]) != 0){
+      return -1;
+    }
+  }
 
+  return 0;
+}
+
+int SerialServer::read_request(RequestPacket* const rq,
+			       int* const seq,
+			       const bool is_wait)
+{
+  if(!_is_framed){
+    *seq = FRAME_NONE;
+    
+    if(Serial.readBytes((char*)rq, sizeof(RequestPacket)) != sizeof(RequestPacket)){
+      Serial.println(F("SerialServer::read_request: did not read the entire request packet"));
+      return -1;
+    }
+    return 0;
+  }
+
+  char frame[FRAME_SIZE(sizeof(RequestPacket))];
+  
+  // drop everything up to FRAME_SYNC0 FRAME_SYNC1. The rest of a
+  // frame that has started is always waited for
+  frame[1] = 0;
+  do {
+    if(!is_wait && (frame[1] != (char)FRAME_SYNC0) &&
+       (Serial.available() <= 0)){
+      return -1;
+    }
+    frame[0] = frame[1];
+    if(Serial.readBytes(&frame[1], 1) != 1){
+      return -1;
+    }
+  } while((frame[0] != (char)FRAME_SYNC0) || (frame[1] != (char)FRAME_SYNC1));
+
+  // the length and seq, then the rest of the frame
+  if(Serial.readBytes(&frame[2], 2) != 2){
+    return -1;
+  }
 
+  const int sz = static_cast<uint8_t>(frame[2]);
+  if(sz > static_cast<int>(sizeof(RequestPacket))){
+    return -1;
+  }
+
+  if(Serial.readBytes(&frame[FRAME_HEADER_SIZE], sz + FRAME_CRC_SIZE) !=
+     static_cast<size_t>(sz + FRAME_CRC_SIZE)){
+    return -1;
+  }
+
+  *seq = static_cast<uint8_t>(frame[3]);
+  return unframe_request(frame, rq);
+}
+
+int SerialServer::write_packet(const void* const packet,
+			       const int sz,
+			       const int seq)
+{
+  char frame[FRAME_SIZE(sizeof(StatusPacket))];
+  const char* packet_ptr = static_cast<const char*>(packet);
+  int frame_sz = sz;
+
+  if(seq != FRAME_NONE){
+    frame_sz = frame_packet(frame, packet, sz, seq);
+    packet_ptr = frame;
+  }
+
+  // Serial only supports sending packets in 64 byte chunks
+  // without editing the default
+  // hardware/arduino/cores/arduino/HardwareSerial.cpp file.	
+  // #define SERIAL_BUFFER_SIZE	64
+  // Thus I'm going to send the packets back in chunks.
+  #define SERIAL_BUFFER_SIZE	64
+
+  const char* packet_end = packet_ptr + frame_sz;
+  while(packet_ptr < packet_end){
+    int chunk_sz = packet_end - packet_ptr;
+    if(chunk_sz > SERIAL_BUFFER_SIZE){
+      chunk_sz = SERIAL_BUFFER_SIZE;
+    }
+    
+    if(Serial.write(packet_ptr, chunk_sz) != static_cast<size_t>(chunk_sz)){
+      Serial.println(F("SerialServer::write_packet: did not write the entire packet"));
+      return -1;
+    }
+    packet_ptr += chunk_sz;
+  }
+
+  return 0;
+}
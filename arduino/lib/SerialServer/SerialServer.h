@@ -50,7 +50,9 @@ CONSTRUCTOR
         
 INTERFACE
 
-	ServiceLoop()		- listen for client data packets
+	ServiceLoop()		- listen for client data packets and
+				  push the subscribed telemetry
+				  in PROTOCOL_RAW or PROTOCOL_FRAMED
 
 AUTHOR                                          
 
@@ -74,5 +76,13 @@ public:
 public:
   int ServiceLoop();
 
+private:
+  int service_batch(const int n, const int seq);
+  int read_request(RequestPacket* const rq,
+		   int* const seq,
+		   const bool is_wait);
+  int write_packet(const void* const packet,
+		   const int sz,
+		   const int seq);
 };
 #endif
@@ -34,6 +34,12 @@ SYNOPSIS
 
 	The data packet that is sent from the server. 			  
 
+	After CMD_SUBSCRIBE_TELEMETRY, the server also pushes
+	TelemetryPacket's without being asked. They can arrive
+	between a request and its reply, so a client reads _reply
+	first: REPLY_TELEMETRY is never the _reply of any other
+	packet, and the rest of the packet is then a TelemetryPacket.
+
 AUTHOR
 	C.Y. Tan
 
@@ -53,6 +59,23 @@ SEE ALSO
 #define REPLY_DEROTATOR_STEPSIZE_ERR	-100
 #define REPLY_DEROTATOR_LIMITS_REACHED	-101
 
+/*
+  A CMD_BATCH that is refused. None of its requests are run
+*/
+#define REPLY_BATCH_ERR			-102
+
+/*
+  A command that is refused: an argument that is out of range, or a
+  setting that cannot change while the derotator is turning
+*/
+#define REPLY_BAD_ARGUMENT		-103
+#define REPLY_BUSY			-104
+
+/*
+  The _reply of a pushed TelemetryPacket
+*/
+#define REPLY_TELEMETRY		100
+
 
 struct ReplyPacket
 {
@@ -60,6 +83,19 @@ struct ReplyPacket
   int16_t _ivalue;
   float _fvalue[4];
 };
+
+#pragma pack(push, 1) // exact fit - no padding
+struct TelemetryPacket
+{
+  int16_t _reply;		// always REPLY_TELEMETRY
+  int16_t _status;		// derotator continue status
+  uint32_t _time_ms;		// millis() of the derotator
+  float _alt;			// deg
+  float _az;			// deg
+  float _accumulated_angle;	// deg
+  float _angle;			// deg w.r.t. user home
+};
+#pragma pack(pop) //back to whatever the previous packing mode was 
 		   
 			
 
@@ -50,6 +50,49 @@ SEE ALSO
 #define WLAN_WPA2	3
 
 #define REPLY_IS_DEROTATING	10
+
+/*
+	In PROTOCOL_FRAMED, CMD_QUERY_STATE can ask in _ivalue for
+	the status in a compact form instead of the StatusPacket
+	itself, which is what any other _ivalue and PROTOCOL_RAW
+	always get back:
+
+	  STATUS_COMPACT	every field that is not zero or empty
+	  STATUS_CHANGED	every field that has changed since the
+				last compact status that was sent
+
+	The compact status is the format that was used, which is
+	STATUS_COMPACT if there has been no compact status since
+	CMD_SET_PROTOCOL, followed by a tag and a value for each
+	field that is sent. An int16_t is a zigzag varint, i.e.
+	(v << 1) ^ (v >> 15) in 7 bit groups LSB first with the top
+	bit set on all but the last, a float its 4 bytes and
+	the SSID its length and its chars. The fields that are not
+	sent are zero or empty (STATUS_COMPACT) or unchanged
+	(STATUS_CHANGED). The password is never sent back, so it
+	has no tag. The compact status is at most STATUS_COMPACT_MAX
+	bytes, which is less than a StatusPacket, so the length of
+	the frame tells the two apart.
+*/
+#define STATUS_FULL		0
+#define STATUS_COMPACT		1
+#define STATUS_CHANGED		2
+
+#define STATUS_TAG_REPLY		1	// int16_t
+#define STATUS_TAG_IS_CLOCKWISE		2	// int16_t
+#define STATUS_TAG_HOME_POS		3	// int16_t
+#define STATUS_TAG_MAX_CW		4	// int16_t
+#define STATUS_TAG_MAX_CCW		5	// int16_t
+#define STATUS_TAG_IS_ENABLE_LIMITS	6	// int16_t
+#define STATUS_TAG_ANGLE		7	// float
+#define STATUS_TAG_ACCUMULATED_ANGLE	8	// float
+#define STATUS_TAG_WLAN_SSID		9	// string
+#define STATUS_TAG_WLAN_SECURITY	10	// int16_t
+#define STATUS_TAG_OMEGA		11	// float
+
+// the format, 7 int16_t's, 3 floats and the SSID, all with tags
+#define STATUS_COMPACT_MAX	(1 + 7*(1 + 3) + 3*(1 + 4) + (2 + 32))
+
 #pragma pack(push, 1) // exact fit - no padding
 struct StatusPacket
 {
@@ -26,6 +26,7 @@
 #include <SPI.h>
 #include <Arduino.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "utility/debug.h"
 
@@ -43,6 +44,12 @@
 #define CC3000_VBAT  5
 #define CC3000_CS    10
 
+// how long to wait for the rest of a request or a batch of requests
+#define TCP_READ_TIMEOUT_MS	1000
+
+// requests that can be outstanding in PROTOCOL_FRAMED
+#define TCP_PIPELINE_MAX	4
+
 /**********************************************************************
 NAME
         TCPServer - This class sets up Wifi to listen to user commands
@@ -58,6 +65,43 @@ PRIVATE FUNCTIONS
 
 	display_connection_details() - send the Wifi details back to the user via Serial.
 
+	service_batch(		- read, service and reply to a CMD_BATCH
+	  client		- from this client
+	  n			- of this many requests
+	  seq			- that came with this seq, or
+	)			  FRAME_NONE. Returns 0 on success
+
+	read_request(		- read the next
+	  client		- from this client
+	  rq			- request into here, and
+	  seq			- its seq, or FRAME_NONE if it did not
+				  come in a frame
+	  is_wait		- wait for it to arrive if true.
+				  Otherwise stop looking for a frame
+				  when there is nothing more to read
+	)			- returns 0 on success. -1 if nothing
+				  good was read
+
+	write_packet(		- write
+	  client		- to this client
+	  packet		- this packet
+	  sz			- of this many bytes
+	  seq			- in a frame with this seq, or as it is
+	)			  for FRAME_NONE. Returns 0 on success
+
+	write_bytes(		- write all of
+	  client		- to this client
+	  buf			- this buffer
+	  sz			- of this many bytes
+	)			- returns 0 on success
+
+	read_bytes(		- read exactly
+	  client		- from this client
+	  buf			- into this buffer
+	  sz			- this many bytes
+	)			- returns 0 on success. -1 if they have
+				  not all arrived in TCP_READ_TIMEOUT_MS
+
 
 LOCAL TYPES AND CLASSES
 
@@ -81,6 +125,9 @@ TCPServer::TCPServer(UserIO* userio, DeRotator* derotator)
   _ssid[0] = '\0';
   _pass[0] = '\0';
   _secmode = WLAN_SEC_UNSEC;
+
+  _pipeline_max = TCP_PIPELINE_MAX;
+  _client = -1;
 }
 
 TCPServer::~TCPServer()
@@ -173,43 +220,48 @@ int TCPServer::ServiceLoop()
   ReplyPacket rp;
   StatusPacket sp;
   
-  int sz;
+  int seq;
+
+  // the next client starts in PROTOCOL_RAW
+  if((_client >= 0) && !_server.getClientRef(_client).connected()){
+    reset_connection();
+    _client = -1;
+  }
   
-  Adafruit_CC3000_ClientRef client = _server.available();
+  const int8_t i = _server.availableIndex();
+  Adafruit_CC3000_ClientRef client = _server.getClientRef(i);
   if (client) {
+    if(i != _client){
+      reset_connection();
+      _client = i;
+    }
+    
     // Check if there is data available to read.
     if (client.available() > 0) {
-      if(sz = client.read(static_cast<void*>(&rq), sizeof(RequestPacket))){
-	#ifdef AAAAAA
-	Serial.print("rq._command = ");
-	Serial.println(rq._command);
-	#endif
+      if(read_request(client, &rq, &seq, false) != 0){
+	// dropped. A frame is looked for again the next time
       }
-
-      if(ServiceRequests(&rq, &rp, &sp) == 0){
+      else if(rq._command == CMD_BATCH){
+	if(service_batch(client, rq._ivalue, seq) != 0){
+	  return -1;
+	}
+      }
+      else if(ServiceRequests(&rq, &rp, &sp) == 0){
 	if(rq._command != CMD_QUERY_STATE){
-
-	  char* packet_ptr = (char*)&rp;
-	  char* packet_end = packet_ptr + sizeof(ReplyPacket);
-	  int sz = sizeof(ReplyPacket);
-	  int sent_sz;	  
-	  do{
-	    sent_sz += client.write(static_cast<void*>(packet_ptr), sz);
-	    packet_ptr += sent_sz;
-	    sz -= sent_sz;
-	  } while(sz > 0);
-	  
+	  if(write_packet(client, &rp, seq == FRAME_NONE? sizeof(ReplyPacket):
+			  reply_size(rq._command), seq) != 0){
+	    return -1;
+	  }
 	}
 	else {
-	  char* packet_ptr = (char*)&sp;
-	  char* packet_end = packet_ptr + sizeof(StatusPacket);
-	  int sz = sizeof(StatusPacket);
-	  int sent_sz;
-	  do{
-	    sent_sz += client.write(static_cast<void*>(packet_ptr), sz);
-	    packet_ptr += sent_sz;
-	    sz -= sent_sz;
-	  } while(sz > 0);
+	  // the compact status needs the length of a frame
+	  char status[STATUS_COMPACT_MAX];
+	  const int sz =
+	    seq == FRAME_NONE? 0:compact_status(&sp, rq._ivalue, status);
+	  if(((sz > 0)? write_packet(client, status, sz, seq):
+	      write_packet(client, &sp, sizeof(StatusPacket), seq)) != 0){
+	    return -1;
+	  }
 	}
       } // ServiceRequests
       else {
@@ -219,10 +271,165 @@ int TCPServer::ServiceLoop()
     } // client.available()
   } // client
 
+  // push telemetry after any reply so that the reply is not
+  // delayed. Only _client can have subscribed
+  if((_client >= 0) && IsTelemetryDue()){
+    TelemetryPacket tp;
+    GetTelemetry(&tp);
+
+    Adafruit_CC3000_ClientRef subscriber = _server.getClientRef(_client);
+    if(write_packet(subscriber, &tp, sizeof(TelemetryPacket),
+		    _is_framed? FRAME_TELEMETRY_SEQ:FRAME_NONE) != 0){
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+
+int TCPServer::service_batch(Adafruit_CC3000_ClientRef& client,
+			     const int n,
+			     const int seq)
+{
+  RequestPacket rq[BATCH_MAX];
+  ReplyPacket rp[BATCH_MAX+1];
+  int rq_seq[BATCH_MAX];
+
+  // read every request of the batch, even of one that is refused,
+  // so that the next request starts at a packet boundary
+  for(int i=0; i<n; i++){
+    const int j = (i < BATCH_MAX)? i:0;
+    
+    if(read_request(client, &rq[j], &rq_seq[j], true) != 0){
+      Serial.println(F("TCPServer::service_batch: did not read the entire batch"));
+      return -1;
+    }
+  }
+
+  if(ServiceBatch(n, rq, rp) != 0){
+    Serial.println(F("TCPServer::service_batch: ServiceBatch() failed"));
+    return -1;
+  }
+
+  // all the replies go back in one write
+  char replies[(BATCH_MAX+1)*FRAME_SIZE(sizeof(ReplyPacket))];
+  int sz;
+
+  if(seq == FRAME_NONE){
+    sz = (1 + rp[0]._ivalue)*sizeof(ReplyPacket);
+    memcpy(replies, rp, sz);
+  }
+  else {
+    sz = frame_packet(replies, &rp[0], reply_size(CMD_BATCH), seq);
+    for(int i=0; i<rp[0]._ivalue; i++){
+      sz += frame_packet(replies + sz, &rp[i+1], reply_size(rq[i]._command),
+			 rq_seq[i]);
+    }
+  }
+  
+  return write_bytes(client, replies, sz);
+}
+
+int TCPServer::read_request(Adafruit_CC3000_ClientRef& client,
+			    RequestPacket* const rq,
+			    int* const seq,
+			    const bool is_wait)
+{
+  if(!_is_framed){
+    *seq = FRAME_NONE;
+    
+    if(read_bytes(client, (char*)rq, sizeof(RequestPacket)) != 0){
+      Serial.println(F("TCPServer::read_request: did not read the entire request packet"));
+      return -1;
+    }
+    return 0;
+  }
+
+  char frame[FRAME_SIZE(sizeof(RequestPacket))];
+  
+  // drop everything up to FRAME_SYNC0 FRAME_SYNC1. The rest of a
+  // frame that has started is always waited for
+  frame[1] = 0;
+  do {
+    if(!is_wait && (frame[1] != (char)FRAME_SYNC0) &&
+       (client.available() <= 0)){
+      return -1;
+    }
+    frame[0] = frame[1];
+    if(read_bytes(client, &frame[1], 1) != 0){
+      return -1;
+    }
+  } while((frame[0] != (char)FRAME_SYNC0) || (frame[1] != (char)FRAME_SYNC1));
+
+  // the length and seq, then the rest of the frame
+  if(read_bytes(client, &frame[2], 2) != 0){
+    return -1;
+  }
+
+  const int sz = static_cast<uint8_t>(frame[2]);
+  if(sz > static_cast<int>(sizeof(RequestPacket))){
+    return -1;
+  }
+
+  if(read_bytes(client, &frame[FRAME_HEADER_SIZE], sz + FRAME_CRC_SIZE) != 0){
+    return -1;
+  }
+
+  *seq = static_cast<uint8_t>(frame[3]);
+  return unframe_request(frame, rq);
+}
+
+int TCPServer::write_packet(Adafruit_CC3000_ClientRef& client,
+			    const void* const packet,
+			    const int sz,
+			    const int seq)
+{
+  if(seq == FRAME_NONE){
+    return write_bytes(client, static_cast<const char*>(packet), sz);
+  }
+
+  char frame[FRAME_SIZE(sizeof(StatusPacket))];
+  return write_bytes(client, frame, frame_packet(frame, packet, sz, seq));
+}
+
+int TCPServer::write_bytes(Adafruit_CC3000_ClientRef& client,
+			   const char* buf,
+			   int sz)
+{
+  while(sz > 0){
+    const int sent_sz = client.write(static_cast<const void*>(buf), sz);
+    if(sent_sz <= 0){
+      Serial.println(F("TCPServer::write_bytes: did not write the entire packet"));
+      return -1;
+    }
+    buf += sent_sz;
+    sz -= sent_sz;
+  }
+
   return 0;
 }
 
+int TCPServer::read_bytes(Adafruit_CC3000_ClientRef& client, char* buf, int sz)
+{
+  const unsigned long start = millis();
+  
+  while(sz > 0){
+    if(client.available() > 0){
+      const int n = client.read(static_cast<void*>(buf), sz);
+      if(n > 0){
+	buf += n;
+	sz -= n;
+      }
+    }
+    else if((millis() - start) > TCP_READ_TIMEOUT_MS){
+      return -1;
+    }
+  }
 
+  return 0;
+}
 
 int TCPServer::GetIPAddress(uint32_t* ip_address)
 {
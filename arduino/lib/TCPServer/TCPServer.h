@@ -38,6 +38,12 @@ NAME
 SYNOPSIS
 	TCPServer sets up the Wifi ADAFRUIT Wifi Shield as a TCP
 	server to listen to user commands that are sent over TCP.
+	The protocol and the telemetry that a client asks for are
+	kept until it goes away or another client sends a request,
+	when the server is back in PROTOCOL_RAW without telemetry, so
+	that a client that did not close cleanly cannot leave it
+	framed or pushing packets to the next one. Telemetry is only
+	written to the client that subscribed.
 
 CONSTRUCTOR
 
@@ -57,7 +63,9 @@ INTERFACE
 	Disconnect()		- disconnect from wifi
 				  network. Returns 0 on success
 
-	ServiceLoop()		- listen for client data packets
+	ServiceLoop()		- listen for client data packets and
+				  push the subscribed telemetry
+				  in PROTOCOL_RAW or PROTOCOL_FRAMED
 
 	GetIPAddress(		- get the wifi address
 	  ipaddress		- and put it into ipaddress
@@ -140,10 +148,26 @@ public:
 
 private:
   int display_connection_details();
+  int service_batch(Adafruit_CC3000_ClientRef& client,
+		    const int n,
+		    const int seq);
+  int read_request(Adafruit_CC3000_ClientRef& client,
+		   RequestPacket* const rq,
+		   int* const seq,
+		   const bool is_wait);
+  int write_packet(Adafruit_CC3000_ClientRef& client,
+		   const void* const packet,
+		   const int sz,
+		   const int seq);
+  int read_bytes(Adafruit_CC3000_ClientRef& client, char* buf, int sz);
+  int write_bytes(Adafruit_CC3000_ClientRef& client,
+		  const char* buf,
+		  int sz);
   
 private:
   Adafruit_CC3000 _cc3000;
   Adafruit_CC3000_Server _server;
+  int8_t _client;		// whose protocol is in use, -1 if none
 
 private:
   char _ssid[WIFI_MAX_STR_LEN];
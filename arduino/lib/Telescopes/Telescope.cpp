@@ -38,6 +38,28 @@
 #define RAD2DEG 180/M_PI
 
 #define OMEGA	4.178e-3*M_PI/180 // rotation frequency of the Earth in rad/s
+#define SIDEREAL_RATE	1.00273790935 // sidereal s per s
+
+#define QUERY_TIMEOUT_US	500000 // us. The LX200 has to start and finish
+				       // each reply within this time
+
+#define LX200_DEGREE_SIGN	0xDF // the LX200 sends this instead of '*'
+#define PRECISION_TRIES		4 // attempts at toggling to high precision
+
+#define MODEL_MAX_STEP_S	60.0 // a longer rotation of the sky rotation model
+				     // is with cos, sin instead of a power series
+#define MODEL_CARRY		16   // calls between exact evaluations of the model
+#define MODEL_CARRY_S		8.0  // s that alt, az are carried on by their rates
+#define MODEL_ZENITH_COS_ALT	1e-3 // nearer the zenith the az rate blows up, so
+				     // every call is exact
+
+#define FUSION_FIX_INTERVAL	30.0 // s between LX200 fixes in the FUSED mode
+#define FUSION_ALPHA		0.5  // alpha-beta filter gains of the fix
+#define FUSION_BETA		0.1  // minus model
+#define FUSION_SLEW_DEG		0.5  // a bigger innovation on the sky is a slew
+#define EPHEMERIS_TOLERANCE_DEG	0.0166666667 // 1 arcmin. The latitude from Gt
+					     // is only good to 1 arcmin, which
+					     // matters near the zenith
 
 
 /**********************************************************************
@@ -53,6 +75,126 @@ PROTECTED FUNCTIONS
 
 PRIVATE FUNCTIONS
 
+	send(			- send the command to the LX200 and wait
+	  cmd			- until it has been transmitted
+	)
+
+	send_nowait(		- put the command into the serial transmit
+	  cmd			- buffer and return immediately
+	)
+
+	receive(		- wait for the reply of the LX200
+	  data			- and copy it here
+	  size			- but no more than this number of bytes
+	)			- returns the number of bytes or -1 on
+				  timeout or overflow
+
+	query_field(		- throw away what is left of an earlier
+				  reply, send the command, wait for
+				  the reply
+	  cmd			- of this command
+	  value			- and parse it into this value
+	)			- returns 0 on success
+
+	read_sidereal_time(	- ask the LX200 for the sidereal time
+	  lst			- the returned time in hours
+	  time			- the returned time in s that it was
+				  asked at
+	)			- returns 0 on success.
+				  returns -1 if it is not a time.
+
+	reset_field()		- get ready to parse the next reply
+
+	parse_field(		- parse one byte of an sDD*MM'SS#,
+				  sDD*MM# or HH:MM.T# reply. The sign
+				  is optional and the degree sign can
+				  be '*', ':' or 0xDF
+	  ch			- the byte
+	  value			- the returned value in degrees
+	)			- returns 1 if more bytes are needed
+				  returns 0 when '#' completes the reply
+				  returns -1 if the reply is malformed
+
+	get_altaz(		- query the LX200 and wait for the reply
+	  alt, az		- the returned alt, az in degrees
+	)			- returns 0 on success
+
+	get_model_altaz(	- model of a star that is carried by
+				  the sky rotation from the alt, az
+				  of the last anchor_model(). The alt,
+				  az are carried on from the last
+				  exact evaluation by their rates and
+				  accelerations, which needs no
+				  transcendental functions. It is
+				  evaluated exactly again after
+				  MODEL_CARRY calls or MODEL_CARRY_S,
+				  or when the time goes backwards.
+	  time			- at this time in s
+	  alt, az		- the returned alt, az in degrees
+	)
+
+	anchor_model(		- start the sky rotation model
+	  time			- at this time in s
+	  alt, az		- from this alt, az in degrees
+	)
+
+	sky_rotation(		- the rotation matrix of the sky about
+				  the pole
+	  Omegat		- by this angle in rad
+	  R			- the returned matrix
+	)			  A small angle is by a power series
+				  so that there is no cos or sin.
+
+	resync_model(		- evaluate the model, and the rates and
+				  accelerations of alt, az, exactly
+				  from the anchor
+	  time			- at this time in s
+	)
+
+	reset_fusion()		- forget the fixes of the FUSED mode
+
+	get_fused_altaz(	- the model corrected by the filtered
+				  fix minus model
+	  time			- at this time in s
+	  alt, az		- the returned alt, az in degrees
+	)
+
+	fuse(			- correct the model with an LX200 fix
+	  time			- made at this time in s
+	  alt, az		- the fix in degrees. Returns the
+				  corrected model.
+	)
+
+	innovation(		- remember the difference between
+	  alt, az		- the fix
+	  model_alt, model_az	- and the model, all in degrees
+	)			- returns the squared difference on
+				  the sky in degrees^2
+
+	read_ephemeris()	- read the RA, Dec, longitude and
+				  sidereal time from the LX200.
+				  Returns 0 on success.
+
+	anchor_ephemeris(	- calculate the hour angle and
+				  declination
+	  time			- at this time in s
+	  alt, az		- from this alt, az in degrees
+	)
+
+	get_ephemeris_altaz(	- the alt, az in degrees
+	  time			- at this time in s
+	  alt, az		- from the hour angle and declination
+	)
+
+	check_slew(		- compare an LX200 fix with the
+				  ephemeris and recalculate the
+				  ephemeris if the telescope has been
+				  slewed
+	  time			- the fix was made at this time in s
+	  alt, az		- the fix in degrees. Returns the
+				  ephemeris alt, az.
+	)
+
 LOCAL TYPES AND CLASSES
 
 AUTHOR
@@ -72,7 +214,34 @@ Telescope::Telescope()
   _az0_rad = 0;
 
   _start_time = 0;
+  _X0 = _Y0 = _Z0 = 0;
+  _pole_x = 1;
+  _pole_z = 0;
+  _model_time = 0;
+  _model_alt = _model_az = 0;
+  _alt_rate = _az_rate = 0;
+  _alt_acc = _az_acc = 0;
+  _model_steps = 0;
   _is_debug = true;
+
+  _query_state = QUERY_IDLE;
+  _query_start_us = 0;
+  _query_time = 0;
+  _query_alt = 0;
+  _query_az = 0;
+
+  _mode = DIRECT;
+  _fix_interval = FUSION_FIX_INTERVAL;
+  reset_fusion();
+
+  _ha0_rad = 0;
+  _dec_rad = 0;
+  _ephemeris_time = 0;
+  _longitude = 0;
+  _lst = -1;
+  _lst_time = 0;
+
+  reset_field();
 }
 
 
@@ -88,34 +257,35 @@ int Telescope::Connect()
   while(!Serial2);
   Serial.println(F("Telescope serial port is open"));
 
-  int data[32];
+  int data[REPLY_SIZE];
 
   //See if there is any telescope connected
   send(F("#:GC#")); // get the date stored in the LX200
-  _is_debug = receive(data) > 0? false:true;
+  _is_debug = receive(data, REPLY_SIZE) > 0? false:true;
 
 
   if(!_is_debug){
 
-    // toggle LX200 to return high precision alt/az data
+    // toggle LX200 to return high precision alt/az data. Both
+    // precisions can be parsed, so give up after a few tries
     int len = 0;
+    int tries = 0;
     do{
       send(F("#:U#")); // toggle precision
     
       // test by getting alt
       send(F("#:GA#")); // get alt
-      len = receive(data);
-    }while (len <= 7);
+      len = receive(data, REPLY_SIZE);
+    }while ((len <= 7) && (++tries < PRECISION_TRIES));
 
 
     // get current site information
-    send(F("#:Gt#"));
-    receive(data);
-    double sign = data[0] == '-'? -1.0:1.0;
-    double d = data[1]*10+data[2];
-    double m = data[4]*10+data[5];
+    double latitude = CHICAGO_LATITUDE;
+    if(query_field(F("#:Gt#"), &latitude) < 0){
+      latitude = CHICAGO_LATITUDE;
+    }
 
-    _latitude_rad = sign*(d + m*0.01666666667)*DEG2RAD;        
+    _latitude_rad = latitude*DEG2RAD;        
   }
   else {
     _latitude_rad = CHICAGO_LATITUDE*DEG2RAD;    
@@ -128,9 +298,25 @@ int Telescope::Init()
 {
 
   double alt, az;
+  const double time = static_cast<double>(millis())*1e-3;
+
+  // in the FUSED mode the first fix also starts the model
+  reset_fusion();
+  _lst = -1;
 
   if(!_is_debug){
-    if(get_altaz(&alt, &az) < 0){
+    // for the checkpoints of the DeRotator, which must not wait
+    // for the LX200 once derotation has started
+    if(read_sidereal_time(&_lst, &_lst_time) < 0){
+      _lst = -1;
+    }
+
+    if((_mode == EPHEMERIS) && (read_ephemeris() == 0)){
+      get_ephemeris_altaz(time, &alt, &az);
+    }
+    else if(get_altaz(&alt, &az) < 0){
+      // in the EPHEMERIS mode the fix is used instead when the
+      // RA, Dec cannot be read
       return -1;
     }
   }
@@ -152,6 +338,52 @@ int Telescope::Init()
       Serial.println(az, 7);
 #endif  
 
+  if(_fix_count == 0){
+    anchor_model(time, alt, az);
+  }
+
+  return 0;
+}
+
+int Telescope::GetAltAz(const double time, double* alt, double* az) 
+{
+  if(!_is_debug){
+    if(get_altaz(alt, az) < 0){
+      return -1;
+    }
+  }
+  else {
+    get_model_altaz(time, alt, az);
+  }
+  
+  return 0;
+}
+
+void Telescope::get_model_altaz(const double time, double* alt, double* az)
+{
+  const double dt = time - _model_time;
+
+  if((dt < 0) || (dt > MODEL_CARRY_S) || (_model_steps >= MODEL_CARRY)){
+    resync_model(time);
+    *alt = _model_alt;
+    *az = _model_az;
+    return;
+  }
+
+  // a short time on, the Taylor series of alt, az is good to far
+  // below an arcsec
+  _model_steps++;
+  *alt = _model_alt + dt*(_alt_rate + 0.5*dt*_alt_acc);
+  *az = _model_az + dt*(_az_rate + 0.5*dt*_az_acc);
+
+  if(*az >= 360.0)
+    *az -= 360.0;
+  else if(*az < 0)
+    *az += 360.0;
+}
+
+void Telescope::anchor_model(const double time, const double alt, const double az)
+{
   _alt0_rad = alt*DEG2RAD;
   _az0_rad = az*DEG2RAD;
 
@@ -159,34 +391,437 @@ int Telescope::Init()
   _Y0 = -cos(_alt0_rad)*sin(_az0_rad);
   _Z0 = sin(_alt0_rad);
 
-  _start_time = static_cast<double>(millis())*1e-3;
+  _start_time = time;
+
+  // the pole is at (cos(latitude), 0, sin(latitude))
+  _pole_x = cos(_latitude_rad);
+  _pole_z = sin(_latitude_rad);
+  resync_model(time);
+}
+
+void Telescope::resync_model(const double time)
+{
+  // the stars turn from east to west, i.e. clockwise about the pole
+  double R[3][3];
+  sky_rotation(-OMEGA*(time - _start_time), R);
+
+  const double X = R[0][0]*_X0 + R[0][1]*_Y0 + R[0][2]*_Z0;
+  const double Y = R[1][0]*_X0 + R[1][1]*_Y0 + R[1][2]*_Z0;
+  const double Z = R[2][0]*_X0 + R[2][1]*_Y0 + R[2][2]*_Z0;
+
+  // velocity v = -OMEGA pole x star and acceleration -OMEGA pole x v
+  const double px = _pole_x, pz = _pole_z;
+  const double vX = OMEGA*pz*Y;
+  const double vY = -OMEGA*(pz*X - px*Z);
+  const double vZ = -OMEGA*px*Y;
+  const double aX = OMEGA*pz*vY;
+  const double aY = -OMEGA*(pz*vX - px*vZ);
+  const double aZ = -OMEGA*px*vY;
+
+  // sin(alt) = Z and tan(az) = -Y/X
+  const double rho2 = X*X + Y*Y;
+  const double rho = sqrt(rho2);
+  _model_alt = atan2(Z, rho)*RAD2DEG;
+  _model_az = atan2(-Y, X)*RAD2DEG;
+  if(_model_az < 0)
+    _model_az += 360.0;
+
+  const double alt_rate = vZ/rho;
+  const double az_rate = (Y*vX - X*vY)/rho2;
+  _alt_rate = alt_rate*RAD2DEG;
+  _alt_acc = (aZ + Z*alt_rate*alt_rate)/rho*RAD2DEG;
+  _az_rate = az_rate*RAD2DEG;
+  _az_acc = ((Y*aX - X*aY) - 2*az_rate*(X*vX + Y*vY))/rho2*RAD2DEG;
+
+  _model_time = time;
+  _model_steps = rho < MODEL_ZENITH_COS_ALT? MODEL_CARRY:0;
+}
+
+void Telescope::sky_rotation(const double Omegat, double R[3][3]) const
+{
+  // Rodrigues: R = cos I + sin [pole]x + (1 - cos) pole pole^T
+  double c, s, d;
+  const double t2 = Omegat*Omegat;
+  if(fabs(Omegat) < OMEGA*MODEL_MAX_STEP_S){
+    // the next terms are below 1e-16
+    d = t2/2*(1 - t2/12*(1 - t2/30));
+    c = 1 - d;
+    s = Omegat*(1 - t2/6*(1 - t2/20));
+  }
+  else {
+    c = cos(Omegat);
+    s = sin(Omegat);
+    d = 1 - c;
+  }
+
+  const double px = _pole_x, pz = _pole_z;
+  R[0][0] = c + d*px*px;  R[0][1] = -s*pz;  R[0][2] = d*px*pz;
+  R[1][0] = s*pz;         R[1][1] = c;      R[1][2] = -s*px;
+  R[2][0] = d*px*pz;      R[2][1] = s*px;   R[2][2] = c + d*pz*pz;
+}
+
+void Telescope::reset_fusion()
+{
+  _fix_time = 0;
+  _fix_count = 0;
+  _bias_alt = _bias_az = 0;
+  _bias_alt_rate = _bias_az_rate = 0;
+  _innovation_alt = _innovation_az = 0;
+  _sum_innovation2 = 0;
+  _sum_residual2 = 0;
+}
+
+void Telescope::get_fused_altaz(const double time, double* alt, double* az)
+{
+  const double dt = time - _fix_time;
+
+  get_model_altaz(time, alt, az);
+  *alt += _bias_alt + _bias_alt_rate*dt;
+  *az += _bias_az + _bias_az_rate*dt;
+
+  if(*az >= 360.0)
+    *az -= 360.0;
+  else if(*az < 0)
+    *az += 360.0;
+}
+
+void Telescope::fuse(const double time, double* alt, double* az)
+{
+  if(_fix_count == 0){
+    anchor_model(time, *alt, *az);
+    _fix_time = time;
+    _fix_count++;
+    return;
+  }
+
+  // innovation: the fix minus the model and the predicted bias
+  double model_alt, model_az;
+  get_fused_altaz(time, &model_alt, &model_az);
+
+  const double dt = time - _fix_time;
+  const double innovation2 = innovation(*alt, *az, model_alt, model_az);
+
+  _fix_time = time;
+  _fix_count++;
+
+  if(innovation2 > FUSION_SLEW_DEG*FUSION_SLEW_DEG){
+    // the telescope has been moved: restart from the fix
+    anchor_model(time, *alt, *az);
+    _bias_alt = _bias_az = 0;
+    _bias_alt_rate = _bias_az_rate = 0;
+    return;
+  }
+
+  _bias_alt += _bias_alt_rate*dt + FUSION_ALPHA*_innovation_alt;
+  _bias_az += _bias_az_rate*dt + FUSION_ALPHA*_innovation_az;
+  if(dt > 0){
+    _bias_alt_rate += FUSION_BETA*_innovation_alt/dt;
+    _bias_az_rate += FUSION_BETA*_innovation_az/dt;
+  }
+
+  _sum_innovation2 += innovation2;
+  _sum_residual2 += (1 - FUSION_ALPHA)*(1 - FUSION_ALPHA)*innovation2;
+
+  get_fused_altaz(time, alt, az);
+}
+
+double Telescope::innovation(const double alt, const double az,
+			     const double model_alt, const double model_az)
+{
+  double daz = az - model_az;
+  if(daz > 180.0)
+    daz -= 360.0;
+  else if(daz < -180.0)
+    daz += 360.0;
+
+  _innovation_alt = alt - model_alt;
+  _innovation_az = daz;
+
+  // compare on the sky, i.e. az shrinks by cos(alt)
+  const double cos_alt = cos(alt*DEG2RAD);
+  return _innovation_alt*_innovation_alt + daz*daz*cos_alt*cos_alt;
+}
+
+int Telescope::read_ephemeris()
+{
+  double ra, dec, longitude, lst;
+
+  if((query_field(F("#:GR#"), &ra) < 0) ||
+     (query_field(F("#:GD#"), &dec) < 0) ||
+     (query_field(F("#:Gg#"), &longitude) < 0)){
+    return -1;
+  }
+
+  double time;
+  if(read_sidereal_time(&lst, &time) < 0){
+    return -1;
+  }
+
+  _ha0_rad = (lst - ra)*15.0*DEG2RAD;
+  _dec_rad = dec*DEG2RAD;
+  _ephemeris_time = time;
+  _longitude = longitude;
+
+  // this counts as the first fix
+  _fix_time = time;
+  _fix_count = 1;
 
   return 0;
 }
 
-int Telescope::GetAltAz(const double time, double* alt, double* az) 
+void Telescope::anchor_ephemeris(const double time, const double alt, const double az)
 {
-  if(!_is_debug){
-    if(get_altaz(alt, az) < 0){
+  const double alt_rad = alt*DEG2RAD;
+  const double az_rad = az*DEG2RAD;
+  const double sin_lat = sin(_latitude_rad);
+  const double cos_lat = cos(_latitude_rad);
+
+  // az is from north through east
+  _dec_rad = asin(sin(alt_rad)*sin_lat + cos(alt_rad)*cos_lat*cos(az_rad));
+  _ha0_rad = atan2(-sin(az_rad)*cos(alt_rad),
+		   sin(alt_rad)*cos_lat - cos(alt_rad)*sin_lat*cos(az_rad));
+  _ephemeris_time = time;
+}
+
+void Telescope::get_ephemeris_altaz(const double time, double* alt, double* az) const
+{
+  const double H = _ha0_rad + OMEGA*(time - _ephemeris_time);
+  const double sin_lat = sin(_latitude_rad);
+  const double cos_lat = cos(_latitude_rad);
+  const double sin_dec = sin(_dec_rad);
+  const double cos_dec = cos(_dec_rad);
+
+  *alt = asin(sin_dec*sin_lat + cos_dec*cos_lat*cos(H))*RAD2DEG;
+  *az = atan2(-cos_dec*sin(H), sin_dec*cos_lat - cos_dec*cos(H)*sin_lat)*RAD2DEG;
+
+  if(*az < 0)
+    *az += 360.0;
+}
+
+void Telescope::check_slew(const double time, double* alt, double* az)
+{
+  if(_fix_count == 0){
+    // the RA, Dec could not be read at Init()
+    anchor_ephemeris(time, *alt, *az);
+    _fix_time = time;
+    _fix_count++;
+    return;
+  }
+
+  double model_alt, model_az;
+  get_ephemeris_altaz(time, &model_alt, &model_az);
+  const double innovation2 = innovation(*alt, *az, model_alt, model_az);
+
+  _fix_time = time;
+  _fix_count++;
+
+  if(innovation2 > FUSION_SLEW_DEG*FUSION_SLEW_DEG){
+    anchor_ephemeris(time, *alt, *az);
+    return;
+  }
+
+  _sum_innovation2 += innovation2;
+
+  if((fabs(_innovation_alt) > EPHEMERIS_TOLERANCE_DEG) ||
+     (fabs(_innovation_az) > EPHEMERIS_TOLERANCE_DEG)){
+    // the ephemeris has drifted off. Near the zenith this is in az
+    // and not on the sky, but the derotation rate goes with az, so
+    // start again from the fix
+    anchor_ephemeris(time, *alt, *az);
+    return;
+  }
+
+  _sum_residual2 += innovation2;
+
+  *alt = model_alt;
+  *az = model_az;
+}
+
+int Telescope::BeginQuery(const double time)
+{
+  if((_query_state == QUERY_ALT) || (_query_state == QUERY_AZ)){
+    return -1;
+  }
+
+  if(_is_debug){
+    get_model_altaz(time, &_query_alt, &_query_az);
+    _query_state = QUERY_DONE;
+    return 0;
+  }
+
+  if((_mode != DIRECT) && (_fix_count > 0) && ((time - _fix_time) < _fix_interval)){
+    // no fix is due: the model alone is good enough
+    if(_mode == FUSED){
+      get_fused_altaz(time, &_query_alt, &_query_az);
+    }
+    else {
+      get_ephemeris_altaz(time, &_query_alt, &_query_az);
+    }
+    _query_state = QUERY_DONE;
+    return 0;
+  }
+
+  // throw away anything left over from an earlier reply
+  while(Serial2.available() > 0){
+    Serial2.read();
+  }
+
+  reset_field();
+  _query_start_us = micros();
+  _query_time = time;
+  _query_state = QUERY_ALT;
+  // pipeline both commands so that the fix costs one round trip
+  send_nowait(F("#:GA#:GZ#")); // get alt and az
+
+  return 1;
+}
+
+int Telescope::Poll()
+{
+  if((_query_state != QUERY_ALT) && (_query_state != QUERY_AZ)){
+    return _query_state == QUERY_DONE? 0:-1;
+  }
+
+  while(Serial2.available() > 0){
+    const int status = parse_field(Serial2.read(),
+				   _query_state == QUERY_ALT? &_query_alt:&_query_az);
+    if(status > 0){
+      continue;
+    }
+
+    if(status < 0){
+      // garbage from the LX200
+      _query_state = QUERY_FAILED;
       return -1;
     }
+
+    reset_field();
+    if(_query_state == QUERY_ALT){
+      // the az reply is already on its way
+      _query_start_us = micros();
+      _query_state = QUERY_AZ;
+    }
+    else {
+      if(_mode == FUSED){
+	fuse(_query_time, &_query_alt, &_query_az);
+      }
+      else if(_mode == EPHEMERIS){
+	check_slew(_query_time, &_query_alt, &_query_az);
+      }
+      _query_state = QUERY_DONE;
+      return 0;
+    }
   }
-  else {
-    const double Omegat = OMEGA*(time - _start_time);
 
-    const double X = cos(_latitude_rad)*(_X0*cos(_latitude_rad)+_Z0*sin(_latitude_rad))*(1-cos(Omegat))+
-      _X0*cos(Omegat)-_Y0*sin(_latitude_rad)*sin(Omegat);
-    const double Y = _Y0*cos(Omegat)+(_X0*sin(_latitude_rad)-_Z0*cos(_latitude_rad))*sin(Omegat);
-    const double Z = sin(_latitude_rad)*(_X0*cos(_latitude_rad)+_Z0*sin(_latitude_rad))*(1-cos(Omegat))+
-      _Z0*cos(Omegat)+_Y0*cos(_latitude_rad)*sin(Omegat);
-  
-    *az = atan2(-Y, X)*RAD2DEG;
-    *alt = atan2(Z*cos(*az*DEG2RAD), X)*RAD2DEG;
+  if((micros() - _query_start_us) > QUERY_TIMEOUT_US){
+    _query_state = QUERY_FAILED;
+    return -1;
+  }
+
+  return 1;
+}
 
-    if(*az < 0)
-      *az += 360.0;
+int Telescope::Result(double* alt, double* az)
+{
+  switch(_query_state){
+    case QUERY_DONE:
+      *alt = _query_alt;
+      *az = _query_az;
+      _query_state = QUERY_IDLE;
+      return 0;
+
+    case QUERY_ALT:
+    case QUERY_AZ:
+      return 1;
+
+    default:
+      _query_state = QUERY_IDLE;
+      return -1;
   }
-  
+}
+
+bool Telescope::IsQuerying() const
+{
+  return _query_state != QUERY_IDLE;
+}
+
+void Telescope::CancelQuery()
+{
+  _query_state = QUERY_IDLE;
+}
+
+void Telescope::SetMode(const MODE mode)
+{
+  _mode = mode;
+}
+
+Telescope::MODE Telescope::GetMode() const
+{
+  return _mode;
+}
+
+int Telescope::SetFixInterval(const double interval)
+{
+  if(interval <= 0){
+    return -1;
+  }
+
+  _fix_interval = interval;
+  return 0;
+}
+
+double Telescope::GetFixInterval() const
+{
+  return _fix_interval;
+}
+
+long Telescope::GetFixCount() const
+{
+  return _fix_count;
+}
+
+void Telescope::GetInnovation(double* alt, double* az) const
+{
+  *alt = _innovation_alt;
+  *az = _innovation_az;
+}
+
+double Telescope::GetInnovationRMS() const
+{
+  // the first fix only starts the model
+  return _fix_count > 1? sqrt(_sum_innovation2/(_fix_count - 1)):0;
+}
+
+double Telescope::GetResidualRMS() const
+{
+  return _fix_count > 1? sqrt(_sum_residual2/(_fix_count - 1)):0;
+}
+
+double Telescope::GetLongitude() const
+{
+  return _longitude;
+}
+
+int Telescope::GetSiderealTime(double* lst) const
+{
+  if(_is_debug || (_lst < 0)){
+    return -1;
+  }
+
+  const double time = static_cast<double>(millis())*1e-3;
+  *lst = _lst + (time - _lst_time)*SIDEREAL_RATE/3600.0;
+  *lst -= 24.0*floor(*lst/24.0);
+  return 0;
+}
+
+int Telescope::read_sidereal_time(double* lst, double* time)
+{
+  // the sidereal time is for when it was asked for
+  *time = static_cast<double>(millis())*1e-3;
+  if((query_field(F("#:GS#"), lst) < 0) || (*lst < 0) || (*lst >= 24.0)){
+    return -1;
+  }
+
   return 0;
 }
 
@@ -208,7 +843,16 @@ int Telescope::send(const __FlashStringHelper* cmd) const
   return 0;
 }
 
-int Telescope::receive(int* const data) const
+int Telescope::send_nowait(const __FlashStringHelper* cmd) const
+{
+  // the command is much shorter than the transmit buffer, so this
+  // does not block
+  Serial2.println(cmd);
+
+  return 0;
+}
+
+int Telescope::receive(int* const data, const int size) const
 {
 
   int* pdata = data;
@@ -225,6 +869,10 @@ int Telescope::receive(int* const data) const
       wait_i = 0; // reset wait
       
       len += num_bytes;
+      if(len > size){
+	// garbage from the LX200
+	return -1;
+      }
       for(int i=0; i<num_bytes; i++){
 	int ch = Serial2.read();
 	*pdata++ = ch;
@@ -249,46 +897,116 @@ int Telescope::receive(int* const data) const
 
 }
 
-int Telescope::get_altaz(double* alt, double* az) const
+int Telescope::query_field(const __FlashStringHelper* cmd, double* value)
 {
-  int data[32];
-  
-  send(F("#:GA#")); // get alt
-  if(receive(data) > 0){
-    *alt = convert2alt(data);
+  int data[REPLY_SIZE];
+
+  // a reply that is still arriving, e.g. of a cancelled query,
+  // would be taken for this one
+  while(Serial2.available() > 0){
+    Serial2.read();
   }
-  else {
-    return -1;
+
+  send(cmd);
+  const int len = receive(data, REPLY_SIZE);
+
+  int status = -1;
+  reset_field();
+  for(int i=0; i<len; i++){
+    if((status = parse_field(data[i], value)) <= 0)
+      break;
   }
+  reset_field();
+
+  return status == 0? 0:-1;
+}
 
-  send(F("#:GZ#")); // get az
-  if(receive(data) > 0){
-    *az = convert2az(data);
+int Telescope::get_altaz(double* alt, double* az)
+{
+  // wait for the query in flight, if any, or start a new one
+  if((_query_state != QUERY_ALT) && (_query_state != QUERY_AZ)){
+    BeginQuery(static_cast<double>(millis())*1e-3);
   }
-  else {
-    return -2;
+
+  while(Poll() > 0){
   }
-  
-  return 0;
+
+  return Result(alt, az);
 }
 
-double Telescope::convert2alt(const int* deg_min_s) const
+void Telescope::reset_field()
 {
-  double sign = deg_min_s[0] == '-'? -1: 1;
-  
-  double d = (deg_min_s[1] - '0')*10+(deg_min_s[2] - '0');
-  double m = (deg_min_s[4] - '0')*10+(deg_min_s[5] - '0');
-  double s = (deg_min_s[7] - '0')*10+(deg_min_s[8] - '0');
-  // conversion is  sign*(d + m/60.0 + s/3600.0)
-  return sign*(d + m*0.01666666667 + s*0.0002777777778);
+  _field_len = 0;
+  _field_part = 0;
+  _field_digits = 0;
+  _is_field_negative = false;
+  _is_field_decimal = false;
+  _field[0] = _field[1] = _field[2] = 0;
 }
 
-double Telescope::convert2az(const int* deg_min_s) const
+int Telescope::parse_field(const int ch, double* value)
 {
-  double d = (deg_min_s[0] - '0')*100+(deg_min_s[1] - '0')*10+(deg_min_s[2] - '0');
-  double m = (deg_min_s[4] - '0')*10+(deg_min_s[5] - '0');
-  double s = (deg_min_s[7] - '0')*10+(deg_min_s[8] - '0');
+  if(++_field_len > FIELD_SIZE){
+    return -1;
+  }
+
+  if((ch >= '0') && (ch <= '9')){
+    // only tenths after the decimal point
+    if(_field_digits >= (_is_field_decimal? 1:3)){
+      return -1;
+    }
+    _field[_field_part] = _field[_field_part]*10 + (ch - '0');
+    _field_digits++;
+    return 1;
+  }
+
+  switch(ch){
+    case '+':
+    case '-':
+      if(_field_len != 1){
+	return -1;
+      }
+      _is_field_negative = ch == '-';
+      return 1;
+
+    case '*':
+    case ':':
+    case '\'':
+    case LX200_DEGREE_SIGN:
+      // next of degrees, minutes and seconds
+      if((_field_digits == 0) || (_field_part >= 2)){
+	return -1;
+      }
+      _field_part++;
+      _field_digits = 0;
+      return 1;
+
+    case '.':
+      // tenths of minutes as in HH:MM.T
+      if((_field_digits == 0) || (_field_part != 1)){
+	return -1;
+      }
+      _field_part++;
+      _field_digits = 0;
+      _is_field_decimal = true;
+      return 1;
+
+    case '#':
+      // at least sDD*MM#
+      if((_field_part == 0) || (_field_digits == 0)){
+	return -1;
+      }
+      if(_is_field_decimal){
+	_field[2] *= 6; // 0.1 minutes = 6 seconds
+      }
+      // conversion is  sign*(d + m/60.0 + s/3600.0)
+      *value = _field[0] + _field[1]*0.01666666667 + _field[2]*0.0002777777778;
+      if(_is_field_negative){
+	*value = -*value;
+      }
+      return 0;
 
-  // conversion is  (d + m/60.0 + s/3600.0)  
-  return (d + m*0.01666666667 + s*0.0002777777778);  
+    default:
+      return -1;
+  }
 }
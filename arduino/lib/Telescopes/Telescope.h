@@ -48,16 +48,120 @@ INTERFACE
 				- Returns 0 on success
 
 	Init(			- initialize the telescope instance
-				  by reading the LX200 alt-az position
-				  and other housekeeping duties.
+				  by reading the LX200 alt-az position,
+				  the sidereal time and other
+				  housekeeping duties.
 	)			- returns 0 on success
 
 	GetAltAz(		- get the alt-az position of the
-			          telescope
+			          telescope. Blocks until the LX200
+				  has replied.
 	  time			- at this time
 	  alt, az		- the returned alt, az in degrees
 	)			- returns 0 on success
 
+	BeginQuery(		- start getting the alt-az position of
+				  the telescope without waiting for
+				  the LX200 to reply. GA and GZ are
+				  sent together so that the fix costs
+				  one round trip.
+	  time			- at this time
+	)			- returns 1 if the query was sent to
+				  the LX200.
+				  returns 0 if the model answered it,
+				  i.e. in the FUSED or EPHEMERIS mode
+				  between fixes or in the debug mode.
+				  returns -1 if a query is already
+				  in flight.
+
+	Poll()			- read the bytes of the reply that have
+				  arrived so far. Never blocks.
+				  Returns 1 if the query is in flight.
+				  Returns 0 if the result is ready.
+				  Returns -1 if the LX200 did not reply
+				  within QUERY_TIMEOUT_US or if no
+				  query was started.
+
+	Result(			- get the result of the query
+	  alt, az		- the returned alt, az in degrees
+	)			- returns 0 on success and the
+				  telescope is ready for the next
+				  BeginQuery().
+				  returns 1 if the query is in flight.
+				  returns -1 if the query failed. The
+				  telescope is ready for the next
+				  BeginQuery().
+
+	IsQuerying()		- returns true if a query has been
+				  started and Result() has not yet
+				  returned 0 or -1.
+
+	CancelQuery()		- forget the query in flight.
+
+	SetMode(		- choose where the alt-az position
+				  comes from
+	  mode			- DIRECT: the default. Every query
+				  is sent to the LX200.
+				  FUSED: the alt-az position is
+				  propagated by the sky rotation
+				  model and corrected by an LX200
+				  fix every fix interval with an
+				  alpha-beta filter. A fix that
+				  disagrees by more than
+				  FUSION_SLEW_DEG is taken to be a
+				  slew and restarts the model.
+				  EPHEMERIS: the RA, Dec and the
+				  sidereal time are read from the
+				  LX200 at Init() and the alt-az
+				  position is calculated from them.
+				  The LX200 is only queried every fix
+				  interval to find out whether the
+				  telescope has been slewed or the
+				  alt or az is more than 1 arcmin off,
+				  in which case the RA, Dec are
+				  recalculated from the fix.
+	)			  Takes effect from Init().
+
+	GetMode()		- returns the mode
+
+	SetFixInterval(		- the time between LX200 fixes in the
+	  interval		- FUSED mode in s. Default: 30 s
+	)			- returns 0 on success.
+				  returns -1 if interval is <= 0
+
+	GetFixInterval()	- returns the fix interval in s
+
+	GetFixCount()		- returns the number of LX200 fixes
+				  used by the FUSED or EPHEMERIS mode
+				  since Init()
+
+	GetInnovation(		- the difference between the last
+				  LX200 fix and the model before it
+				  was corrected
+	  alt, az		- in degrees
+	)
+
+	GetInnovationRMS()	- returns the rms of the innovations
+				  since Init() in degrees
+
+	GetResidualRMS()	- returns the rms of the differences
+				  between the LX200 fixes and the
+				  model after it was corrected, in
+				  degrees
+
+	GetLongitude()		- returns the site longitude in
+				  degrees, west positive as the LX200
+				  has it. Only read in the EPHEMERIS
+				  mode.
+
+	GetSiderealTime(	- the local sidereal time, carried on
+				  from the one read at Init() so that
+				  the LX200 is not asked again
+	  lst			- in hours
+	)			- returns 0 on success.
+				  returns -1 if the LX200 did not give
+				  it at Init() or in the debug mode.
+
 AUTHOR                                          
 
         C.Y. Tan
@@ -85,15 +189,54 @@ public:
   int Init();
   int GetAltAz(const double time, double* alt,  double* az);
   double GetLatitude() const;
+
+  int BeginQuery(const double time);
+  int Poll();
+  int Result(double* alt, double* az);
+  bool IsQuerying() const;
+  void CancelQuery();
+
+  enum MODE {DIRECT, FUSED, EPHEMERIS};
+
+  void SetMode(const MODE mode);
+  MODE GetMode() const;
+  int SetFixInterval(const double interval);
+  double GetFixInterval() const;
+
+  long GetFixCount() const;
+  void GetInnovation(double* alt, double* az) const;
+  double GetInnovationRMS() const;
+  double GetResidualRMS() const;
+
+  double GetLongitude() const;
+  int GetSiderealTime(double* lst) const;
  
 private:
   int send(const __FlashStringHelper* cmd) const;
-  int receive(int* const data) const;
+  int send_nowait(const __FlashStringHelper* cmd) const;
+  int receive(int* const data, const int size) const;
+  int query_field(const __FlashStringHelper* cmd, double* value);
+  int read_sidereal_time(double* lst, double* time);
+
+  int get_altaz(double* alt, double* az);
+  void get_model_altaz(const double time, double* alt, double* az);
 
-  int get_altaz(double* alt, double* az) const;
+  void anchor_model(const double time, const double alt, const double az);
+  void sky_rotation(const double Omegat, double R[3][3]) const;
+  void resync_model(const double time);
+  void reset_fusion();
+  void get_fused_altaz(const double time, double* alt, double* az);
+  void fuse(const double time, double* alt, double* az);
+  double innovation(const double alt, const double az,
+		    const double model_alt, const double model_az);
+
+  int read_ephemeris();
+  void anchor_ephemeris(const double time, const double alt, const double az);
+  void get_ephemeris_altaz(const double time, double* alt, double* az) const;
+  void check_slew(const double time, double* alt, double* az);
   
-  double convert2alt(const int* deg_min_s) const;
-  double convert2az(const int* deg_min_s) const;
+  void reset_field();
+  int parse_field(const int ch, double* value);
 
 private:
   double _alt0_rad;
@@ -103,9 +246,58 @@ private:
 
   double _start_time;
 
+  // the sky rotation model, evaluated exactly at _model_time
+  double _pole_x, _pole_z;
+  double _model_time;		// s
+  double _model_alt, _model_az;	// degrees
+  double _alt_rate, _az_rate;	// degrees/s
+  double _alt_acc, _az_acc;	// degrees/s^2
+  long _model_steps;		// calls since the last resync_model()
+
 private:
   double _latitude_rad;
 
+private:
+  enum QUERY_STATE {QUERY_IDLE, QUERY_ALT, QUERY_AZ, QUERY_DONE, QUERY_FAILED};
+  enum {REPLY_SIZE = 32, FIELD_SIZE = 16};
+
+  QUERY_STATE _query_state;
+  unsigned long _query_start_us;
+  double _query_time;
+  double _query_alt, _query_az;
+
+private:
+  // alpha-beta filter of the LX200 fix minus the model
+  MODE _mode;
+  double _fix_interval;		// s
+  double _fix_time;		// time of the last fix in s
+  long _fix_count;
+  double _bias_alt, _bias_az;	// degrees
+  double _bias_alt_rate, _bias_az_rate; // degrees/s
+  double _innovation_alt, _innovation_az;
+  double _sum_innovation2;
+  double _sum_residual2;
+
+private:
+  // hour angle and declination of the EPHEMERIS mode
+  double _ha0_rad, _dec_rad;
+  double _ephemeris_time;	// time of _ha0_rad in s
+  double _longitude;		// degrees west
+
+private:
+  // sidereal time read at Init()
+  double _lst;			// hours. < 0 if unknown
+  double _lst_time;		// s
+
+private:
+  // state of the streaming parser of one sDD*MM'SS# reply
+  int _field_len;
+  int _field_part;
+  int _field_digits;
+  bool _is_field_negative;
+  bool _is_field_decimal;
+  long _field[3];
+
 private:  
   bool _is_debug;
   
@@ -35,8 +35,6 @@
 
 #include "UserIO.h"
 
-#define MECHANICAL_STEPSIZE	0.05970731707 // deg/step
-
 /**********************************************************************
 	Defines for the LCD
  **********************************************************************/
@@ -269,6 +267,25 @@ void UserIO::Init(DeRotator* const derotator,
   if(load_saved_settings() != 0){
     _userio->LoadDefaultSettings();
   }
+
+  // and where the stepper was when the power went away, so that
+  // there is no need to go to the Hall home
+  switch(_derotator->RestorePosition()){
+    case 0:
+      Print("Position", "restored", 1000);
+      break;
+    case -2:
+      Print("Position lost", "Goto HALL Home", 2000);
+      break;
+  }
+
+  // the power went away while derotating, so carry on from where it
+  // left off once the telescope can be asked where it is
+  if(_derotator->IsResumePending()){
+    Print("Derotation", "resuming", 1000);
+    _is_start_derotator = true;
+    _is_stop_derotator = false;
+  }
 }
 
 void UserIO::ShowStartupMessage()
@@ -388,7 +405,7 @@ int UserIO::ServiceSetup()
   if(_is_got_user_home){
     char buf[32];
     _derotator->SetUserHome();
-    sprintf(buf, "%d", _derotator->GetUserHome()*MECHANICAL_STEPSIZE);	
+    sprintf(buf, "%d", static_cast<int>(_derotator->GetGearTrain().ToDegrees(_derotator->GetUserHome())));
     
     _userio->Print("Setting Home to",
 		   buf,
@@ -405,7 +422,7 @@ int UserIO::ServiceSetup()
     // Therefore SetMaxCCW() is here.        
     _derotator->SetMaxCCW();
 
-    sprintf(buf, "%d", _derotator->GetMaxCCW()*MECHANICAL_STEPSIZE);	
+    sprintf(buf, "%d", static_cast<int>(_derotator->GetGearTrain().ToDegrees(_derotator->GetMaxCCW())));
     
     _userio->Print("Setting CW to",
 		   buf,
@@ -421,7 +438,7 @@ int UserIO::ServiceSetup()
     // Therefore SetMaxCW() is here.
     _derotator->SetMaxCW();
 
-    sprintf(buf, "%d", _derotator->GetMaxCW()*MECHANICAL_STEPSIZE);	
+    sprintf(buf, "%d", static_cast<int>(_derotator->GetGearTrain().ToDegrees(_derotator->GetMaxCW())));
     
     _userio->Print("Setting CCW to",
 		   buf,
@@ -450,7 +467,27 @@ int UserIO::ServiceDeRotator()
     _telescope->GetAltAz(static_cast<double>(millis())*1e-3, &alt, &az);
     PrintAltAzRot(alt, az, 0.0);
   
-    if(_derotator->Start(alt, az) < 0){
+    if(_derotator->IsResumePending()){
+      // on the LCD, because the serial port may be carrying the
+      // packets of the SerialServer by now
+      _lcd.setCursor(0,1);
+      const int status = _derotator->Resume(alt, az);
+      if(status == -3){
+	// the checkpoint cannot be trusted, so start afresh
+	_lcd.print(F("Resume refused  "));
+	_derotator->Start(alt, az);
+      }
+      else if(status < 0){
+	_lcd.print(F("Resume failed   "));
+      }
+      else {
+	double gap_s, rotation;
+	_derotator->GetResumeGap(&gap_s, &rotation);
+	_lcd.print(F("Resumed "));
+	_lcd.print(gap_s, 0); _lcd.print(F("s     "));
+      }
+    }
+    else if(_derotator->Start(alt, az) < 0){
       Serial.print(F("setup(): Cannot start derotator."));
     }
 
@@ -631,6 +668,8 @@ void UserIO::SaveSettings()
   _userio->_userio_memento._max_ccw = _derotator->GetMaxCW();
   _userio->_userio_memento._is_clockwise = _derotator->GetCorrectionDirection()? 1:0;
   _userio->_userio_memento._is_limits_enabled = _derotator->IsEnableLimits()? 1:0;
+  _userio->_userio_memento._gear_ratio = _derotator->GetGearTrain().GetRatio();
+  _userio->_userio_memento._steps_per_turn = _derotator->GetGearTrain().GetStepsPerTurn();
   
   _tcpServer->GetSSID(_userio->_userio_memento._WLAN_ssid);
   _tcpServer->GetPass(_userio->_userio_memento._WLAN_pass);
@@ -662,6 +701,9 @@ void UserIO::LoadSavedSettings()
 
 void UserIO::LoadDefaultSettings()
 {
+  // the limits are converted to steps with the gear train
+  const GearTrain gear_train;
+  _derotator->SetGearTrain(gear_train);
   _derotator->LoadLimits();
 
   _tcpServer->SetSSID(WLAN_SSID);
@@ -670,10 +712,12 @@ void UserIO::LoadDefaultSettings()
 
   // update the memento
   _userio->_userio_memento._home_pos = 0;
-  _userio->_userio_memento._max_cw = static_cast<long>(90.0/MECHANICAL_STEPSIZE);
-  _userio->_userio_memento._max_ccw = static_cast<long>(-90/MECHANICAL_STEPSIZE);
+  _userio->_userio_memento._max_cw = gear_train.ToSteps(90.0);
+  _userio->_userio_memento._max_ccw = gear_train.ToSteps(-90.0);
   _userio->_userio_memento._is_clockwise = 1;
   _userio->_userio_memento._is_limits_enabled = 0;  
+  _userio->_userio_memento._gear_ratio = gear_train.GetRatio();
+  _userio->_userio_memento._steps_per_turn = gear_train.GetStepsPerTurn();
 
   strcpy(_userio->_userio_memento._WLAN_ssid, WLAN_SSID);
   _userio->_userio_memento._WLAN_ssid[strlen(WLAN_SSID)] = '\0';
@@ -692,6 +736,19 @@ void UserIO::ForceLCDPrintMenu(menu& m, bool drawExit)
   _menulcd.force_printMenu(m, drawExit);
 }
 
+void UserIO::ShowControlMenu()
+{
+  main_menu.activeNode = &control_menu;
+}
+
+void UserIO::ShowSetupMenu(const bool is_redraw)
+{
+  main_menu.activeNode = &setup_menu;
+  if(is_redraw){
+    ForceLCDPrintMenu(setup_menu, true);
+  }
+}
+
 
 void UserIO::SetInitDeRotatorFlag()
 {
@@ -709,6 +766,7 @@ void UserIO::SetInitDeRotatorFlag()
   }
   else {
     _userio->ForceLCDPrintMenu(control_menu, true);
+    _userio->_derotator->Stop();
     _userio->_is_start_derotator = false;
     _userio->_is_stop_derotator = true;
   }
@@ -718,8 +776,12 @@ void UserIO::SetStopDeRotatorFlag()
 {
   if(_userio->_is_stop_derotator == false){
     _userio->ForceLCDPrintMenu(control_menu, true);    
+
+    // so that the session is not resumed after a power cycle
+    _userio->_derotator->Stop();
   }
-  
+
+  _userio->_is_start_derotator = false;
   _userio->_is_stop_derotator = true;
 
   // and reset the derotator continue status to ok
@@ -811,6 +873,12 @@ int UserIO::load_saved_settings()
   EEPROM.get(address, _userio->_userio_memento);
   
   if(_userio->_userio_memento._signature == 0xABCD){
+    GearTrain gear_train;
+    if(gear_train.Set(_userio->_userio_memento._gear_ratio,
+		      _userio->_userio_memento._steps_per_turn) == 0){
+      _derotator->SetGearTrain(gear_train);
+    }
+
     _derotator->SetUserHome(_userio->_userio_memento._home_pos);
     // Note: CW and CCW are reversed between UserIO and DeRotator
     _derotator->SetMaxCCW(_userio->_userio_memento._max_cw);
@@ -97,6 +97,12 @@ INTERFACE
 
 	ServiceDeRotator()	- Service the derotator.
 				- returns 0 on success.
+				  In the POLLED mode the DeRotator
+				  hands over to the SCHEDULED engine
+				  when it cannot keep up, e.g. near the
+				  zenith, instead of stopping with -1.
+				  CMD_SET_HIGH_RATE 0 stops it as it
+				  used to.
 
 	ServiceWifi()		- Service the wifi shield
 				- returns 0 on success
@@ -104,14 +110,16 @@ INTERFACE
 	PrintProgressWheel()	- Print a progress wheel on the LCD
 
 	SaveSettings()		- save the userio and tcp server
-				  settings into EEPROM memory.
+				  settings and the gear train into
+				  EEPROM memory.
 
 	LoadSavedSettings()	- load the userio settings that was
 				  previously saved into the EEPROM
 				  back into the derotator.
 
-	LoadDefaultSettings()	- load derotator load limits back
-				  into the derotator.
+	LoadDefaultSettings()	- load derotator load limits and the
+				  default gear train back into the
+				  derotator.
 
 	ForceLCDPrinterMenu(	- Force printing of the 
 	  m			- menu 
@@ -119,7 +127,15 @@ INTERFACE
 				- to the LCD
 	)
 
-	SetInitDeRotatorFlag()	- Callback of "START" in control_menu
+	ShowControlMenu()	- make the control menu the active menu
+
+	ShowSetupMenu(		- make the setup menu the active menu
+	  is_redraw		- and print it to the LCD if true.
+	)			  Default: false
+
+	SetInitDeRotatorFlag()	- Callback of "START" in control_menu.
+				  See ServiceDeRotator() for how the
+				  POLLED mode copes near the zenith.
 
 	SetStopDeRotatorFlag()	- Callback of "STOP" in control menu
 
@@ -209,6 +225,8 @@ public:
 public:
 
   void ForceLCDPrintMenu(menu& m, bool drawExit);
+  void ShowControlMenu();
+  void ShowSetupMenu(const bool is_redraw = false);
 
 public:
   static void Red() {_lcd.setBacklight(0x1);}
@@ -306,6 +324,8 @@ private:
       _WLAN_ssid[0] = '\0';
       _WLAN_pass[0] = '\0';
       _WLAN_security = 0;
+      _gear_ratio = 0;
+      _steps_per_turn = 0;
     };
 
     uint16_t _signature;
@@ -316,6 +336,10 @@ private:
     char _WLAN_ssid[WIFI_MAX_STR_LEN];
     char _WLAN_pass[WIFI_MAX_STR_LEN];
     uint8_t _WLAN_security;
+    // appended, so older settings read NaN or 0 here and keep the
+    // default gear train
+    float _gear_ratio;
+    float _steps_per_turn;
   };
 
   UserIOMemento _userio_memento;
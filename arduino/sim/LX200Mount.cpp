@@ -0,0 +1,294 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "LX200Mount.h"
+
+#define DEG2RAD	M_PI/180.0
+#define RAD2DEG 180.0/M_PI
+
+#define OMEGA	7.2921150e-5 // sidereal rotation rate of the Earth in rad/s
+
+#define LX200_DEGREE_SIGN	'\xDF' // the LX200 sends this instead of '*'
+
+#define SIM_LONGITUDE		87.6298 // degrees west as the LX200 has it
+#define SIM_LST0		5.0	// local sidereal time in hours at t = 0
+
+/**********************************************************************
+NAME
+        LX200Mount - a simulated LX200 that is plugged into Serial2 of
+		     the simulated board.
+
+SYNOPSIS
+	See LX200Mount.h
+
+PRIVATE FUNCTIONS
+
+	reply(			- queue the reply
+	  port			- on this serial port
+	  s			- the reply string
+	  t_us			- the command was received at this time
+	)
+
+	format_dms(		- format in the LX200 style
+	  buf			- into this buffer
+	  deg			- this angle in degrees
+	  is_signed		- with a leading sign, i.e. sDD*MM
+				  otherwise DDD*MM
+	  is_high_precision	- append 'SS if true
+	)			- returns the length of the string
+
+	format_hms(		- format a time in the LX200 style
+	  buf			- into this buffer
+	  hours			- this time in hours
+	  is_high_precision	- HH:MM:SS if true, otherwise HH:MM.T
+	)			- returns the length of the string
+
+	sidereal_time(		- the local sidereal time in radians
+	  t_us			- at this virtual time
+	)
+
+	parallactic_angle(	- the parallactic angle in radians
+	  ha			- at this hour angle in radians
+	)
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+LX200Mount::LX200Mount(const double latitude)
+  : _latitude_rad(latitude*DEG2RAD),
+    _ha0_rad(0),
+    _dec_rad(0),
+    _t0_us(0),
+    _q0(0),
+    _last_q(0),
+    _rotation_rad(0),
+    _latency_us(5000),	// 5 ms
+    _reply_free_us(0),
+    _is_absent(false),
+    _is_high_precision(false),
+    _cmd_len(0),
+    _query_count(0)
+{
+}
+
+LX200Mount::~LX200Mount()
+{
+}
+
+void LX200Mount::Point(const double alt, const double az)
+{
+  const double h = alt*DEG2RAD;
+  const double A = az*DEG2RAD;
+  const double sl = sin(_latitude_rad);
+  const double cl = cos(_latitude_rad);
+
+  // alt-az (azimuth from north through east) to hour angle and declination
+  _dec_rad = asin(sin(h)*sl + cos(h)*cl*cos(A));
+  _ha0_rad = atan2(-sin(A)*cos(h), sin(h)*cl - cos(h)*sl*cos(A));
+  _t0_us = SimBoard::Now();
+
+  _q0 = _last_q = parallactic_angle(_ha0_rad);
+  _rotation_rad = 0;
+}
+
+void LX200Mount::GetAltAz(const unsigned long long t_us, double* alt, double* az) const
+{
+  const double H = _ha0_rad + OMEGA*(static_cast<double>(t_us) - _t0_us)*1e-6;
+  const double sl = sin(_latitude_rad);
+  const double cl = cos(_latitude_rad);
+
+  const double h = asin(sin(_dec_rad)*sl + cos(_dec_rad)*cl*cos(H));
+  double A = atan2(-cos(_dec_rad)*sin(H), sin(_dec_rad)*cl - cos(_dec_rad)*cos(H)*sl);
+  if(A < 0)
+    A += 2*M_PI;
+
+  *alt = h*RAD2DEG;
+  *az = A*RAD2DEG;
+}
+
+double LX200Mount::FieldRotation(const unsigned long long t_us)
+{
+  const double H = _ha0_rad + OMEGA*(static_cast<double>(t_us) - _t0_us)*1e-6;
+  const double q = parallactic_angle(H);
+
+  // unwrap
+  double dq = q - _last_q;
+  while(dq > M_PI) dq -= 2*M_PI;
+  while(dq < -M_PI) dq += 2*M_PI;
+  _last_q = q;
+
+  // the derotator angular velocity is -dq/dt
+  _rotation_rad -= dq;
+
+  return _rotation_rad*RAD2DEG;
+}
+
+void LX200Mount::OnByte(HardwareSerial* port,
+			const char ch,
+			const unsigned long long t_us)
+{
+  if(ch == ':'){
+    _cmd_len = 0;
+    return;
+  }
+
+  if(ch != '#'){
+    if((ch != '\r') && (ch != '\n') && (_cmd_len < static_cast<int>(sizeof(_cmd)) - 1))
+      _cmd[_cmd_len++] = ch;
+    return;
+  }
+
+  // '#' terminates a command. A '#' on its own just clears the buffer.
+  _cmd[_cmd_len] = '\0';
+  _cmd_len = 0;
+
+  if(_is_absent)
+    return;
+
+  char buf[32];
+  double alt, az;
+
+  if(strcmp(_cmd, "GC") == 0){
+    reply(port, "10/17/15#", t_us);
+  }
+  else if(strcmp(_cmd, "U") == 0){
+    _is_high_precision = !_is_high_precision;
+  }
+  else if(strcmp(_cmd, "GA") == 0){
+    _query_count++;
+    GetAltAz(t_us, &alt, &az);
+    format_dms(buf, alt, true, _is_high_precision);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "GZ") == 0){
+    _query_count++;
+    GetAltAz(t_us, &alt, &az);
+    format_dms(buf, az, false, _is_high_precision);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "Gt") == 0){
+    format_dms(buf, _latitude_rad*RAD2DEG, true, false);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "Gg") == 0){
+    format_dms(buf, SIM_LONGITUDE, false, false);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "GS") == 0){
+    format_hms(buf, sidereal_time(t_us)*RAD2DEG/15.0, true);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "GR") == 0){
+    // RA = LST - HA is fixed
+    const double ra = sidereal_time(_t0_us) - _ha0_rad;
+    format_hms(buf, ra*RAD2DEG/15.0, _is_high_precision);
+    reply(port, buf, t_us);
+  }
+  else if(strcmp(_cmd, "GD") == 0){
+    format_dms(buf, _dec_rad*RAD2DEG, true, _is_high_precision);
+    reply(port, buf, t_us);
+  }
+}
+
+void LX200Mount::reply(HardwareSerial* port,
+		       const char* s,
+		       const unsigned long long t_us)
+{
+  unsigned long long t = t_us + _latency_us;
+  if(t < _reply_free_us)
+    t = _reply_free_us;
+
+  for(const char* p = s; *p; p++){
+    t += port->ByteTime();
+    port->Inject(*p, t);
+  }
+  _reply_free_us = t;
+}
+
+int LX200Mount::format_dms(char* buf,
+			   const double deg,
+			   const bool is_signed,
+			   const bool is_high_precision) const
+{
+  const char sign = deg < 0? '-':'+';
+  const double unit = is_high_precision? 3600.0:60.0;
+  long v = static_cast<long>(floor(fabs(deg)*unit + 0.5));
+  if(!is_signed)
+    v %= static_cast<long>(360*unit);
+
+  if(is_high_precision){
+    const long d = v/3600, m = (v/60)%60, s = v%60;
+    return is_signed?
+      sprintf(buf, "%c%02ld%c%02ld'%02ld#", sign, d, LX200_DEGREE_SIGN, m, s):
+      sprintf(buf, "%03ld%c%02ld'%02ld#", d, LX200_DEGREE_SIGN, m, s);
+  }
+  else {
+    const long d = v/60, m = v%60;
+    return is_signed?
+      sprintf(buf, "%c%02ld%c%02ld#", sign, d, LX200_DEGREE_SIGN, m):
+      sprintf(buf, "%03ld%c%02ld#", d, LX200_DEGREE_SIGN, m);
+  }
+}
+
+int LX200Mount::format_hms(char* buf,
+			   const double hours,
+			   const bool is_high_precision) const
+{
+  double h = fmod(hours, 24.0);
+  if(h < 0)
+    h += 24.0;
+
+  if(is_high_precision){
+    const long v = static_cast<long>(floor(h*3600.0 + 0.5)) % (24*3600);
+    return sprintf(buf, "%02ld:%02ld:%02ld#", v/3600, (v/60)%60, v%60);
+  }
+  else {
+    const long v = static_cast<long>(floor(h*600.0 + 0.5)) % (24*600);
+    return sprintf(buf, "%02ld:%02ld.%01ld#", v/600, (v/10)%60, v%10);
+  }
+}
+
+double LX200Mount::sidereal_time(const unsigned long long t_us) const
+{
+  return SIM_LST0*15.0*DEG2RAD + OMEGA*static_cast<double>(t_us)*1e-6;
+}
+
+double LX200Mount::parallactic_angle(const double ha) const
+{
+  return atan2(sin(ha), tan(_latitude_rad)*cos(_dec_rad) - sin(_dec_rad)*cos(ha));
+}
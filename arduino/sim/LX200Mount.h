@@ -0,0 +1,150 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LX200MOUNT_HPP
+#define LX200MOUNT_HPP
+
+#include "Arduino.h"
+
+/**********************************************************************
+NAME
+
+        LX200Mount - a simulated LX200 that is plugged into Serial2 of
+		     the simulated board.
+
+SYNOPSIS
+	LX200Mount answers the subset of the LX200 command set that
+	Telescope uses: GC, U, GA, GZ, Gt, Gg, GS, GR and GD. The alt-az position of the target is computed
+	exactly from its hour angle and declination so that the
+	simulation can compare the derotator against the true field
+	rotation.
+
+	The replies are delivered byte by byte at the serial baud rate
+	after a configurable processing latency. An absent mount never
+	replies.
+
+CONSTRUCTOR
+
+        LX200Mount(		- constructor
+	  latitude		- site latitude in degrees
+	)
+
+
+INTERFACE
+	Point(			- point the mount at the target
+	  alt, az		- that is at this alt-az position in
+				  degrees at the current virtual time.
+	)
+
+	GetAltAz(		- the exact alt-az position in degrees
+	  t_us			- at this virtual time
+	  alt, az
+	)
+
+	FieldRotation(		- the exact field rotation in degrees
+	  t_us			- at this virtual time since Point().
+	)			  This is the integral of the derotator
+				  angular velocity and is unwrapped so
+				  it must be called at least every few
+				  minutes.
+
+	SetLatency(		- the time taken by the mount to start
+	  us			- replying to a command
+	)
+
+	SetAbsent(		- the mount does not reply
+	  is_absent		- if true.
+	)
+
+	GetQueryCount()		- returns the number of GA and GZ
+				  commands received.
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+class LX200Mount : public SerialPeer
+{
+public:
+  LX200Mount(const double latitude);
+  ~LX200Mount();
+
+public:
+  void Point(const double alt, const double az);
+  void GetAltAz(const unsigned long long t_us, double* alt, double* az) const;
+  double FieldRotation(const unsigned long long t_us);
+
+  void SetLatency(const unsigned long long us) { _latency_us = us; }
+  void SetAbsent(const bool is_absent) { _is_absent = is_absent; }
+
+  unsigned long GetQueryCount() const { return _query_count; }
+
+public:
+  virtual void OnByte(HardwareSerial* port,
+		      const char ch,
+		      const unsigned long long t_us);
+
+private:
+  void reply(HardwareSerial* port,
+	     const char* s,
+	     const unsigned long long t_us);
+
+  int format_dms(char* buf,
+		 const double deg,
+		 const bool is_signed,
+		 const bool is_high_precision) const;
+
+  int format_hms(char* buf,
+		 const double hours,
+		 const bool is_high_precision) const;
+
+  double sidereal_time(const unsigned long long t_us) const;
+
+  double parallactic_angle(const double ha) const;
+
+private:
+  double _latitude_rad;
+  double _ha0_rad, _dec_rad;
+  unsigned long long _t0_us;
+
+  double _q0, _last_q;
+  double _rotation_rad;
+
+  unsigned long long _latency_us;
+  unsigned long long _reply_free_us;
+  bool _is_absent;
+  bool _is_high_precision;
+
+  char _cmd[16];
+  int _cmd_len;
+
+  unsigned long _query_count;
+};
+#endif
@@ -0,0 +1,935 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* operating system header files (use <> for make depend) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+/* general system header files (use "" for make depend) */
+#include "Arduino.h"
+
+/* local include files (use "") */
+#include "Telescope.h"
+#include "DeRotator.h"
+#include "EEPROM.h"
+#include "LX200Mount.h"
+
+#define STEPPER_STEP_PIN	6
+#define STEPPER_DIR_PIN		7
+
+#define MAX_TARGETS	64
+
+#define HALL_INTERRUPT		5	// the Hall switch
+#define HALL_PIN		18	// on this pin
+#define HALL_MAGNET_DEG		3.0	// where the magnet is from the start
+#define HALL_HOMINGS		4	// for the repeatability
+#define HALL_BACKOFF_STEPS	10	// full steps, see DeRotator.cpp
+#define MOVE_TIMEOUT_US		600000000ULL
+
+/**********************************************************************
+NAME
+
+	derot_bench - replays targets through DeRotator::Start() and
+		      DeRotator::Continue() on a virtual clock.
+
+SYNOPSIS
+
+	derot_bench [-f targets] [-l loop_us] [-p poll_us] [-m latency_us]
+		    [-L latitude] [-s sample_s] [-t mode] [-u microstep]
+		    [-T source] [-F fix_s] [-H] [-x absent_s] [-a] [-v]
+		    [-g angle] [-y hall_delay_us] [-e angle] [-R gap_s]
+		    [-b budget] [-G ratio]
+
+	-f	file of targets, one per line: name alt az hours.
+		Lines starting with '#' are ignored.
+		Default: a built in list of targets.
+	-l	virtual time in us taken by the rest of loop() per
+		iteration. Default: 500 us
+	-p	virtual time in us charged for every Serial2.available()
+		Default: 2 us
+	-m	LX200 reply latency in us. Default: 5000 us
+	-L	site latitude in degrees. Default: Chicago
+	-s	tracking error sample period in virtual seconds. Default: 1 s
+	-t	DeRotator tracking mode: polled, scheduled or
+		absolute.
+		Default: polled
+	-u	microstep factor: 1, 2, 4, 8, 16 or 32. Default: 1
+	-T	Telescope mode: direct, fused or ephemeris.
+		Default: direct
+	-F	LX200 fix interval in s of the fused and ephemeris
+		modes.
+		Default: 30 s
+	-H	disable the high rate tracking, which is on by
+		default, see DeRotator::DisableHighRate()
+	-x	the mount stops replying this many virtual seconds
+		after the start. Default: never
+	-a	stop the target at the first -1 or -2 from Continue()
+		just like UserIO::ServiceDeRotator() does.
+	-v	echo Serial to stdout
+	-g	instead of the targets, time a move to this user angle
+		in degrees, the move back to the user home and the
+		search for the Hall home with the magnet
+		HALL_MAGNET_DEG away. Reports the steps, the time
+		that each move takes against what GetMoveTime()
+		predicted and where the Hall home ends up.
+		The Hall home is found HALL_HOMINGS times for the
+		repeatability. Checks that the Hall home is where
+		the switch fired during the creep, that the homing
+		offset is how far before that it fired during the
+		fast approach, and that GetHomingStats() agrees with
+		the homes found. Exits with 1 if a check fails.
+	-y	the Hall switch interrupt fires this many us after
+		the magnet is reached. Default: 0
+	-e	instead of the targets, find the Hall home, park at
+		this user angle and cycle the power. Then park at the
+		Hall home and cycle the power, once as it is and once
+		with the motor turned while the power is off. Reports
+		what DeRotator::RestorePosition() returns, how far the
+		restored position is off and the EEPROM writes.
+	-R	the board resets half way through each target and
+		the power stays off for this many seconds. The
+		session is then resumed. Reports the gap that
+		DeRotator::GetResumeGap() gives, the rotation that
+		was made up in degrees, the time after power up until
+		the error is below one step, the max error in arcmin
+		before the reset and after that time, and the
+		number of checkpoints. A gap that Resume() refuses
+		starts afresh and gives a gap of -1.
+	-b	error budget in arcmin of the field angle between
+		LX200 fixes, see DeRotator::SetErrorBudget().
+		Default: ERROR_BUDGET
+	-G	gear ratio of another mechanism, i.e. turns of the
+		stepper motor per turn of the camera. The default is
+		that of GearTrain().
+
+	For each target the following are reported:
+		loops/s		loop() iterations per wall clock second
+		vloops/s	loop() iterations per virtual second
+		steps		stepper motor steps issued
+		fixes		LX200 GA and GZ queries
+		err		max and rms tracking error in arcmin
+				against the exact field rotation
+		+1/0/-1/-2	the number of times Continue() returned
+				each status
+		abort		virtual time in s of the first -1 or -2
+		forecast	virtual time in s of the -1 or -2 that
+				DeRotator::GetTrackability() forecasts
+				once its first forecast is done. -1 if
+				none within its horizon.
+		maxlat		the longest virtual time in us spent in
+				one call of Continue(), i.e. the worst
+				loop() latency that it causes
+		meanlat		the mean virtual time in us per call
+
+AUTHOR
+	C.Y. Tan
+
+REVISION
+	$Revision$
+
+SEE ALSO
+
+**********************************************************************/
+
+struct Target {
+  char name[32];
+  double alt, az;	// degrees
+  double hours;
+};
+
+struct Options {
+  unsigned long long loop_us;
+  unsigned long long poll_us;
+  unsigned long long latency_us;
+  double latitude;
+  double sample_s;
+  DeRotator::TRACKING_MODE mode;
+  int microstep;
+  Telescope::MODE source;
+  double fix_interval_s;
+  bool is_high_rate;
+  double absent_s;
+  bool is_abort;
+  bool is_verbose;
+  bool is_moves;
+  double goto_angle;
+  unsigned long long hall_delay_us;
+  bool is_power_cycle;
+  double park_angle;
+  bool is_crash;
+  double crash_gap_s;
+  double error_budget;
+  GearTrain gear_train;
+};
+
+struct HallSwitch {
+  long magnet_pos;		// sim step position where it comes on
+  unsigned long long delay_us;	// until the interrupt fires
+  bool is_on;
+  bool is_pending;
+  unsigned long long fire_us;
+  int fires;			// interrupts fired so far
+  long fire_pos[2];		// sim step position of the first two
+};
+
+struct Result {
+  double wall_s;
+  double virtual_s;
+  unsigned long long loops;
+  unsigned long steps;
+  unsigned long fixes;
+  double max_err, rms_err; // arcmin
+  unsigned long status[4]; // +1, 0, -1, -2
+  unsigned long long max_latency_us;
+  double mean_latency_us;
+  double abort_s;
+  double forecast_s;
+};
+
+static const Target default_targets[] = {
+  {"rising-east",	20.0,	 80.0,	8.0},
+  {"mid-south",		45.0,	170.0,	2.0},
+  {"setting-west",	50.0,	260.0,	3.0},
+  {"high-transit",	80.0,	175.0,	1.0},
+  {"debug-fast",	88.2032, 300.938, 0.5},
+  {"zenith-pass",	86.2720, 83.7149, 0.67},
+};
+
+static double wall_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int load_targets(const char* filename, Target* targets)
+{
+  FILE* fp = fopen(filename, "r");
+  if(!fp){
+    fprintf(stderr, "derot_bench: cannot open %s\n", filename);
+    return -1;
+  }
+
+  int n = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), fp) && (n < MAX_TARGETS)){
+    if((line[0] == '#') || (line[0] == '\n'))
+      continue;
+
+    Target* t = &targets[n];
+    if(sscanf(line, "%31s %lf %lf %lf", t->name, &t->alt, &t->az, &t->hours) == 4){
+      n++;
+    }
+    else {
+      fprintf(stderr, "derot_bench: ignoring line: %s", line);
+    }
+  }
+
+  fclose(fp);
+  return n;
+}
+
+static int run_target(const Target& target, const Options& opt, Result* r)
+{
+  SimBoard::Reset();
+  SimBoard::SetPollCost(opt.poll_us);
+  SimBoard::SetStepPins(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+  Serial.SetEcho(opt.is_verbose);
+
+  LX200Mount mount(opt.latitude);
+  mount.SetLatency(opt.latency_us);
+  mount.Point(target.alt, target.az);
+  Serial2.Connect(&mount);
+
+  Telescope telescope;
+  telescope.SetMode(opt.source);
+  telescope.SetFixInterval(opt.fix_interval_s);
+  DeRotator derotator(&telescope, opt.gear_train, false);
+  derotator.SetCorrectionDirection(true);
+  derotator.SetTrackingMode(opt.mode);
+  if(opt.error_budget > 0)
+    derotator.SetErrorBudget(opt.error_budget);
+  if(derotator.SetMicrostep(opt.microstep) != 0){
+    fprintf(stderr, "derot_bench: invalid microstep %d\n", opt.microstep);
+    return -1;
+  }
+  if(!opt.is_high_rate)
+    derotator.DisableHighRate();
+
+  if(telescope.Connect() != 0){
+    fprintf(stderr, "derot_bench: %s: telescope did not answer\n", target.name);
+    return -1;
+  }
+
+  // this is what UserIO::ServiceDeRotator() does on START
+  double alt, az;
+  telescope.Init();
+  telescope.GetAltAz(static_cast<double>(millis())*1e-3, &alt, &az);
+
+  const unsigned long long t_start = SimBoard::Now();
+  const unsigned long long t_end = t_start +
+    static_cast<unsigned long long>(target.hours*3600e6);
+  const unsigned long long sample_us =
+    static_cast<unsigned long long>(opt.sample_s*1e6);
+  const long pos0 = SimBoard::GetStepPosition();
+  const unsigned long steps0 = SimBoard::GetStepCount();
+  const unsigned long fixes0 = mount.GetQueryCount();
+  const double rotation0 = mount.FieldRotation(t_start);
+
+  memset(r, 0, sizeof(Result));
+  r->abort_s = -1;
+
+  int status = derotator.Start(alt, az);
+  if(status < 0){
+    r->abort_s = 0;
+    r->status[2]++;
+  }
+
+  r->forecast_s = -1;
+  bool is_forecast = false;
+
+  const double wall0 = wall_time();
+  unsigned long long next_sample = t_start;
+  unsigned long samples = 0;
+  double sum_err2 = 0;
+  unsigned long long sum_latency_us = 0;
+  const unsigned long long t_absent = opt.absent_s > 0?
+    t_start + static_cast<unsigned long long>(opt.absent_s*1e6):t_end;
+
+  while(SimBoard::Now() < t_end){
+    SimBoard::Advance(opt.loop_us);
+
+    if(SimBoard::Now() >= t_absent)
+      mount.SetAbsent(true);
+
+    const unsigned long long t0 = SimBoard::Now();
+    status = derotator.Continue();
+    const unsigned long long latency_us = SimBoard::Now() - t0;
+    r->loops++;
+
+    sum_latency_us += latency_us;
+    if(latency_us > r->max_latency_us)
+      r->max_latency_us = latency_us;
+
+    switch(status){
+      case 1: r->status[0]++; break;
+      case 0: r->status[1]++; break;
+      case -1: r->status[2]++; break;
+      case -2: r->status[3]++; break;
+    }
+
+    if((status < 0) && (r->abort_s < 0)){
+      r->abort_s = (SimBoard::Now() - t_start)*1e-6;
+    }
+
+    // the first forecast is made over the first Continue() calls
+    if(!is_forecast){
+      double forecast_s;
+      const int trackability = derotator.GetTrackability(&forecast_s);
+      if(trackability != -3){
+	is_forecast = true;
+	if(trackability < 0)
+	  r->forecast_s = forecast_s + (SimBoard::Now() - t_start)*1e-6;
+      }
+    }
+
+    if(SimBoard::Now() >= next_sample){
+      const double mech = (SimBoard::GetStepPosition() - pos0)*opt.gear_train.GetStepsize()/opt.microstep;
+      const double exact = mount.FieldRotation(SimBoard::Now()) - rotation0;
+      const double err = (mech - exact)*60.0; // arcmin
+
+      if(fabs(err) > r->max_err)
+	r->max_err = fabs(err);
+      sum_err2 += err*err;
+      samples++;
+      next_sample += sample_us;
+    }
+
+    if(opt.is_abort && (status < 0))
+      break;
+  }
+
+  r->wall_s = wall_time() - wall0;
+  r->virtual_s = (SimBoard::Now() - t_start)*1e-6;
+  r->steps = SimBoard::GetStepCount() - steps0;
+  r->fixes = mount.GetQueryCount() - fixes0;
+  r->rms_err = samples > 0? sqrt(sum_err2/samples):0;
+  r->mean_latency_us = r->loops > 0? static_cast<double>(sum_latency_us)/r->loops:0;
+
+  return 0;
+}
+
+static void poll_hall(HallSwitch* hall)
+{
+  // the switch is on past the magnet and fires a falling edge
+  // hall->delay_us after it comes on, e.g. through an RC filter
+  const bool is_on = SimBoard::GetStepPosition() >= hall->magnet_pos;
+  if(is_on && !hall->is_on){
+    hall->fire_us = SimBoard::Now() + hall->delay_us;
+    hall->is_pending = true;
+  }
+  else if(!is_on){
+    hall->is_pending = false;
+  }
+  hall->is_on = is_on;
+  digitalWrite(HALL_PIN, is_on? LOW:HIGH);
+
+  if(hall->is_pending && (SimBoard::Now() >= hall->fire_us)){
+    if(hall->fires < 2){
+      hall->fire_pos[hall->fires] = SimBoard::GetStepPosition();
+    }
+    hall->fires++;
+    SimBoard::FireInterrupt(HALL_INTERRUPT);
+    hall->is_pending = false;
+  }
+}
+
+static int run_move(const char* name,
+		    DeRotator& derotator,
+		    int (DeRotator::*cont)(),
+		    const Options& opt,
+		    HallSwitch* hall)
+{
+  const double predicted_s = derotator.GetMoveTime();
+  const unsigned long long t0 = SimBoard::Now();
+  const unsigned long steps0 = SimBoard::GetStepCount();
+  int status;
+
+  // fine time steps so that the Hall switch fires on the step that
+  // passes the magnet, like the real interrupt
+  unsigned long long next_loop_us = t0;
+  do {
+    while(SimBoard::Now() < next_loop_us){
+      SimBoard::Advance(10);
+      poll_hall(hall);
+    }
+    next_loop_us += opt.loop_us;
+    status = (derotator.*cont)();
+  } while((status > 0) && (SimBoard::Now() - t0 < MOVE_TIMEOUT_US));
+
+  printf("%-10s %7lu %9.3f %11.3f %7d\n",
+	 name,
+	 SimBoard::GetStepCount() - steps0,
+	 (SimBoard::Now() - t0)*1e-6,
+	 predicted_s,
+	 status);
+
+  return status;
+}
+
+static int check(const char* name, const bool is_ok)
+{
+  printf("check %-28s %s\n", name, is_ok? "ok":"FAILED");
+  return is_ok? 0:1;
+}
+
+static int run_moves(const Options& opt)
+{
+  SimBoard::Reset();
+  SimBoard::SetStepPins(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+  Serial.SetEcho(opt.is_verbose);
+
+  Telescope telescope;
+  DeRotator derotator(&telescope, opt.gear_train, false);
+  if(derotator.SetMicrostep(opt.microstep) != 0){
+    fprintf(stderr, "derot_bench: invalid microstep %d\n", opt.microstep);
+    return 1;
+  }
+
+  HallSwitch hall;
+  hall.magnet_pos = static_cast<long>(HALL_MAGNET_DEG*opt.gear_train.GetStepsPerDegree()*opt.microstep);
+  hall.delay_us = opt.hall_delay_us;
+  hall.is_on = false;
+  hall.is_pending = false;
+  hall.fire_us = 0;
+  hall.fires = 0;
+
+  // what the homings should give, from where the switch really fired
+  int failures = 0;
+  int homings = 0;
+  long last_home = 0;
+  double sum = 0, sum2 = 0, shift = 0;
+
+  printf("%-10s %7s %9s %11s %7s\n", "move", "steps", "time_s", "predicted_s", "status");
+
+  derotator.StartGoingToUserAngle(opt.goto_angle);
+  run_move("goto", derotator, &DeRotator::ContinueFindingUserAngle, opt, &hall);
+
+  derotator.StartGoingToUserHome();
+  run_move("home", derotator, &DeRotator::ContinueFindingUserHome, opt, &hall);
+
+  for(int i=0; i<HALL_HOMINGS; i++){
+    if(i > 0){
+      // back to before the magnet. The user home is the Hall home now
+      derotator.StartGoingToUserAngle(-HALL_MAGNET_DEG);
+      run_move("back", derotator, &DeRotator::ContinueFindingUserAngle, opt, &hall);
+    }
+
+    hall.fires = 0;
+    derotator.StartGoingToHallHome();
+    if(run_move("hall", derotator, &DeRotator::ContinueFindingHallHome, opt, &hall) != 0){
+      failures += check("hall home found", false);
+      break;
+    }
+    derotator.StopFindingHallHome();
+
+    // the Hall home is 0, so the sim position of 0 is the magnet
+    const long home = SimBoard::GetStepPosition() - StepEngine::GetPosition();
+    printf("hall home error %ld steps in %.3f s, fast approach %.2f full steps late\n",
+	   home - hall.magnet_pos,
+	   derotator.GetHomingTime(),
+	   derotator.GetHomingOffset());
+
+    // the approach and the creep each fire once. The home is where
+    // the creep fired, and the offset is how far before that the
+    // approach fired
+    failures += check("fast approach and creep fire", hall.fires == 2);
+    if(hall.fires >= 2){
+      failures += check("hall home at the creep edge", home == hall.fire_pos[1]);
+      failures += check("homing offset",
+			fabs(derotator.GetHomingOffset() -
+			     static_cast<double>(hall.fire_pos[0] - hall.fire_pos[1])/opt.microstep) < 1e-9);
+    }
+
+    // the edge in the frame of the last homing, in full steps
+    if(homings > 0){
+      shift = static_cast<double>(home - last_home)/opt.microstep;
+      sum += shift;
+      sum2 += shift*shift;
+    }
+    last_home = home;
+    homings++;
+  }
+
+  double last, mean, sigma;
+  const int count = derotator.GetHomingStats(&last, &mean, &sigma);
+  printf("repeatability %d shifts, last %.3f mean %.3f sigma %.3f full steps\n",
+	 count, last, mean, sigma);
+
+  double expect_mean = 0, expect_sigma = 0;
+  if(homings > 1){
+    expect_mean = sum/(homings - 1);
+    const double var = sum2/(homings - 1) - expect_mean*expect_mean;
+    expect_sigma = var > 0? sqrt(var):0;
+  }
+  failures += check("homing stats",
+		    (count == ((homings > 0)? homings - 1:0)) &&
+		    (fabs(last - shift) < 1e-9) &&
+		    (fabs(mean - expect_mean) < 1e-9) &&
+		    (fabs(sigma - expect_sigma) < 1e-6));
+
+  return failures;
+}
+
+static void idle(DeRotator& derotator,
+		 const Options& opt,
+		 HallSwitch* hall,
+		 const double seconds,
+		 int* saves)
+{
+  const unsigned long long end_us = SimBoard::Now() + static_cast<unsigned long long>(seconds*1e6);
+  while(SimBoard::Now() < end_us){
+    SimBoard::Advance(opt.loop_us);
+    poll_hall(hall);
+    *saves += derotator.ServicePosition();
+  }
+}
+
+static void power_cycle(const char* name,
+			const Options& opt,
+			HallSwitch* hall,
+			const long turned)
+{
+  // the motor stays where it is, but the sim position starts again
+  // from 0. It may have been turned by hand while the power was off
+  hall->magnet_pos -= SimBoard::GetStepPosition() + turned;
+  SimBoard::Reset();
+  EEPROM.Reset();
+  SimBoard::SetStepPins(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+  Serial.SetEcho(opt.is_verbose);
+  hall->is_on = false;
+  hall->is_pending = false;
+  poll_hall(hall);
+
+  Telescope telescope;
+  DeRotator derotator(&telescope, opt.gear_train, false);
+  derotator.SetMicrostep(opt.microstep);
+
+  const unsigned long long t0 = SimBoard::Now();
+  const int status = derotator.RestorePosition();
+
+  // the Hall home is 0, so the magnet is at -position
+  printf("%-10s %7d %9ld %9.3f\n",
+	 name,
+	 status,
+	 status == 0? StepEngine::GetPosition() + hall->magnet_pos:0,
+	 (SimBoard::Now() - t0)*1e-6);
+}
+
+static void run_power_cycles(const Options& opt)
+{
+  SimBoard::Reset();
+  SimBoard::SetStepPins(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+  Serial.SetEcho(opt.is_verbose);
+  EEPROM.Erase();
+
+  HallSwitch hall;
+  hall.magnet_pos = static_cast<long>(HALL_MAGNET_DEG*opt.gear_train.GetStepsPerDegree()*opt.microstep);
+  hall.delay_us = opt.hall_delay_us;
+  hall.is_on = false;
+  hall.is_pending = false;
+  hall.fire_us = 0;
+
+  int saves = 0;
+  printf("%-10s %7s %9s %11s %7s\n", "move", "steps", "time_s", "predicted_s", "status");
+  {
+    Telescope telescope;
+    DeRotator derotator(&telescope, opt.gear_train, false);
+    if(derotator.SetMicrostep(opt.microstep) != 0){
+      fprintf(stderr, "derot_bench: invalid microstep %d\n", opt.microstep);
+      return;
+    }
+
+    derotator.StartGoingToHallHome();
+    if(run_move("hall", derotator, &DeRotator::ContinueFindingHallHome, opt, &hall) != 0){
+      return;
+    }
+    derotator.StopFindingHallHome();
+
+    derotator.StartGoingToUserAngle(opt.park_angle);
+    run_move("park", derotator, &DeRotator::ContinueFindingUserAngle, opt, &hall);
+    idle(derotator, opt, &hall, 5.0, &saves);
+  }
+
+  printf("\n%-10s %7s %9s %9s\n", "restore", "status", "err_steps", "time_s");
+  power_cycle("parked", opt, &hall, 0);
+
+  {
+    Telescope telescope;
+    DeRotator derotator(&telescope, opt.gear_train, false);
+    derotator.SetMicrostep(opt.microstep);
+    derotator.RestorePosition();
+
+    derotator.StartGoingToUserAngle(0);
+    run_move("home", derotator, &DeRotator::ContinueFindingUserAngle, opt, &hall);
+    idle(derotator, opt, &hall, 5.0, &saves);
+  }
+  power_cycle("hall-home", opt, &hall, 0);
+  power_cycle("turned", opt, &hall, -HALL_BACKOFF_STEPS*opt.microstep);
+
+  unsigned long max_writes = 0;
+  for(int i=0; i<EEPROM.length(); i++){
+    if(EEPROM.GetWriteCount(i) > max_writes)
+      max_writes = EEPROM.GetWriteCount(i);
+  }
+  printf("\n%d saves, %lu EEPROM bytes written, at most %lu times to one byte\n",
+	 saves, EEPROM.GetWriteCount(), max_writes);
+}
+
+static int run_crash(const Target& target, const Options& opt)
+{
+  SimBoard::Reset();
+  SimBoard::SetPollCost(opt.poll_us);
+  SimBoard::SetStepPins(STEPPER_STEP_PIN, STEPPER_DIR_PIN);
+  Serial.SetEcho(opt.is_verbose);
+  EEPROM.Erase();
+
+  LX200Mount mount(opt.latitude);
+  mount.SetLatency(opt.latency_us);
+  mount.Point(target.alt, target.az);
+  Serial2.Connect(&mount);
+
+  const unsigned long long t_start = SimBoard::Now();
+  const unsigned long long t_crash = t_start + static_cast<unsigned long long>(target.hours*1800e6);
+  const unsigned long long t_end = t_start + static_cast<unsigned long long>(target.hours*3600e6);
+  const unsigned long long gap_us = static_cast<unsigned long long>(opt.crash_gap_s*1e6);
+  const long pos0 = SimBoard::GetStepPosition();
+  const double rotation0 = mount.FieldRotation(t_start);
+  const double step_deg = opt.gear_train.GetStepsize()/opt.microstep;
+
+  double max_err = 0, max_err_after = 0, recover_s = -1, gap_s = 0, made_up = 0;
+  int status = 0, checkpoints = 0;
+
+  for(int boot=0; boot<2; boot++){
+    Telescope telescope;
+    telescope.SetMode(opt.source);
+    telescope.SetFixInterval(opt.fix_interval_s);
+    DeRotator derotator(&telescope, opt.gear_train, false);
+    derotator.SetCorrectionDirection(true);
+    derotator.SetTrackingMode(opt.mode);
+    if(opt.error_budget > 0)
+      derotator.SetErrorBudget(opt.error_budget);
+    derotator.SetMicrostep(opt.microstep);
+    if(!opt.is_high_rate)
+      derotator.DisableHighRate();
+
+    // what setup() and UserIO::ServiceDeRotator() do
+    const int restored = derotator.RestorePosition();
+    if(telescope.Connect() != 0){
+      fprintf(stderr, "derot_bench: %s: telescope did not answer\n", target.name);
+      return -1;
+    }
+
+    double alt, az;
+    telescope.Init();
+    telescope.GetAltAz(static_cast<double>(millis())*1e-3, &alt, &az);
+    const unsigned long long t_boot = SimBoard::Now();
+    if(boot == 0){
+      derotator.Start(alt, az);
+    }
+    else if((restored != 0) || !derotator.IsResumePending()){
+      fprintf(stderr, "derot_bench: %s: no session to resume\n", target.name);
+      return -1;
+    }
+    else {
+      // a gap that cannot be right is refused, and UserIO starts afresh
+      if(derotator.Resume(alt, az) == -3)
+	derotator.Start(alt, az);
+      derotator.GetResumeGap(&gap_s, &made_up);
+    }
+
+    const unsigned long long t_stop = boot == 0? t_crash:t_end;
+    unsigned long long next_sample = SimBoard::Now();
+    while(SimBoard::Now() < t_stop){
+      SimBoard::Advance(opt.loop_us);
+      status = derotator.Continue();
+      checkpoints += derotator.ServicePosition();
+
+      if(SimBoard::Now() >= next_sample){
+	const double mech = (SimBoard::GetStepPosition() - pos0)*step_deg;
+	const double exact = mount.FieldRotation(SimBoard::Now()) - rotation0;
+	const double err = fabs(mech - exact);
+
+	if(boot == 0){
+	  if(err > max_err)
+	    max_err = err;
+	}
+	else if(recover_s < 0){
+	  if(err < step_deg)
+	    recover_s = (SimBoard::Now() - t_boot)*1e-6;
+	}
+	else if(err > max_err_after){
+	  max_err_after = err;
+	}
+	next_sample += static_cast<unsigned long long>(opt.sample_s*1e6);
+      }
+
+      if(opt.is_abort && (status < 0))
+	break;
+    }
+
+    if(boot == 0){
+      // the power goes away. The motor stays where it is
+      SimBoard::DetachTimer();
+      Serial2.Reset();
+      SimBoard::Advance(gap_us);
+      EEPROM.Reset();
+      Serial2.Connect(&mount);
+    }
+  }
+
+  printf("%-14s %7.2f %7.1f %8.1f %8.3f %9.1f %8.2f %8.2f %7d\n",
+	 target.name,
+	 target.hours,
+	 opt.crash_gap_s,
+	 gap_s,
+	 made_up,
+	 recover_s,
+	 max_err*60.0,
+	 max_err_after*60.0,
+	 checkpoints);
+
+  return 0;
+}
+
+static void run_crashes(const Options& opt, const Target* targets, const int num_targets)
+{
+  printf("%-14s %7s %7s %8s %8s %9s %8s %8s %7s\n",
+	 "target", "hours", "gap_s", "rgap_s", "madeup", "resume_s",
+	 "maxerr'", "aftererr'", "saves");
+
+  for(int i=0; i<num_targets; i++){
+    run_crash(targets[i], opt);
+  }
+}
+
+static void usage()
+{
+  fprintf(stderr,
+	  "usage: derot_bench [-f targets] [-l loop_us] [-p poll_us] [-m latency_us]\n"
+	  "                   [-L latitude] [-s sample_s] [-t mode] [-u microstep]\n"
+	  "                   [-T source] [-F fix_s] [-H] [-x absent_s] [-a] [-v]\n"
+	  "                   [-g angle] [-y hall_delay_us] [-e angle] [-R gap_s]\n"
+	  "                   [-b budget] [-G ratio]\n");
+}
+
+int main(int argc, char* argv[])
+{
+  Options opt;
+  opt.loop_us = 500;
+  opt.poll_us = 2;
+  opt.latency_us = 5000;
+  opt.latitude = CHICAGO_LATITUDE;
+  opt.sample_s = 1.0;
+  opt.mode = DeRotator::POLLED;
+  opt.microstep = 1;
+  opt.source = Telescope::DIRECT;
+  opt.fix_interval_s = 30.0;
+  opt.is_high_rate = true;
+  opt.absent_s = 0;
+  opt.is_abort = false;
+  opt.is_verbose = false;
+  opt.is_moves = false;
+  opt.goto_angle = 0;
+  opt.hall_delay_us = 0;
+  opt.is_power_cycle = false;
+  opt.park_angle = 0;
+  opt.is_crash = false;
+  opt.crash_gap_s = 0;
+  opt.error_budget = 0;
+
+  Target targets[MAX_TARGETS];
+  int num_targets = sizeof(default_targets)/sizeof(Target);
+  memcpy(targets, default_targets, sizeof(default_targets));
+
+  int c;
+  while((c = getopt(argc, argv, "f:l:p:m:L:s:t:u:T:F:Hx:avg:y:e:R:b:G:h")) != -1){
+    switch(c){
+      case 'f':
+	if((num_targets = load_targets(optarg, targets)) < 0)
+	  return 1;
+	break;
+      case 'l': opt.loop_us = strtoull(optarg, NULL, 10); break;
+      case 'p': opt.poll_us = strtoull(optarg, NULL, 10); break;
+      case 'm': opt.latency_us = strtoull(optarg, NULL, 10); break;
+      case 'L': opt.latitude = atof(optarg); break;
+      case 's': opt.sample_s = atof(optarg); break;
+      case 't':
+	if(strcmp(optarg, "polled") == 0)
+	  opt.mode = DeRotator::POLLED;
+	else if(strcmp(optarg, "scheduled") == 0)
+	  opt.mode = DeRotator::SCHEDULED;
+	else if(strcmp(optarg, "absolute") == 0)
+	  opt.mode = DeRotator::ABSOLUTE;
+	else {
+	  usage();
+	  return 1;
+	}
+	break;
+      case 'u': opt.microstep = atoi(optarg); break;
+      case 'T':
+	if(strcmp(optarg, "direct") == 0)
+	  opt.source = Telescope::DIRECT;
+	else if(strcmp(optarg, "fused") == 0)
+	  opt.source = Telescope::FUSED;
+	else if(strcmp(optarg, "ephemeris") == 0)
+	  opt.source = Telescope::EPHEMERIS;
+	else {
+	  usage();
+	  return 1;
+	}
+	break;
+      case 'F': opt.fix_interval_s = atof(optarg); break;
+      case 'H': opt.is_high_rate = false; break;
+      case 'x': opt.absent_s = atof(optarg); break;
+      case 'a': opt.is_abort = true; break;
+      case 'v': opt.is_verbose = true; break;
+      case 'g':
+	opt.is_moves = true;
+	opt.goto_angle = atof(optarg);
+	break;
+      case 'y': opt.hall_delay_us = strtoull(optarg, NULL, 10); break;
+      case 'e':
+	opt.is_power_cycle = true;
+	opt.park_angle = atof(optarg);
+	break;
+      case 'R':
+	opt.is_crash = true;
+	opt.crash_gap_s = atof(optarg);
+	break;
+      case 'b':
+	opt.error_budget = atof(optarg);
+	if(opt.error_budget <= 0){
+	  usage();
+	  return 1;
+	}
+	break;
+      case 'G':
+	if(opt.gear_train.Set(atof(optarg), opt.gear_train.GetStepsPerTurn()) != 0){
+	  usage();
+	  return 1;
+	}
+	break;
+      default:
+	usage();
+	return 1;
+    }
+  }
+
+  if(opt.is_moves){
+    return run_moves(opt) == 0? 0:1;
+  }
+
+  if(opt.is_power_cycle){
+    run_power_cycles(opt);
+    return 0;
+  }
+
+  if(opt.is_crash){
+    run_crashes(opt, targets, num_targets);
+    return 0;
+  }
+
+  printf("%-14s %7s %7s %10s %8s %7s %7s %8s %8s %8s %8s %6s %6s %8s %8s %9s %10s\n",
+	 "target", "hours", "wall_s", "loops/s", "vloops/s", "steps", "fixes",
+	 "maxerr'", "rmserr'", "+1", "0", "-1", "-2", "abort_s", "fcast_s",
+	 "maxlat_us", "meanlat_us");
+
+  for(int i=0; i<num_targets; i++){
+    Result r;
+    if(run_target(targets[i], opt, &r) != 0)
+      continue;
+
+    printf("%-14s %7.2f %7.2f %10.0f %8.0f %7lu %7lu %8.2f %8.2f %8lu %8lu %6lu %6lu %8.1f %8.1f %9llu %10.1f\n",
+	   targets[i].name,
+	   r.virtual_s/3600.0,
+	   r.wall_s,
+	   r.wall_s > 0? r.loops/r.wall_s:0,
+	   r.virtual_s > 0? r.loops/r.virtual_s:0,
+	   r.steps,
+	   r.fixes,
+	   r.max_err,
+	   r.rms_err,
+	   r.status[0], r.status[1], r.status[2], r.status[3],
+	   r.abort_s,
+	   r.forecast_s,
+	   r.max_latency_us,
+	   r.mean_latency_us);
+  }
+
+  return 0;
+}
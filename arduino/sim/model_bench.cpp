@@ -0,0 +1,214 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* operating system header files (use <> for make depend) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+/* general system header files (use "" for make depend) */
+#include "Arduino.h"
+
+/* local include files (use "") */
+#include "Telescope.h"
+
+#define DEG2RAD	M_PI/180.0
+#define RAD2DEG 180.0/M_PI
+#define OMEGA	4.178e-3*M_PI/180 // as in Telescope.cpp
+
+#define MODEL_ALT	88.2032	// the debug star of Telescope::Init()
+#define MODEL_AZ	300.938
+
+/**********************************************************************
+NAME
+
+	model_bench - times the sky rotation model of the Telescope
+		      debug mode against the closed form that it
+		      replaces and checks that they agree.
+
+SYNOPSIS
+
+	model_bench [-d step_s] [-H hours]
+
+	-d	time between GetAltAz() calls in s. Default: 0.25 s
+	-H	hours that are modelled. Default: 8 h
+
+	The steady run calls GetAltAz() every step. The jittered run
+	adds up to 10% to each step. Both carry alt, az on by their
+	rates between the exact evaluations of the model. The closed
+	form is the rotation of the anchor by cos() and sin() of the
+	whole angle at every call.
+
+	For each run the time of one call is reported in ns and the
+	largest angle on the sky between the run and the closed form
+	in arcsec.
+
+AUTHOR
+
+	C.Y. Tan
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+static double wall_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// the model as it was before it was carried on from call to call
+static void closed_form(const double t, double* alt, double* az)
+{
+  const double lat = CHICAGO_LATITUDE*DEG2RAD;
+  const double alt0 = MODEL_ALT*DEG2RAD, az0 = MODEL_AZ*DEG2RAD;
+  const double X0 = cos(alt0)*cos(az0);
+  const double Y0 = -cos(alt0)*sin(az0);
+  const double Z0 = sin(alt0);
+  const double Omegat = -OMEGA*t;
+
+  const double X = cos(lat)*(X0*cos(lat)+Z0*sin(lat))*(1-cos(Omegat))+
+    X0*cos(Omegat)-Y0*sin(lat)*sin(Omegat);
+  const double Y = Y0*cos(Omegat)+(X0*sin(lat)-Z0*cos(lat))*sin(Omegat);
+  const double Z = sin(lat)*(X0*cos(lat)+Z0*sin(lat))*(1-cos(Omegat))+
+    Z0*cos(Omegat)+Y0*cos(lat)*sin(Omegat);
+
+  *az = atan2(-Y, X)*RAD2DEG;
+  *alt = atan2(Z, sqrt(X*X + Y*Y))*RAD2DEG;
+  if(*az < 0)
+    *az += 360.0;
+}
+
+// angle on the sky in arcsec between two alt, az in degrees
+static double separation(const double alt1, const double az1,
+			 const double alt2, const double az2)
+{
+  const double a1 = alt1*DEG2RAD, A1 = az1*DEG2RAD;
+  const double a2 = alt2*DEG2RAD, A2 = az2*DEG2RAD;
+  const double dx = cos(a1)*cos(A1) - cos(a2)*cos(A2);
+  const double dy = cos(a1)*sin(A1) - cos(a2)*sin(A2);
+  const double dz = sin(a1) - sin(a2);
+
+  return 2*asin(0.5*sqrt(dx*dx + dy*dy + dz*dz))*RAD2DEG*3600;
+}
+
+static void run(const char* name,
+		const double step_s,
+		const double jitter,
+		const double hours)
+{
+  Telescope telescope;
+  telescope.Connect();	// no LX200, so the debug mode
+  telescope.Init();
+  const double t0 = static_cast<double>(millis())*1e-3;
+
+  const long n = static_cast<long>(hours*3600/step_s);
+  double* alt = new double[n];
+  double* az = new double[n];
+  double* t = new double[n];
+
+  srand(1);
+  double time = t0;
+  for(long i = 0; i < n; i++){
+    time += step_s*(1 + jitter*rand()/RAND_MAX);
+    t[i] = time;
+  }
+
+  const double w0 = wall_time();
+  for(long i = 0; i < n; i++){
+    telescope.GetAltAz(t[i], &alt[i], &az[i]);
+  }
+  const double w1 = wall_time();
+
+  double max_err = 0;
+  for(long i = 0; i < n; i++){
+    double alt1, az1;
+    closed_form(t[i] - t0, &alt1, &az1);
+    const double err = separation(alt[i], az[i], alt1, az1);
+    if(err > max_err)
+      max_err = err;
+  }
+
+  printf("%-12s %10ld %10.1f %12.2e\n", name, n, (w1 - w0)*1e9/n, max_err);
+
+  delete[] alt;
+  delete[] az;
+  delete[] t;
+}
+
+static void run_closed_form(const double step_s, const double hours)
+{
+  const long n = static_cast<long>(hours*3600/step_s);
+  volatile double sum = 0;
+  double s = 0;
+
+  const double w0 = wall_time();
+  for(long i = 0; i < n; i++){
+    double alt, az;
+    closed_form(i*step_s, &alt, &az);
+    s += alt + az;
+  }
+  const double w1 = wall_time();
+  sum = s;
+  (void)sum;
+
+  printf("%-12s %10ld %10.1f %12s\n", "closed form", n, (w1 - w0)*1e9/n, "-");
+}
+
+int main(int argc, char* argv[])
+{
+  double step_s = 0.25;
+  double hours = 8;
+  int c;
+
+  while((c = getopt(argc, argv, "d:H:h")) != -1){
+    switch(c){
+      case 'd':
+	step_s = atof(optarg);
+	break;
+      case 'H':
+	hours = atof(optarg);
+	break;
+      default:
+	fprintf(stderr, "usage: model_bench [-d step_s] [-H hours]\n");
+	return 2;
+    }
+  }
+
+  if((step_s <= 0) || (hours <= 0)){
+    fprintf(stderr, "model_bench: step and hours must be > 0\n");
+    return 2;
+  }
+
+  SimBoard::Reset();
+  printf("%-12s %10s %10s %12s\n", "model", "calls", "ns/call", "maxerr\"");
+  run("steady", step_s, 0, hours);
+  run("jittered", step_s, 0.1, hours);
+  run_closed_form(step_s, hours);
+
+  return 0;
+}
@@ -0,0 +1,418 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <stdio.h>
+#include <string.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "Arduino.h"
+
+/**********************************************************************
+NAME
+        Arduino.cpp - host shim of the Arduino core
+
+SYNOPSIS
+	See Arduino.h
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define SERIAL_TX_BUFFER_SIZE	64 // same as the MEGA2560 core
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+
+unsigned long long SimBoard::_now_us = 0;
+unsigned long long SimBoard::_poll_cost_us = 2;
+uint8_t SimBoard::_pin[SimBoard::NUM_PINS];
+void (*SimBoard::_isr[SimBoard::NUM_INTERRUPTS])();
+bool SimBoard::_is_interrupts = true;
+void (*SimBoard::_timer_isr)() = NULL;
+unsigned long long SimBoard::_timer_period_us = 0;
+unsigned long long SimBoard::_timer_next_us = 0;
+bool SimBoard::_is_in_timer_isr = false;
+uint8_t SimBoard::_step_pin = 0xff;
+uint8_t SimBoard::_dir_pin = 0xff;
+unsigned long SimBoard::_step_count = 0;
+long SimBoard::_step_position = 0;
+
+/**********************************************************************
+	Time
+ **********************************************************************/
+
+unsigned long micros()
+{
+  return static_cast<unsigned long>(SimBoard::Now());
+}
+
+unsigned long millis()
+{
+  return static_cast<unsigned long>(SimBoard::Now()/1000);
+}
+
+void delay(unsigned long ms)
+{
+  SimBoard::Advance(static_cast<unsigned long long>(ms)*1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  SimBoard::Advance(us);
+}
+
+/**********************************************************************
+	Pins and interrupts
+ **********************************************************************/
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if((mode == INPUT_PULLUP) && (pin < SimBoard::NUM_PINS)){
+    SimBoard::_pin[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if(pin >= SimBoard::NUM_PINS)
+    return;
+
+  // count the rising edges of the step pin
+  if((pin == SimBoard::_step_pin) && (SimBoard::_pin[pin] == LOW) && (val != LOW)){
+    SimBoard::_step_count++;
+    SimBoard::_step_position += (SimBoard::_pin[SimBoard::_dir_pin] != LOW)? 1:-1;
+  }
+  SimBoard::_pin[pin] = val != LOW? HIGH:LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pin < SimBoard::NUM_PINS? SimBoard::_pin[pin]:LOW;
+}
+
+void attachInterrupt(uint8_t num, void (*handler)(), int /* mode */)
+{
+  if(num < SimBoard::NUM_INTERRUPTS)
+    SimBoard::_isr[num] = handler;
+}
+
+void detachInterrupt(uint8_t num)
+{
+  if(num < SimBoard::NUM_INTERRUPTS)
+    SimBoard::_isr[num] = NULL;
+}
+
+void noInterrupts()
+{
+  SimBoard::_is_interrupts = false;
+}
+
+void interrupts()
+{
+  SimBoard::_is_interrupts = true;
+}
+
+/**********************************************************************
+	SimBoard
+ **********************************************************************/
+
+void SimBoard::Reset()
+{
+  _now_us = 0;
+  memset(_pin, 0, sizeof(_pin));
+  _step_count = 0;
+  _step_position = 0;
+  _is_interrupts = true;
+  _is_in_timer_isr = false;
+  DetachTimer();
+
+  Serial.Reset();
+  Serial1.Reset();
+  Serial2.Reset();
+  Serial3.Reset();
+}
+
+void SimBoard::Advance(const unsigned long long dt_us)
+{
+  const unsigned long long end_us = _now_us + dt_us;
+
+  // run the timer interrupt at each of its ticks on the way. Time
+  // spent inside the handler, e.g. delayMicroseconds(), just passes.
+  if(_timer_isr && _is_interrupts && !_is_in_timer_isr){
+    while(_timer_next_us <= end_us){
+      if(_timer_next_us > _now_us){
+	_now_us = _timer_next_us;
+	_timer_next_us += _timer_period_us;
+      }
+      else {
+	// ticks missed while interrupts were off only fire once, just
+	// like a pending compare match flag
+	_timer_next_us += ((_now_us - _timer_next_us)/_timer_period_us + 1)*_timer_period_us;
+      }
+
+      _is_in_timer_isr = true;
+      _timer_isr();
+      _is_in_timer_isr = false;
+    }
+  }
+
+  if(end_us > _now_us)
+    _now_us = end_us;
+}
+
+void SimBoard::AttachTimer(const unsigned long long period_us, void (*handler)())
+{
+  _timer_period_us = period_us > 0? period_us:1;
+  _timer_next_us = _now_us + _timer_period_us;
+  _timer_isr = handler;
+}
+
+void SimBoard::DetachTimer()
+{
+  _timer_isr = NULL;
+}
+
+void SimBoard::SetStepPins(const uint8_t step_pin, const uint8_t dir_pin)
+{
+  _step_pin = step_pin;
+  _dir_pin = dir_pin;
+}
+
+void SimBoard::FireInterrupt(const uint8_t num)
+{
+  if((num < NUM_INTERRUPTS) && _isr[num]){
+    // interrupts are off in an interrupt routine until it returns
+    const bool is_interrupts = _is_interrupts;
+    _is_interrupts = false;
+    _isr[num]();
+    _is_interrupts = is_interrupts;
+  }
+}
+
+/**********************************************************************
+	HardwareSerial
+ **********************************************************************/
+
+HardwareSerial::HardwareSerial()
+  : _peer(NULL),
+    _is_echo(false),
+    _timeout_ms(1000),
+    _byte_time_us(87) // 115200 baud
+{
+  Reset();
+}
+
+void HardwareSerial::Reset()
+{
+  _tx_free_us = 0;
+  _bytes_written = 0;
+  _rx_head = _rx_tail = 0;
+}
+
+void HardwareSerial::begin(const unsigned long baud)
+{
+  // 1 start bit, 8 data bits, 1 stop bit
+  _byte_time_us = (10*1000000ULL + baud - 1)/baud;
+}
+
+void HardwareSerial::Inject(const char ch, const unsigned long long arrival_us)
+{
+  unsigned int next = (_rx_tail + 1) % RX_SIZE;
+  if(next == _rx_head)
+    return; // overrun: the byte is lost just like on the hardware
+
+  _rx_time[_rx_tail] = arrival_us;
+  _rx_data[_rx_tail] = ch;
+  _rx_tail = next;
+}
+
+int HardwareSerial::available()
+{
+  // polling is not free on the board
+  SimBoard::Advance(SimBoard::GetPollCost());
+
+  int n = 0;
+  for(unsigned int i = _rx_head; i != _rx_tail; i = (i + 1) % RX_SIZE){
+    if(_rx_time[i] > SimBoard::Now())
+      break;
+    n++;
+  }
+  return n;
+}
+
+int HardwareSerial::peek()
+{
+  if((_rx_head == _rx_tail) || (_rx_time[_rx_head] > SimBoard::Now()))
+    return -1;
+
+  return static_cast<unsigned char>(_rx_data[_rx_head]);
+}
+
+int HardwareSerial::read()
+{
+  int ch = peek();
+  if(ch >= 0)
+    _rx_head = (_rx_head + 1) % RX_SIZE;
+
+  return ch;
+}
+
+size_t HardwareSerial::readBytes(char* buffer, size_t length)
+{
+  size_t n = 0;
+  const unsigned long long timeout_us = _timeout_ms*1000ULL;
+  unsigned long long start_us = SimBoard::Now();
+
+  while(n < length){
+    int ch = read();
+    if(ch >= 0){
+      buffer[n++] = static_cast<char>(ch);
+      start_us = SimBoard::Now();
+    }
+    else {
+      // wait for the next byte or give up
+      if((_rx_head == _rx_tail) ||
+	 (_rx_time[_rx_head] - start_us > timeout_us)){
+	SimBoard::Advance(start_us + timeout_us > SimBoard::Now()?
+			  start_us + timeout_us - SimBoard::Now():0);
+	break;
+      }
+      SimBoard::Advance(_rx_time[_rx_head] - SimBoard::Now());
+    }
+  }
+  return n;
+}
+
+void HardwareSerial::flush()
+{
+  // block until the transmit buffer has drained
+  if(_tx_free_us > SimBoard::Now())
+    SimBoard::Advance(_tx_free_us - SimBoard::Now());
+}
+
+size_t HardwareSerial::write(uint8_t ch)
+{
+  const unsigned long long now_us = SimBoard::Now();
+
+  // block if the transmit buffer is full
+  const unsigned long long buffered_us = SERIAL_TX_BUFFER_SIZE*_byte_time_us;
+  if(_tx_free_us > now_us + buffered_us)
+    SimBoard::Advance(_tx_free_us - buffered_us - now_us);
+
+  _tx_free_us = (_tx_free_us > SimBoard::Now()? _tx_free_us:SimBoard::Now()) + _byte_time_us;
+  _bytes_written++;
+
+  if(_peer)
+    _peer->OnByte(this, static_cast<char>(ch), _tx_free_us);
+
+  if(_is_echo)
+    fputc(ch, stdout);
+
+  return 1;
+}
+
+size_t HardwareSerial::write(const char* buffer, size_t length)
+{
+  for(size_t i=0; i<length; i++)
+    write(static_cast<uint8_t>(buffer[i]));
+  return length;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t length)
+{
+  return write(reinterpret_cast<const char*>(buffer), length);
+}
+
+size_t HardwareSerial::print(const char* s)
+{
+  return write(s, strlen(s));
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper* s)
+{
+  return print(reinterpret_cast<const char*>(s));
+}
+
+size_t HardwareSerial::print(char c)
+{
+  return write(static_cast<uint8_t>(c));
+}
+
+size_t HardwareSerial::print(int n, int base)
+{
+  return print(static_cast<long>(n), base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base)
+{
+  return print(static_cast<unsigned long>(n), base);
+}
+
+size_t HardwareSerial::print(long n, int base)
+{
+  if((n < 0) && (base == DEC)){
+    return print('-') + print(static_cast<unsigned long>(-n), base);
+  }
+  return print(static_cast<unsigned long>(n), base);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+  char buf[8*sizeof(unsigned long) + 1];
+  char* p = &buf[sizeof(buf) - 1];
+  *p = '\0';
+
+  if(base < 2)
+    base = 10;
+
+  do {
+    unsigned long digit = n % base;
+    *--p = digit < 10? '0' + digit:'A' + digit - 10;
+    n /= base;
+  } while(n);
+
+  return print(p);
+}
+
+size_t HardwareSerial::print(double f, int digits)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, f);
+  return print(buf);
+}
+
+size_t HardwareSerial::println()
+{
+  return print("\r\n");
+}
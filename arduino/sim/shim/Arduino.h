@@ -0,0 +1,289 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/**********************************************************************
+NAME
+
+        Arduino.h - host shim of the parts of the Arduino core that
+		    are used by the DeRotator and Telescope libraries.
+
+SYNOPSIS
+	This header replaces <Arduino.h> when the derotator libraries
+	are compiled on a host computer. Time does not pass by itself:
+	micros() and millis() return the value of a virtual clock that
+	only moves when SimBoard::Advance() is called, either by the
+	simulation driver or by the shim itself to charge the cost of
+	a blocking call (delay(), Serial.flush(), polling
+	Serial.available() etc.)
+
+	Serial is a sink for the debugging messages of the
+	libraries. Serial2 is connected to a SerialPeer, e.g. the
+	simulated LX200 in LX200Mount.h, at the configured baud rate.
+
+	Differences from the MEGA2560 that the user must keep in mind:
+		(a) unsigned long is 64 bits so that micros() does NOT
+		    wrap after 71 minutes.
+		(b) double is 64 bits and not 32 bits.
+
+INTERFACE
+	SimBoard::Reset()		- reset the virtual clock, pins,
+					  step counters and serial ports.
+
+	SimBoard::Advance(		- advance the virtual clock
+	  dt_us				- by this many us
+	)
+
+	SimBoard::Now()			- returns the virtual time in us
+
+	SimBoard::SetPollCost(		- charge this many us to the
+	  us				  virtual clock every time
+	)				  Serial.available() is called.
+
+	SimBoard::SetStepPins(		- count the rising edges of
+	  step_pin			- this pin as stepper steps and use
+	  dir_pin			- this pin for the direction
+	)
+
+	SimBoard::GetStepCount()	- returns the total number of
+					  step pulses seen.
+
+	SimBoard::GetStepPosition()	- returns the signed step count,
+					  +1 for each step with dir HIGH.
+
+	SimBoard::FireInterrupt(	- call the handler attached
+	  num				- to this external interrupt number
+	)				  with interrupts off, like the
+					  MEGA2560 does
+
+	SimBoard::AttachTimer(		- call this handler every
+	  period_us			- period_us of virtual time, like a
+	  handler			  timer compare interrupt. The handler
+	)				  is not called while noInterrupts()
+					  is in effect or while it is
+					  already running.
+
+	SimBoard::DetachTimer()		- stop calling the timer handler
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+	LX200Mount.h
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define HIGH	0x1
+#define LOW	0x0
+
+#define INPUT		0x0
+#define OUTPUT		0x1
+#define INPUT_PULLUP	0x2
+
+#define CHANGE	1
+#define FALLING	2
+#define RISING	3
+
+#define DEC	10
+#define HEX	16
+#define OCT	8
+#define BIN	2
+
+#define PROGMEM
+#define pgm_read_byte(addr)	(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)	(*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t*)(addr))
+#define pgm_read_float(addr)	(*(const float*)(addr))
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+template<class T> inline T max(const T a, const T b) { return a > b? a:b; }
+template<class T> inline T min(const T a, const T b) { return a < b? a:b; }
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t num, void (*handler)(), int mode);
+void detachInterrupt(uint8_t num);
+void noInterrupts();
+void interrupts();
+
+/**********************************************************************
+	Serial ports
+ **********************************************************************/
+
+class HardwareSerial;
+
+/*
+  Anything that is plugged into a serial port of the simulated board
+*/
+class SerialPeer
+{
+public:
+  virtual ~SerialPeer() {}
+
+  // the board has finished transmitting ch at virtual time t_us
+  virtual void OnByte(HardwareSerial* port,
+		      const char ch,
+		      const unsigned long long t_us) = 0;
+};
+
+class HardwareSerial
+{
+public:
+  HardwareSerial();
+
+public:
+  void begin(const unsigned long baud);
+  void end() {}
+  operator bool() const { return true; }
+
+  int available();
+  int read();
+  int peek();
+  size_t readBytes(char* buffer, size_t length);
+  void setTimeout(unsigned long timeout_ms) { _timeout_ms = timeout_ms; }
+  void flush();
+
+  size_t write(uint8_t ch);
+  size_t write(const char* buffer, size_t length);
+  size_t write(const uint8_t* buffer, size_t length);
+
+  size_t print(const char* s);
+  size_t print(const __FlashStringHelper* s);
+  size_t print(char c);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double f, int digits = 2);
+
+  size_t println();
+  template<class T> size_t println(const T x) { size_t n = print(x); return n + println(); }
+  template<class T> size_t println(const T x, int f) { size_t n = print(x, f); return n + println(); }
+
+public:
+  // simulation side
+  void Connect(SerialPeer* const peer) { _peer = peer; }
+  void Inject(const char ch, const unsigned long long arrival_us);
+  void SetEcho(const bool is_echo) { _is_echo = is_echo; }
+  unsigned long long ByteTime() const { return _byte_time_us; }
+  unsigned long GetBytesWritten() const { return _bytes_written; }
+  void Reset();
+
+private:
+  SerialPeer* _peer;
+  bool _is_echo;
+  unsigned long _timeout_ms;
+  unsigned long long _byte_time_us;
+  unsigned long long _tx_free_us;
+  unsigned long _bytes_written;
+
+  // receive buffer of (arrival time, byte)
+  enum {RX_SIZE = 256};
+  unsigned long long _rx_time[RX_SIZE];
+  char _rx_data[RX_SIZE];
+  unsigned int _rx_head, _rx_tail;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+/**********************************************************************
+	The simulated board
+ **********************************************************************/
+
+class SimBoard
+{
+public:
+  static void Reset();
+  static void Advance(const unsigned long long dt_us);
+  static unsigned long long Now() { return _now_us; }
+
+  static void SetPollCost(const unsigned long long us) { _poll_cost_us = us; }
+  static unsigned long long GetPollCost() { return _poll_cost_us; }
+
+  static void SetStepPins(const uint8_t step_pin, const uint8_t dir_pin);
+  static unsigned long GetStepCount() { return _step_count; }
+  static long GetStepPosition() { return _step_position; }
+
+  static void FireInterrupt(const uint8_t num);
+
+  static void AttachTimer(const unsigned long long period_us, void (*handler)());
+  static void DetachTimer();
+
+private:
+  friend void pinMode(uint8_t pin, uint8_t mode);
+  friend void digitalWrite(uint8_t pin, uint8_t val);
+  friend int digitalRead(uint8_t pin);
+  friend void attachInterrupt(uint8_t num, void (*handler)(), int mode);
+  friend void detachInterrupt(uint8_t num);
+  friend void noInterrupts();
+  friend void interrupts();
+
+  static unsigned long long _now_us;
+  static unsigned long long _poll_cost_us;
+
+  enum {NUM_PINS = 70, NUM_INTERRUPTS = 6};
+  static uint8_t _pin[NUM_PINS];
+  static void (*_isr[NUM_INTERRUPTS])();
+
+  static bool _is_interrupts;
+  static void (*_timer_isr)();
+  static unsigned long long _timer_period_us;
+  static unsigned long long _timer_next_us;
+  static bool _is_in_timer_isr;
+
+  static uint8_t _step_pin, _dir_pin;
+  static unsigned long _step_count;
+  static long _step_position;
+};
+
+#endif
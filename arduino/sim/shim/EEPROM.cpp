@@ -0,0 +1,84 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <string.h>
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "avr/eeprom.h"
+
+#define EEPROM_WRITE_US	3300	// per byte, see the ATmega2560 datasheet
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass()
+{
+  Erase();
+}
+
+uint8_t EEPROMClass::read(const int address) const
+{
+  return (address >= 0) && (address < SIZE)? _data[address]:0xFF;
+}
+
+void EEPROMClass::write(const int address, const uint8_t value)
+{
+  if((address < 0) || (address >= SIZE))
+    return;
+
+  // eeprom_write_byte() busy waits for the last write to end
+  if(SimBoard::Now() < _ready_us)
+    SimBoard::Advance(_ready_us - SimBoard::Now());
+
+  _data[address] = value;
+  _writes[address]++;
+  _write_count++;
+  _ready_us = SimBoard::Now() + EEPROM_WRITE_US;
+}
+
+void EEPROMClass::update(const int address, const uint8_t value)
+{
+  if(read(address) != value)
+    write(address, value);
+}
+
+void EEPROMClass::Erase()
+{
+  memset(_data, 0xFF, sizeof(_data));
+  memset(_writes, 0, sizeof(_writes));
+  _write_count = 0;
+  _ready_us = 0;
+}
+
+unsigned long EEPROMClass::GetWriteCount(const int address) const
+{
+  return (address >= 0) && (address < SIZE)? _writes[address]:0;
+}
+
+bool eeprom_is_ready()
+{
+  return SimBoard::Now() >= EEPROM._ready_us;
+}
@@ -0,0 +1,106 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef EEPROM_SHIM_H
+#define EEPROM_SHIM_H
+
+#include <stdint.h>
+
+/**********************************************************************
+NAME
+
+        EEPROM.h - host shim of the Arduino EEPROM library.
+
+SYNOPSIS
+	The 4 kB EEPROM of the MEGA2560 is kept in memory. It is NOT
+	cleared by SimBoard::Reset() so that a power cycle can be
+	simulated. Like the real EEPROM, a byte takes 3.3 ms to be
+	written in the background. Writing the next byte before then
+	waits for the rest of that time on the virtual clock.
+
+INTERFACE
+	read(), write(), update(), get(), put(), length() - as the
+					  Arduino EEPROM library
+
+	Erase()				- set every byte to 0xFF, like a
+					  new chip
+
+	Reset()				- the power has been cycled. The
+					  byte being written is done.
+
+	GetWriteCount()			- returns the number of bytes
+					  written since Erase()
+
+	GetWriteCount(			- returns the number of times
+	  address			- this byte was written
+	)
+
+**********************************************************************/
+
+class EEPROMClass
+{
+public:
+  EEPROMClass();
+
+public:
+  uint8_t read(const int address) const;
+  void write(const int address, const uint8_t value);
+  void update(const int address, const uint8_t value);
+  uint16_t length() const { return SIZE; }
+
+  template<class T> T& get(const int address, T& t) const
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(&t);
+    for(unsigned int i=0; i<sizeof(T); i++)
+      p[i] = read(address + i);
+    return t;
+  }
+
+  template<class T> const T& put(const int address, const T& t)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&t);
+    for(unsigned int i=0; i<sizeof(T); i++)
+      update(address + i, p[i]);
+    return t;
+  }
+
+public:
+  // simulation side
+  void Erase();
+  void Reset() { _ready_us = 0; }
+  unsigned long GetWriteCount() const { return _write_count; }
+  unsigned long GetWriteCount(const int address) const;
+
+private:
+  enum {SIZE = 4096};
+  uint8_t _data[SIZE];
+  unsigned long _writes[SIZE];
+  unsigned long _write_count;
+  unsigned long long _ready_us;	// virtual time the last write ends
+
+  friend bool eeprom_is_ready();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,41 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef AVR_EEPROM_SHIM_H
+#define AVR_EEPROM_SHIM_H
+
+/**********************************************************************
+NAME
+
+        avr/eeprom.h - host shim of the parts of the avr-libc EEPROM
+		       header that are used by the libraries.
+
+SYNOPSIS
+	eeprom_is_ready() is true once the last byte written by the
+	EEPROM shim has had its 3.3 ms. See EEPROM.h
+
+**********************************************************************/
+
+bool eeprom_is_ready();
+
+#endif
@@ -0,0 +1,179 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* operating system header files (use <> for make depend) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* general system header files (use "" for make depend) */
+#include "Arduino.h"
+
+/* local include files (use "") */
+#include "TrigTable.h"
+
+#define DEG2RAD	M_PI/180.0
+
+/**********************************************************************
+NAME
+
+	trig_bench - checks the accuracy of TrigTable against libm and
+		     times both on the host.
+
+SYNOPSIS
+
+	trig_bench [-n calls]
+
+	-n	calls of each function that are timed.
+		Default: 10000000
+
+	The accuracy is checked at 100000 angles over two turns each
+	way. For Cos() and Sin() the worst error is reported as a
+	fraction of TrigTable::MaxError(), which must not be above 1.
+	For Sec() the worst relative error is reported for alt within
+	89 deg of the horizon, which is where dzeta_dt() is used.
+
+	The time of each call is reported in ns and, on x86, in TSC
+	cycles. The times on the MEGA2560 are from
+	../trig_bench/trig_bench.ino.
+
+	Returns 1 if the error bound is broken.
+
+AUTHOR
+
+	C.Y. Tan
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+typedef float (*TrigFunction)(const float x);
+
+static float table_cos(const float x) { return TrigTable::Cos(x); }
+static float table_sin(const float x) { return TrigTable::Sin(x); }
+static float table_sec(const float x) { return TrigTable::Sec(x); }
+static float libm_cos(const float x) { return cosf(x); }
+static float libm_sin(const float x) { return sinf(x); }
+static float libm_sec(const float x) { return 1.0f/cosf(x); }
+static float libm_cos_double(const float x) { return cos(static_cast<double>(x)); }
+
+static double wall_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static unsigned long long cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static void time_function(const char* name,
+			  const TrigFunction f,
+			  const long ncalls)
+{
+  // angles over a few turns like the az of propagate()
+  volatile float sum = 0;
+  const float dx = static_cast<float>(4*M_PI/1024);
+
+  const double t0 = wall_time();
+  const unsigned long long c0 = cycles();
+  float x = static_cast<float>(-2*M_PI);
+  float s = 0;
+  for(long i = 0; i < ncalls; i++){
+    s += f(x);
+    x += dx;
+    if(x > 2*M_PI){
+      x = static_cast<float>(-2*M_PI);
+    }
+  }
+  const unsigned long long c1 = cycles();
+  const double t1 = wall_time();
+  sum = s;
+
+  printf("%-16s %10.2f %10.1f\n", name,
+	 (t1 - t0)*1e9/ncalls,
+	 static_cast<double>(c1 - c0)/ncalls);
+  (void)sum;
+}
+
+int main(int argc, char* argv[])
+{
+  long ncalls = 10000000;
+  int c;
+
+  while((c = getopt(argc, argv, "n:h")) != -1){
+    switch(c){
+      case 'n':
+	ncalls = atol(optarg);
+	break;
+      default:
+	fprintf(stderr, "usage: trig_bench [-n calls]\n");
+	return 2;
+    }
+  }
+
+  // accuracy against double precision libm
+  const int nangles = 100000;
+  double max_cos = 0, max_sin = 0, max_sec = 0;
+  for(int i = 0; i <= nangles; i++){
+    const float x = static_cast<float>(-4*M_PI + 8*M_PI*i/nangles);
+
+    const double ecos = fabs(TrigTable::Cos(x) - cos(static_cast<double>(x)))/TrigTable::MaxError(x);
+    const double esin = fabs(TrigTable::Sin(x) - sin(static_cast<double>(x)))/
+      TrigTable::MaxError(static_cast<float>(M_PI/2) - x);
+    if(ecos > max_cos) max_cos = ecos;
+    if(esin > max_sin) max_sin = esin;
+
+    const float alt = static_cast<float>((-89.0 + 178.0*i/nangles)*DEG2RAD);
+    const double sec = 1.0/cos(static_cast<double>(alt));
+    const double esec = fabs(TrigTable::Sec(alt) - sec)/sec;
+    if(esec > max_sec) max_sec = esec;
+  }
+
+  printf("Cos() max error  %.3f of MaxError()\n", max_cos);
+  printf("Sin() max error  %.3f of MaxError()\n", max_sin);
+  printf("Sec() max error  %.2e relative for |alt| <= 89 deg\n\n", max_sec);
+
+  printf("%-16s %10s %10s\n", "function", "ns/call", "cycles");
+  time_function("TrigTable::Cos", table_cos, ncalls);
+  time_function("TrigTable::Sin", table_sin, ncalls);
+  time_function("TrigTable::Sec", table_sec, ncalls);
+  time_function("cosf", libm_cos, ncalls);
+  time_function("sinf", libm_sin, ncalls);
+  time_function("1/cosf", libm_sec, ncalls);
+  time_function("cos (double)", libm_cos_double, ncalls);
+
+  return ((max_cos > 1) || (max_sin > 1))? 1:0;
+}
@@ -0,0 +1,137 @@
+/*$Id$*/
+/*
+    derot is the controller code for the Arduino MEGA2560
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <math.h>
+
+/* general system header files (use "" for make depend) */
+#include "Arduino.h"
+
+/* local include files (use "") */
+#include "TrigTable.h"
+
+/**********************************************************************
+NAME
+
+	trig_bench - times TrigTable against the cos() and sin() of
+		     avr-libc on the MEGA2560.
+
+SYNOPSIS
+	Each function is called NCALLS times on angles spread over a
+	few turns and its time is counted in CPU cycles by Timer1
+	running at the 16 MHz clock. The cost of the loop itself is
+	measured with a function that returns its argument and is taken
+	off. The results are printed on Serial at 115200 baud.
+
+	sim/trig_bench.cpp does the same on the host and also checks
+	the accuracy.
+
+AUTHOR
+
+	C.Y. Tan
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+#define NCALLS	1000
+
+typedef float (*TrigFunction)(const float x);
+
+static float empty(const float x) { return x; }
+static float table_cos(const float x) { return TrigTable::Cos(x); }
+static float table_sin(const float x) { return TrigTable::Sin(x); }
+static float table_sec(const float x) { return TrigTable::Sec(x); }
+static float libm_cos(const float x) { return cos(x); }
+static float libm_sin(const float x) { return sin(x); }
+static float libm_sec(const float x) { return 1.0/cos(x); }
+
+volatile float sum;
+
+/*
+  returns the mean CPU cycles of one call. Timer1 overflows every
+  4096 us, so the overflows are counted too.
+*/
+static float time_function(const TrigFunction f)
+{
+  unsigned long overflows = 0;
+  float x = -2*M_PI;
+  float s = 0;
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TCCR1B = _BV(CS10); // no prescaler
+
+  for(int i = 0; i < NCALLS; i++){
+    s += f(x);
+    x += 4*M_PI/NCALLS;
+
+    if(TIFR1 & _BV(TOV1)){
+      TIFR1 = _BV(TOV1);
+      overflows++;
+    }
+  }
+
+  const unsigned int count = TCNT1;
+  TCCR1B = 0;
+  if(TIFR1 & _BV(TOV1)){
+    overflows++;
+  }
+  interrupts();
+  sum = s;
+
+  return (overflows*65536.0 + count)/NCALLS;
+}
+
+static void report(const char* name, const TrigFunction f, const float loop_cycles)
+{
+  const float cycles = time_function(f) - loop_cycles;
+  Serial.print(name);
+  Serial.print(F("\t"));
+  Serial.print(cycles, 0);
+  Serial.print(F(" cycles\t"));
+  Serial.print(cycles/16.0, 1);
+  Serial.println(F(" us"));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println(F("trig_bench: cycles per call"));
+
+  const float loop_cycles = time_function(empty);
+
+  report("TrigTable::Cos", table_cos, loop_cycles);
+  report("TrigTable::Sin", table_sin, loop_cycles);
+  report("TrigTable::Sec", table_sec, loop_cycles);
+  report("cos", libm_cos, loop_cycles);
+  report("sin", libm_sin, loop_cycles);
+  report("1/cos", libm_sec, loop_cycles);
+}
+
+void loop()
+{
+}
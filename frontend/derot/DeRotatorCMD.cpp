@@ -97,7 +97,8 @@ REVISION
 
 DeRotatorCMD::DeRotatorCMD(const double mechanical_stepsize)
 :
-  _MECHANICAL_STEPSIZE(mechanical_stepsize)
+  _MECHANICAL_STEPSIZE(mechanical_stepsize),
+  _STEPS_PER_DEGREE(1.0/mechanical_stepsize)
 {
   _tcpClient = NULL;
   _serialClient = NULL;
@@ -121,6 +122,9 @@ int DeRotatorCMD::Connect2Wifi(const char* ipAddress)
     return -1;
   }
 
+  // an older derotator stays in PROTOCOL_RAW
+  _tcpClient->UseFrames();
+
   return 0;
 }
 
@@ -135,6 +139,9 @@ int DeRotatorCMD::Connect2Serial(const char* devicename)
     return -1;
   }
 
+  // an older derotator stays in PROTOCOL_RAW
+  _serialClient->UseFrames();
+
   return 0;
 }
 
@@ -172,7 +179,10 @@ int DeRotatorCMD::SendCommand(RequestPacket* const rq,
     }
 
 
-    if(rp->_reply != REPLY_OK){
+    // the getters reply with the type of their values
+    if((rp->_reply != REPLY_OK) &&
+       (rp->_reply != REPLY_INT16) &&
+       (rp->_reply != REPLY_FLOAT)){
       throw string("Reply is not ok");
     }
 
@@ -232,6 +242,51 @@ int DeRotatorCMD::SendCommand(RequestPacket* const rq) const
   }
 }
 
+int DeRotatorCMD::SendCommands(RequestPacket* const rq,
+			       ReplyPacket* const rp,
+			       const int n) const
+{
+  using namespace std;
+
+  const int pipeline_max = _serialClient? _serialClient->GetPipelineMax():
+    _tcpClient? _tcpClient->GetPipelineMax():1;
+  
+  try{
+    for(int i=0; i<n; i+=pipeline_max){
+      const int m = (n - i < pipeline_max)? n - i:pipeline_max;
+      
+      if(_serialClient){
+	if(_serialClient->Send(&rq[i], m) != 0){
+	  throw string("Send request failed");
+	}
+	for(int j=i; j<i+m; j++){
+	  if(_serialClient->Receive(&rp[j]) != 0){
+	    throw string("Did not receive reply packet");
+	  }
+	}
+      }
+
+      if(_tcpClient){
+	if(_tcpClient->Send(&rq[i], m) != 0){
+	  throw string("Send request failed");
+	}
+	for(int j=i; j<i+m; j++){
+	  if(_tcpClient->Receive(&rp[j]) != 0){
+	    throw string("Did not receive reply packet");
+	  }
+	}
+      }
+    }
+
+    return 0;
+  }
+  catch(string& message){
+    cerr << "DeRotatorCMD::SendCommands(): "
+	 << message
+	 << "\n";
+    return -1;
+  }
+}
 
 int DeRotatorCMD::Goto(const float degrees) const
 {
@@ -272,7 +327,7 @@ int DeRotatorCMD::Goto(const float d0,
     double dd = d1-d0;
 
     // calculate the number of steps between d0 to d1
-    int16_t dsteps = dd/_MECHANICAL_STEPSIZE; // degrees/(degrees/step)
+    int16_t dsteps = dd*_STEPS_PER_DEGREE; // degrees*(steps/degree)
     float dangle = dd/dsteps; // degrees per step
 
     // calculate the speed to move from d0 to d1 per step
@@ -357,3 +412,76 @@ int DeRotatorCMD::SetOmega(const float omega) const
 
   return 0;
 }
+
+int DeRotatorCMD::GetGearTrain(double* ratio, double* steps_per_turn)
+{
+  RequestPacket rq;
+  ReplyPacket rp;
+
+  rq._command = CMD_GET_GEAR_TRAIN;
+
+  if(SendCommand(&rq, &rp) != REPLY_FLOAT){
+    cerr << "DeRotatorCMD::GetGearTrain(): SendCommand() error\n";
+    return -1;
+  }
+
+  *ratio = rp._fvalue[0];
+  *steps_per_turn = rp._fvalue[1];
+  _MECHANICAL_STEPSIZE = rp._fvalue[2];
+  _STEPS_PER_DEGREE = rp._fvalue[3];
+
+  return 0;
+}
+
+int DeRotatorCMD::SetGearTrain(const double ratio, const double steps_per_turn)
+{
+  if((ratio <= 0) || (steps_per_turn <= 0)){
+    cerr << "DeRotatorCMD::SetGearTrain(): the ratio and the steps per turn "
+	 << "must be > 0\n";
+    return -1;
+  }
+
+  RequestPacket rq;
+
+  rq._command = CMD_SET_GEAR_TRAIN;
+  rq._fvalue[0] = ratio;
+  rq._fvalue[1] = steps_per_turn;
+
+  if(SendCommand(&rq) != REPLY_OK){
+    cerr << "DeRotatorCMD::SetGearTrain(): SendCommand() error\n";
+    return -1;
+  }
+
+  _STEPS_PER_DEGREE = ratio*steps_per_turn/360.0;
+  _MECHANICAL_STEPSIZE = 1.0/_STEPS_PER_DEGREE;
+
+  return 0;
+}
+
+double DeRotatorCMD::GetStepsize() const
+{
+  return _MECHANICAL_STEPSIZE;
+}
+
+int DeRotatorCMD::GetCommandStats(const int command,
+				  int* calls,
+				  double* max_us,
+				  double* mean_us) const
+{
+  RequestPacket rq;
+  ReplyPacket rp;
+
+  rq._command = CMD_GET_COMMAND_STATS;
+  rq._ivalue = command;
+
+  // an older derotator does not reply with REPLY_FLOAT
+  if(SendCommand(&rq, &rp) != REPLY_FLOAT){
+    return -1;
+  }
+
+  *calls = rp._ivalue;
+  *max_us = rp._fvalue[0];
+  *mean_us = rp._fvalue[1];
+
+  return static_cast<int>(rp._fvalue[2]);
+}
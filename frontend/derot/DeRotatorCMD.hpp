@@ -45,7 +45,8 @@ CONSTRUCTOR
 
         DeRotatorCMD(		- constructor
 	  mechanical_stepsize	- the mechanical step size of the
-				  system in degrees/step.
+				  system in degrees/step until
+				  GetGearTrain() asks the derotator.
 				  Default: 0.05970731707 deg/step
 	)	
 
@@ -54,7 +55,8 @@ INTERFACE
 
 	Connect2Wifi(		- connect to the derotator via WIFI
 		ipAddress	- to this ip address
-	)			- returns 0 on success
+	)			- returns 0 on success. PROTOCOL_FRAMED
+				  is used if the derotator knows it
 
 	Connect2Serial(		- connect to the derotator via
 		   		  Serial line
@@ -64,12 +66,21 @@ INTERFACE
 	SendCommand(		- send the command to the derotator
 		rq		- stored in the request packet
 		rp		- the reply from the derotator
-	)			- returns 0 on success
+	)			- returns REPLY_OK, REPLY_INT16 or
+				  REPLY_FLOAT on success
 
 	SendCommand(		- send the command to the derotator
 		rq		- stored in the request packet
 	)			- returns 0 on success
 
+	SendCommands(		- send the commands to the derotator,
+				  with as many outstanding at once as
+				  it can take
+		rq		- stored in these request packets
+		rp		- the replies from the derotator
+		n		- this many of them
+	)			- returns 0 if every reply arrived
+
 	Goto(			- goto this position 
 		degrees		- in degrees w.r.t. home
 	)			- returns 0 on success
@@ -82,6 +93,35 @@ INTERFACE
 	)			- returns 0 on success
 
 
+	GetGearTrain(		- ask the derotator for its gear train
+				  and use its step size from now on
+		ratio		- turns of the stepper motor per
+				  turn of the camera
+		steps_per_turn	- full steps per turn of the stepper
+				  motor
+	)			- returns 0 on success
+
+	SetGearTrain(		- give the derotator another gear train.
+				  It is kept after SETUP_SAVE_SETTINGS
+		ratio		- turns of the stepper motor per
+				  turn of the camera
+		steps_per_turn	- full steps per turn of the stepper
+				  motor
+	)			- returns 0 on success
+
+	GetStepsize()		- returns the mechanical step size in
+				  degrees/full step
+
+	GetCommandStats(	- ask the derotator how long it took to
+				  service
+		command		- this command, or STATS_SLOWEST for
+				  the slowest one
+		calls		- the number of times it was called
+		max_us		- the longest service time in us
+		mean_us		- the mean service time in us
+	)			- returns the command, or -1 if the
+				  derotator does not know it
+
         WaitUntil(		- wait until the derotator
 		degrees		- reaches at this angle in degrees
 		wait_time	- the time to wait before each check
@@ -118,6 +158,10 @@ public:
 
   int SendCommand(RequestPacket* const rq) const;
 
+  int SendCommands(RequestPacket* const rq,
+		   ReplyPacket* const rp,
+		   const int n) const;
+
   int Goto(const float degrees) const;
   int Goto(const float d0,
 	   const float d1,
@@ -127,6 +171,15 @@ public:
 		 const float wait_time = 0.5) const;
 
   int SetOmega(const float omega) const;
+
+  int GetGearTrain(double* ratio, double* steps_per_turn);
+  int SetGearTrain(const double ratio, const double steps_per_turn);
+  double GetStepsize() const;
+
+  int GetCommandStats(const int command,
+		      int* calls,
+		      double* max_us,
+		      double* mean_us) const;
   
 
 private:
@@ -134,6 +187,7 @@ private:
   SerialClient* _serialClient;
 
 private:
-  const double _MECHANICAL_STEPSIZE;
+  double _MECHANICAL_STEPSIZE;	// degrees/full step
+  double _STEPS_PER_DEGREE;	// and its reciprocal
 };
 #endif
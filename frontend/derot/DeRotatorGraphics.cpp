@@ -67,6 +67,8 @@ REVISION
 
 using namespace std;
 
+double DeRotatorGraphics::_stepsize = DEFAULT_STEPSIZE;
+
 double atan2a(const double y, const double x)
 {
   /*
@@ -271,6 +273,16 @@ bool DeRotatorGraphics::IsEnableLimits()
   return _is_limits_enabled;
 }
 
+void DeRotatorGraphics::SetStepsize(const double stepsize)
+{
+  _stepsize = stepsize;
+}
+
+double DeRotatorGraphics::GetStepsize()
+{
+  return _stepsize;
+}
+
 
 
 void DeRotatorGraphics::draw()
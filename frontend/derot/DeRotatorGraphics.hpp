@@ -137,6 +137,16 @@ INTERFACE
 	DisableLimits()		- disable the CW and CCW limits
 	IsEnableLimits()	- return the state of the limits
 
+	SetStepsize(		- set the mechanical step size that the
+				  macros below convert steps with
+		stepsize	- in degrees/full step, as the derotator
+				  reports it with CMD_GET_GEAR_TRAIN
+	)
+
+	GetStepsize()		- returns the mechanical step size in
+				  degrees/full step. DEFAULT_STEPSIZE
+				  until it is set.
+
 MACROS for managing angles
 
 	There can be an inconsistent definition of the angle here in
@@ -195,8 +205,9 @@ SEE ALSO
 
 **********************************************************************/
 
-// converting steps to angle
-#define MECHANICAL_STEPSIZE	0.05970731707 // deg/step
+// converting steps to angle with the derotator's gear train
+#define DEFAULT_STEPSIZE	0.05970731707 // deg/step of the default gears
+#define MECHANICAL_STEPSIZE	DeRotatorGraphics::GetStepsize()
 
 // The way I've mounted the hardware derotator, +angle
 // spins the hardware in the anti-clockwise direction.
@@ -261,6 +272,9 @@ public:
   void DisableLimits();
   bool IsEnableLimits();
 
+  static void SetStepsize(const double stepsize);
+  static double GetStepsize();
+
 public:
   // these functions must be defined for derived classes of FL_Gl_Window
   void draw();
@@ -301,6 +315,9 @@ private:
   // user enables for disables the cw and ccw limits
   bool _is_limits_enabled;
 
+  // degrees/full step of the derotator that is connected
+  static double _stepsize;
+
 private:
   DeRotatorUI* _derotatorUI;
 
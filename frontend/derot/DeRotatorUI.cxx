@@ -447,8 +447,14 @@ LOG_TRACE << "Start: "
           << "steps = " << steps->value();
 
                    
-//Now start a timer to collect angle data from the derotator
-Fl::add_timeout(REPEAT_TIME, timer_cb, this);
+//Now start a timer to collect angle data from the derotator.
+//The derotator pushes the data if it takes the subscription.
+if(SubscribeTelemetry(TELEMETRY_EVERY_STEP) == REPLY_OK){
+  Fl::add_timeout(TELEMETRY_REPEAT_TIME, timer_cb, this);
+}
+else {
+  Fl::add_timeout(REPEAT_TIME, timer_cb, this);
+}
 }
 void DeRotatorUI::cb_Start(Fl_Button* o, void* v) {
   ((DeRotatorUI*)(o->parent()->parent()->user_data()))->cb_Start_i(o,v);
@@ -464,27 +470,48 @@ Fl::remove_timeout(timer_cb, this);
 Fl::remove_timeout(timer_cb1, this);
 Fl::remove_timeout(timer_cb2, this);
 
+// stop the derotator and get the telescope position in one batch
+RequestPacket rq[3];
+ReplyPacket rp[3];
+int n = 0;
 
-RequestPacket rq;
-rq._command = DEROTATOR_STOP;
+// nothing else, so that its frames fit over serial too
+memset(rq, 0, sizeof(rq));
 
-if(SendCommand(&rq) != REPLY_OK){    
+// the derotator no longer has to push telemetry
+if(_is_telemetry){
+  rq[n]._command = CMD_SUBSCRIBE_TELEMETRY;
+  rq[n]._ivalue = TELEMETRY_OFF;
+  n++;
+}
+
+const int stop = n++;
+rq[stop]._command = DEROTATOR_STOP;
+
+const int altaz = n++;
+rq[altaz]._command = CMD_GET_ALTAZ_ZETA;
+
+if((SendBatch(rq, rp, n) != REPLY_OK) || (rp[stop]._reply != REPLY_OK)){    
   LOG_ERROR << "DeRotatorUI::Stop: SendCommand() failed";
   return;
 }
 
+if(_is_telemetry){
+  // throw away what was pushed before the reply
+  TelemetryPacket tp;
+  while(ReceiveTelemetry(&tp) > 0);
+  _is_telemetry = false;
+}
+
 LOG_TRACE << "Stop: " 
           << "deg = " << deg->value() << " "
           << "steps = " << steps->value();
           
-/* get telescope position */
-rq._command = CMD_GET_ALTAZ_ZETA;
-ReplyPacket rp;
-
-if(SendCommand(&rq, &rp) == REPLY_OK){
+/* telescope position */
+if(rp[altaz]._reply == REPLY_OK){
   LOG_TRACE << "Stop: telescope at ("
-            << rp._fvalue[0] << ", "
-            << rp._fvalue[1]  << ")";
+            << rp[altaz]._fvalue[0] << ", "
+            << rp[altaz]._fvalue[1]  << ")";
 
 
 }
@@ -685,6 +712,15 @@ void DeRotatorUI::cb_QueryHardware_i(Fl_Menu_*, void*) {
 using namespace std;
 
 RequestPacket rq;
+
+// the step and angle macros need the step size of the derotator's
+// gear train. An older derotator keeps the default one
+ReplyPacket gear_rp;
+rq._command = CMD_GET_GEAR_TRAIN;
+if(SendCommand(&rq, &gear_rp) == REPLY_FLOAT){
+  DeRotatorGraphics::SetStepsize(gear_rp._fvalue[2]);
+}
+
 rq._command = CMD_QUERY_STATE;
 
 if(_serial_client){
@@ -808,7 +844,12 @@ if(sp._reply >= 0){
     SetCCWLimit->deactivate();
     
     //Now start a timer to collect angle data from the derotator
-    Fl::add_timeout(REPEAT_TIME, timer_cb, this);
+    if(SubscribeTelemetry(TELEMETRY_EVERY_STEP) == REPLY_OK){
+      Fl::add_timeout(TELEMETRY_REPEAT_TIME, timer_cb, this);
+    }
+    else {
+      Fl::add_timeout(REPEAT_TIME, timer_cb, this);
+    }
      
   }
 
@@ -1139,6 +1180,8 @@ if(_tcp_client == NULL){
   }
    
   LOG_INFO << "WIFI Connected!";
+  // an older derotator stays in PROTOCOL_RAW
+  _tcp_client->UseFrames();
   // get the current hardware status of the derotator
   LOG_INFO << "querying hardware";
   QueryHardware->do_callback(o); 
@@ -1202,6 +1245,8 @@ if(_serial_client == NULL){
   _serial_client->ReadStringUntil();
   _serial_client->ReadStringUntil();
   _serial_client->ReadStringUntil();
+  // an older derotator stays in PROTOCOL_RAW
+  _serial_client->UseFrames();
   
     // get the current hardware status of the derotator
   QueryHardware->do_callback(o); 
@@ -1254,33 +1299,42 @@ src::severity_logger< severity_level > lg;
  LOG_INFO << "WLAN password = " << WLANPassword->value();
  LOG_INFO << "WLAN security = " << WLANSecurity->value();
 
-RequestPacket rq;
+RequestPacket rq[3];
+ReplyPacket rp[3];
 
-rq._command = CMD_SET_WLAN_SSID;
-strcpy(rq._buf, WLANSSID->value());
-rq._buf[strlen(WLANSSID->value())] = '\0';
+rq[0]._command = CMD_SET_WLAN_SSID;
+strcpy(rq[0]._buf, WLANSSID->value());
+rq[0]._buf[strlen(WLANSSID->value())] = '\0';
 
-if(SendCommand(&rq) != REPLY_OK){
-  LOG_INFO << "DeRotatorUI::Send via serial: SendCommand(): "
+rq[1]._command = CMD_SET_WLAN_PASS;
+strcpy(rq[1]._buf, WLANPassword->value());
+rq[1]._buf[strlen(WLANPassword->value())] = '\0';
+
+rq[2]._command = CMD_SET_WLAN_SECURITY;
+rq[2]._ivalue = WLANSecurity->value();
+
+// all three are sent in one batch
+if(SendBatch(rq, rp, 3) != REPLY_OK){
+  LOG_INFO << "DeRotatorUI::Send via serial: SendBatch(): "
+	   << " cannot send the WLAN setup";
+  return;
+}
+
+if(rp[0]._reply != REPLY_OK){
+  LOG_INFO << "DeRotatorUI::Send via serial: SendBatch(): "
 	   << " cannot send WLANSSID "
 	   <<  WLANSSID->value();
   return;
 }
 
-rq._command = CMD_SET_WLAN_PASS;
-strcpy(rq._buf, WLANPassword->value());
-rq._buf[strlen(WLANPassword->value())] = '\0';
-
-if(SendCommand(&rq) != REPLY_OK){
-  LOG_INFO << "DeRotatorUI::Send via serial: SendCommand(): "
+if(rp[1]._reply != REPLY_OK){
+  LOG_INFO << "DeRotatorUI::Send via serial: SendBatch(): "
 	   << " cannot send WLAN password";
   return;
 }
 
-rq._command = CMD_SET_WLAN_SECURITY;
-rq._ivalue = WLANSecurity->value();
-if(SendCommand(&rq) != REPLY_OK){
-  LOG_INFO << "DeRotatorUI::Send via serial: SendCommand(): "
+if(rp[2]._reply != REPLY_OK){
+  LOG_INFO << "DeRotatorUI::Send via serial: SendBatch(): "
 	   << " cannot send WLAN security = "
 	   << WLANSecurity->value();
   return;
@@ -1729,6 +1783,8 @@ DeRotatorUI::DeRotatorUI() {
   // initialization code
   _serial_client = NULL;
   _tcp_client = NULL;
+  _is_telemetry = false;
+  _telemetry_wait = 0;
   
   /*
     For some stupid reason, if I initialize _*_help in its extra code, 
@@ -1811,38 +1867,77 @@ void DeRotatorUI::show() {
 }
 
 void DeRotatorUI::timer_cb(void* data) {
-  // get the (alt, az, accumulated angle)
+  // get the (alt, az, accumulated angle) from the telemetry that the
+  // derotator pushes, or by asking for it
   using namespace std;
   using namespace logging::trivial;
   src::severity_logger< severity_level > lg;   
   
   DeRotatorUI* dr = (DeRotatorUI*)data;
   
-  RequestPacket rq;
-  rq._command = CMD_GET_ALTAZ_ZETA;
+  int status = 0;
+  double alt, az, zeta, angle;
   
-  ReplyPacket rp;
-  int status;
+  if(dr->_is_telemetry){
+    // only the latest of the packets that have arrived is shown
+    TelemetryPacket tp;
+    int n = 0;
+    
+    while((status = dr->ReceiveTelemetry(&tp)) > 0){
+      n++;
+    }
+    
+    if((status == 0) && (n == 0)){
+      dr->_telemetry_wait += TELEMETRY_REPEAT_TIME;
+      if(dr->_telemetry_wait < TELEMETRY_TIMEOUT){
+        Fl::repeat_timeout(TELEMETRY_REPEAT_TIME, timer_cb, data);
+        return;
+      }
+      // the derotator has stopped pushing, so ask for it instead
+      LOG_ERROR << "DeRotatorUI::timer_cb(): no telemetry. Polling instead";
+      dr->_is_telemetry = false;
+    }
+    else if(status == 0){
+      dr->_telemetry_wait = 0;
+      status = tp._status;
+      alt = tp._alt;
+      az = tp._az;
+      zeta = tp._accumulated_angle;
+      angle = tp._angle;
+    }
+  }
   
-  if((status=dr->SendCommand(&rq, &rp)) == REPLY_OK){
+  if(!dr->_is_telemetry){
+    RequestPacket rq;
+    rq._command = CMD_GET_ALTAZ_ZETA;
+  
+    ReplyPacket rp;
+    status = dr->SendCommand(&rq, &rp);
+    alt = rp._fvalue[0];
+    az = rp._fvalue[1];
+    zeta = rp._fvalue[2];
+    angle = rp._fvalue[3];
+  }
+  
+  if(status == REPLY_OK){
   #ifdef AAAAA
-    LOG_TRACE << "alt = " << rp._fvalue[0] << " "
-              << "az = " << rp._fvalue[1] << " "
-              << "zeta = " << rp._fvalue[2] << " "
-              << "angle (FA) = " << HA2FA(rp._fvalue[3]);
+    LOG_TRACE << "alt = " << alt << " "
+              << "az = " << az << " "
+              << "zeta = " << zeta << " "
+              << "angle (FA) = " << HA2FA(angle);
   #endif
     double home_angle = dr->derotator_graphics->GetHomeAngle();
     
-    dr->derotator_graphics->ZAngle(rp._fvalue[2]);
-    dr->derotator_graphics->ZOutlineAngle(HA2FA(rp._fvalue[3]) + home_angle);
-    dr->derotator_graphics->ZCameraAngle(HA2FA(rp._fvalue[3]) + home_angle);
+    dr->derotator_graphics->ZAngle(zeta);
+    dr->derotator_graphics->ZOutlineAngle(HA2FA(angle) + home_angle);
+    dr->derotator_graphics->ZCameraAngle(HA2FA(angle) + home_angle);
     dr->derotator_graphics->redraw();
    
     char buf[32];
-    sprintf(buf, "%4.2f", HA2FA(rp._fvalue[3]));
+    sprintf(buf, "%4.2f", HA2FA(angle));
     dr->deg->value(buf);
     
-    sprintf(buf, "%4d", static_cast<int>(HA2FS(rp._fvalue[3])));
+    sprintf(buf, "%4d", static_cast<int>(HA2FS(angle)));
     dr->steps->value(buf);
   
   }
@@ -1857,6 +1952,7 @@ void DeRotatorUI::timer_cb(void* data) {
       case -1: 
         // lost the connection so disconnect wifi or serial line
         // and reactivate buttons
+        dr->_is_telemetry = false;
   
         if(dr->_tcp_client){
           // close the tcp port
@@ -1887,7 +1983,8 @@ void DeRotatorUI::timer_cb(void* data) {
   }
   
         
-  Fl::repeat_timeout(REPEAT_TIME, timer_cb, data);
+  Fl::repeat_timeout(dr->_is_telemetry? TELEMETRY_REPEAT_TIME: REPEAT_TIME,
+                     timer_cb, data);
 }
 
 void DeRotatorUI::timer_cb1(void* data) {
@@ -2081,7 +2178,7 @@ int DeRotatorUI::SendCommand(RequestPacket* const rq, ReplyPacket* const rp) {
     }
     
     
-    if(rp->_reply != REPLY_OK){
+    if((rp->_reply != REPLY_OK) && (rp->_reply != REPLY_FLOAT)){
       using namespace logging::trivial;
       src::severity_logger< severity_level > lg;          
       // throw string("Reply is not ok");
@@ -2099,3 +2196,130 @@ int DeRotatorUI::SendCommand(RequestPacket* const rq, ReplyPacket* const rp) {
     return -1;    
   }
 }
+
+int DeRotatorUI::SendBatch(RequestPacket* const rq, ReplyPacket* const rp, const int n) {
+  // send the n requests in rq to the derotator as one CMD_BATCH and
+  // receive their replies in rp. Returns REPLY_OK if the derotator ran
+  // the batch. Each request then has its own reply in rp. Over serial
+  // the requests are sent one at a time instead if the batch does not
+  // fit into the RX buffer of the derotator
+  using namespace std;
+  
+  try{
+    if((n < 1) || (n > BATCH_MAX)){
+      throw string("a batch has 1 to BATCH_MAX requests");
+    }
+  
+    RequestPacket frame[BATCH_MAX+1];
+    memset(&frame[0], 0, sizeof(RequestPacket));
+    frame[0]._command = CMD_BATCH;
+    frame[0]._ivalue = n;
+    for(int i=0; i<n; i++){
+      frame[i+1] = rq[i];
+    }
+  
+    // the rest of a batch is lost while the loop() of the derotator
+    // is busy, e.g. derotating when Stop is pressed
+    if(_serial_client && !_serial_client->IsBatchFitting(frame, n+1)){
+      for(int i=0; i<n; i++){
+        if(_serial_client->Send(&rq[i]) != 0){
+          throw string("Serial: Send request failed");
+        }
+        if(_serial_client->Receive(&rp[i]) != 0){
+          throw string("Serial: Did not receive reply packet");
+        }
+      }
+      return REPLY_OK;
+    }
+    
+    if(_serial_client){
+      if(_serial_client->Send(frame, n+1) != 0){
+        throw string("Serial: Send request failed");
+      }
+    }
+    
+    if(_tcp_client){
+      if(_tcp_client->Send(frame, n+1) != 0){
+        throw string("TCP: Send request failed");
+      }
+    }
+    
+    // the reply of the batch comes before the replies of its requests
+    ReplyPacket reply;
+    
+    for(int i=0; i<=n; i++){
+      ReplyPacket* const packet = (i == 0)? &reply: &rp[i-1];
+      
+      if(_serial_client){
+        if(_serial_client->Receive(packet) !=0){
+          throw string("Serial: Did not receive reply packet");
+        }
+      }
+      
+      if(_tcp_client){
+        if(_tcp_client->Receive(packet) !=0){
+          throw string("TCP: Did not receive reply packet");
+        }
+      }
+      
+      if((i == 0) && (reply._reply != REPLY_OK)){
+        using namespace logging::trivial;
+        src::severity_logger< severity_level > lg;          
+        LOG_ERROR << "Batch is refused";
+        LOG_ERROR << "Got reply = " << reply._reply;
+        return reply._reply;
+      }
+    }
+    
+    return REPLY_OK;
+  }
+  catch(string& message){
+    using namespace logging::trivial;
+    src::severity_logger< severity_level > lg; 
+    LOG_ERROR << "DeRotatorUI::SendBatch(): "
+              << message;
+    return -1;    
+  }
+}
+
+int DeRotatorUI::SubscribeTelemetry(const int period_ms) {
+  // ask the derotator to push telemetry every period_ms, on every
+  // step for TELEMETRY_EVERY_STEP, or to stop for TELEMETRY_OFF.
+  // The telemetry is taken with ReceiveTelemetry()
+  using namespace std;
+  
+  RequestPacket rq;
+  rq._command = CMD_SUBSCRIBE_TELEMETRY;
+  rq._ivalue = period_ms;
+  
+  ReplyPacket rp;
+  const int status = SendCommand(&rq, &rp);
+  
+  if(period_ms < 0){
+    // throw away what was pushed before the reply
+    TelemetryPacket tp;
+    while(ReceiveTelemetry(&tp) > 0);
+    _is_telemetry = false;
+  }
+  else {
+    _is_telemetry = (status == REPLY_OK);
+  }
+  _telemetry_wait = 0;
+  
+  return status;
+}
+
+int DeRotatorUI::ReceiveTelemetry(TelemetryPacket* const tp) {
+  // take the next telemetry packet that the derotator pushed,
+  // without waiting. Returns 1 if there is one, 0 if there is none
+  // yet and -1 on error
+  if(_serial_client){
+    return _serial_client->Receive(tp);
+  }
+  
+  if(_tcp_client){
+    return _tcp_client->Receive(tp);
+  }
+  
+  return -1;
+}
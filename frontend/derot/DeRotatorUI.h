@@ -33,6 +33,8 @@
 #define MECHANICAL_STEPSIZE 0.05970731707 // deg/step
 #include <Fl/Fl_Float_Input.H>
 #define REPEAT_TIME 0.5
+#define TELEMETRY_REPEAT_TIME 0.05
+#define TELEMETRY_TIMEOUT 5.0
 #include <FL/Fl_Text_Display.H>
 #include <FL/Fl_Menu_Bar.H>
 #include <FL/Fl_Native_File_Chooser.H>
@@ -62,6 +64,8 @@ class DeRotatorUI {
 public:
   SerialClient* _serial_client; 
   TCPClient* _tcp_client; 
+  bool _is_telemetry; 
+  double _telemetry_wait; 
   Fl_Text_Buffer *_message_buffer; 
   DeRotatorConfig* _derotator_config; 
   Fl_Help_Dialog *_introduction; 
@@ -325,5 +329,8 @@ public:
   static void timer_cb2(void* data);
   int SendCommand(RequestPacket* const rq);
   int SendCommand(RequestPacket* const rq, ReplyPacket* const rp);
+  int SendBatch(RequestPacket* const rq, ReplyPacket* const rp, const int n);
+  int SubscribeTelemetry(const int period_ms);
+  int ReceiveTelemetry(TelemetryPacket* const tp);
 };
 #endif
@@ -0,0 +1,392 @@
+/*$Id$*/
+/*
+    derot is the GUI frontend that controls the field derotator
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+/* operating system header files (use <> for make depend) */
+#include <string.h>
+
+using namespace std;
+
+/* general system header files (use "" for make depend) */
+
+/* local include files (use "") */
+#include "PacketFrame.hpp"
+
+/* file global variables */
+
+/*
+   The fields of the compact status (see StatusPacket.hpp) and how
+   they are written
+*/
+#define STATUS_INT16	0	// zigzag varint
+#define STATUS_FLOAT	1	// its 4 bytes
+#define STATUS_STRING	2	// its length and its chars
+
+#define N_STATUS_FIELDS	11
+
+struct StatusField {
+  int _tag;
+  int _type;
+  int _offset;			// in the StatusPacket
+  int _size;			// in the StatusPacket
+};
+
+static const StatusField status_fields[N_STATUS_FIELDS] = {
+  {STATUS_TAG_REPLY, STATUS_INT16, offsetof(StatusPacket, _reply), sizeof(int16_t)},
+  {STATUS_TAG_IS_CLOCKWISE, STATUS_INT16, offsetof(StatusPacket, _is_clockwise_correction), sizeof(int16_t)},
+  {STATUS_TAG_HOME_POS, STATUS_INT16, offsetof(StatusPacket, _home_pos), sizeof(int16_t)},
+  {STATUS_TAG_MAX_CW, STATUS_INT16, offsetof(StatusPacket, _max_cw), sizeof(int16_t)},
+  {STATUS_TAG_MAX_CCW, STATUS_INT16, offsetof(StatusPacket, _max_ccw), sizeof(int16_t)},
+  {STATUS_TAG_IS_ENABLE_LIMITS, STATUS_INT16, offsetof(StatusPacket, _is_enable_limits), sizeof(int16_t)},
+  {STATUS_TAG_ANGLE, STATUS_FLOAT, offsetof(StatusPacket, _angle), sizeof(float)},
+  {STATUS_TAG_ACCUMULATED_ANGLE, STATUS_FLOAT, offsetof(StatusPacket, _accumulated_angle), sizeof(float)},
+  {STATUS_TAG_WLAN_SSID, STATUS_STRING, offsetof(StatusPacket, _WLAN_ssid), sizeof(((StatusPacket*)0)->_WLAN_ssid)},
+  {STATUS_TAG_WLAN_SECURITY, STATUS_INT16, offsetof(StatusPacket, _WLAN_security), sizeof(int16_t)},
+  {STATUS_TAG_OMEGA, STATUS_FLOAT, offsetof(StatusPacket, _omega), sizeof(float)}
+};
+
+/**********************************************************************
+NAME
+	PacketFrame - the client side of PROTOCOL_FRAMED
+
+SYNOPSIS
+	See PacketFrame.hpp
+
+                                                
+PROTECTED FUNCTIONS
+
+PRIVATE FUNCTIONS
+	unpack_status(		- put
+	  status		- this compact status
+	  sz			- of this many bytes
+	)			- into _status. Returns 0 on success.
+				  -1 if it cannot be read, when _status
+				  is not changed
+
+
+LOCAL TYPES AND CLASSES
+
+AUTHOR
+
+        C.Y. Tan
+
+SEE ALSO
+
+REVISION
+	$Revision$
+
+**********************************************************************/
+
+PacketFrame::PacketFrame()
+{
+  _is_framed = false;
+  _pipeline_max = 1;
+  _seq = FRAME_TELEMETRY_SEQ;
+  _frame_sz = 0;
+
+  memset(&_status, 0, sizeof(StatusPacket));
+  _is_status = false;
+}
+
+void PacketFrame::SetFramed(const int pipeline_max)
+{
+  _is_framed = true;
+  _pipeline_max = pipeline_max > 1? pipeline_max:1;
+
+  // the server forgets its last compact status too
+  _is_status = false;
+}
+
+bool PacketFrame::IsFramed() const
+{
+  return _is_framed;
+}
+
+int PacketFrame::GetPipelineMax() const
+{
+  return _pipeline_max;
+}
+
+void PacketFrame::Restart()
+{
+  _outstanding.clear();
+  _replies.clear();
+}
+
+int PacketFrame::Pack(const RequestPacket* const request, char* const frame)
+{
+  // FRAME_TELEMETRY_SEQ is never the seq of a request
+  _seq = (_seq == 255)? 1:_seq + 1;
+
+  Request sent;
+  sent._seq = _seq;
+  sent._is_status = request->_command == CMD_QUERY_STATE;
+  _outstanding.push_back(sent);
+
+  int sz = FrameSize(request) - FRAME_SIZE(0);
+  
+  frame[0] = FRAME_SYNC0;
+  frame[1] = FRAME_SYNC1;
+  frame[3] = _seq;
+  memcpy(frame + FRAME_HEADER_SIZE, request, sz);
+
+  if(sent._is_status){
+    // until its reply is taken, _status may not be the server's last
+    const int16_t format = _is_status? STATUS_CHANGED:STATUS_COMPACT;
+    if(sz < static_cast<int>(offsetof(RequestPacket, _ivalue) + sizeof(int16_t))){
+      sz = offsetof(RequestPacket, _ivalue) + sizeof(int16_t);
+    }
+    memcpy(frame + FRAME_HEADER_SIZE + offsetof(RequestPacket, _ivalue),
+	   &format, sizeof(int16_t));
+    _is_status = false;
+  }
+  frame[2] = sz;
+
+  const uint16_t crc = CRC16((const uint8_t*)(frame + 2), sz + 2);
+  frame[FRAME_HEADER_SIZE + sz] = crc & 0xff;
+  frame[FRAME_HEADER_SIZE + sz + 1] = crc >> 8;
+
+  return FRAME_SIZE(sz);
+}
+
+int PacketFrame::FrameSize(const RequestPacket* const request)
+{
+  // the strings are only sent when they are used
+  int sz = ((request->_command == CMD_SET_WLAN_SSID) ||
+	    (request->_command == CMD_SET_WLAN_PASS))?
+    sizeof(RequestPacket):offsetof(RequestPacket, _buf);
+
+  // nor are the zeros at the end, which the server puts back
+  const char* const packet = reinterpret_cast<const char*>(request);
+  while((sz > static_cast<int>(sizeof(int16_t))) && (packet[sz-1] == 0)){
+    sz--;
+  }
+
+  return FRAME_SIZE(sz);
+}
+
+int PacketFrame::Feed(const char c)
+{
+  // look for FRAME_SYNC0 FRAME_SYNC1 first
+  if(_frame_sz < 2){
+    if((_frame_sz == 1) && (c == (char)FRAME_SYNC1)){
+      _frame[_frame_sz++] = c;
+    }
+    else {
+      _frame_sz = (c == (char)FRAME_SYNC0)? 1:0;
+      _frame[0] = c;
+    }
+    return 0;
+  }
+
+  _frame[_frame_sz++] = c;
+
+  const int sz = (uint8_t)_frame[2];
+  if(sz > (int)sizeof(StatusPacket)){
+    // not a frame after all
+    _frame_sz = (c == (char)FRAME_SYNC0)? 1:0;
+    _frame[0] = c;
+    return 0;
+  }
+
+  if(_frame_sz < FRAME_SIZE(sz)){
+    return 0;
+  }
+  _frame_sz = 0;
+
+  const uint16_t crc = CRC16((const uint8_t*)(_frame + 2), sz + 2);
+  if(((uint8_t)_frame[FRAME_HEADER_SIZE + sz] != (crc & 0xff)) ||
+     ((uint8_t)_frame[FRAME_HEADER_SIZE + sz + 1] != (crc >> 8))){
+    return 0;
+  }
+
+  const uint8_t seq = _frame[3];
+
+  if(seq == FRAME_TELEMETRY_SEQ){
+    TelemetryPacket tp;
+    memset(&tp, 0, sizeof(TelemetryPacket));
+    memcpy(&tp, _frame + FRAME_HEADER_SIZE,
+	   sz < (int)sizeof(TelemetryPacket)? sz:sizeof(TelemetryPacket));
+    _telemetry.push_back(tp);
+    return 1;
+  }
+
+  // drop the reply to a request that is no longer outstanding
+  for(size_t i=0; i<_outstanding.size(); i++){
+    if(_outstanding[i]._seq == seq){
+      Reply reply;
+      reply._seq = seq;
+      reply._sz = sz;
+      memcpy(reply._packet, _frame + FRAME_HEADER_SIZE, sz);
+      _replies.push_back(reply);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int PacketFrame::TakeReply(char* const packet, const int sz)
+{
+  if(_outstanding.empty()){
+    return -1;
+  }
+
+  if(_replies.empty()){
+    return 0;
+  }
+
+  // the replies come back in the order of the requests, so a
+  // later one means that the reply to this one was lost
+  const Request request = _outstanding.front();
+  _outstanding.pop_front();
+
+  const Reply& reply = _replies.front();
+  if(reply._seq != request._seq){
+    return -1;
+  }
+
+  // a compact status is always shorter than a StatusPacket
+  if(request._is_status && (reply._sz < sizeof(StatusPacket))){
+    const int status = unpack_status(reply._packet, reply._sz);
+    _replies.pop_front();
+    if(status != 0){
+      return -1;
+    }
+
+    _is_status = true;
+    memset(packet, 0, sz);
+    memcpy(packet, &_status, sizeof(StatusPacket) < (size_t)sz?
+	   sizeof(StatusPacket):sz);
+    return 1;
+  }
+
+  memset(packet, 0, sz);
+  memcpy(packet, reply._packet, reply._sz < sz? reply._sz:sz);
+  _replies.pop_front();
+
+  return 1;
+}
+
+int PacketFrame::TakeTelemetry(TelemetryPacket* const telemetryPacket)
+{
+  if(_telemetry.empty()){
+    return 0;
+  }
+
+  *telemetryPacket = _telemetry.front();
+  _telemetry.pop_front();
+  return 1;
+}
+
+uint16_t PacketFrame::CRC16(const uint8_t* data,
+			    const size_t length,
+			    uint16_t crc)
+{
+  for(size_t i=0; i<length; i++){
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for(uint8_t bit=0; bit<8; bit++){
+      crc = (crc & 0x8000)? (crc << 1) ^ 0x1021:(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+int PacketFrame::unpack_status(const char* const status, const int sz)
+{
+  if(sz < 1){
+    return -1;
+  }
+
+  // the fields that are not sent are zero or unchanged
+  StatusPacket sp;
+  if(status[0] == STATUS_COMPACT){
+    memset(&sp, 0, sizeof(StatusPacket));
+  }
+  else if(status[0] == STATUS_CHANGED){
+    sp = _status;
+  }
+  else {
+    return -1;
+  }
+
+  int i = 1;
+  while(i < sz){
+    const int tag = (uint8_t)status[i++];
+
+    const StatusField* field = NULL;
+    for(size_t j=0; j<N_STATUS_FIELDS; j++){
+      if(status_fields[j]._tag == tag){
+	field = &status_fields[j];
+	break;
+      }
+    }
+    if(field == NULL){
+      return -1;
+    }
+
+    char* const value = (char*)&sp + field->_offset;
+
+    switch(field->_type){
+      case STATUS_INT16: {
+	uint16_t zigzag = 0;
+	for(int shift=0; ; shift+=7){
+	  if((i >= sz) || (shift > 14)){
+	    return -1;
+	  }
+	  const uint8_t c = status[i++];
+	  zigzag |= (uint16_t)(c & 0x7f) << shift;
+	  if(!(c & 0x80)){
+	    break;
+	  }
+	}
+	const int16_t v = (int16_t)((zigzag >> 1) ^ ((zigzag & 1)? 0xffff:0));
+	memcpy(value, &v, sizeof(int16_t));
+      }
+      break;
+      case STATUS_STRING: {
+	if(i >= sz){
+	  return -1;
+	}
+	const int length = (uint8_t)status[i++];
+	if((length > field->_size) || (i + length > sz)){
+	  return -1;
+	}
+	memset(value, 0, field->_size);
+	memcpy(value, status + i, length);
+	i += length;
+      }
+      break;
+      default:
+	if(i + field->_size > sz){
+	  return -1;
+	}
+	memcpy(value, status + i, field->_size);
+	i += field->_size;
+    }
+  }
+
+  // the password is never sent back
+  sp._WLAN_password[0] = '\0';
+  _status = sp;
+  return 0;
+}
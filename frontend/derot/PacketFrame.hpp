@@ -0,0 +1,171 @@
+/*$Id$*/
+/*
+    derot is the GUI frontend that controls the field derotator
+    Copyright (C) 2015  C.Y. Tan
+    Contact: cytan299@yahoo.com
+
+    This file is part of derot
+
+    derot is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    derot is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with derot.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PACKETFRAME_HPP
+#define PACKETFRAME_HPP
+
+/**********************************************************************
+NAME
+	PacketFrame - the client side of PROTOCOL_FRAMED
+
+
+SYNOPSIS
+	PacketFrame puts the requests of a client into frames and
+	takes the reply and telemetry packets out of the frames that
+	come back (see CMD_SET_PROTOCOL in RequestPacket.hpp). It does
+	no reading or writing itself, so that both TCPClient and
+	SerialClient can use it.
+
+	The requests of one Send() of the client are numbered and
+	outstanding together. Their replies are taken in the same
+	order, and a reply that comes for a request that is no longer
+	outstanding is dropped.
+
+	CMD_QUERY_STATE asks for STATUS_CHANGED if the reply to the
+	last one was taken, and for STATUS_COMPACT otherwise (see
+	StatusPacket.hpp). TakeReply() puts the compact status back
+	into a whole StatusPacket on top of the last one, so that the
+	caller does not see the difference. The StatusPacket of a
+	derotator that does not know the compact status is taken as
+	it is.
+
+
+CONSTRUCTOR
+   	PacketFrame()		- starts in PROTOCOL_RAW
+
+
+INTERFACE
+	SetFramed(		- use PROTOCOL_FRAMED
+		pipeline_max	- with this many requests outstanding
+	)
+
+	IsFramed()		- returns true for PROTOCOL_FRAMED
+
+	GetPipelineMax()	- returns how many requests can be
+				  outstanding. 1 for PROTOCOL_RAW
+
+	Restart()		- forget the requests that are still
+				  outstanding
+
+	Pack(			- put
+		request		- this request
+		frame		- into this buffer of
+				  FRAME_SIZE(sizeof(RequestPacket))
+	)			- returns the size of the frame
+
+	FrameSize(		- returns the size of the frame that
+		request		- this request is packed into. The
+	)			  zeros at its end are not sent
+
+	Feed(			- feed
+		c		- the next byte that was read
+	)			- returns 1 when it ends a good frame,
+				  0 otherwise
+
+	TakeReply(		- take the reply to the oldest
+				  outstanding request
+		packet		- into this packet
+		sz		- of this size. The bytes that were not
+	)			  sent are zero. Returns 1 if it has
+				  arrived, 0 if not yet and -1 if it was
+				  lost or is a compact status that cannot
+				  be read
+
+	TakeTelemetry(		- take the next
+		telemetryPacket	- telemetry packet
+	)			- returns 1 if there is one, 0 if not
+
+	CRC16(			- CRC-16/CCITT
+		data		- of these bytes
+		length		- and this many of them
+		crc		- starting with this CRC. Default: 0xFFFF
+	)			- returns the CRC
+
+
+AUTHOR
+	C.Y. Tan
+
+SEE ALSO
+	RequestPacket.hpp
+
+**********************************************************************/
+#include "RequestPacket.hpp"
+#include "ReplyPacket.hpp"
+#include "StatusPacket.hpp"
+
+#include <stddef.h>
+#include <deque>
+
+class PacketFrame {
+public:
+  PacketFrame();
+
+public:
+  void SetFramed(const int pipeline_max);
+  bool IsFramed() const;
+  int GetPipelineMax() const;
+
+  void Restart();
+  int Pack(const RequestPacket* const request, char* const frame);
+  static int FrameSize(const RequestPacket* const request);
+
+  int Feed(const char c);
+  int TakeReply(char* const packet, const int sz);
+  int TakeTelemetry(TelemetryPacket* const telemetryPacket);
+
+  static uint16_t CRC16(const uint8_t* data,
+			const size_t length,
+			uint16_t crc = 0xFFFF);
+
+private:
+  int unpack_status(const char* const status, const int sz);
+
+private:
+  struct Request {
+    uint8_t _seq;
+    bool _is_status;			// CMD_QUERY_STATE
+  };
+
+  struct Reply {
+    uint8_t _seq;
+    uint8_t _sz;
+    char _packet[sizeof(StatusPacket)];
+  };
+
+  bool _is_framed;
+  int _pipeline_max;
+
+  uint8_t _seq;				// of the last request
+  std::deque<Request> _outstanding;	// the requests sent
+  std::deque<Reply> _replies;		// that have come back
+  std::deque<TelemetryPacket> _telemetry;
+
+  char _frame[FRAME_SIZE(sizeof(StatusPacket))]; // being read
+  int _frame_sz;
+
+  StatusPacket _status;			// the last status taken
+  bool _is_status;			// and whether it is still
+					// the server's last one
+};
+
+#endif
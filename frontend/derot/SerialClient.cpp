@@ -34,6 +34,7 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <vector>
 
 #include "logging.hpp"
 
@@ -79,6 +80,7 @@ catch(const string& message)
 SerialClient::~SerialClient()
 {
   if(_serial){
+    use_raw();
     _serial->close();
 
     delete _serial;
@@ -93,9 +95,13 @@ int SerialClient::Connect(const char* devname)
 
     // close the serial port if it is open
     if(_serial){
+      use_raw();
       _serial->close();
       delete _serial;
     }
+
+    // a new port starts in PROTOCOL_RAW
+    _frame = PacketFrame();
     
     using namespace boost;
     
@@ -128,7 +134,7 @@ int SerialClient::Connect(const char* devname)
 }
 
 
-int SerialClient::Send(RequestPacket* request)
+int SerialClient::Send(RequestPacket* request, const int n)
 {
   using namespace logging::trivial;
   src::severity_logger< severity_level > lg;
@@ -141,15 +147,57 @@ int SerialClient::Send(RequestPacket* request)
   using namespace boost;
 
   try{
-    // flush whatever is in the serial buffer first
+    if(_frame.IsFramed()){
+      // take whatever is in the serial buffer first, which keeps
+      // the telemetry and drops everything else
+      int sz;
+      while((sz = IsGotData()) > 0){
+	vector<char> buf(sz);
+	_serial->read(&buf[0], sz);
+	for(int i=0; i<sz; i++){
+	  _frame.Feed(buf[i]);
+	}
+      }
+      
+      // the requests are all outstanding together
+      vector<char> frames(n*FRAME_SIZE(sizeof(RequestPacket)));
+      sz = 0;
+
+      _frame.Restart();
+      for(int i=0; i<n; i++){
+	sz += _frame.Pack(&request[i], &frames[sz]);
+      }
+      
+      _serial->write(&frames[0], sz);
+      return 0;
+    }
+    
+    // flush whatever is in the serial buffer first, but keep the
+    // telemetry that has been pushed
     int sz;
     while((sz = IsGotData()) > 0){
+      int16_t reply;
+      
+      if(sz >= static_cast<int>(sizeof(int16_t))){
+	_serial->read((char*)&reply, sizeof(int16_t));
+	sz -= sizeof(int16_t);
+
+	if(reply == REPLY_TELEMETRY){
+	  TelemetryPacket tp;
+	  tp._reply = reply;
+	  _serial->read((char*)&tp + sizeof(int16_t),
+			sizeof(TelemetryPacket) - sizeof(int16_t));
+	  _telemetry.push_back(tp);
+	  continue;
+	}
+      }
+
       LOG_ERROR << "<" << sz << ">:"
 		<< "flushing ... "
-		<< _serial->readString(sz) << "\n";      
+		<< (sz > 0? _serial->readString(sz):string()) << "\n";      
     }
     
-    _serial->write((char*)request, sizeof(RequestPacket));
+    _serial->write((char*)request, n*sizeof(RequestPacket));
   }
   catch(boost::system::system_error& e){
     LOG_ERROR << "SerialClient::Send(): Error sending request packet. "
@@ -174,7 +222,15 @@ int SerialClient::Receive(ReplyPacket* replyPacket)
   using namespace boost;
 
   try{
-    _serial->read((char*)(replyPacket), sizeof(ReplyPacket));
+    if(_frame.IsFramed()){
+      if(read_frame((char*)(replyPacket), sizeof(ReplyPacket)) < 0){
+	LOG_ERROR << "SerialClient::Receive(): reply packet was lost\n";
+	return -1;
+      }
+      return 0;
+    }
+    
+    read_packet((char*)(replyPacket), sizeof(ReplyPacket));
   }
   catch(boost::system::system_error& e){
     LOG_ERROR << "SerialClient::Receive(): Error reading reply packet. "
@@ -200,7 +256,15 @@ int SerialClient::Receive(StatusPacket* statusPacket)
   using namespace boost;
 
   try{
-    _serial->read((char*)statusPacket, sizeof(StatusPacket));
+    if(_frame.IsFramed()){
+      if(read_frame((char*)statusPacket, sizeof(StatusPacket)) < 0){
+	LOG_ERROR << "SerialClient::Receive(): status packet was lost\n";
+	return -1;
+      }
+      return 0;
+    }
+    
+    read_packet((char*)statusPacket, sizeof(StatusPacket));
   }
   catch(boost::system::system_error& e){
     LOG_ERROR << "SerialClient::Receive(): Error reading status packet. "
@@ -212,6 +276,167 @@ int SerialClient::Receive(StatusPacket* statusPacket)
   return 0;
 }
 
+int SerialClient::Receive(TelemetryPacket* telemetryPacket)
+{
+  using namespace logging::trivial;
+  src::severity_logger< severity_level > lg;
+  
+  if(!_telemetry.empty()){
+    *telemetryPacket = _telemetry.front();
+    _telemetry.pop_front();
+    return 1;
+  }
+
+  if(_frame.TakeTelemetry(telemetryPacket)){
+    return 1;
+  }
+
+  if(_serial == NULL){
+    LOG_ERROR << "SerialClient::Receive(): serial port has not been set. Cannot receive telemetry\n";
+    return -1;
+  }
+
+  // don't wait if nothing has been pushed yet
+  const int sz = IsGotData();
+  if(sz < 0){
+    return -1;
+  }
+  if(sz == 0){
+    return 0;
+  }
+  
+  using namespace boost;
+
+  try{
+    if(_frame.IsFramed()){
+      // take all that has arrived. The replies are kept too
+      vector<char> buf(sz);
+      _serial->read(&buf[0], sz);
+      for(int i=0; i<sz; i++){
+	_frame.Feed(buf[i]);
+      }
+      return _frame.TakeTelemetry(telemetryPacket);
+    }
+    
+    // no request is outstanding, so this can only be telemetry
+    _serial->read((char*)telemetryPacket, sizeof(TelemetryPacket));
+  }
+  catch(boost::system::system_error& e){
+    LOG_ERROR << "SerialClient::Receive(): Error reading telemetry packet. "
+	      << "Error message: " << e.what() << "\n";
+    _serial->close();
+    return -1;
+  }
+
+  if(telemetryPacket->_reply != REPLY_TELEMETRY){
+    LOG_ERROR << "SerialClient::Receive(): not a telemetry packet. "
+	      << "Got reply = " << telemetryPacket->_reply << "\n";
+    return -1;
+  }
+
+  return 1;
+}
+
+int SerialClient::read_packet(char* packet, int sz)
+{
+  // every packet starts with int16_t _reply. Throws like
+  // TimeoutSerial::read() on error
+  int16_t reply;
+
+  while(true){
+    _serial->read((char*)&reply, sizeof(int16_t));
+
+    if(reply != REPLY_TELEMETRY){
+      break;
+    }
+
+    TelemetryPacket tp;
+    tp._reply = reply;
+    _serial->read((char*)&tp + sizeof(int16_t),
+		  sizeof(TelemetryPacket) - sizeof(int16_t));
+    _telemetry.push_back(tp);
+  }
+
+  memcpy(packet, &reply, sizeof(int16_t));
+  _serial->read(packet + sizeof(int16_t), sz - sizeof(int16_t));
+
+  return 0;
+}
+
+int SerialClient::read_frame(char* packet, int sz)
+{
+  // throws like TimeoutSerial::read() on error
+  int status;
+  
+  while((status = _frame.TakeReply(packet, sz)) == 0){
+    char c;
+    _serial->read(&c, 1);
+    _frame.Feed(c);
+  }
+
+  return status > 0? 0:-1;
+}
+
+int SerialClient::UseFrames()
+{
+  using namespace logging::trivial;
+  src::severity_logger< severity_level > lg;
+
+  RequestPacket rq;
+  ReplyPacket rp;
+
+  memset(&rq, 0, sizeof(RequestPacket));
+  rq._command = CMD_SET_PROTOCOL;
+  rq._ivalue = PROTOCOL_FRAMED;
+
+  if((Send(&rq) != 0) || (Receive(&rp) != 0)){
+    return -1;
+  }
+
+  // an older server does not know CMD_SET_PROTOCOL
+  if((rp._reply != REPLY_OK) ||
+     (rp._ivalue != PROTOCOL_FRAMED) ||
+     (rp._fvalue[1] != CMD_SET_PROTOCOL)){
+    LOG_INFO << "SerialClient::UseFrames(): server does not know frames\n";
+    return -1;
+  }
+
+  _frame.SetFramed(static_cast<int>(rp._fvalue[0]));
+  return 0;
+}
+
+int SerialClient::GetPipelineMax() const
+{
+  return _frame.GetPipelineMax();
+}
+
+bool SerialClient::IsBatchFitting(const RequestPacket* request,
+				  const int n) const
+{
+  // a whole RequestPacket already fills most of it
+  if(!_frame.IsFramed()){
+    return false;
+  }
+
+  int sz = 0;
+  for(int i=0; i<n; i++){
+    sz += PacketFrame::FrameSize(&request[i]);
+  }
+
+  return sz <= SERIAL_RX_SIZE;
+}
+
+void SerialClient::use_raw()
+{
+  if(_frame.IsFramed()){
+    RequestPacket rq;
+
+    memset(&rq, 0, sizeof(RequestPacket));
+    rq._command = CMD_SET_PROTOCOL;
+    rq._ivalue = PROTOCOL_RAW;
+    Send(&rq);
+  }
+}
 
 int SerialClient::ReadString()
 {
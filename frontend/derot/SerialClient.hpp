@@ -50,7 +50,8 @@ INTERFACE
 
 	Send(			- send the request to the server
 		requestPacket
-	)
+		n		- or this many requests in one write.
+	)			  Default: 1
 
 	Receive(
 	   replyPacket		- receive the reply packet from the server
@@ -60,6 +61,35 @@ INTERFACE
 	   statusPacket		- receive the status packet from the server
 	)
 
+	Receive(
+	   telemetryPacket	- take the next telemetry packet that the
+	)			  server pushed after
+				  CMD_SUBSCRIBE_TELEMETRY, without waiting.
+				  Returns 1 if there is one, 0 if there
+				  is none yet and -1 on error.
+
+	Telemetry that arrives ahead of a reply or status packet is
+	kept until it is taken with Receive(telemetryPacket).
+
+	UseFrames()		- ask the server for PROTOCOL_FRAMED.
+				  Returns 0 if it agreed. An older
+				  server stays in PROTOCOL_RAW
+	
+	GetPipelineMax()	- returns how many requests should be
+				  outstanding at once
+
+	IsBatchFitting(		- returns true if
+		request		- these requests
+		n		- and this many of them
+	)			  fit into the RX buffer of the server
+				  in one Send(). Only with
+				  PROTOCOL_FRAMED
+
+	With PROTOCOL_FRAMED the n requests of one Send() are all
+	outstanding, and their replies are taken in the same order
+	with Receive(). The replies still outstanding from an
+	earlier Send() are dropped.
+
 
 	Flush(			- flush the serial port
 	   ec			- reference to user defined error code variable
@@ -75,10 +105,13 @@ SEE ALSO
 #include "RequestPacket.hpp"
 #include "ReplyPacket.hpp"
 #include "StatusPacket.hpp"
+#include "PacketFrame.hpp"
 
 #include "boost/asio.hpp"
 #include "TimeoutSerial.h"
 
+#include <deque>
+
 class SerialClient {
 public:   
   SerialClient(const char* devname = NULL);
@@ -86,10 +119,15 @@ public:
 
   int Connect(const char* devname = "/dev/cu.usbmodem1a1231");
 
-  int Send(RequestPacket* request);
+  int Send(RequestPacket* request, const int n = 1);
   
   int Receive(ReplyPacket* replyPacket);
   int Receive(StatusPacket* statusPacket);  
+  int Receive(TelemetryPacket* telemetryPacket);
+
+  int UseFrames();
+  int GetPipelineMax() const;
+  bool IsBatchFitting(const RequestPacket* request, const int n) const;
 
   int ReadString();
   std::string ReadStringUntil(const std::string& delim="\n");
@@ -99,6 +137,13 @@ public:
 private:
   TimeoutSerial* _serial;
 
+  std::deque<TelemetryPacket> _telemetry; // pushed ahead of a reply
+  PacketFrame _frame;	// PROTOCOL_FRAMED after UseFrames()
+
+  int read_packet(char* packet, int sz);
+  int read_frame(char* packet, int sz);
+  void use_raw();
+
 };
 
 #endif
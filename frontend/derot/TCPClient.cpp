@@ -35,6 +35,7 @@
 #include <fcntl.h>
 
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
@@ -58,6 +59,27 @@ SYNOPSIS
 PROTECTED FUNCTIONS
 
 PRIVATE FUNCTIONS
+	read_bytes(		- read exactly
+	  buf			- into this buffer
+	  sz			- this many bytes
+	)			- returns 0 on success
+
+	read_packet(		- read the next reply or status
+	  packet		- packet into this buffer
+	  sz			- of this size. The telemetry that
+	)			  arrives ahead of it is kept in
+				  _telemetry. Returns 0 on success
+
+	read_frame(		- read the reply to the oldest
+				  outstanding request in
+				  PROTOCOL_FRAMED
+	  packet		- into this buffer
+	  sz			- of this size
+	)			- returns 0 on success
+
+	use_raw()		- put the server back into PROTOCOL_RAW
+				  for the next client, without waiting
+				  for the reply
 
 
 LOCAL TYPES AND CLASSES
@@ -162,18 +184,37 @@ catch(const string& message)
 
 TCPClient::~TCPClient()
 {
+  use_raw();
   close(_sFd);
   delete [] _serverIP;
   _serverIP = NULL;
 }
 
 
-int TCPClient::Send(RequestPacket* request)
+int TCPClient::Send(RequestPacket* request, const int n)
 {
   using namespace logging::trivial;
   src::severity_logger< severity_level > lg;
   
-  if(write(_sFd, (char*)request, sizeof(RequestPacket)) == -1){
+  if(_frame.IsFramed()){
+    // the requests are all outstanding together
+    vector<char> frames(n*FRAME_SIZE(sizeof(RequestPacket)));
+    int sz = 0;
+
+    _frame.Restart();
+    for(int i=0; i<n; i++){
+      sz += _frame.Pack(&request[i], &frames[sz]);
+    }
+
+    if(write(_sFd, &frames[0], sz) == -1){
+      LOG_ERROR << "TCPClient::Send(): Error sending request frame";
+      close(_sFd);
+      return -1;
+    }
+    return 0;
+  }
+  
+  if(write(_sFd, (char*)request, n*sizeof(RequestPacket)) == -1){
     LOG_ERROR << "TCPClient::Send(): Error sending request packet";
     close(_sFd);	
     return -1;	
@@ -187,7 +228,15 @@ int TCPClient::Receive(ReplyPacket* replyPacket)
   using namespace logging::trivial;
   src::severity_logger< severity_level > lg;
   
-  if(read(_sFd, (char*)replyPacket, sizeof(ReplyPacket)) < 0){  
+  if(_frame.IsFramed()){
+    if(read_frame((char*)replyPacket, sizeof(ReplyPacket)) < 0){
+      LOG_ERROR << "TCPClient::Receive(replyPacket): Error reading frame";
+      return -1;
+    }
+    return 0;
+  }
+  
+  if(read_packet((char*)replyPacket, sizeof(ReplyPacket)) < 0){  
     LOG_ERROR << "TCPClient::Receive(replyPacket): Error reading socket";
     close(_sFd);
     return -1;
@@ -202,7 +251,15 @@ int TCPClient::Receive(StatusPacket* statusPacket)
   using namespace logging::trivial;
   src::severity_logger< severity_level > lg;
   
-  if(read(_sFd, (char*)statusPacket, sizeof(StatusPacket)) < 0){  
+  if(_frame.IsFramed()){
+    if(read_frame((char*)statusPacket, sizeof(StatusPacket)) < 0){
+      LOG_ERROR << "TCPClient::Receive(statusPacket): Error reading frame";
+      return -1;
+    }
+    return 0;
+  }
+  
+  if(read_packet((char*)statusPacket, sizeof(StatusPacket)) < 0){  
     LOG_ERROR << "TCPClient::Receive(statusPacket): Error reading socket";
     close(_sFd);
     return -1;
@@ -211,9 +268,175 @@ int TCPClient::Receive(StatusPacket* statusPacket)
   return 0;
 }
 
+int TCPClient::Receive(TelemetryPacket* telemetryPacket)
+{
+  using namespace logging::trivial;
+  src::severity_logger< severity_level > lg;
+
+  if(!_telemetry.empty()){
+    *telemetryPacket = _telemetry.front();
+    _telemetry.pop_front();
+    return 1;
+  }
+
+  if(_frame.TakeTelemetry(telemetryPacket)){
+    return 1;
+  }
+
+  // don't wait if nothing has been pushed yet
+  fd_set rd;
+  FD_ZERO(&rd);
+  FD_SET(_sFd, &rd);
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+
+  const int n = select(_sFd+1, &rd, NULL, NULL, &timeout);
+  if(n < 0){
+    LOG_ERROR << "TCPClient::Receive(telemetryPacket): Error polling socket";
+    close(_sFd);
+    return -1;
+  }
+  if(n == 0){
+    return 0;
+  }
+
+  if(_frame.IsFramed()){
+    // take all that has arrived. The replies are kept too
+    char buf[64];
+    const ssize_t sz = read(_sFd, buf, sizeof(buf));
+    if(sz <= 0){
+      LOG_ERROR << "TCPClient::Receive(telemetryPacket): Error reading socket";
+      close(_sFd);
+      return -1;
+    }
+    for(ssize_t i=0; i<sz; i++){
+      _frame.Feed(buf[i]);
+    }
+    return _frame.TakeTelemetry(telemetryPacket);
+  }
+
+  // no request is outstanding, so this can only be telemetry
+  if(read_bytes((char*)telemetryPacket, sizeof(TelemetryPacket)) < 0){
+    LOG_ERROR << "TCPClient::Receive(telemetryPacket): Error reading socket";
+    close(_sFd);
+    return -1;
+  }
+
+  if(telemetryPacket->_reply != REPLY_TELEMETRY){
+    LOG_ERROR << "TCPClient::Receive(telemetryPacket): not a telemetry packet. "
+	      << "Got reply = " << telemetryPacket->_reply;
+    return -1;
+  }
+
+  return 1;
+}
+
+int TCPClient::read_bytes(char* buf, int sz)
+{
+  while(sz > 0){
+    const ssize_t n = read(_sFd, buf, sz);
+    if(n <= 0){
+      // error, time out or the server closed the connection
+      return -1;
+    }
+    buf += n;
+    sz -= n;
+  }
+
+  return 0;
+}
+
+int TCPClient::read_packet(char* packet, int sz)
+{
+  // every packet starts with int16_t _reply
+  int16_t reply;
+
+  while(true){
+    if(read_bytes((char*)&reply, sizeof(int16_t)) < 0){
+      return -1;
+    }
+
+    if(reply != REPLY_TELEMETRY){
+      break;
+    }
+
+    TelemetryPacket tp;
+    tp._reply = reply;
+    if(read_bytes((char*)&tp + sizeof(int16_t),
+		  sizeof(TelemetryPacket) - sizeof(int16_t)) < 0){
+      return -1;
+    }
+    _telemetry.push_back(tp);
+  }
+
+  memcpy(packet, &reply, sizeof(int16_t));
+  return read_bytes(packet + sizeof(int16_t), sz - sizeof(int16_t));
+}
+
+int TCPClient::read_frame(char* packet, int sz)
+{
+  int status;
+  
+  while((status = _frame.TakeReply(packet, sz)) == 0){
+    char c;
+    if(read_bytes(&c, 1) < 0){
+      return -1;
+    }
+    _frame.Feed(c);
+  }
+
+  return status > 0? 0:-1;
+}
+
+int TCPClient::UseFrames()
+{
+  using namespace logging::trivial;
+  src::severity_logger< severity_level > lg;
+
+  RequestPacket rq;
+  ReplyPacket rp;
+
+  memset(&rq, 0, sizeof(RequestPacket));
+  rq._command = CMD_SET_PROTOCOL;
+  rq._ivalue = PROTOCOL_FRAMED;
+
+  if((Send(&rq) != 0) || (Receive(&rp) != 0)){
+    return -1;
+  }
+
+  // an older server does not know CMD_SET_PROTOCOL
+  if((rp._reply != REPLY_OK) ||
+     (rp._ivalue != PROTOCOL_FRAMED) ||
+     (rp._fvalue[1] != CMD_SET_PROTOCOL)){
+    LOG_INFO << "TCPClient::UseFrames(): server does not know frames";
+    return -1;
+  }
+
+  _frame.SetFramed(static_cast<int>(rp._fvalue[0]));
+  return 0;
+}
+
+int TCPClient::GetPipelineMax() const
+{
+  return _frame.GetPipelineMax();
+}
+
+void TCPClient::use_raw()
+{
+  if(_frame.IsFramed() && (_serverIP != NULL)){
+    RequestPacket rq;
+
+    memset(&rq, 0, sizeof(RequestPacket));
+    rq._command = CMD_SET_PROTOCOL;
+    rq._ivalue = PROTOCOL_RAW;
+    Send(&rq);
+  }
+}
 
 void TCPClient::Close()
 {
+  use_raw();
   close(_sFd);
   delete [] _serverIP;
   _serverIP = NULL;  
@@ -41,12 +41,39 @@ CONSTRUCTOR
 INTERFACE
 	Send(			- send the request to the server
 		requestPacket
-	)
+		n		- or this many requests in one write.
+	)			  Default: 1
 
 	Receive(
 	   replyPacket		- receive the reply packet from the server
 	)
 
+	Receive(
+	   statusPacket		- receive the status packet from the server
+	)
+
+	Receive(
+	   telemetryPacket	- take the next telemetry packet that the
+	)			  server pushed after
+				  CMD_SUBSCRIBE_TELEMETRY, without waiting.
+				  Returns 1 if there is one, 0 if there
+				  is none yet and -1 on error.
+
+	Telemetry that arrives ahead of a reply or status packet is
+	kept until it is taken with Receive(telemetryPacket).
+
+	UseFrames()		- ask the server for PROTOCOL_FRAMED.
+				  Returns 0 if it agreed. An older
+				  server stays in PROTOCOL_RAW
+	
+	GetPipelineMax()	- returns how many requests should be
+				  outstanding at once
+
+	With PROTOCOL_FRAMED the n requests of one Send() are all
+	outstanding, and their replies are taken in the same order
+	with Receive(). The replies still outstanding from an
+	earlier Send() are dropped.
+
 AUTHOR
 	C.Y. Tan
 
@@ -57,16 +84,23 @@ SEE ALSO
 #include "RequestPacket.hpp"
 #include "ReplyPacket.hpp"
 #include "StatusPacket.hpp"
+#include "PacketFrame.hpp"
+
+#include <deque>
 
 class TCPClient {
 public:   
   TCPClient(const char* ipAddress, const int portNumber);
   ~TCPClient();
 
-  int Send(RequestPacket* request);
+  int Send(RequestPacket* request, const int n = 1);
 
   int Receive(ReplyPacket* replyPacket);
   int Receive(StatusPacket* statusPacket);  
+  int Receive(TelemetryPacket* telemetryPacket);
+
+  int UseFrames();
+  int GetPipelineMax() const;
 
   void Close();
 
@@ -74,6 +108,14 @@ private:
    char* _serverIP;
    int _portNumber;
    int _sFd;		//socket file descriptor 
+
+   std::deque<TelemetryPacket> _telemetry; // pushed ahead of a reply
+   PacketFrame _frame;	// PROTOCOL_FRAMED after UseFrames()
+
+   int read_bytes(char* buf, int sz);
+   int read_packet(char* packet, int sz);
+   int read_frame(char* packet, int sz);
+   void use_raw();
 };
 
 #endif
@@ -157,7 +157,11 @@ SYNOPSIS
 	  -s [ --srange ] arg    start and stop in steps (separated by a space)
 	  -d [ --drange ] arg    start and stop in degrees (separated by a space)
 	  -t [ --time ] arg      time to complete from start to stop
+	  -g [ --gear ] arg      gear ratio and full steps per turn of the
+				 stepper motor (separated by a space)
 	  -H [ --Home ]          go home
+	  --stats                print the service time of every
+				 command that the derotator has run
 	  -v [ --version ]       print version
 
 
@@ -198,6 +202,9 @@ int process_options(int argc, char **argv)
 
   double omega; // rad/s (Earth's rotation rate)
 
+  double gr[] = {0.0, 0.0};
+  vector<double> gear(&gr[0], &gr[0]+2); // ratio, full steps per turn
+
   using boost::lexical_cast;    
   namespace po = boost::program_options;
   // derot command line options
@@ -216,6 +223,9 @@ int process_options(int argc, char **argv)
      "time to complete from start to stop in seconds")
     ("omega,o", po::value<double>(&omega)->default_value(OMEGA),
      "rotation rate of the earth in rad/s")
+    ("gear,g", po::value<vector<double> >(&gear)->multitoken(),
+     "gear ratio and full steps per turn of the stepper motor (separated by a space)")
+    ("stats", "print the service time of the commands run by the derotator")
     ("version,v", "print version")
     ;
 
@@ -257,11 +267,64 @@ int process_options(int argc, char **argv)
       throw string("process_options(): Connect2Serial(): failed\n");      
     }
   }
+
+  if(vm.count("gear")){
+    if((gear.size() != 2) || (dcmd.SetGearTrain(gear[0], gear[1]) != 0)){
+      throw string("process_options(): SetGearTrain(): failed\n");
+    }
+    return 1;
+  }
+
+  if(vm.count("stats")){
+    // the same ranges of commands as the table in BaseServer.cpp
+    const int first[] = {DEROTATOR_START, SETUP_SET_USER_HOME, CMD_GET_ALTAZ_ZETA};
+    const int last[] = {DEROTATOR_GOTO_USER_HOME, SETUP_DEF_SETTINGS, CMD_SET_PROTOCOL};
+    vector<RequestPacket> rq;
+
+    for(int i=0; i<3; i++){
+      for(int command=first[i]; command<=last[i]; command++){
+	RequestPacket packet;
+	memset(&packet, 0, sizeof(RequestPacket));
+	packet._command = CMD_GET_COMMAND_STATS;
+	packet._ivalue = command;
+	rq.push_back(packet);
+      }
+    }
+
+    // and the slowest of them last
+    rq.push_back(rq.back());
+    rq.back()._ivalue = STATS_SLOWEST;
+
+    // they are all sent before their stats are changed by printing
+    vector<ReplyPacket> rp(rq.size());
+    if(dcmd.SendCommands(&rq[0], &rp[0], rq.size()) != 0){
+      throw string("process_options(): SendCommands(): failed\n");
+    }
+
+    for(size_t i=0; i<rp.size(); i++){
+      if(rp[i]._reply != REPLY_FLOAT){
+	throw string("process_options(): CMD_GET_COMMAND_STATS: failed\n");
+      }
+      if((rq[i]._ivalue == STATS_SLOWEST) || (rp[i]._ivalue > 0)){
+	cout << (rq[i]._ivalue == STATS_SLOWEST? "slowest ":"")
+	     << "command " << rp[i]._fvalue[2] << ": "
+	     << rp[i]._ivalue << " calls, max "
+	     << rp[i]._fvalue[0] << " us, mean "
+	     << rp[i]._fvalue[1] << " us\n";
+      }
+    }
+    return 1;
+  }
+
+  // steps are converted with the step size of the derotator. An
+  // older derotator does not know it, so keep the default
+  double ratio, steps_per_turn;
+  dcmd.GetGearTrain(&ratio, &steps_per_turn);
   
   if(vm.count("srange")){
     // convert to degrees
-    drange[0] = srange[0]*MECHANICAL_STEPSIZE;
-    drange[1] = srange[1]*MECHANICAL_STEPSIZE;
+    drange[0] = srange[0]*dcmd.GetStepsize();
+    drange[1] = srange[1]*dcmd.GetStepsize();
     is_got_range = true;
   }
 
@@ -278,7 +341,7 @@ int process_options(int argc, char **argv)
   }
 
   if(vm.count("gotoS")){
-    if(dcmd.Goto(steps*MECHANICAL_STEPSIZE) != 0){
+    if(dcmd.Goto(steps*dcmd.GetStepsize()) != 0){
       throw string("process_options(): Goto(): failed\n");      
     }
     return 1;